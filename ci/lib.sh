@@ -50,25 +50,10 @@ ci_run_standalone_tests() {
   ci_log "standalone IVSHMEM protocol tests (non-Windows)"
   cmake -S tests/standalone -B "${build_dir}"
   cmake --build "${build_dir}"
-  "${build_dir}/test_ivshmem_protocol"
+  ctest --test-dir "${build_dir}" --output-on-failure
 }
 
 ci_run_tests() {
   local build_dir="${1:-build}"
-  local exe=""
-  for candidate in \
-    "${build_dir}/tests/test_ivshmem_protocol.exe" \
-    "${build_dir}/tests/test_ivshmem_protocol" \
-    "${build_dir}/test_ivshmem_protocol.exe" \
-    "${build_dir}/test_ivshmem_protocol"; do
-    if [[ -x "${candidate}" ]]; then
-      exe="${candidate}"
-      break
-    fi
-  done
-  if [[ -n "${exe}" ]]; then
-    "${exe}"
-    return $?
-  fi
-  (cd "${build_dir}" && ctest --output-on-failure -R ivshmem_protocol)
+  (cd "${build_dir}" && ctest --output-on-failure -L unit)
 }
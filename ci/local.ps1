@@ -49,27 +49,20 @@ function Invoke-Tests {
         $standalone = "${BuildDir}-standalone"
         cmake -S tests/standalone -B $standalone
         cmake --build $standalone
-        & (Join-Path $standalone 'test_ivshmem_protocol.exe')
-        if (-not $?) { & (Join-Path $standalone 'test_ivshmem_protocol') }
+        ctest --test-dir $standalone --output-on-failure
+        if ($LASTEXITCODE -ne 0) { throw "unit tests failed with exit code $LASTEXITCODE" }
         return
     }
     if (-not (Test-Path (Join-Path $BuildDir 'build.ninja'))) {
         Invoke-Configure
     }
+    # Every target, so whichever unit tests this platform defines are there for ctest -L unit
     Write-Step 'build unit tests'
-    cmake --build $BuildDir --target test_ivshmem_protocol
+    cmake --build $BuildDir
     Write-Step 'run IVSHMEM protocol unit tests'
-    $exe = Join-Path $BuildDir 'tests/test_ivshmem_protocol.exe'
-    if (-not (Test-Path $exe)) {
-        $exe = Join-Path $BuildDir 'tests/test_ivshmem_protocol'
-    }
-    if (-not (Test-Path $exe)) {
-        Push-Location $BuildDir
-        ctest --output-on-failure -R ivshmem_protocol
-        Pop-Location
-        return
-    }
-    & $exe
+    Push-Location $BuildDir
+    ctest --output-on-failure -L unit
+    Pop-Location
     if ($LASTEXITCODE -ne 0) { throw "unit tests failed with exit code $LASTEXITCODE" }
 }
 
@@ -34,6 +34,8 @@ endif()
 # platform specific compile definitions
 if(WIN32)
     include(${CMAKE_MODULE_PATH}/compile_definitions/windows.cmake)
+elseif(UNIX AND NOT APPLE)
+    include(${CMAKE_MODULE_PATH}/compile_definitions/linux.cmake)
 endif()
 
 include_directories(SYSTEM "${CMAKE_SOURCE_DIR}/third-party/nv-codec-headers/include")
@@ -46,11 +48,12 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/smemory.h"
         "${CMAKE_SOURCE_DIR}/src/ivshmem_protocol.h"
         "${CMAKE_SOURCE_DIR}/src/interprocess.h"
-        "${CMAKE_SOURCE_DIR}/src/interprocess.cpp"
         "${CMAKE_SOURCE_DIR}/src/cbs.cpp"
         "${CMAKE_SOURCE_DIR}/src/utility.h"
         "${CMAKE_SOURCE_DIR}/src/config.h"
         "${CMAKE_SOURCE_DIR}/src/config.cpp"
+        "${CMAKE_SOURCE_DIR}/src/frame_trace.cpp"
+        "${CMAKE_SOURCE_DIR}/src/frame_trace.h"
         "${CMAKE_SOURCE_DIR}/src/globals.cpp"
         "${CMAKE_SOURCE_DIR}/src/globals.h"
         "${CMAKE_SOURCE_DIR}/src/logging.cpp"
@@ -58,14 +61,26 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/output_debug.cpp"
         "${CMAKE_SOURCE_DIR}/src/output_debug.h"
         "${CMAKE_SOURCE_DIR}/src/main.cpp"
+        "${CMAKE_SOURCE_DIR}/src/ring_producer.h"
         "${CMAKE_SOURCE_DIR}/src/video.cpp"
         "${CMAKE_SOURCE_DIR}/src/video.h"
         "${CMAKE_SOURCE_DIR}/src/video_colorspace.cpp"
         "${CMAKE_SOURCE_DIR}/src/video_colorspace.h"
+        "${CMAKE_SOURCE_DIR}/src/video_convert.cpp"
+        "${CMAKE_SOURCE_DIR}/src/video_convert.h"
+        "${CMAKE_SOURCE_DIR}/src/video_damage.cpp"
+        "${CMAKE_SOURCE_DIR}/src/video_damage.h"
+        "${CMAKE_SOURCE_DIR}/src/video_rfi.cpp"
+        "${CMAKE_SOURCE_DIR}/src/video_rfi.h"
         "${CMAKE_SOURCE_DIR}/src/audio.cpp"
         "${CMAKE_SOURCE_DIR}/src/audio.h"
         "${CMAKE_SOURCE_DIR}/src/platform/common.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/synthetic.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/synthetic.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/synthetic_display.cpp"
         "${CMAKE_SOURCE_DIR}/src/thread_safe.h"
+        "${CMAKE_SOURCE_DIR}/src/stripe_pool.cpp"
+        "${CMAKE_SOURCE_DIR}/src/stripe_pool.h"
         "${CMAKE_SOURCE_DIR}/src/sync.h"
         ${PLATFORM_TARGET_FILES})
 
@@ -76,6 +91,10 @@ list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_ASSETS_DIR="${SUNSHINE_ASSETS_DIR_DEF}
 
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_TRAY=${SUNSHINE_TRAY})
 
+if(FFMPEG_X264_RFI)
+    list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_X264_BUILD=${SUNSHINE_X264_BUILD})
+endif()
+
 include_directories("${CMAKE_SOURCE_DIR}")
 
 include_directories(
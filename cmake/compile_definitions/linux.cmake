@@ -0,0 +1,14 @@
+# linux specific compile definitions
+
+add_compile_definitions(SUNSHINE_PLATFORM="linux")
+
+# only the shared-memory transport and the synthetic display are implemented for linux so far,
+# there is no audio capture
+set(PLATFORM_TARGET_FILES
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/audio.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/display.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/interprocess.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/misc.cpp")
+
+list(PREPEND PLATFORM_LIBRARIES
+        rt)
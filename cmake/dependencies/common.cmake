@@ -38,6 +38,20 @@ if(NOT DEFINED FFMPEG_PREPARED_BINARIES)
             "${FFMPEG_PREPARED_BINARIES}/lib/libx265.a"
             ${HDR10_PLUS_LIBRARY}
             ${FFMPEG_PLATFORM_LIBRARIES})
+
+    # Reference frame invalidation for libx264 reads the encoder out of libavcodec's private
+    # context, so it's only built against the x264 build these binaries were verified with
+    set(SUNSHINE_X264_BUILD 164)
+    if(EXISTS "${FFMPEG_PREPARED_BINARIES}/include/x264.h")
+        file(STRINGS "${FFMPEG_PREPARED_BINARIES}/include/x264.h" X264_BUILD_DEFINE
+                REGEX "^#define X264_BUILD [0-9]+")
+    endif()
+    if(X264_BUILD_DEFINE MATCHES "X264_BUILD ([0-9]+)" AND CMAKE_MATCH_1 EQUAL SUNSHINE_X264_BUILD)
+        set(FFMPEG_X264_RFI ON)
+    else()
+        message(STATUS "x264 build is not ${SUNSHINE_X264_BUILD}, \
+                software H.264 reference frame invalidation disabled")
+    endif()
 else()
     set(FFMPEG_LIBRARIES
         "${FFMPEG_PREPARED_BINARIES}/lib/libavcodec.a"
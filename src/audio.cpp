@@ -221,7 +221,10 @@ void capture(safe::mail_t mail, config_t config, void *channel_data) {
   // Capture takes place on this thread
   platf::adjust_thread_priority(platf::thread_priority_e::high);
 
-  auto samples = std::make_shared<sample_queue_t::element_type>(30);
+  // This thread is the only producer and encodeThread the only consumer; follow the mode chosen
+  // for the packet queues
+  auto queue_mode = mail->queue<packet_t>(mail::audio_packets)->mode();
+  auto samples = std::make_shared<sample_queue_t::element_type>(30, queue_mode);
   std::thread thread{encodeThread, mail, samples, config, channel_data};
 
   auto fg = util::fail_guard([&]() {
@@ -228,7 +228,19 @@ video_t video{
     0, // hevc_mode
     0, // av1_mode
 
-    2, // min_threads
+    2,     // min_threads
+    0,     // convert_stripes
+    false, // convert_ahead
+    false, // capture_paced
+    100,   // keepalive_ms
+    false, // skip_static
+    false, // static_backoff
+    false, // track_damage
+    0,     // roi_static_qp
+    false, // intra_refresh
+    0,     // refresh_period
+    true,  // idr_refresh
+    0,     // rfi_refs
     {
         "superfast"s,   // preset
         "zerolatency"s, // tune
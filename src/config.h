@@ -21,7 +21,19 @@ struct video_t {
   int hevc_mode;
   int av1_mode;
 
-  int min_threads; // Minimum number of threads/slices for CPU encoding
+  int min_threads;     // Minimum number of threads/slices for CPU encoding
+  int convert_stripes; // Stripes software color conversion runs in parallel, 0 for one per core
+  bool convert_ahead;  // Convert the next frame on its own thread while the encoder runs
+  bool capture_paced;  // Encode each capture as it arrives instead of on a fixed frame grid
+  int keepalive_ms;    // With capture_paced, repeat the last frame after this long without one
+  bool skip_static;    // Don't convert captures whose pixels match the previous one
+  bool static_backoff; // Encode unchanged frames less and less often, down to one per keepalive_ms
+  bool track_damage;   // Convert only the parts of a capture that changed
+  int roi_static_qp;   // QP added where a software-encoded frame didn't change, 0 for none
+  bool intra_refresh;  // Heal the picture with rolling intra refresh waves
+  int refresh_period;  // Frames per intra refresh wave, 0 for a fifth of a second
+  bool idr_refresh;    // With intra_refresh, let the next wave stand in for requested IDR frames
+  int rfi_refs;        // Frames libx264 keeps to fall back on after a loss, below 2 for none
   struct {
     std::string sw_preset;
     std::string sw_tune;
@@ -0,0 +1,73 @@
+#pragma once
+
+/**
+ * @file src/cursor_channel.h
+ * @brief Publishes one display's pointer into a CursorChannel.
+ */
+
+#include "globals.h"
+#include "ivshmem_protocol.h"
+#include "platform/common.h"
+#include "smemory.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+/**
+ * Hands the pointer captured for one display to the host, which draws it over the video.
+ *
+ * The capture thread publishes into it, and the thread receiving EventType::Pointer calls
+ * refresh() so that toggling display_cursor shows or hides the pointer without waiting for the
+ * mouse to move.
+ */
+class cursor_channel_t : public platf::cursor_sink_t {
+public:
+  explicit cursor_channel_t(CursorChannel *channel) : writer{channel} {}
+
+  void shape(const platf::cursor_shape_t &shape) override {
+    std::lock_guard lg{mutex};
+
+    if (!writer.shape((std::uint32_t)shape.type, shape.width, shape.height, shape.pitch,
+                      shape.hotspot_x, shape.hotspot_y, shape.data)) {
+      BOOST_LOG(warning) << "Cursor shape of "sv << shape.width << 'x' << shape.height
+                         << " doesn't fit the cursor channel"sv;
+    }
+  }
+
+  void position(bool visible, int x, int y,
+                std::chrono::steady_clock::time_point timestamp) override {
+    std::lock_guard lg{mutex};
+
+    last = {visible, x, y, timestamp};
+    publish();
+  }
+
+  /** Publish the last position again, e.g. after display_cursor changed. */
+  void refresh() {
+    std::lock_guard lg{mutex};
+
+    if (last) {
+      publish();
+    }
+  }
+
+private:
+  struct position_t {
+    bool visible;
+    int x;
+    int y;
+    std::chrono::steady_clock::time_point timestamp;
+  };
+
+  void publish() {
+    auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        last->timestamp.time_since_epoch());
+    writer.position(last->visible && display_cursor, last->x, last->y, timestamp.count());
+  }
+
+  std::mutex mutex;
+  ivshmem_protocol::cursor::writer_t writer;
+  std::optional<position_t> last;
+};
@@ -0,0 +1,176 @@
+#include "frame_trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <set>
+
+namespace frame_trace {
+namespace {
+/** A span between two stages, drawn on its own track so overlapping frames stay readable. */
+struct span_t {
+  const char *name;
+  stage_e begin;
+  stage_e end;
+};
+
+constexpr std::array<span_t, 6> spans{{
+    {"capture", stage_e::pool_acquire, stage_e::capture},
+    {"wait for encoder", stage_e::capture, stage_e::convert_start},
+    {"convert", stage_e::convert_start, stage_e::convert_end},
+    {"encode", stage_e::encode_start, stage_e::encode_end},
+    {"packet queue", stage_e::enqueue, stage_e::dequeue},
+    {"publish", stage_e::dequeue, stage_e::publish},
+}};
+
+std::atomic<ring_t *> active{nullptr};
+
+int track(int channel, std::size_t span) {
+  return channel * static_cast<int>(spans.size()) + static_cast<int>(span) + 1;
+}
+} // namespace
+
+ring_t::ring_t(std::size_t capacity)
+    : _capacity{std::max<std::size_t>(capacity, 1)},
+      _slots{std::make_unique<slot_t[]>(_capacity)} {}
+
+void ring_t::push(const record_t &record) {
+  auto index = _next.fetch_add(1, std::memory_order_relaxed);
+  auto &slot = _slots[index % _capacity];
+
+  // A writer that lapped the whole ring may still be in this slot, or already done with a
+  // newer record; either way this record is the one to lose
+  auto sequence = slot.sequence.load(std::memory_order_relaxed);
+  if ((sequence & 1) || sequence > 2 * index ||
+      !slot.sequence.compare_exchange_strong(sequence, 2 * index + 1,
+                                             std::memory_order_relaxed)) {
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot.fields[0].store(record.frame, std::memory_order_relaxed);
+  slot.fields[1].store(record.channel, std::memory_order_relaxed);
+  for (std::size_t i = 0; i < kStages; ++i) {
+    slot.fields[i + 2].store(record.ns[i], std::memory_order_relaxed);
+  }
+
+  slot.sequence.store(2 * (index + 1), std::memory_order_release);
+}
+
+std::vector<record_t> ring_t::snapshot() const {
+  auto end = _next.load(std::memory_order_acquire);
+  auto begin = end > _capacity ? end - _capacity : 0;
+
+  std::vector<record_t> records;
+  records.reserve(end - begin);
+  for (auto index = begin; index < end; ++index) {
+    auto &slot = _slots[index % _capacity];
+    if (slot.sequence.load(std::memory_order_acquire) != 2 * (index + 1)) {
+      continue;
+    }
+
+    record_t record;
+    record.frame = slot.fields[0].load(std::memory_order_relaxed);
+    record.channel = static_cast<int>(slot.fields[1].load(std::memory_order_relaxed));
+    for (std::size_t i = 0; i < kStages; ++i) {
+      record.ns[i] = slot.fields[i + 2].load(std::memory_order_relaxed);
+    }
+
+    // Discard it if a writer lapped us while copying
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) == 2 * (index + 1)) {
+      records.push_back(record);
+    }
+  }
+
+  return records;
+}
+
+void enable(std::size_t capacity) {
+  if (active.load()) {
+    return;
+  }
+
+  // Never freed: the pipeline threads may still submit while the process exits
+  active.store(new ring_t{capacity});
+}
+
+bool enabled() {
+  return active.load(std::memory_order_relaxed) != nullptr;
+}
+
+void submit(const record_t &record) {
+  if (auto ring = active.load(std::memory_order_acquire)) {
+    ring->push(record);
+  }
+}
+
+std::vector<record_t> snapshot() {
+  auto ring = active.load(std::memory_order_acquire);
+  return ring ? ring->snapshot() : std::vector<record_t>{};
+}
+
+void write_chrome_json(std::ostream &out, const std::vector<record_t> &records) {
+  // Timestamps are relative to the first stage recorded, in microseconds
+  auto origin = std::numeric_limits<std::int64_t>::max();
+  for (auto &record : records) {
+    for (auto ns : record.ns) {
+      if (ns) {
+        origin = std::min(origin, ns);
+      }
+    }
+  }
+  auto us = [origin](std::int64_t ns) { return (ns - origin) / 1000.0; };
+
+  out << std::fixed << std::setprecision(3) << "[\n";
+  bool first = true;
+  auto separator = [&]() -> std::ostream & {
+    out << (first ? "" : ",\n");
+    first = false;
+    return out;
+  };
+
+  std::set<int> channels;
+  for (auto &record : records) {
+    channels.insert(record.channel);
+  }
+  for (auto channel : channels) {
+    for (std::size_t span = 0; span < spans.size(); ++span) {
+      separator() << R"({"ph":"M","pid":1,"tid":)" << track(channel, span)
+                  << R"(,"name":"thread_name","args":{"name":"display )" << channel << ": "
+                  << spans[span].name << R"("}})";
+      separator() << R"({"ph":"M","pid":1,"tid":)" << track(channel, span)
+                  << R"(,"name":"thread_sort_index","args":{"sort_index":)"
+                  << track(channel, span) << "}}";
+    }
+  }
+
+  for (auto &record : records) {
+    for (std::size_t span = 0; span < spans.size(); ++span) {
+      auto begin = record.at(spans[span].begin);
+      auto end = record.at(spans[span].end);
+      if (!begin || !end || end < begin) {
+        continue;
+      }
+
+      separator() << R"({"ph":"X","pid":1,"tid":)" << track(record.channel, span)
+                  << R"(,"name":")" << spans[span].name << R"(","ts":)" << us(begin)
+                  << R"(,"dur":)" << (end - begin) / 1000.0 << R"(,"args":{"frame":)"
+                  << record.frame << "}}";
+    }
+  }
+
+  out << "\n]\n";
+}
+
+bool write_chrome_json(const std::string &path) {
+  std::ofstream out{path, std::ios::trunc};
+  if (!out) {
+    return false;
+  }
+
+  write_chrome_json(out, snapshot());
+  return static_cast<bool>(out);
+}
+} // namespace frame_trace
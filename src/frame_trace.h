@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Per-frame timestamps from capture to shared-memory publish.
+ *
+ * Each video packet carries a record_t from encode_run to push_video, which adds the last
+ * stages and submits it. Records land in a fixed-size ring that keeps the most recent
+ * frames and can be written out as Chrome trace-event JSON (chrome://tracing, Perfetto).
+ * Nothing is recorded unless enable() was called.
+ */
+namespace frame_trace {
+enum class stage_e {
+  pool_acquire,  ///< Capture thread took an image from the pool
+  capture,       ///< Display backend filled the image
+  convert_start, ///< encode_run or its convert stage started converting the image
+  convert_end,
+  encode_start,
+  encode_end,
+  enqueue, ///< Packet raised on the video packet queue
+  dequeue, ///< push_video popped the packet
+  publish, ///< Packet visible to the host consumer
+  count,
+};
+
+constexpr std::size_t kStages = static_cast<std::size_t>(stage_e::count);
+
+struct record_t {
+  std::int64_t frame = -1;
+  int channel = 0; ///< Display index
+
+  /** Nanoseconds since the steady_clock epoch; 0 if the stage didn't happen for this frame. */
+  std::array<std::int64_t, kStages> ns{};
+
+  void mark(stage_e stage, std::chrono::steady_clock::time_point time) {
+    ns[static_cast<std::size_t>(stage)] =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+  }
+
+  void mark(stage_e stage) {
+    mark(stage, std::chrono::steady_clock::now());
+  }
+
+  std::int64_t at(stage_e stage) const {
+    return ns[static_cast<std::size_t>(stage)];
+  }
+};
+
+/**
+ * Bounded multi-producer ring that overwrites its oldest records.
+ *
+ * Every field is an atomic, and a per-slot sequence number tells snapshot() whether a
+ * slot was rewritten while it was being copied, in which case the slot is skipped. A
+ * record is dropped if another writer still holds its slot, which takes a whole lap.
+ */
+class ring_t {
+public:
+  explicit ring_t(std::size_t capacity);
+
+  void push(const record_t &record);
+
+  /** Completed records, oldest first. */
+  std::vector<record_t> snapshot() const;
+
+  std::size_t capacity() const {
+    return _capacity;
+  }
+
+private:
+  static constexpr std::size_t kFields = kStages + 2;
+
+  struct slot_t {
+    std::atomic<std::uint64_t> sequence{0}; ///< 2 * (index + 1) when complete, odd while writing
+    std::array<std::atomic<std::int64_t>, kFields> fields{};
+  };
+
+  std::size_t _capacity;
+  std::unique_ptr<slot_t[]> _slots;
+  std::atomic<std::uint64_t> _next{0};
+};
+
+/** Start recording into a ring of `capacity` records. Call before the pipeline starts. */
+void enable(std::size_t capacity);
+
+bool enabled();
+
+/** Store a finished record; does nothing unless enabled. */
+void submit(const record_t &record);
+
+/** Records currently held, oldest first. */
+std::vector<record_t> snapshot();
+
+/** Write `records` as a Chrome trace-event JSON array of complete ("X") events. */
+void write_chrome_json(std::ostream &out, const std::vector<record_t> &records);
+
+/** Write what is currently held to `path`; false if the file can't be written. */
+bool write_chrome_json(const std::string &path);
+} // namespace frame_trace
@@ -22,7 +22,48 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ivshmem_protocol.h"
 #include "smemory.h"
 #include <stdbool.h>
-#include <windows.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <mutex>
+#include <vector>
+#endif
+
+/*
+  The transport is implemented per platform:
+    - src/platform/windows/interprocess.cpp talks to the IVSHMEM driver and
+      named file mappings.
+    - src/platform/linux/interprocess.cpp maps files and POSIX shared memory,
+      and uses eventfd for doorbells.
+*/
+
+#ifdef _WIN32
+typedef void *EventHandle; // HANDLE
+#else
+typedef int EventHandle; // eventfd
+#endif
+
+/*
+  Auto-reset event used to wait for doorbells.
+*/
+class DoorbellEvent {
+public:
+  DoorbellEvent();
+  ~DoorbellEvent();
+
+  bool Initialize();
+  void DeInitialize();
+  EventHandle GetHandle();
+
+  // Returns true if the event was signalled before timeoutMs elapsed
+  bool Wait(uint32_t timeoutMs);
+  bool Signal();
+
+private:
+  EventHandle m_handle;
+  bool m_initialized;
+};
 
 class IVSHMEM {
 public:
@@ -31,11 +72,10 @@ public:
 
   bool Initialize();
   void DeInitialize();
-  UINT64 GetSize();
+  uint64_t GetSize();
   void *GetMemory();
-  HANDLE getHandle();
-  bool RegisterEvent(HANDLE event, UINT16 vector);
-  bool RingDoorbell(UINT16 peerID, UINT16 vector);
+  bool RegisterEvent(EventHandle event, uint16_t vector);
+  bool RingDoorbell(uint16_t peerID, uint16_t vector);
 
 protected:
 private:
@@ -43,16 +83,39 @@ private:
 
   char m_devPath[512];
   bool m_initialized;
-  HANDLE m_handle;
-  UINT64 m_size;
+  uint64_t m_size;
   bool m_gotSize;
   void *m_memory;
   bool m_gotMemory;
+
+#ifdef _WIN32
+  void *m_handle;
+#else
+  /*
+    Without a guest driver there is no one to forward doorbells to, so they are
+    delivered to the events registered in this process, whatever the peer ID.
+  */
+  enum { MAX_VECTORS = 32 };
+
+  int m_fd;
+  std::mutex m_eventsLock;
+  std::vector<EventHandle> m_events[MAX_VECTORS];
+#endif
 };
 
 class SharedMemory {
 public:
-  SharedMemory(const char *name, size_t size);
+  enum Flags : unsigned {
+    Create = 1 << 0,    // create the mapping instead of opening an existing one
+    HugePages = 1 << 1, // back the mapping with huge pages where possible
+    Populate = 1 << 2,  // fault the pages in up front
+  };
+
+  /*
+    On Linux a NULL or empty name creates an anonymous memfd, which is only
+    useful within this process.
+  */
+  SharedMemory(const char *name, size_t size, unsigned flags = 0);
   ~SharedMemory();
 
   bool Initialize();
@@ -63,7 +126,14 @@ public:
 private:
   char m_name[512];
   size_t m_size;
-  HANDLE m_handle;
+  unsigned m_flags;
   void *m_memory;
   bool m_initialized;
-};
\ No newline at end of file
+
+#ifdef _WIN32
+  void *m_handle;
+#else
+  int m_fd;
+  bool m_created;
+#endif
+};
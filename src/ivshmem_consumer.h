@@ -0,0 +1,187 @@
+#pragma once
+
+/**
+ * @file src/ivshmem_consumer.h
+ * @brief Host-side reader for the media channels written by the guest producer.
+ *
+ * Reference implementation of what the host consumer does with MediaMemory and
+ * MediaRingMemory, and with CursorMemory, used by the benchmarks and as a model for
+ * the CGO consumer.
+ */
+
+#include "ivshmem_protocol.h"
+#include "smemory.h"
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+namespace ivshmem_protocol::consumer {
+
+/** A video or audio packet with its 17-byte header decoded. */
+struct frame_t {
+  std::uint64_t frame_index;
+  std::uint64_t rtp_sample_duration;
+  std::uint8_t flags; ///< kVideoFlag* for video, unused for audio
+  const char *data;   ///< Encoded bitstream, still in shared memory
+  std::size_t size;
+
+  bool is_idr() const {
+    return flags & kVideoFlagKeyframe;
+  }
+
+  bool after_ref_frame_invalidation() const {
+    return flags & kVideoFlagAfterRefFrameInvalidation;
+  }
+};
+
+/** Decode the header written by push_video/push_audio; std::nullopt if `size` is too short. */
+inline std::optional<frame_t> parse_frame(const char *payload, std::size_t size) {
+  if (size < kVideoPacketHeaderSize) {
+    return std::nullopt;
+  }
+
+  frame_t frame;
+  std::memcpy(&frame.frame_index, payload, sizeof(frame.frame_index));
+  std::memcpy(&frame.rtp_sample_duration, payload + sizeof(frame.frame_index),
+              sizeof(frame.rtp_sample_duration));
+  frame.flags = static_cast<std::uint8_t>(payload[kVideoPacketHeaderSize - 1]);
+  frame.data = payload + kVideoPacketHeaderSize;
+  frame.size = size - kVideoPacketHeaderSize;
+
+  return frame;
+}
+
+/** Prepare `memory` for a ring-layout producer, as the host does before starting the guest. */
+inline void init_ring_memory(MediaRingMemory *memory, int doorbell_peer_id = 0) {
+  std::memset(&memory->header, 0, sizeof(memory->header));
+  memory->header.magic = ring::kMagic;
+  memory->header.version = ring::kVersion;
+  memory->header.doorbell_peer_id = doorbell_peer_id;
+}
+
+/** Whether the producer accepted the ring layout prepared by init_ring_memory(). */
+inline bool ring_accepted(MediaRingMemory *memory) {
+  return consume(memory->header.accepted_version) == ring::kVersion;
+}
+
+/**
+ * Reads one guest-to-host channel in either layout.
+ *
+ * Same contract as ring::reader_t: copy what you need from peek(), then release().
+ * The legacy layout has no consumer cursor, so the producer never waits for us
+ * and release() can't tell whether the slot was overwritten in the meantime.
+ */
+template <class Queue, class Ring> class channel_reader_t {
+public:
+  explicit channel_reader_t(Queue *queue) : queue{queue}, read_index{consume(queue->inindex)} {}
+
+  explicit channel_reader_t(Ring *ring) : queue{nullptr}, read_index{0} {
+    ring_reader.emplace(ring);
+  }
+
+  std::optional<frame_t> peek() {
+    if (ring_reader) {
+      while (auto record = ring_reader->peek()) {
+        if (auto frame = parse_frame(record->payload, record->size)) {
+          return frame;
+        }
+
+        // Nothing the producer writes is this short; skip it
+        ring_reader->release();
+      }
+      return std::nullopt;
+    }
+
+    while (read_index != consume(queue->inindex)) {
+      auto slot = &queue->incoming[read_index];
+      if (auto frame = parse_frame(slot->data, static_cast<std::size_t>(slot->size))) {
+        return frame;
+      }
+
+      read_index = advance_index(read_index, kInQueueSize);
+    }
+    return std::nullopt;
+  }
+
+  bool release() {
+    if (ring_reader) {
+      return ring_reader->release();
+    }
+
+    read_index = advance_index(read_index, kInQueueSize);
+    return true;
+  }
+
+private:
+  Queue *queue;
+  int read_index;
+  std::optional<ring::reader_t> ring_reader;
+};
+
+using video_reader_t = channel_reader_t<MediaQueue, VideoRing>;
+using audio_reader_t = channel_reader_t<DataQueue, AudioRing>;
+
+/** Prepare `memory` for a cursor channel, as the host does before starting the guest. */
+inline void init_cursor_memory(CursorMemory *memory) {
+  std::memset(&memory->header, 0, sizeof(memory->header));
+  memory->header.magic = cursor::kMagic;
+  memory->header.version = cursor::kVersion;
+}
+
+/** Whether the producer publishes the pointer on the channel prepared by init_cursor_memory(). */
+inline bool cursor_accepted(CursorMemory *memory) {
+  return consume(memory->header.accepted_version) == cursor::kVersion;
+}
+
+/**
+ * Follows one display's pointer: the newest shape and where it is.
+ *
+ * Shapes come in rarely, so poll() copies the newest out of shared memory and
+ * the host draws from that copy for as long as it stays current.
+ */
+class cursor_reader_t {
+public:
+  struct shape_t {
+    CursorShapeHeader header;
+    std::vector<char> data;
+  };
+
+  explicit cursor_reader_t(CursorChannel *channel) : channel{channel}, shapes{&channel->shapes} {}
+
+  /** Take in the shapes published since the last call. @return true if shape() changed. */
+  bool poll() {
+    bool changed = false;
+    while (auto record = shapes.peek()) {
+      auto parsed = cursor::parse_shape(*record);
+      if (parsed) {
+        pending.header = parsed->header;
+        pending.data.assign(parsed->data, parsed->data + parsed->size);
+      }
+
+      if (shapes.release() && parsed) {
+        latest = std::move(pending);
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  /** The newest shape, which may be older than position()->shape_id if poll() wasn't called. */
+  const std::optional<shape_t> &shape() const {
+    return latest;
+  }
+
+  std::optional<cursor::position_t> position() {
+    return cursor::read_position(&channel->position);
+  }
+
+private:
+  CursorChannel *channel;
+  ring::reader_t shapes;
+  shape_t pending{};
+  std::optional<shape_t> latest;
+};
+
+} // namespace ivshmem_protocol::consumer
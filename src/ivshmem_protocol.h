@@ -6,13 +6,20 @@
  *
  * Layout must stay in sync with worker/proxy/util/memory and worker/daemon/utils/memory
  * CGO definitions and docs/engineering/ci_cd/sunshine_testing_feasibility.md.
+ * ivshmem_consumer.h has a reference host-side reader.
  */
 
 #include "smemory.h"
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <deque>
+#include <initializer_list>
+#include <optional>
+#include <thread>
 
 namespace ivshmem_protocol {
 
@@ -27,6 +34,59 @@ constexpr std::size_t kTagSize = TAG_SIZE;
 constexpr std::size_t kVideoPacketHeaderSize =
     sizeof(std::uint64_t) + sizeof(std::uint64_t) + sizeof(std::uint8_t);
 
+/** Bits of the last video packet header byte. */
+constexpr std::uint8_t kVideoFlagKeyframe = 1 << 0;
+constexpr std::uint8_t kVideoFlagAfterRefFrameInvalidation = 1 << 1;
+/** Starts an intra refresh wave; a decoder that lost frames is whole again once it has run. */
+constexpr std::uint8_t kVideoFlagIntraRefresh = 1 << 2;
+
+constexpr std::size_t kCacheLine = RING_CACHE_LINE;
+
+/**
+ * Cursor publication shared by every producer and consumer of the shared memory.
+ *
+ * A producer fills the slot or record first and then publish()es the cursor with release
+ * semantics; the other side consume()s it with acquire semantics before touching the payload.
+ * load_relaxed() is for the owner of a cursor re-reading its own value.
+ */
+template <class T> inline void publish(T &cursor, T value) {
+  std::atomic_ref<T>{cursor}.store(value, std::memory_order_release);
+}
+
+template <class T> inline T consume(T &cursor) {
+  return std::atomic_ref<T>{cursor}.load(std::memory_order_acquire);
+}
+
+template <class T> inline T load_relaxed(T &cursor) {
+  return std::atomic_ref<T>{cursor}.load(std::memory_order_relaxed);
+}
+
+/** Publish `desired` only if nobody moved the cursor away from `expected`. */
+template <class T> inline bool compare_publish(T &cursor, T expected, T desired) {
+  return std::atomic_ref<T>{cursor}.compare_exchange_strong(expected, desired,
+                                                            std::memory_order_acq_rel);
+}
+
+/**
+ * Guest-local cursor padded to its own cache line, for state shared between guest threads
+ * (the shared-memory cursors are padded by the RingCursors layout itself).
+ */
+template <class T> struct alignas(RING_CACHE_LINE) padded_cursor_t {
+  T value{};
+
+  void publish(T updated) {
+    ivshmem_protocol::publish(value, updated);
+  }
+
+  T consume() {
+    return ivshmem_protocol::consume(value);
+  }
+};
+
+static_assert(sizeof(padded_cursor_t<std::uint64_t>) == RING_CACHE_LINE);
+static_assert(std::atomic_ref<int>::is_always_lock_free);
+static_assert(std::atomic_ref<std::uint64_t>::is_always_lock_free);
+
 inline int advance_index(int index, int capacity) {
   int updated = index + 1;
   if (updated >= capacity) {
@@ -57,6 +117,784 @@ inline bool video_payload_fits(std::size_t payload_size) {
   return payload_size <= (kMediaPacketSize - kVideoPacketHeaderSize);
 }
 
+/**
+ * Variable-length byte ring (MEDIA_RING_VERSION 1), see smemory.h for the layout.
+ */
+namespace ring {
+
+constexpr std::uint32_t kMagic = MEDIA_RING_MAGIC;
+constexpr std::uint32_t kVersion = MEDIA_RING_VERSION;
+constexpr std::size_t kRecordAlign = RING_RECORD_ALIGN;
+constexpr std::size_t kRecordHeaderSize = sizeof(RingRecordHeader);
+constexpr std::size_t kVideoRingSize = VIDEO_RING_SIZE;
+constexpr std::size_t kAudioRingSize = AUDIO_RING_SIZE;
+
+static_assert((kVideoRingSize & (kVideoRingSize - 1)) == 0, "ring size must be a power of two");
+static_assert((kAudioRingSize & (kAudioRingSize - 1)) == 0, "ring size must be a power of two");
+static_assert(kRecordHeaderSize == kRecordAlign, "a padding header must always fit in the tail");
+static_assert(sizeof(MediaRingHeader) == RING_CACHE_LINE);
+static_assert(offsetof(RingCursors, read_cursor) == RING_CACHE_LINE);
+static_assert(sizeof(RingDisplayQueue) % RING_CACHE_LINE == 0);
+static_assert(offsetof(MediaRingMemory, video) % RING_CACHE_LINE == 0);
+static_assert(offsetof(MediaRingMemory, audio) % RING_CACHE_LINE == 0);
+
+enum class layout_e {
+  legacy, ///< MediaMemory with fixed MediaPacket slots
+  ring,   ///< MediaRingMemory
+};
+
+/** Bytes a record with `payload_size` bytes of payload occupies in the data region. */
+constexpr std::size_t record_span(std::size_t payload_size) {
+  return (kRecordHeaderSize + payload_size + kRecordAlign - 1) & ~(kRecordAlign - 1);
+}
+
+/**
+ * Largest payload accepted by a ring of `capacity` bytes. Capping records at
+ * half the ring guarantees a record always fits after at most one padding record.
+ */
+constexpr std::size_t max_payload(std::size_t capacity) {
+  return capacity / 2 - kRecordHeaderSize;
+}
+
+/**
+ * Decide which layout the host prepared in `memory`.
+ * Offset 0 of the legacy layout is a queue index (0..IN_QUEUE_SIZE-1), so it can't match the magic.
+ */
+inline layout_e detect_layout(const void *memory, std::size_t size) {
+  if (size < sizeof(MediaRingMemory)) {
+    return layout_e::legacy;
+  }
+
+  auto header = static_cast<const MediaRingHeader *>(memory);
+  if (header->magic != kMagic || header->version < kVersion) {
+    return layout_e::legacy;
+  }
+
+  return layout_e::ring;
+}
+
+/** Acknowledge the ring layout so the host stops waiting for a legacy producer. */
+inline void accept_layout(MediaRingHeader *header) {
+  publish(header->accepted_version, kVersion);
+}
+
+struct segment_t {
+  const void *data;
+  std::size_t size;
+};
+
+/** A record as seen by the consumer; `payload` points into the ring until released. */
+struct record_t {
+  std::uint32_t type;
+  std::uint64_t sequence;
+  const char *payload;
+  std::size_t size;
+};
+
+/** What the producer does when the consumer hasn't freed enough space for a record. */
+enum class backpressure_e {
+  wait,        ///< Wait up to max_wait for the consumer, then drop the new record
+  drop_oldest, ///< Reclaim the oldest unread records unless they are keyframes, else drop the new one
+  overwrite,   ///< Reclaim the oldest unread records unconditionally
+};
+
+struct backpressure_t {
+  backpressure_e policy = backpressure_e::wait;
+  std::chrono::microseconds max_wait = std::chrono::milliseconds{8};
+};
+
+struct write_result_t {
+  bool written;
+  bool stalled;              ///< The producer had to wait for the consumer
+  std::uint64_t overwritten; ///< Unread records reclaimed to make room
+};
+
+/** Space handed out by writer_t::reserve(); fill `payload`, then commit() or cancel() it. */
+struct reservation_t {
+  std::uint64_t start;   ///< Cursor of the record header
+  std::size_t span;      ///< Bytes reserved from `start`
+  std::uint64_t sequence;
+  char *payload;
+  std::size_t capacity; ///< Usable payload bytes, at least what was asked for
+};
+
+/**
+ * Producer side of a byte ring. Only one writer may exist per ring, and it isn't thread-safe.
+ *
+ * Records become visible in ring order: write_cursor only moves past a reservation once it and
+ * every reservation before it have been committed or cancelled.
+ *
+ * In the lossy policies the writer advances read_cursor itself, so consumers must release
+ * records with a compare-and-swap (see reader_t::release) and discard them when it fails.
+ */
+class writer_t {
+public:
+  writer_t(RingCursors *cursors, char *data, std::size_t capacity)
+      : cursors{cursors}, data{data}, capacity{capacity},
+        write_cursor{load_relaxed(cursors->write_cursor)}, reserve_cursor{write_cursor} {}
+
+  template <class Ring>
+  explicit writer_t(Ring *ring) : writer_t(&ring->cursors, ring->data, sizeof(ring->data)) {}
+
+  /** Bytes the consumer has not released yet, including outstanding reservations. */
+  std::size_t used() const {
+    return static_cast<std::size_t>(reserve_cursor - consume(cursors->read_cursor));
+  }
+
+  /** Whether a record with `payload_size` bytes fits without reclaiming anything. */
+  bool fits(std::size_t payload_size) const {
+    return used() + bytes_needed(payload_size) <= capacity;
+  }
+
+  /**
+   * Carve out room for a record of up to `payload_capacity` bytes without publishing it.
+   * @return std::nullopt if the payload is too large or the consumer hasn't freed enough space.
+   */
+  std::optional<reservation_t> reserve(std::size_t payload_capacity) {
+    if (payload_capacity > max_payload(capacity) || !fits(payload_capacity)) {
+      return std::nullopt;
+    }
+
+    auto span = record_span(payload_capacity);
+    if (span > tail()) {
+      RingRecordHeader padding{static_cast<std::uint32_t>(tail() - kRecordHeaderSize),
+                               RING_RECORD_PADDING, 0};
+      std::memcpy(data + (reserve_cursor & (capacity - 1)), &padding, sizeof(padding));
+      reserve_cursor += tail();
+    }
+
+    reservation_t reservation{reserve_cursor, span, ++sequence,
+                              data + (reserve_cursor & (capacity - 1)) + kRecordHeaderSize,
+                              span - kRecordHeaderSize};
+    reserve_cursor += span;
+    pending.push_back(pending_t{reservation.start, reserve_cursor, false});
+
+    return reservation;
+  }
+
+  /** Publish `payload_size` bytes already written to `reservation.payload` as a `type` record. */
+  void commit(const reservation_t &reservation, std::uint32_t type, std::size_t payload_size) {
+    auto record = reservation.payload - kRecordHeaderSize;
+    RingRecordHeader header{static_cast<std::uint32_t>(payload_size), type, reservation.sequence};
+    std::memcpy(record, &header, sizeof(header));
+
+    // Spans are multiples of kRecordAlign, so any leftover has room for a skip header
+    auto used_span = record_span(payload_size);
+    if (used_span < reservation.span) {
+      RingRecordHeader skip{
+          static_cast<std::uint32_t>(reservation.span - used_span - kRecordHeaderSize),
+          RING_RECORD_SKIP, 0};
+      std::memcpy(record + used_span, &skip, sizeof(skip));
+    }
+
+    complete(reservation.start);
+  }
+
+  /** Give up a reservation; consumers will skip over its space. */
+  void cancel(const reservation_t &reservation) {
+    RingRecordHeader skip{static_cast<std::uint32_t>(reservation.span - kRecordHeaderSize),
+                          RING_RECORD_SKIP, reservation.sequence};
+    std::memcpy(reservation.payload - kRecordHeaderSize, &skip, sizeof(skip));
+
+    complete(reservation.start);
+  }
+
+  /**
+   * Append one record made of `segments` and publish it.
+   * @return false if the payload is too large or the consumer hasn't freed enough space.
+   */
+  bool write(std::uint32_t type, std::initializer_list<segment_t> segments) {
+    auto payload_size = size_of(segments);
+    auto reservation = reserve(payload_size);
+    if (!reservation) {
+      return false;
+    }
+
+    fill_and_commit(*reservation, type, segments, payload_size);
+    return true;
+  }
+
+  /**
+   * Append one record, applying `backpressure` when the ring is full.
+   * @param can_drop Decides whether an unread record may be reclaimed under drop_oldest.
+   */
+  template <class CanDrop>
+  write_result_t write(std::uint32_t type, std::initializer_list<segment_t> segments,
+                       const backpressure_t &backpressure, CanDrop &&can_drop) {
+    write_result_t result{false, false, 0};
+
+    auto payload_size = size_of(segments);
+    if (payload_size > max_payload(capacity)) {
+      return result;
+    }
+
+    if (!fits(payload_size)) {
+      switch (backpressure.policy) {
+      case backpressure_e::wait: {
+        result.stalled = true;
+        auto deadline = std::chrono::steady_clock::now() + backpressure.max_wait;
+        while (!fits(payload_size) && std::chrono::steady_clock::now() < deadline) {
+          std::this_thread::sleep_for(std::chrono::microseconds{100});
+        }
+        break;
+      }
+      case backpressure_e::drop_oldest:
+        result.overwritten = reclaim(payload_size, can_drop);
+        break;
+      case backpressure_e::overwrite:
+        result.overwritten = reclaim(payload_size, [](const record_t &) { return true; });
+        break;
+      }
+    }
+
+    auto reservation = reserve(payload_size);
+    if (!reservation) {
+      return result;
+    }
+
+    fill_and_commit(*reservation, type, segments, payload_size);
+    result.written = true;
+    return result;
+  }
+
+private:
+  struct pending_t {
+    std::uint64_t start;
+    std::uint64_t end;
+    bool done;
+  };
+
+  static std::size_t size_of(std::initializer_list<segment_t> segments) {
+    std::size_t payload_size = 0;
+    for (auto &segment : segments) {
+      payload_size += segment.size;
+    }
+    return payload_size;
+  }
+
+  std::size_t tail() const {
+    return capacity - (reserve_cursor & (capacity - 1));
+  }
+
+  std::size_t bytes_needed(std::size_t payload_size) const {
+    auto span = record_span(payload_size);
+    return span > tail() ? span + tail() : span;
+  }
+
+  void fill_and_commit(const reservation_t &reservation, std::uint32_t type,
+                       std::initializer_list<segment_t> segments, std::size_t payload_size) {
+    auto offset = reservation.payload;
+    for (auto &segment : segments) {
+      std::memcpy(offset, segment.data, segment.size);
+      offset += segment.size;
+    }
+
+    commit(reservation, type, payload_size);
+  }
+
+  void complete(std::uint64_t start) {
+    for (auto &entry : pending) {
+      if (entry.start == start) {
+        entry.done = true;
+        break;
+      }
+    }
+
+    auto previous = write_cursor;
+    while (!pending.empty() && pending.front().done) {
+      write_cursor = pending.front().end;
+      pending.pop_front();
+    }
+
+    if (write_cursor != previous) {
+      publish(cursors->write_cursor, write_cursor);
+    }
+  }
+
+  /**
+   * Advance read_cursor past the oldest unread records until `payload_size` fits.
+   * @return The number of records (not counting padding) taken away from the consumer.
+   */
+  template <class CanDrop> std::uint64_t reclaim(std::size_t payload_size, CanDrop &&can_drop) {
+    std::uint64_t reclaimed = 0;
+
+    while (!fits(payload_size)) {
+      auto head = consume(cursors->read_cursor);
+      if (head == write_cursor) {
+        break;
+      }
+
+      RingRecordHeader header;
+      std::memcpy(&header, data + (head & (capacity - 1)), sizeof(header));
+
+      auto is_filler = header.type == RING_RECORD_PADDING || header.type == RING_RECORD_SKIP;
+      auto span = header.type == RING_RECORD_PADDING ? capacity - (head & (capacity - 1)) :
+                                                       record_span(header.size);
+      if (!is_filler &&
+          !can_drop(record_t{header.type, header.sequence,
+                             data + (head & (capacity - 1)) + kRecordHeaderSize, header.size})) {
+        break;
+      }
+
+      // Fails if the consumer released the record in the meantime, which frees the space anyway
+      if (compare_publish(cursors->read_cursor, head, head + span) && !is_filler) {
+        ++reclaimed;
+      }
+    }
+
+    return reclaimed;
+  }
+
+  RingCursors *cursors;
+  char *data;
+  std::size_t capacity;
+  std::uint64_t write_cursor;
+  std::uint64_t reserve_cursor;
+  std::uint64_t sequence = 0;
+  std::deque<pending_t> pending;
+};
+
+/**
+ * Consumer side of a byte ring, used by tests and host-side reference code.
+ */
+class reader_t {
+public:
+  reader_t(RingCursors *cursors, const char *data, std::size_t capacity)
+      : cursors{cursors}, data{data}, capacity{capacity},
+        read_cursor{load_relaxed(cursors->read_cursor)} {}
+
+  template <class Ring>
+  explicit reader_t(Ring *ring) : reader_t(&ring->cursors, ring->data, sizeof(ring->data)) {}
+
+  /**
+   * Next published record, skipping padding and skip records. Copy what you need, then call
+   * release(): the payload is only known to be intact if release() returns true.
+   */
+  std::optional<record_t> peek() {
+    // The producer reclaimed records we hadn't released yet
+    auto shared_read_cursor = consume(cursors->read_cursor);
+    if (shared_read_cursor > read_cursor) {
+      read_cursor = released_cursor = shared_read_cursor;
+    }
+
+    // Loaded after read_cursor: the producer never reclaims past what it has published
+    auto write_cursor = consume(cursors->write_cursor);
+
+    while (read_cursor < write_cursor) {
+      auto offset = read_cursor & (capacity - 1);
+
+      RingRecordHeader header;
+      std::memcpy(&header, data + offset, sizeof(header));
+
+      if (header.type == RING_RECORD_PADDING) {
+        read_cursor += capacity - offset;
+        continue;
+      }
+
+      if (header.size > max_payload(capacity) || record_span(header.size) > capacity - offset) {
+        // The producer reclaims before it overwrites, so a torn header means read_cursor moved
+        shared_read_cursor = consume(cursors->read_cursor);
+        if (shared_read_cursor > read_cursor) {
+          read_cursor = released_cursor = shared_read_cursor;
+          continue;
+        }
+
+        // Corrupted by someone else; everything published so far is suspect
+        compare_publish(cursors->read_cursor, released_cursor, write_cursor);
+        read_cursor = released_cursor = consume(cursors->read_cursor);
+        continue;
+      }
+
+      current_span = record_span(header.size);
+      if (header.type == RING_RECORD_SKIP) {
+        read_cursor += current_span;
+        continue;
+      }
+
+      return record_t{header.type, header.sequence, data + offset + kRecordHeaderSize,
+                      header.size};
+    }
+
+    // Hand back filler we stepped over, or a ring of cancelled reservations would stay full
+    if (read_cursor > released_cursor &&
+        compare_publish(cursors->read_cursor, released_cursor, read_cursor)) {
+      released_cursor = read_cursor;
+    }
+
+    return std::nullopt;
+  }
+
+  /**
+   * Hand the space of the record returned by peek() back to the producer.
+   * @return false if the producer reclaimed the record while it was being read.
+   */
+  bool release() {
+    auto next = read_cursor + current_span;
+    current_span = 0;
+
+    auto expected = released_cursor;
+    while (!compare_publish(cursors->read_cursor, expected, next)) {
+      // Only the producer moves read_cursor behind our back, and only forward
+      auto shared_read_cursor = consume(cursors->read_cursor);
+      if (shared_read_cursor > read_cursor) {
+        read_cursor = released_cursor = shared_read_cursor;
+        return false;
+      }
+
+      // It merely reclaimed padding in front of the record
+      expected = shared_read_cursor;
+    }
+
+    read_cursor = released_cursor = next;
+    return true;
+  }
+
+private:
+  RingCursors *cursors;
+  const char *data;
+  std::size_t capacity;
+  std::uint64_t read_cursor;
+  std::uint64_t released_cursor = read_cursor; ///< Last value we published
+  std::size_t current_span = 0;
+};
+
+/** Whether a RING_RECORD_VIDEO payload carries a keyframe. */
+inline bool is_keyframe(const record_t &record) {
+  return record.type == RING_RECORD_VIDEO && record.size >= kVideoPacketHeaderSize &&
+         (record.payload[kVideoPacketHeaderSize - 1] & kVideoFlagKeyframe);
+}
+
+} // namespace ring
+
+/**
+ * Cursor channel (CURSOR_MEMORY_VERSION 1), see smemory.h for the layout.
+ */
+namespace cursor {
+
+constexpr std::uint32_t kMagic = CURSOR_MEMORY_MAGIC;
+constexpr std::uint32_t kVersion = CURSOR_MEMORY_VERSION;
+constexpr std::size_t kRingSize = CURSOR_RING_SIZE;
+
+static_assert((kRingSize & (kRingSize - 1)) == 0, "ring size must be a power of two");
+static_assert(sizeof(CursorShapeHeader) == 32);
+static_assert(sizeof(CursorPosition) == RING_CACHE_LINE);
+static_assert(sizeof(CursorMemoryHeader) == RING_CACHE_LINE);
+static_assert(offsetof(CursorChannel, shapes) % RING_CACHE_LINE == 0);
+static_assert(sizeof(CursorChannel) % RING_CACHE_LINE == 0);
+
+/** Whether the host prepared `memory` for a cursor channel. */
+inline bool detect(const void *memory, std::size_t size) {
+  if (size < sizeof(CursorMemory)) {
+    return false;
+  }
+
+  auto header = static_cast<const CursorMemoryHeader *>(memory);
+  return header->magic == kMagic && header->version >= kVersion;
+}
+
+/** Acknowledge the channel so the host stops drawing the pointer from video frames. */
+inline void accept(CursorMemoryHeader *header) {
+  publish(header->accepted_version, kVersion);
+}
+
+/** The fields of CursorPosition. */
+struct position_t {
+  bool visible;
+  std::int32_t x;
+  std::int32_t y;
+  std::uint64_t shape_id;
+  std::int64_t timestamp_ns;
+  std::uint64_t updates;
+};
+
+/** Overwrite `slot`, which must only have one writer. */
+inline void write_position(CursorPosition *slot, const position_t &position) {
+  auto sequence = load_relaxed(slot->sequence);
+  std::atomic_ref<std::uint32_t>{slot->sequence}.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  std::atomic_ref<std::uint32_t>{slot->visible}.store(position.visible, std::memory_order_relaxed);
+  std::atomic_ref<std::int32_t>{slot->x}.store(position.x, std::memory_order_relaxed);
+  std::atomic_ref<std::int32_t>{slot->y}.store(position.y, std::memory_order_relaxed);
+  std::atomic_ref<std::uint64_t>{slot->shape_id}.store(position.shape_id,
+                                                       std::memory_order_relaxed);
+  std::atomic_ref<std::int64_t>{slot->timestamp_ns}.store(position.timestamp_ns,
+                                                          std::memory_order_relaxed);
+  std::atomic_ref<std::uint64_t>{slot->updates}.store(position.updates,
+                                                      std::memory_order_relaxed);
+
+  publish(slot->sequence, sequence + 2);
+}
+
+/**
+ * Copy `slot` from between two writes.
+ * @return std::nullopt if nothing was published yet, or the writer was busy for every attempt.
+ */
+inline std::optional<position_t> read_position(CursorPosition *slot, int attempts = 64) {
+  for (int attempt = 0; attempt < attempts; ++attempt) {
+    auto before = consume(slot->sequence);
+    if (before & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    position_t position{load_relaxed(slot->visible) != 0, load_relaxed(slot->x),
+                        load_relaxed(slot->y),          load_relaxed(slot->shape_id),
+                        load_relaxed(slot->timestamp_ns), load_relaxed(slot->updates)};
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (load_relaxed(slot->sequence) == before) {
+      if (!position.updates) {
+        return std::nullopt;
+      }
+      return position;
+    }
+  }
+
+  return std::nullopt;
+}
+
+/** A RING_RECORD_CURSOR_SHAPE payload; `data` points into the ring until released. */
+struct shape_t {
+  CursorShapeHeader header;
+  const char *data;
+  std::size_t size; ///< pitch * height
+};
+
+/** std::nullopt if `record` isn't a shape or is shorter than its header says. */
+inline std::optional<shape_t> parse_shape(const ring::record_t &record) {
+  if (record.type != RING_RECORD_CURSOR_SHAPE || record.size < sizeof(CursorShapeHeader)) {
+    return std::nullopt;
+  }
+
+  shape_t shape;
+  std::memcpy(&shape.header, record.payload, sizeof(shape.header));
+  shape.data = record.payload + sizeof(shape.header);
+  shape.size = (std::size_t)shape.header.pitch * shape.header.height;
+  if (shape.size > record.size - sizeof(shape.header)) {
+    return std::nullopt;
+  }
+
+  return shape;
+}
+
+/**
+ * Guest side of one display's CursorChannel. Not thread-safe.
+ *
+ * Counting carries on from what's in the channel, so the host never sees ids or update
+ * counts go back when the guest restarts.
+ */
+class writer_t {
+public:
+  explicit writer_t(CursorChannel *channel)
+      : channel{channel}, shapes{&channel->shapes},
+        shape_id{load_relaxed(channel->position.shape_id)},
+        updates{load_relaxed(channel->position.updates)} {}
+
+  /**
+   * Publish a new shape for the positions that follow. Unread shapes are reclaimed if the
+   * ring is full, since only the newest one matters.
+   * @param data pitch * height bytes.
+   * @return false if the shape is too large for the ring.
+   */
+  bool shape(std::uint32_t type, std::uint32_t width, std::uint32_t height, std::uint32_t pitch,
+             std::int32_t hotspot_x, std::int32_t hotspot_y, const void *data) {
+    CursorShapeHeader header{shape_id + 1, type, width, height, pitch, hotspot_x, hotspot_y};
+    auto result = shapes.write(RING_RECORD_CURSOR_SHAPE,
+                               {{&header, sizeof(header)}, {data, (std::size_t)pitch * height}},
+                               ring::backpressure_t{ring::backpressure_e::overwrite},
+                               [](const ring::record_t &) { return true; });
+    if (!result.written) {
+      return false;
+    }
+
+    ++shape_id;
+    return true;
+  }
+
+  /** Publish where the last shape is drawn now. */
+  void position(bool visible, std::int32_t x, std::int32_t y, std::int64_t timestamp_ns) {
+    write_position(&channel->position, {visible, x, y, shape_id, timestamp_ns, ++updates});
+  }
+
+private:
+  CursorChannel *channel;
+  ring::writer_t shapes;
+  std::uint64_t shape_id;
+  std::uint64_t updates;
+};
+
+} // namespace cursor
+
+/**
+ * Host-to-guest control messages, several per DataPacket.
+ *
+ * A batch starts with kMagic and kVersion, then holds messages back to back, each a
+ * header_t followed by `length` bytes of little-endian, full-width fields. The legacy
+ * format puts an EventType (always below kMagic) in the first byte instead.
+ *
+ * A message's version only ever grows by appending fields. Readers skip types they
+ * don't know by `length`, ignore trailing fields they don't know, and reject
+ * messages that are too short for the fields they need.
+ */
+namespace control {
+
+constexpr std::uint8_t kMagic = 0xC7;
+constexpr std::uint8_t kVersion = 1;
+
+/** Numbered like the legacy EventType so both formats share one dispatch. */
+enum class type_e : std::uint8_t {
+  pointer = 0,               ///< u8 visible
+  bitrate = 1,               ///< u32 kbps
+  framerate = 2,             ///< u32 fps
+  idr = 3,                   ///< (none)
+  resolution = 7,            ///< u32 width, u32 height
+  reset = 8,                 ///< (none)
+  video_reset = 9,           ///< (none)
+  audio_reset = 10,          ///< (none)
+  invalidate_ref_frames = 11 ///< u64 first frame, u64 last frame
+};
+
+struct header_t {
+  std::uint8_t type;
+  std::uint8_t version;
+  std::uint16_t length;
+};
+
+static_assert(sizeof(header_t) == 4);
+
+constexpr std::size_t kBatchHeaderSize = 2;
+
+/** One decoded message; `payload` points into the buffer given to reader_t. */
+struct message_t {
+  type_e type;
+  std::uint8_t version;
+  const char *payload;
+  std::size_t size;
+
+  /** Copy the field at `offset`; false if the message is too short to have it. */
+  template <class T> bool read(std::size_t offset, T &value) const {
+    if (offset > size || size - offset < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, payload + offset, sizeof(T));
+    return true;
+  }
+};
+
+/** Whether `data` holds a batch rather than a legacy command. */
+inline bool is_batch(const void *data, std::size_t size) {
+  return size >= kBatchHeaderSize && static_cast<const std::uint8_t *>(data)[0] == kMagic;
+}
+
+/** Walks the messages of a batch. Never reads outside [data, data + size). */
+class reader_t {
+public:
+  reader_t(const void *data, std::size_t size)
+      : data{static_cast<const char *>(data)}, size{size}, offset{kBatchHeaderSize} {
+    valid = is_batch(data, size) && static_cast<std::uint8_t>(this->data[1]) >= 1;
+  }
+
+  /** False if this isn't a batch at all. */
+  bool ok() const {
+    return valid;
+  }
+
+  /** True once next() found a message running past the end of the buffer. */
+  bool truncated() const {
+    return broken;
+  }
+
+  std::optional<message_t> next() {
+    if (!valid || broken || size - offset < sizeof(header_t)) {
+      return std::nullopt;
+    }
+
+    header_t header;
+    std::memcpy(&header, data + offset, sizeof(header));
+    offset += sizeof(header);
+
+    if (header.length > size - offset) {
+      broken = true;
+      return std::nullopt;
+    }
+
+    message_t message{static_cast<type_e>(header.type), header.version, data + offset,
+                      header.length};
+    offset += header.length;
+    return message;
+  }
+
+private:
+  const char *data;
+  std::size_t size;
+  std::size_t offset;
+  bool valid;
+  bool broken = false;
+};
+
+/** Builds a batch in a caller-provided buffer, e.g. DataPacket::data. */
+class writer_t {
+public:
+  writer_t(void *data, std::size_t capacity) : data{static_cast<char *>(data)}, capacity{capacity} {
+    if (capacity >= kBatchHeaderSize) {
+      this->data[0] = static_cast<char>(kMagic);
+      this->data[1] = static_cast<char>(kVersion);
+      used = kBatchHeaderSize;
+    }
+  }
+
+  /** Bytes written so far, i.e. the DataPacket size. */
+  std::size_t size() const {
+    return used;
+  }
+
+  /** Append a message made of `fields`; false if it doesn't fit. */
+  bool add(type_e type, std::initializer_list<ring::segment_t> fields = {}) {
+    std::size_t length = 0;
+    for (auto &field : fields) {
+      length += field.size;
+    }
+    if (used == 0 || length > UINT16_MAX || capacity - used < sizeof(header_t) + length) {
+      return false;
+    }
+
+    header_t header{static_cast<std::uint8_t>(type), kVersion,
+                    static_cast<std::uint16_t>(length)};
+    std::memcpy(data + used, &header, sizeof(header));
+    used += sizeof(header);
+    for (auto &field : fields) {
+      std::memcpy(data + used, field.data, field.size);
+      used += field.size;
+    }
+    return true;
+  }
+
+  bool bitrate(std::uint32_t kbps) {
+    return add(type_e::bitrate, {{&kbps, sizeof(kbps)}});
+  }
+
+  bool framerate(std::uint32_t fps) {
+    return add(type_e::framerate, {{&fps, sizeof(fps)}});
+  }
+
+  bool resolution(std::uint32_t width, std::uint32_t height) {
+    return add(type_e::resolution, {{&width, sizeof(width)}, {&height, sizeof(height)}});
+  }
+
+  bool invalidate_ref_frames(std::uint64_t first_frame, std::uint64_t last_frame) {
+    return add(type_e::invalidate_ref_frames,
+               {{&first_frame, sizeof(first_frame)}, {&last_frame, sizeof(last_frame)}});
+  }
+
+private:
+  char *data;
+  std::size_t capacity;
+  std::size_t used = 0;
+};
+
+} // namespace control
+
 } // namespace ivshmem_protocol
 
 // Legacy C linkage used by interprocess.h and main.cpp.
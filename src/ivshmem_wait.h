@@ -0,0 +1,151 @@
+#pragma once
+
+/**
+ * @file src/ivshmem_wait.h
+ * @brief Waiting for the other side of the shared memory to publish something.
+ *
+ * Readers spin for a short while, since the next message usually follows quickly,
+ * then yield the CPU, and only then block on a doorbell or timer. Blocking costs a
+ * wakeup of tens of microseconds or more, spinning costs a core, and the policy
+ * decides how long each phase lasts.
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace ivshmem_protocol {
+
+/** Tell the CPU we are busy-waiting, which saves power and frees the core's sibling thread. */
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
+
+/** The phase of wait_for() in which the condition became true. */
+enum class wake_e {
+  ready,   ///< Before waiting at all
+  spin,    ///< While spinning
+  yield,   ///< While yielding
+  block,   ///< After blocking
+  timeout, ///< Not at all; the caller should check for shutdown and wait again
+};
+
+struct wait_policy_t {
+  std::chrono::nanoseconds spin{std::chrono::microseconds{20}};
+  std::chrono::nanoseconds yield{std::chrono::microseconds{100}};
+  std::chrono::milliseconds block{1000}; ///< Passed on to the block callback
+};
+
+/**
+ * Wait until `ready()` returns true.
+ * @param block Called with policy.block once spinning and yielding gave up; should return
+ *              early when the producer rings the doorbell.
+ */
+template <class Ready, class Block>
+wake_e wait_for(Ready &&ready, const wait_policy_t &policy, Block &&block) {
+  if (ready()) {
+    return wake_e::ready;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start < policy.spin) {
+    for (int i = 0; i < 64; ++i) {
+      cpu_relax();
+    }
+    if (ready()) {
+      return wake_e::spin;
+    }
+  }
+
+  while (std::chrono::steady_clock::now() - start < policy.spin + policy.yield) {
+    std::this_thread::yield();
+    if (ready()) {
+      return wake_e::yield;
+    }
+  }
+
+  block(policy.block);
+  return ready() ? wake_e::block : wake_e::timeout;
+}
+
+/**
+ * Latency histogram with power-of-two buckets, from 1 ns up to about 9 seconds.
+ * Cheap enough to record on every message; not thread-safe.
+ */
+class latency_histogram_t {
+public:
+  static constexpr std::size_t kBuckets = 34;
+
+  void record(std::chrono::nanoseconds latency) {
+    auto ns = static_cast<std::uint64_t>(latency.count() > 0 ? latency.count() : 0);
+
+    std::size_t bucket = 0;
+    while (bucket + 1 < kBuckets && (1ull << bucket) <= ns) {
+      ++bucket;
+    }
+
+    ++buckets[bucket];
+    ++total;
+    if (ns > max_ns) {
+      max_ns = ns;
+    }
+  }
+
+  std::uint64_t count() const {
+    return total;
+  }
+
+  std::chrono::nanoseconds max() const {
+    return to_duration(max_ns);
+  }
+
+  /** Upper bound of the bucket holding the `p`th percentile (0-100); 0 when empty. */
+  std::chrono::nanoseconds percentile(double p) const {
+    auto rank = static_cast<std::uint64_t>(p / 100 * total);
+    std::uint64_t seen = 0;
+    for (std::size_t bucket = 0; bucket < kBuckets; ++bucket) {
+      seen += buckets[bucket];
+      if (seen > rank) {
+        return to_duration(std::min<std::uint64_t>(max_ns, (1ull << bucket) - 1));
+      }
+    }
+    return to_duration(max_ns);
+  }
+
+  /** Fold in samples recorded elsewhere, e.g. by another thread. */
+  void merge(const latency_histogram_t &other) {
+    for (std::size_t bucket = 0; bucket < kBuckets; ++bucket) {
+      buckets[bucket] += other.buckets[bucket];
+    }
+    total += other.total;
+    max_ns = std::max(max_ns, other.max_ns);
+  }
+
+  void reset() {
+    buckets = {};
+    total = 0;
+    max_ns = 0;
+  }
+
+private:
+  static std::chrono::nanoseconds to_duration(std::uint64_t ns) {
+    return std::chrono::nanoseconds{static_cast<std::chrono::nanoseconds::rep>(ns)};
+  }
+
+  std::array<std::uint64_t, kBuckets> buckets{};
+  std::uint64_t total = 0;
+  std::uint64_t max_ns = 0;
+};
+
+} // namespace ivshmem_protocol
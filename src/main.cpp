@@ -5,13 +5,17 @@
 
 // standard includes
 #include "smemory.h"
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <climits>
 #include <codecvt>
 #include <csignal>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <string_view>
 #include <thread>
@@ -19,11 +23,16 @@
 // local includes
 #include "audio.h"
 #include "config.h"
+#include "cursor_channel.h"
+#include "frame_trace.h"
 #include "globals.h"
 #include "interprocess.h"
+#include "ivshmem_protocol.h"
+#include "ivshmem_wait.h"
 #include "logging.h"
 #include "output_debug.h"
 #include "platform/common.h"
+#include "ring_producer.h"
 #include "video.h"
 
 #ifdef _WIN32
@@ -111,13 +120,23 @@ int main(int argc, char *argv[]) {
 
   mail::man = std::make_shared<safe::mail_raw_t>();
   MediaMemory *memory = NULL;
+  MediaRingMemory *ring_memory = NULL;
   IVSHMEM *ivshmem = NULL;
   SharedMemory *shm = NULL;
+  CursorMemory *cursor_memory = NULL;
+  IVSHMEM *cursor_ivshmem = NULL;
+  SharedMemory *cursor_shm = NULL;
   bool debug_output_timing = false;
 
   std::string ivshmem_path;
   std::string shm_name;
+  std::string cursor_ivshmem_path;
+  std::string cursor_shm_name;
   std::string capture_display;
+  ivshmem_protocol::ring::backpressure_t backpressure;
+  ivshmem_protocol::wait_policy_t control_wait;
+  auto packet_queue_mode = safe::queue_mode_e::locked;
+  std::string trace_file;
 
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
@@ -129,8 +148,58 @@ int main(int argc, char *argv[]) {
       ivshmem_path = argv[++i];
     } else if (arg == "--shm"sv && i + 1 < argc) {
       shm_name = argv[++i];
+    } else if (arg == "--cursor-ivshmem"sv && i + 1 < argc) {
+      cursor_ivshmem_path = argv[++i];
+    } else if (arg == "--cursor-shm"sv && i + 1 < argc) {
+      cursor_shm_name = argv[++i];
+    } else if (arg == "--capture"sv && i + 1 < argc) {
+      config::video.capture = argv[++i];
+    } else if (arg == "--convert-stripes"sv && i + 1 < argc) {
+      config::video.convert_stripes = std::max(std::atoi(argv[++i]), 0);
+    } else if (arg == "--convert-ahead"sv && i + 1 < argc) {
+      config::video.convert_ahead = argv[++i] == "on"sv;
+    } else if (arg == "--pacing"sv && i + 1 < argc) {
+      config::video.capture_paced = argv[++i] == "capture"sv;
+    } else if (arg == "--keepalive-ms"sv && i + 1 < argc) {
+      config::video.keepalive_ms = std::max(std::atoi(argv[++i]), 1);
+    } else if (arg == "--skip-static"sv && i + 1 < argc) {
+      config::video.skip_static = argv[++i] == "on"sv;
+    } else if (arg == "--static-backoff"sv && i + 1 < argc) {
+      config::video.static_backoff = argv[++i] == "on"sv;
+    } else if (arg == "--damage"sv && i + 1 < argc) {
+      config::video.track_damage = argv[++i] == "on"sv;
+    } else if (arg == "--roi-static-qp"sv && i + 1 < argc) {
+      config::video.roi_static_qp = std::clamp(std::atoi(argv[++i]), 0, 51);
+    } else if (arg == "--intra-refresh"sv && i + 1 < argc) {
+      config::video.intra_refresh = argv[++i] == "on"sv;
+    } else if (arg == "--refresh-period"sv && i + 1 < argc) {
+      config::video.refresh_period = std::max(std::atoi(argv[++i]), 0);
+    } else if (arg == "--idr-refresh"sv && i + 1 < argc) {
+      config::video.idr_refresh = argv[++i] != "off"sv;
+    } else if (arg == "--rfi-refs"sv && i + 1 < argc) {
+      config::video.rfi_refs = std::max(std::atoi(argv[++i]), 0);
     } else if (arg == "--capture-display"sv && i + 1 < argc) {
       capture_display = argv[++i];
+    } else if (arg == "--backpressure"sv && i + 1 < argc) {
+      std::string_view policy = argv[++i];
+      if (policy == "drop"sv) {
+        backpressure.policy = ivshmem_protocol::ring::backpressure_e::drop_oldest;
+      } else if (policy == "overwrite"sv) {
+        backpressure.policy = ivshmem_protocol::ring::backpressure_e::overwrite;
+      } else {
+        backpressure.policy = ivshmem_protocol::ring::backpressure_e::wait;
+      }
+    } else if (arg == "--backpressure-wait-ms"sv && i + 1 < argc) {
+      backpressure.max_wait = std::chrono::milliseconds{std::atoi(argv[++i])};
+    } else if (arg == "--control-spin-us"sv && i + 1 < argc) {
+      control_wait.spin = std::chrono::microseconds{std::atoi(argv[++i])};
+    } else if (arg == "--control-yield-us"sv && i + 1 < argc) {
+      control_wait.yield = std::chrono::microseconds{std::atoi(argv[++i])};
+    } else if (arg == "--trace-file"sv && i + 1 < argc) {
+      trace_file = argv[++i];
+    } else if (arg == "--packet-queue"sv && i + 1 < argc) {
+      packet_queue_mode =
+          argv[++i] == "spsc"sv ? safe::queue_mode_e::spsc : safe::queue_mode_e::locked;
     }
   }
 
@@ -139,30 +208,80 @@ int main(int argc, char *argv[]) {
     BOOST_LOG(error) << "Logging failed to initialize"sv;
   }
 
+  if (!trace_file.empty()) {
+    // The last few minutes at 240 fps, about 7 MB
+    frame_trace::enable(1 << 16);
+  }
+
   if (!ivshmem_path.empty()) {
     ivshmem = new IVSHMEM(ivshmem_path.c_str());
-    if (ivshmem->Initialize() && ivshmem->GetSize() >= sizeof(MediaMemory)) {
-      BOOST_LOG(info) << "Found ivshmem shared memory"sv;
-      memory = (MediaMemory *)ivshmem->GetMemory();
+    if (ivshmem->Initialize()) {
+      if (ivshmem_protocol::ring::detect_layout(ivshmem->GetMemory(), ivshmem->GetSize()) ==
+          ivshmem_protocol::ring::layout_e::ring) {
+        BOOST_LOG(info) << "Found ivshmem shared memory (ring layout)"sv;
+        ring_memory = (MediaRingMemory *)ivshmem->GetMemory();
+      } else if (ivshmem->GetSize() >= sizeof(MediaMemory)) {
+        BOOST_LOG(info) << "Found ivshmem shared memory"sv;
+        memory = (MediaMemory *)ivshmem->GetMemory();
+      }
     }
   } else if (!shm_name.empty()) {
-    shm = new SharedMemory(shm_name.c_str(), sizeof(MediaMemory));
-    if (shm->Initialize()) {
-      BOOST_LOG(info) << "Found named shared memory: " << shm_name;
-      memory = (MediaMemory *)shm->GetMemory();
+    // The ring layout is smaller than MediaMemory, so map that much first to look for its header
+    shm = new SharedMemory(shm_name.c_str(), sizeof(MediaRingMemory));
+    if (shm->Initialize() &&
+        ivshmem_protocol::ring::detect_layout(shm->GetMemory(), shm->GetSize()) ==
+            ivshmem_protocol::ring::layout_e::ring) {
+      BOOST_LOG(info) << "Found named shared memory (ring layout): " << shm_name;
+      ring_memory = (MediaRingMemory *)shm->GetMemory();
+    } else {
+      delete shm;
+      shm = new SharedMemory(shm_name.c_str(), sizeof(MediaMemory));
+      if (shm->Initialize()) {
+        BOOST_LOG(info) << "Found named shared memory: " << shm_name;
+        memory = (MediaMemory *)shm->GetMemory();
+      }
     }
   }
 
-  if (memory == NULL) {
+  if (ring_memory) {
+    ivshmem_protocol::ring::accept_layout(&ring_memory->header);
+  }
+
+  // The host may take the pointer on its own channel and draw it over the video itself
+  if (!cursor_ivshmem_path.empty()) {
+    cursor_ivshmem = new IVSHMEM(cursor_ivshmem_path.c_str());
+    if (cursor_ivshmem->Initialize() &&
+        ivshmem_protocol::cursor::detect(cursor_ivshmem->GetMemory(), cursor_ivshmem->GetSize())) {
+      cursor_memory = (CursorMemory *)cursor_ivshmem->GetMemory();
+    }
+  } else if (!cursor_shm_name.empty()) {
+    cursor_shm = new SharedMemory(cursor_shm_name.c_str(), sizeof(CursorMemory));
+    if (cursor_shm->Initialize() &&
+        ivshmem_protocol::cursor::detect(cursor_shm->GetMemory(), cursor_shm->GetSize())) {
+      cursor_memory = (CursorMemory *)cursor_shm->GetMemory();
+    }
+  }
+
+  if (cursor_memory) {
+    BOOST_LOG(info) << "Found cursor channel, leaving the cursor out of the video"sv;
+    ivshmem_protocol::cursor::accept(&cursor_memory->header);
+  } else if (!cursor_ivshmem_path.empty() || !cursor_shm_name.empty()) {
+    BOOST_LOG(warning) << "Cursor channel not available, drawing the cursor into the video"sv;
+  }
+
+  if (memory == NULL && ring_memory == NULL) {
     BOOST_LOG(info) << "IPC shared memory not available, using mockup memory block"sv;
     BOOST_LOG(info) << "Output packet timing debug mode enabled"sv;
     debug_output_timing = true;
     memory = (MediaMemory *)calloc(1, sizeof(MediaMemory));
   }
 
+  int *doorbell_peer_id = ring_memory ? &ring_memory->header.doorbell_peer_id :
+                                        &memory->doorbell_peer_id;
+
   // Create signal handler after logging has been initialized
   auto process_shutdown_event = mail::man->event<bool>(mail::shutdown);
-  on_signal(SIGINT, [process_shutdown_event, ivshmem, shm]() {
+  on_signal(SIGINT, [process_shutdown_event, ivshmem, shm, cursor_ivshmem, cursor_shm]() {
     BOOST_LOG(info) << "Interrupt handler called"sv;
     logging::log_flush();
     process_shutdown_event->raise(true);
@@ -170,9 +289,13 @@ int main(int argc, char *argv[]) {
       ivshmem->DeInitialize();
     if (shm)
       shm->DeInitialize();
+    if (cursor_ivshmem)
+      cursor_ivshmem->DeInitialize();
+    if (cursor_shm)
+      cursor_shm->DeInitialize();
   });
 
-  on_signal(SIGTERM, [process_shutdown_event, ivshmem, shm]() {
+  on_signal(SIGTERM, [process_shutdown_event, ivshmem, shm, cursor_ivshmem, cursor_shm]() {
     BOOST_LOG(info) << "Terminate handler called"sv;
     logging::log_flush();
     process_shutdown_event->raise(true);
@@ -180,10 +303,16 @@ int main(int argc, char *argv[]) {
       ivshmem->DeInitialize();
     if (shm)
       shm->DeInitialize();
+    if (cursor_ivshmem)
+      cursor_ivshmem->DeInitialize();
+    if (cursor_shm)
+      cursor_shm->DeInitialize();
   });
 
+#ifdef _WIN32
   // Wait as long as possible to terminate Sunshine.exe during logoff/shutdown
   SetProcessShutdownParameters(0x100, SHUTDOWN_NORETRY);
+#endif
 
   auto platf_deinit_guard = platf::init();
 
@@ -226,7 +355,9 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  auto video_capture = [&](safe::mail_t mail, std::string displayin, int codec) {
+  auto video_capture = [&](safe::mail_t mail, std::string displayin, int codec,
+                           std::shared_ptr<ring_producer_t> producer,
+                           std::shared_ptr<cursor_channel_t> cursor) {
     video::config_t config;
     config.display = displayin;
     config.width = 1920;
@@ -239,9 +370,11 @@ int main(int argc, char *argv[]) {
     config.videoFormat = codec;
     config.dynamicRange = 0;
     config.chromaSamplingType = 0;
-    config.enableIntraRefresh = 0;
+    config.enableIntraRefresh = config::video.intra_refresh;
+    config.intraRefreshPeriod = config::video.refresh_period;
+    config.idrByIntraRefresh = config::video.idr_refresh;
 
-    video::capture(mail, config, NULL);
+    video::capture(mail, config, NULL, producer.get(), cursor.get());
   };
 
   auto audio_capture = [&](safe::mail_t mail) {
@@ -256,7 +389,18 @@ int main(int argc, char *argv[]) {
 
   auto mail = std::make_shared<safe::mail_raw_t>();
 
-  auto pull = [process_shutdown_event, mail, ivshmem](MediaQueue *queue) {
+  std::array<std::shared_ptr<cursor_channel_t>, MAX_DISPLAY> cursor_channels;
+  if (cursor_memory) {
+    for (int i = 0; i < MAX_DISPLAY; ++i) {
+      cursor_channels[i] = std::make_shared<cursor_channel_t>(&cursor_memory->display[i]);
+    }
+  }
+
+  // `queue` is either the legacy MediaQueue or the ring layout's ControlQueue
+  auto pull = [process_shutdown_event, ivshmem, control_wait,
+               &cursor_channels](safe::mail_t mail, auto *queue) {
+    namespace control = ivshmem_protocol::control;
+
     auto timer = platf::create_high_precision_timer();
     auto local_shutdown = mail->event<bool>(mail::shutdown);
     auto bitrate = mail->event<int>(mail::bitrate);
@@ -267,47 +411,122 @@ int main(int argc, char *argv[]) {
     auto audio_reset = mail->event<bool>(mail::audio_reset);
     auto invalidate_ref_frames = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
 
-    HANDLE event = NULL;
+    DoorbellEvent event;
     bool has_doorbell = false;
     if (ivshmem) {
-      event = CreateEvent(NULL, FALSE, FALSE, NULL);
-      if (event) {
-        if (ivshmem->RegisterEvent(event, 0)) {
+      if (event.Initialize()) {
+        if (ivshmem->RegisterEvent(event.GetHandle(), 0)) {
           BOOST_LOG(info) << "Successfully registered IVSHMEM doorbell event on vector 0";
           has_doorbell = true;
         } else {
           BOOST_LOG(warning) << "Failed to register IVSHMEM doorbell event, falling back to polling";
-          CloseHandle(event);
-          event = NULL;
+          event.DeInitialize();
         }
       }
     }
 
+    // Without a doorbell, blocking means polling every millisecond
+    auto block = [&](std::chrono::milliseconds timeout) {
+      if (has_doorbell) {
+        event.Wait((uint32_t)timeout.count());
+      } else {
+        timer->sleep_for(1ms);
+      }
+    };
+
+    // Time from noticing a command to having handled it, and how it was noticed
+    ivshmem_protocol::latency_histogram_t handling_latency;
+    std::array<uint64_t, 4> wakes{};
+
     int cached_bitrate = 6000; // kbps, matches default config.bitrate
-    int new_framerate;
-    auto expected_index = queue->outindex;
-    char buffer[DATA_PACKET_SIZE] = {0};
-    while (!process_shutdown_event->peek() && !local_shutdown->peek()) {
-      while (expected_index == queue->outindex) {
-        if (has_doorbell) {
-          WaitForSingleObject(event, 1000);
-          if (process_shutdown_event->peek() || local_shutdown->peek()) {
-            break;
-          }
-        } else {
-          timer->sleep_for(1ms);
-        }
+    auto set_bitrate = [&](int kbps) {
+      if (kbps > 0 && kbps != cached_bitrate) {
+        cached_bitrate = kbps;
+        bitrate->raise(kbps);
       }
-      if (expected_index == queue->outindex) {
-        continue;
+    };
+    auto set_resolution = [&](int width, int height) {
+      if (width > 0 && height > 0) {
+        BOOST_LOG(info) << "Resolution change requested: " << width << "x" << height;
+        resolution->raise(std::make_pair(width, height));
+        idr->raise(true);
       }
+    };
+    auto set_pointer = [&](bool visible) {
+      display_cursor = visible;
 
-      memcpy(buffer, queue->outgoing[expected_index].data, queue->outgoing[expected_index].size);
+      // A cursor channel shows or hides it right away, rather than with the next mouse move
+      for (auto &cursor_channel : cursor_channels) {
+        if (cursor_channel) {
+          cursor_channel->refresh();
+        }
+      }
+    };
 
-      expected_index++;
-      if (expected_index >= OUT_QUEUE_SIZE)
-        expected_index = 0;
+    // Commands without arguments mean the same in both formats
+    auto handle_simple = [&](int type) {
+      switch (type) {
+      case EventType::Idr:
+        idr->raise(true);
+        break;
+      case EventType::Reset:
+        BOOST_LOG(info) << "Pipeline reset requested";
+        process_shutdown_event->raise(true);
+        break;
+      case EventType::VideoReset:
+        BOOST_LOG(info) << "Video pipeline reset requested";
+        video_reset->raise(true);
+        break;
+      case EventType::AudioReset:
+        BOOST_LOG(info) << "Audio pipeline reset requested";
+        audio_reset->raise(true);
+        break;
+      default:
+        break;
+      }
+    };
 
+    // Messages too short for the fields we need are ignored
+    auto handle = [&](const control::message_t &message) {
+      switch (message.type) {
+      case control::type_e::bitrate: {
+        uint32_t kbps;
+        if (message.read(0, kbps) && kbps <= INT_MAX)
+          set_bitrate((int)kbps);
+        break;
+      }
+      case control::type_e::framerate: {
+        uint32_t fps;
+        if (message.read(0, fps) && fps > 0 && fps <= 1000)
+          framerate->raise((int)fps);
+        break;
+      }
+      case control::type_e::pointer: {
+        uint8_t visible;
+        if (message.read(0, visible))
+          set_pointer(visible != 0);
+        break;
+      }
+      case control::type_e::resolution: {
+        uint32_t width, height;
+        if (message.read(0, width) && message.read(4, height) && width <= 16384 && height <= 16384)
+          set_resolution((int)width, (int)height);
+        break;
+      }
+      case control::type_e::invalidate_ref_frames: {
+        uint64_t first_frame, last_frame;
+        if (message.read(0, first_frame) && message.read(8, last_frame))
+          invalidate_ref_frames->raise(std::make_pair(first_frame, last_frame));
+        break;
+      }
+      default:
+        handle_simple((int)message.type);
+        break;
+      }
+    };
+
+    // One command per packet, with its arguments scaled down to fit a byte
+    auto handle_legacy = [&](const char *buffer) {
       switch (buffer[0]) {
       case EventType::Bitrate: {
         if (buffer[1] == 0)
@@ -315,76 +534,119 @@ int main(int argc, char *argv[]) {
 
         int new_bitrate = buffer[1] * 1000;                   // kbps
         if (std::abs(new_bitrate - cached_bitrate) >= 1000) { // only change if delta >= 1 Mbps
-          cached_bitrate = new_bitrate;
-          bitrate->raise(new_bitrate);
+          set_bitrate(new_bitrate);
         }
         break;
       }
-      case EventType::Framerate:
-        new_framerate = buffer[1] * 2;
+      case EventType::Framerate: {
+        int new_framerate = buffer[1] * 2;
         if (new_framerate < 20)
           break;
 
         framerate->raise(new_framerate);
         break;
-      case EventType::Idr:
-        idr->raise(true);
-        break;
-      case EventType::Pointer:
-        display_cursor = buffer[1] != 0;
-        break;
-      case EventType::Resolution: {
-        int new_width = (uint8_t)buffer[1] * 20;
-        int new_height = (uint8_t)buffer[2] * 20;
-        if (new_width > 0 && new_height > 0) {
-          BOOST_LOG(info) << "Resolution change requested: " << new_width << "x" << new_height;
-          resolution->raise(std::make_pair(new_width, new_height));
-          idr->raise(true);
-        }
-        break;
       }
-      case EventType::Reset:
-        BOOST_LOG(info) << "Pipeline reset requested";
-        process_shutdown_event->raise(true);
+      case EventType::Pointer:
+        set_pointer(buffer[1] != 0);
         break;
-      case EventType::VideoReset:
-        BOOST_LOG(info) << "Video pipeline reset requested";
-        video_reset->raise(true);
-        break;
-      case EventType::AudioReset:
-        BOOST_LOG(info) << "Audio pipeline reset requested";
-        audio_reset->raise(true);
+      case EventType::Resolution:
+        set_resolution((uint8_t)buffer[1] * 20, (uint8_t)buffer[2] * 20);
         break;
       case EventType::InvalidateRefFrames: {
-        uint64_t first_frame = *(uint64_t*)&buffer[1];
-        uint64_t last_frame = *(uint64_t*)&buffer[9];
+        uint64_t first_frame, last_frame;
+        memcpy(&first_frame, &buffer[1], sizeof(first_frame));
+        memcpy(&last_frame, &buffer[9], sizeof(last_frame));
         invalidate_ref_frames->raise(std::make_pair(first_frame, last_frame));
         break;
       }
       default:
+        handle_simple(buffer[0]);
         break;
       }
-    }
+    };
+
+    auto expected_index = ivshmem_protocol::consume(queue->outindex);
+    char buffer[DATA_PACKET_SIZE] = {0};
+    while (!process_shutdown_event->peek() && !local_shutdown->peek()) {
+      auto wake = ivshmem_protocol::wait_for(
+          [&]() { return expected_index != ivshmem_protocol::consume(queue->outindex); },
+          control_wait, block);
+      if (wake == ivshmem_protocol::wake_e::timeout) {
+        continue;
+      }
+      auto arrival = steady_clock::now();
+      wakes[(int)wake]++;
 
-    if (event) {
-      CloseHandle(event);
+      // The size comes from the other side of the shared memory
+      auto size = std::clamp(queue->outgoing[expected_index].size, 0, DATA_PACKET_SIZE);
+      memcpy(buffer, queue->outgoing[expected_index].data, size);
+
+      expected_index++;
+      if (expected_index >= OUT_QUEUE_SIZE)
+        expected_index = 0;
+
+      if (control::is_batch(buffer, size)) {
+        control::reader_t reader{buffer, (std::size_t)size};
+        while (auto message = reader.next()) {
+          handle(*message);
+        }
+        if (reader.truncated()) {
+          BOOST_LOG(warning) << "Dropped the rest of a truncated control batch"sv;
+        }
+      } else {
+        handle_legacy(buffer);
+      }
+
+      handling_latency.record(steady_clock::now() - arrival);
+      if (handling_latency.count() % 100 == 0) {
+        BOOST_LOG(debug) << "Control commands: "sv << handling_latency.count()
+                         << ", handled in p50 "sv
+                         << duration_cast<microseconds>(handling_latency.percentile(50)).count()
+                         << "us p99 "sv
+                         << duration_cast<microseconds>(handling_latency.percentile(99)).count()
+                         << "us max "sv
+                         << duration_cast<microseconds>(handling_latency.max()).count()
+                         << "us; noticed immediately "sv << wakes[0] << ", spinning "sv << wakes[1]
+                         << ", yielding "sv << wakes[2] << ", after blocking "sv << wakes[3];
+      }
     }
   };
 
   auto video_output_watchdog_ms = std::make_shared<std::atomic<int64_t>>(0);
 
   auto push_video = [process_shutdown_event, debug_output_timing, video_output_watchdog_ms, ivshmem,
-                     memory](safe::mail_t mail, MediaQueue *queue, UINT16 doorbell_vector) {
+                     doorbell_peer_id, backpressure](safe::mail_t mail, MediaQueue *queue,
+                                                     std::shared_ptr<ring_producer_t> producer,
+                                                     uint16_t doorbell_vector) {
     auto video_packets = mail->queue<video::packet_t>(mail::video_packets);
     auto audio_packets = mail->queue<audio::packet_t>(mail::audio_packets);
     auto local_shutdown = mail->event<bool>(mail::shutdown);
+    auto idr = mail->event<bool>(mail::idr);
 
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
 
     auto now_ms = []() {
       return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
     };
-    output_debug::timing_t output_timing{debug_output_timing};
+    const char *recovery = !config::video.intra_refresh ? "IDR frames"
+                           : config::video.idr_refresh  ? "intra refresh waves"
+                                                        : "IDR frames over intra refresh";
+    output_debug::timing_t output_timing{
+        debug_output_timing, config::video.capture_paced ? "capture" : "fixed", recovery};
+
+    // After a frame is lost the host can't decode anything until the next IDR frame or
+    // intra refresh wave, so skip the frames in between and give the consumer a chance to
+    // catch up.
+    bool awaiting_idr = false;
+    auto on_frame_lost = [&](uint64_t findex) {
+      if (!awaiting_idr) {
+        BOOST_LOG(warning) << "Host consumer fell behind at frame "sv << findex
+                           << ", requesting IDR frame"sv;
+        awaiting_idr = true;
+      }
+      idr->raise(true);
+    };
+
     auto check_output_timeout = [&]() {
       auto last_output_packet = video_output_watchdog_ms->load();
       if (last_output_packet == 0 || now_ms() - last_output_packet < 10000) {
@@ -404,13 +666,16 @@ int main(int argc, char *argv[]) {
           check_output_timeout();
           break;
         }
+        if (packet->trace) {
+          packet->trace->mark(frame_trace::stage_e::dequeue);
+        }
 
         auto findex = packet->frame_index();
         std::string_view payload{(char *)packet->data(), packet->data_size()};
         std::vector<uint8_t> payload_with_replacements;
         uint64_t rtp_sample_duration = packet->rtp_sample_duration;
 
-        if (packet->is_idr() && packet->replacements) {
+        if ((packet->is_idr() || packet->starts_intra_refresh) && packet->replacements) {
           for (auto &replacement : *packet->replacements) {
             auto frame_old = replacement.old;
             auto frame_new = replacement._new;
@@ -421,37 +686,92 @@ int main(int argc, char *argv[]) {
         }
 
         if (packet->is_idr())
-          flags |= (1 << 0);
+          flags |= ivshmem_protocol::kVideoFlagKeyframe;
         if (packet->after_ref_frame_invalidation)
-          flags |= (1 << 1);
+          flags |= ivshmem_protocol::kVideoFlagAfterRefFrameInvalidation;
+        if (packet->starts_intra_refresh)
+          flags |= ivshmem_protocol::kVideoFlagIntraRefresh;
+
+        if (awaiting_idr) {
+          if (!packet->is_idr() && !packet->starts_intra_refresh) {
+            output_timing.count_dropped();
+            continue;
+          }
+          awaiting_idr = false;
+        }
 
-        constexpr auto header_size = sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint8_t);
-        if (payload.size() > MEDIA_PACKET_SIZE - header_size) {
+        constexpr auto header_size = ivshmem_protocol::kVideoPacketHeaderSize;
+        const auto payload_capacity =
+            producer ? ivshmem_protocol::ring::max_payload(ivshmem_protocol::ring::kVideoRingSize) -
+                         header_size :
+                     MEDIA_PACKET_SIZE - header_size;
+        if (payload.size() > payload_capacity) {
           BOOST_LOG(error) << "Dropping oversized video packet: " << payload.size()
                            << " bytes exceeds shared memory payload capacity "
-                           << (MEDIA_PACKET_SIZE - header_size);
+                           << payload_capacity;
           if (check_output_timeout()) {
             break;
           }
           continue;
         }
 
-        auto updated = queue->inindex + 1;
-        if (updated >= IN_QUEUE_SIZE)
-          updated = 0;
-
-        queue->incoming[queue->inindex].size = 0;
-        copy_to_packet(&queue->incoming[queue->inindex], &findex, sizeof(uint64_t));
-        copy_to_packet(&queue->incoming[queue->inindex], &rtp_sample_duration, sizeof(uint64_t));
-        copy_to_packet(&queue->incoming[queue->inindex], &flags, sizeof(uint8_t));
-        copy_to_packet(&queue->incoming[queue->inindex], (void *)payload.data(), payload.size());
-        queue->inindex = updated;
-        if (ivshmem && memory->doorbell_peer_id > 0) {
-          ivshmem->RingDoorbell((UINT16)memory->doorbell_peer_id, doorbell_vector);
+        if (producer && payload.data() == (char *)packet->data() &&
+            producer->commit_in_place(payload.data(), payload.size(), findex, rtp_sample_duration,
+                                      flags)) {
+          // Encoded straight into the ring; nothing to copy
+        } else if (producer) {
+          auto result = producer->write(
+              {{&findex, sizeof(findex)},
+               {&rtp_sample_duration, sizeof(rtp_sample_duration)},
+               {&flags, sizeof(flags)},
+               {payload.data(), payload.size()}},
+              backpressure,
+              [](const auto &record) { return !ivshmem_protocol::ring::is_keyframe(record); });
+
+          if (result.stalled) {
+            output_timing.count_stalled();
+          }
+          if (result.overwritten) {
+            output_timing.count_overwritten(result.overwritten);
+            if (!packet->is_idr()) {
+              on_frame_lost(findex);
+            }
+          }
+          if (!result.written) {
+            output_timing.count_dropped();
+            on_frame_lost(findex);
+            if (check_output_timeout()) {
+              break;
+            }
+            continue;
+          }
+        } else {
+          auto index = ivshmem_protocol::load_relaxed(queue->inindex);
+          auto slot = &queue->incoming[index];
+
+          slot->size = 0;
+          copy_to_packet(slot, &findex, sizeof(uint64_t));
+          copy_to_packet(slot, &rtp_sample_duration, sizeof(uint64_t));
+          copy_to_packet(slot, &flags, sizeof(uint8_t));
+          copy_to_packet(slot, (void *)payload.data(), payload.size());
+          ivshmem_protocol::publish(queue->inindex,
+                                    ivshmem_protocol::advance_index(index, IN_QUEUE_SIZE));
+        }
+        if (ivshmem && *doorbell_peer_id > 0) {
+          ivshmem->RingDoorbell((uint16_t)*doorbell_peer_id, doorbell_vector);
+        }
+        if (packet->trace) {
+          packet->trace->channel = doorbell_vector - 1;
+          packet->trace->mark(frame_trace::stage_e::publish);
+          frame_trace::submit(*packet->trace);
         }
         video_output_watchdog_ms->store(now_ms());
         output_timing.record(findex, header_size + payload.size(), packet->is_idr(),
-                             packet->encode_duration_us.value_or(0));
+                             packet->encode_duration_us.value_or(0),
+                             {packet->convert_duration_us, packet->convert_wait_us,
+                              packet->capture_age_us, packet->skipped_converts,
+                              packet->skipped_encodes, packet->skipped_us},
+                             packet->starts_intra_refresh);
       } while (video_packets->peek());
     }
 
@@ -459,13 +779,19 @@ int main(int argc, char *argv[]) {
       local_shutdown->raise(true);
   };
 
-  auto push_audio = [process_shutdown_event, ivshmem, memory](safe::mail_t mail, DataQueue *queue) {
+  auto push_audio = [process_shutdown_event, ivshmem, doorbell_peer_id](
+                        safe::mail_t mail, DataQueue *queue, AudioRing *ring) {
     auto video_packets = mail->queue<video::packet_t>(mail::video_packets);
     auto audio_packets = mail->queue<audio::packet_t>(mail::audio_packets);
     auto local_shutdown = mail->event<bool>(mail::shutdown);
 
     platf::adjust_thread_priority(platf::thread_priority_e::high);
 
+    std::optional<ivshmem_protocol::ring::writer_t> writer;
+    if (ring) {
+      writer.emplace(ring);
+    }
+
     char sum = 0;
     uint64_t findex = 0;
     while (!process_shutdown_event->peek() && !local_shutdown->peek()) {
@@ -478,19 +804,29 @@ int main(int argc, char *argv[]) {
         size_t size = packet->data.size();
         uint64_t rtp_sample_duration = packet->rtp_sample_duration;
 
-        auto updated = queue->inindex + 1;
-        if (updated >= IN_QUEUE_SIZE)
-          updated = 0;
-
         findex++;
-        queue->incoming[queue->inindex].size = 0;
-        copy_to_dpacket(&queue->incoming[queue->inindex], &findex, sizeof(uint64_t));
-        copy_to_dpacket(&queue->incoming[queue->inindex], &rtp_sample_duration, sizeof(uint64_t));
-        copy_to_dpacket(&queue->incoming[queue->inindex], &sum, sizeof(uint8_t));
-        copy_to_dpacket(&queue->incoming[queue->inindex], ptr, size);
-        queue->inindex = updated;
-        if (ivshmem && memory->doorbell_peer_id > 0) {
-          ivshmem->RingDoorbell((UINT16)memory->doorbell_peer_id, MAX_DISPLAY + 1);
+        if (writer) {
+          if (!writer->write(RING_RECORD_AUDIO, {{&findex, sizeof(findex)},
+                                                 {&rtp_sample_duration, sizeof(rtp_sample_duration)},
+                                                 {&sum, sizeof(sum)},
+                                                 {ptr, size}})) {
+            BOOST_LOG(warning) << "Audio ring full, dropping packet "sv << findex;
+            continue;
+          }
+        } else {
+          auto index = ivshmem_protocol::load_relaxed(queue->inindex);
+          auto slot = &queue->incoming[index];
+
+          slot->size = 0;
+          copy_to_dpacket(slot, &findex, sizeof(uint64_t));
+          copy_to_dpacket(slot, &rtp_sample_duration, sizeof(uint64_t));
+          copy_to_dpacket(slot, &sum, sizeof(uint8_t));
+          copy_to_dpacket(slot, ptr, size);
+          ivshmem_protocol::publish(queue->inindex,
+                                    ivshmem_protocol::advance_index(index, IN_QUEUE_SIZE));
+        }
+        if (ivshmem && *doorbell_peer_id > 0) {
+          ivshmem->RingDoorbell((uint16_t)*doorbell_peer_id, MAX_DISPLAY + 1);
         }
       } while (audio_packets->peek());
     }
@@ -508,11 +844,32 @@ int main(int argc, char *argv[]) {
       displays = platf::display_names(platf::mem_type_e::dxgi);
     }
 
+    mail->set_queue_mode(mail::audio_packets, packet_queue_mode);
+
     for (int i = 0; i < displays.size(); i++) {
-      auto codec = memory->video[i].metadata.codec;
-      auto capture = std::thread{video_capture, mail, displays.at(i), codec};
-      auto forward = std::thread{push_video, mail, &memory->video[i].internal, (UINT16)(i + 1)};
-      auto receive = std::thread{pull, &memory->video[i].internal};
+      // Each display gets its own packets and control events; shutdown and audio stay shared
+      auto display_mail = mail->child({mail::shutdown, mail::audio_packets, mail::audio_reset});
+      display_mail->set_queue_mode(mail::video_packets, packet_queue_mode);
+
+      auto cursor_channel = i < MAX_DISPLAY ? cursor_channels[i] : nullptr;
+
+      std::thread capture, forward, receive;
+      if (ring_memory) {
+        auto &display = ring_memory->video[i];
+        auto producer = std::make_shared<ring_producer_t>(&display.ring);
+        capture = std::thread{video_capture, display_mail, displays.at(i), display.metadata.codec,
+                              producer, cursor_channel};
+        forward = std::thread{push_video, display_mail, (MediaQueue *)NULL, producer,
+                              (uint16_t)(i + 1)};
+        receive = std::thread{pull, display_mail, &display.control};
+      } else {
+        auto codec = memory->video[i].metadata.codec;
+        capture = std::thread{video_capture, display_mail, displays.at(i), codec,
+                              std::shared_ptr<ring_producer_t>{}, cursor_channel};
+        forward = std::thread{push_video, display_mail, &memory->video[i].internal,
+                              std::shared_ptr<ring_producer_t>{}, (uint16_t)(i + 1)};
+        receive = std::thread{pull, display_mail, &memory->video[i].internal};
+      }
       receive.detach();
       capture.detach();
       forward.detach();
@@ -521,7 +878,9 @@ int main(int argc, char *argv[]) {
 
   {
     auto capture = std::thread{audio_capture, mail};
-    auto forward = std::thread{push_audio, mail, &memory->audio};
+    auto forward = ring_memory ?
+                       std::thread{push_audio, mail, (DataQueue *)NULL, &ring_memory->audio} :
+                       std::thread{push_audio, mail, &memory->audio, (AudioRing *)NULL};
     capture.detach();
     forward.detach();
   }
@@ -531,6 +890,14 @@ int main(int argc, char *argv[]) {
   while (!process_shutdown_event->peek() && !local_shutdown->peek())
     timer->sleep_for(100ms);
 
+  if (!trace_file.empty()) {
+    if (frame_trace::write_chrome_json(trace_file)) {
+      BOOST_LOG(info) << "Wrote frame trace to "sv << trace_file;
+    } else {
+      BOOST_LOG(error) << "Failed to write frame trace to "sv << trace_file;
+    }
+  }
+
   BOOST_LOG(info) << "Closed";
   timer->sleep_for(1s);
 
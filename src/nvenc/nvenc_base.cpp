@@ -271,7 +271,7 @@ bool nvenc_base::create_encoder(const nvenc_config &config, const video::config_
 
     if (client_config.enableIntraRefresh) {
       format_config.enableIntraRefresh = 1;
-      format_config.intraRefreshPeriod = std::max(1, (client_config.framerate * 200) / 1000);
+      format_config.intraRefreshPeriod = video::intra_refresh_period(client_config);
       format_config.intraRefreshCnt = format_config.intraRefreshPeriod - 1;
     }
   };
@@ -355,7 +355,7 @@ bool nvenc_base::create_encoder(const nvenc_config &config, const video::config_
 
     if (client_config.enableIntraRefresh) {
       format_config.enableIntraRefresh = 1;
-      format_config.intraRefreshPeriod = std::max(1, (client_config.framerate * 200) / 1000);
+      format_config.intraRefreshPeriod = video::intra_refresh_period(client_config);
       format_config.intraRefreshCnt = format_config.intraRefreshPeriod - 1;
     }
 
@@ -7,6 +7,7 @@
 #include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <numeric>
 #include <sstream>
 #include <string>
 
@@ -60,7 +61,7 @@ std::string idr_markers(const std::vector<timing_t::sample_t> &history) {
   const auto begin = history.size() > graph_width ? history.end() - graph_width : history.begin();
   std::ostringstream out;
   for (auto it = begin; it != history.end(); ++it) {
-    out << (it->last_idr ? '^' : ' ');
+    out << (it->idr_frames ? '^' : it->refresh_waves ? '~' : ' ');
   }
   return out.str();
 }
@@ -134,6 +135,29 @@ std::string clear_previous_render(size_t lines) {
   return out.str();
 }
 
+/** Nearest-rank percentile (0-100) of values, which it reorders; 0 when empty */
+double percentile(std::vector<double> &values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  auto rank = std::min(values.size() - 1, static_cast<size_t>(p / 100 * values.size()));
+  std::nth_element(values.begin(), values.begin() + rank, values.end());
+  return values[rank];
+}
+
+/** Frame rate the encode thread could sustain with conversion off its critical path */
+double convert_ceiling(const timing_t::sample_t &sample) {
+  auto per_frame_us = sample.avg_encode_us +
+                      (sample.convert_ahead ? sample.avg_convert_wait_us : sample.avg_convert_us);
+  return per_frame_us > 0 ? 1e6 / per_frame_us : 0;
+}
+
+/** Frame rate the encode thread could sustain converting each frame itself */
+double inline_ceiling(const timing_t::sample_t &sample) {
+  auto per_frame_us = sample.avg_encode_us + sample.avg_convert_us;
+  return per_frame_us > 0 ? 1e6 / per_frame_us : 0;
+}
+
 void metric_row(std::ostringstream &out, const char *name, double value, const char *unit,
                 double max_value, const char *color, int precision = 2) {
   out << "  " << std::left << std::setw(15) << name << reset << std::right << std::setw(11)
@@ -142,15 +166,36 @@ void metric_row(std::ostringstream &out, const char *name, double value, const c
 }
 } // namespace
 
-timing_t::timing_t(bool enabled)
-    : enabled{enabled}, start_time{std::chrono::steady_clock::now()}, window_start{start_time},
+timing_t::timing_t(bool enabled, const char *pacing, const char *recovery)
+    : enabled{enabled}, pacing{pacing}, recovery{recovery},
+      start_time{std::chrono::steady_clock::now()}, window_start{start_time},
       last_packet{start_time} {
   if (this->enabled) {
     BOOST_LOG(info) << "Output packet timing terminal graph enabled";
   }
 }
 
-void timing_t::record(int64_t frame_index, size_t packet_size, bool idr_frame, double encode_duration_us) {
+void timing_t::count_overwritten(uint64_t records) {
+  queue_window.overwritten += records;
+  queue_total.overwritten += records;
+}
+
+void timing_t::count_dropped() {
+  queue_window.dropped++;
+  queue_total.dropped++;
+}
+
+void timing_t::count_stalled() {
+  queue_window.stalled++;
+  queue_total.stalled++;
+}
+
+const timing_t::queue_counters_t &timing_t::queue_totals() const {
+  return queue_total;
+}
+
+void timing_t::record(int64_t frame_index, size_t packet_size, bool idr_frame, double encode_duration_us,
+                      const convert_t &convert, bool refresh_wave) {
   if (!enabled) {
     return;
   }
@@ -160,8 +205,28 @@ void timing_t::record(int64_t frame_index, size_t packet_size, bool idr_frame, d
   last_packet = now;
   packets++;
   bytes += packet_size;
+  size_squared_total += (double)packet_size * packet_size;
+  size_max = std::max(size_max, packet_size);
+  idr_frames += idr_frame;
+  refresh_waves += refresh_wave;
   encode_total_us += encode_duration_us;
   encode_max_us = std::max(encode_max_us, encode_duration_us);
+  if (convert.duration_us) {
+    convert_total_us += *convert.duration_us;
+    converts++;
+  }
+  if (convert.wait_us) {
+    convert_wait_total_us += *convert.wait_us;
+    convert_waits++;
+  }
+  if (convert.capture_age_us) {
+    capture_ages_us.push_back(*convert.capture_age_us);
+  }
+  for (auto counters : {&skipped_window, &skipped_total}) {
+    counters->converts += convert.skipped_converts;
+    counters->encodes += convert.skipped_encodes;
+    counters->cpu_us += convert.skipped_us;
+  }
 
   if (packets > 1) {
     interval_total_ms += interval_ms;
@@ -187,6 +252,9 @@ void timing_t::record(int64_t frame_index, size_t packet_size, bool idr_frame, d
     auto variance = interval_squared_total_ms / interval_count - avg_interval_ms * avg_interval_ms;
     jitter_ms = std::sqrt(std::max(0.0, variance));
   }
+  auto avg_size = (double)bytes / packets;
+  auto size_variance = size_squared_total / packets - avg_size * avg_size;
+  auto capture_age_total_us = std::accumulate(capture_ages_us.begin(), capture_ages_us.end(), 0.0);
   sample_t sample{
       std::chrono::duration<double>(now - start_time).count(),
       packets * 1000.0 / elapsed_ms,
@@ -196,11 +264,26 @@ void timing_t::record(int64_t frame_index, size_t packet_size, bool idr_frame, d
       jitter_ms,
       packets > 0 ? encode_total_us / packets : 0,
       encode_max_us,
+      converts > 0 ? convert_total_us / converts : 0,
+      convert_waits > 0 ? convert_wait_total_us / convert_waits : 0,
+      capture_ages_us.empty() ? 0 : capture_age_total_us / capture_ages_us.size(),
+      percentile(capture_ages_us, 50),
+      percentile(capture_ages_us, 95),
+      percentile(capture_ages_us, 99),
+      percentile(capture_ages_us, 100),
+      convert_waits > 0,
       packets,
       bytes,
+      avg_size,
+      std::sqrt(std::max(0.0, size_variance)),
+      size_max,
+      idr_frames,
+      refresh_waves,
       frame_index,
       packet_size,
       idr_frame,
+      queue_window,
+      skipped_window,
   };
 
   history.push_back(sample);
@@ -213,12 +296,23 @@ void timing_t::record(int64_t frame_index, size_t packet_size, bool idr_frame, d
   window_start = now;
   packets = 0;
   bytes = 0;
+  size_squared_total = 0;
+  size_max = 0;
+  idr_frames = 0;
+  refresh_waves = 0;
   interval_total_ms = 0;
   interval_squared_total_ms = 0;
   interval_min_ms = 0;
   interval_max_ms = 0;
   encode_total_us = 0;
   encode_max_us = 0;
+  convert_total_us = 0;
+  converts = 0;
+  convert_wait_total_us = 0;
+  convert_waits = 0;
+  capture_ages_us.clear();
+  queue_window = {};
+  skipped_window = {};
 }
 
 void timing_t::print_terminal(const sample_t &sample) {
@@ -227,6 +321,9 @@ void timing_t::print_terminal(const sample_t &sample) {
   const auto max_interval_max = max_of(history, [](const auto &sample) { return sample.max_interval_ms; });
   const auto jitter_max = max_of(history, [](const auto &sample) { return sample.jitter_ms; });
   const auto encode_max = max_of(history, [](const auto &sample) { return sample.max_encode_us; });
+  const auto convert_max = max_of(history, [](const auto &sample) { return sample.avg_convert_us; });
+  const auto age_max = max_of(history, [](const auto &sample) { return sample.max_capture_age_us; });
+  const auto size_scale = max_of(history, [](const auto &sample) { return sample.max_size / 1024.0; });
   const auto interval_scale = std::max({avg_interval_max, max_interval_max, jitter_max, 1.0});
   const auto interval_scale_us = interval_scale * 1000.0;
 
@@ -246,6 +343,11 @@ void timing_t::print_terminal(const sample_t &sample) {
   metric_row(out, "jitter", sample.jitter_ms * 1000.0, "us", interval_scale_us, jitter_color(sample), 1);
   metric_row(out, "avg encode", sample.avg_encode_us, "us", encode_max, cyan, 1);
   metric_row(out, "max encode", sample.max_encode_us, "us", encode_max, yellow, 1);
+  metric_row(out, "avg convert", sample.avg_convert_us, "us", convert_max, cyan, 1);
+  metric_row(out, "convert wait", sample.avg_convert_wait_us, "us", convert_max, orange, 1);
+  metric_row(out, "capture age", sample.avg_capture_age_us, "us", age_max, green, 1);
+  metric_row(out, "avg size", sample.avg_size / 1024.0, "KiB", size_scale, blue, 1);
+  metric_row(out, "max size", sample.max_size / 1024.0, "KiB", size_scale, red, 1);
 
   out << "\n" << bold << "timeline" << reset << dim << "  oldest -> newest" << reset << "\n";
   out << "  " << blue << "fps        " << reset
@@ -263,7 +365,32 @@ void timing_t::print_terminal(const sample_t &sample) {
   out << "  " << cyan << "encode us  " << reset
       << sparkline(history, [](const auto &sample) { return sample.avg_encode_us; }, encode_max)
       << "\n";
-  out << "  " << red << "IDR        " << reset << idr_markers(history) << "\n\n";
+  out << "  " << blue << "size KiB   " << reset
+      << sparkline(history, [](const auto &sample) { return sample.max_size / 1024.0; }, size_scale)
+      << "\n";
+  out << "  " << red << "IDR/wave   " << reset << idr_markers(history) << "\n\n";
+
+  out << bold << "shared memory" << reset << "  overwritten " << sample.queue.overwritten << " ("
+      << queue_total.overwritten << ")   dropped " << sample.queue.dropped << " ("
+      << queue_total.dropped << ")   stalled " << sample.queue.stalled << " ("
+      << queue_total.stalled << ")" << dim << "  window (total)" << reset << "\n\n";
+
+  out << bold << "capture to encode" << reset << "  " << pacing << " pacing" << std::setprecision(1)
+      << "   p50 " << sample.p50_capture_age_us << "   p95 " << sample.p95_capture_age_us
+      << "   p99 " << sample.p99_capture_age_us << "   max " << sample.max_capture_age_us
+      << " us\n";
+  out << bold << "convert" << reset << "  "
+      << (sample.convert_ahead ? "ahead of the encoder" : "inline with the encoder")
+      << std::setprecision(1) << "   encoder-bound ceiling " << convert_ceiling(sample) << " fps"
+      << dim << "  (inline " << inline_ceiling(sample) << " fps)" << reset << "\n";
+  out << bold << "frame size" << reset << "  recovery by " << recovery << std::setprecision(1)
+      << "   stddev " << sample.size_stddev / 1024.0 << " KiB   max/avg "
+      << (sample.avg_size > 0 ? sample.max_size / sample.avg_size : 0) << "x   IDR "
+      << sample.idr_frames << "   waves " << sample.refresh_waves << "\n";
+  out << bold << "static" << reset << "  skipped converts " << sample.skipped.converts << " ("
+      << skipped_total.converts << ")   encodes " << sample.skipped.encodes << " ("
+      << skipped_total.encodes << ")   saved ~" << sample.skipped.cpu_us / 1000.0 << " ms ("
+      << skipped_total.cpu_us / 1000.0 << ")" << dim << "  window (total)" << reset << "\n\n";
 
   out << bold << "jitter insight" << reset << "  " << jitter_color(sample) << jitter_insight(sample)
       << reset << "\n";
@@ -3,11 +3,36 @@
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <optional>
 #include <vector>
 
 namespace output_debug {
 class timing_t {
 public:
+  /** Shared-memory producer events caused by a consumer that falls behind. */
+  struct queue_counters_t {
+    uint64_t overwritten; ///< Unread records reclaimed by the producer
+    uint64_t dropped;     ///< Frames never written to shared memory
+    uint64_t stalled;     ///< Frames that had to wait for the consumer
+  };
+
+  /** How the frame's image reached the encoder; unset fields weren't measured for it. */
+  struct convert_t {
+    std::optional<double> duration_us;
+    std::optional<double> wait_us; ///< Encoder blocked on a conversion running ahead of it
+    std::optional<double> capture_age_us;
+    uint32_t skipped_converts; ///< Unchanged captures the encoder didn't convert
+    uint32_t skipped_encodes;  ///< Unchanged frames the encoder didn't send
+    double skipped_us;         ///< Estimated CPU time those would have taken
+  };
+
+  /** Work left out because the captured pixels didn't change. */
+  struct skipped_counters_t {
+    uint64_t converts;
+    uint64_t encodes;
+    double cpu_us;
+  };
+
   struct sample_t {
     double elapsed_seconds;
     double fps;
@@ -17,32 +42,75 @@ public:
     double jitter_ms;
     double avg_encode_us;
     double max_encode_us;
+    double avg_convert_us;
+    double avg_convert_wait_us;
+    double avg_capture_age_us; ///< Capture to encode start, over frames with a new image
+    double p50_capture_age_us;
+    double p95_capture_age_us;
+    double p99_capture_age_us;
+    double max_capture_age_us;
+    bool convert_ahead; ///< Some frame in the window was converted ahead of the encoder
     uint64_t packets;
     uint64_t bytes;
+    double avg_size;       ///< Bytes per packet
+    double size_stddev;    ///< Spread of the packet sizes, which recovery frames drive up
+    size_t max_size;
+    uint64_t idr_frames;
+    uint64_t refresh_waves; ///< Packets that started an intra refresh wave
     int64_t last_frame;
     size_t last_size;
     bool last_idr;
+    queue_counters_t queue;
+    skipped_counters_t skipped;
   };
 
-  explicit timing_t(bool enabled);
+  /**
+   * pacing names how encode_run schedules frames and recovery how the encoder repairs the
+   * picture after a loss, for the terminal graph
+   */
+  explicit timing_t(bool enabled, const char *pacing = "fixed",
+                    const char *recovery = "IDR frames");
+
+  void record(int64_t frame_index, size_t packet_size, bool idr_frame, double encode_duration_us = 0,
+              const convert_t &convert = {}, bool refresh_wave = false);
+
+  void count_overwritten(uint64_t records);
+  void count_dropped();
+  void count_stalled();
 
-  void record(int64_t frame_index, size_t packet_size, bool idr_frame, double encode_duration_us = 0);
+  /** Counters since construction, maintained even when the terminal graph is disabled. */
+  const queue_counters_t &queue_totals() const;
 
 private:
   void print_terminal(const sample_t &sample);
 
   bool enabled;
+  const char *pacing;
+  const char *recovery;
   std::chrono::steady_clock::time_point start_time;
   std::chrono::steady_clock::time_point window_start;
   std::chrono::steady_clock::time_point last_packet;
   uint64_t packets{};
   uint64_t bytes{};
+  double size_squared_total{};
+  size_t size_max{};
+  uint64_t idr_frames{};
+  uint64_t refresh_waves{};
   double interval_total_ms{};
   double interval_squared_total_ms{};
   double interval_min_ms{};
   double interval_max_ms{};
   double encode_total_us{};
   double encode_max_us{};
+  double convert_total_us{};
+  uint64_t converts{};
+  double convert_wait_total_us{};
+  uint64_t convert_waits{};
+  std::vector<double> capture_ages_us;
+  queue_counters_t queue_window{};
+  queue_counters_t queue_total{};
+  skipped_counters_t skipped_window{};
+  skipped_counters_t skipped_total{};
   size_t last_render_lines{};
   std::vector<sample_t> history;
 };
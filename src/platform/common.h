@@ -15,6 +15,7 @@
 #include "src/thread_safe.h"
 #include "src/utility.h"
 #include "src/video_colorspace.h"
+#include "src/video_damage.h"
 
 typedef struct _SS_HDR_METADATA {
   // RGB order
@@ -164,6 +165,16 @@ public:
   std::int32_t row_pitch{};
 
   std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+  /** When the capture thread took this image from its pool; only set while frame tracing. */
+  std::optional<std::chrono::steady_clock::time_point> pool_acquire_timestamp;
+  /** video::damage::fingerprint() of data; only set while skipping static frames. */
+  std::optional<std::uint64_t> fingerprint;
+  /**
+   * Everything that may differ from the image captured before this one, or std::nullopt if
+   * anything may have. Backends that know set it; otherwise the capture thread compares the
+   * two images.
+   */
+  std::optional<std::vector<video::damage::rect_t>> damage;
 
   virtual ~img_t() = default;
 };
@@ -250,6 +261,44 @@ struct nvenc_encode_device_t : encode_device_t {
 
 enum class capture_e : int { ok, reinit, timeout, interrupted, error };
 
+/**
+ * Values match DXGI_OUTDUPL_POINTER_SHAPE_TYPE and CURSOR_SHAPE_* in smemory.h.
+ */
+enum class cursor_shape_e : std::uint32_t {
+  monochrome = 1,   ///< 1 bpp AND mask rows followed by as many XOR mask rows
+  color = 2,        ///< BGRA, blended by alpha
+  masked_color = 4, ///< BGRX; alpha 0xFF XORs the pixel, 0 replaces it
+};
+
+struct cursor_shape_t {
+  cursor_shape_e type;
+  std::uint32_t width;
+  std::uint32_t height; ///< Rows of data, twice the pointer's height for monochrome
+  std::uint32_t pitch;
+  std::int32_t hotspot_x;
+  std::int32_t hotspot_y;
+  const std::uint8_t *data; ///< pitch * height bytes
+};
+
+/**
+ * Receives the pointer instead of the captured image, when a display has one.
+ *
+ * Called from the capture thread.
+ */
+class cursor_sink_t {
+public:
+  /** The pointer looks different from now on. */
+  virtual void shape(const cursor_shape_t &shape) = 0;
+
+  /**
+   * The shape's top-left corner moved to (x, y) in display pixels, or it was shown or hidden.
+   */
+  virtual void position(bool visible, int x, int y,
+                        std::chrono::steady_clock::time_point timestamp) = 0;
+
+  virtual ~cursor_sink_t() = default;
+};
+
 class display_t {
 public:
   /**
@@ -336,6 +385,12 @@ public:
 
   int width, height;
 
+  /**
+   * When set, capture() leaves the pointer out of the images and hands it to this sink instead,
+   * so that moving it over a static desktop produces no new frames.
+   */
+  cursor_sink_t *cursor_sink = nullptr;
+
 protected:
 };
 
@@ -395,8 +450,9 @@ std::unique_ptr<audio_control_t> audio_control();
 std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name,
                                    const video::config_t &config);
 
-// A list of names of displays accepted as display_name with the mem_type_e
-std::vector<std::string> display_names(mem_type_e hwdevice_type);
+// A list of names of displays accepted as display_name with the mem_type_e. Backends that
+// create displays from their name alone, like the synthetic one, list `wanted` as well.
+std::vector<std::string> display_names(mem_type_e hwdevice_type, const std::string &wanted = {});
 
 /**
  * @brief Returns if GPUs/drivers have changed since the last call to this function.
@@ -0,0 +1,14 @@
+/**
+ * @file src/platform/linux/audio.cpp
+ * @brief Linux audio.
+ *
+ * There is no audio capture on Linux yet. Without an audio_control_t the audio thread waits
+ * for shutdown and the stream carries video only.
+ */
+#include "src/platform/common.h"
+
+namespace platf {
+std::unique_ptr<audio_control_t> audio_control() {
+  return nullptr;
+}
+} // namespace platf
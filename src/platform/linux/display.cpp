@@ -0,0 +1,36 @@
+/**
+ * @file src/platform/linux/display.cpp
+ * @brief Linux displays.
+ *
+ * There is no screen capture on Linux yet, only the synthetic display, which lets the
+ * capture, conversion and encode pipeline run on a headless machine.
+ */
+#include "src/config.h"
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/platform/synthetic.h"
+
+namespace platf {
+std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name,
+                                   const video::config_t &config) {
+  if (hwdevice_type != mem_type_e::system) {
+    return nullptr;
+  }
+
+  if (config::video.capture != "synthetic"sv) {
+    BOOST_LOG(error) << "Only --capture synthetic is supported on Linux"sv;
+    return nullptr;
+  }
+
+  return synthetic::display(display_name, config);
+}
+
+std::vector<std::string> display_names(mem_type_e, const std::string &wanted) {
+  return synthetic::display_names(wanted);
+}
+
+// Only software encoders run on the synthetic display, and they don't depend on the GPU
+bool needs_encoder_reenumeration() {
+  return false;
+}
+} // namespace platf
@@ -0,0 +1,324 @@
+/**
+ * @file src/platform/linux/interprocess.cpp
+ * @brief Linux implementation of the shared-memory transport.
+ *
+ * IVSHMEM maps a file that exposes the shared region, e.g. the memory-backend-file
+ * given to QEMU's ivshmem-plain device on the host, or a PCI BAR resource file inside
+ * the guest. Doorbells are eventfds registered in this process, so a producer and a
+ * consumer running side by side can signal each other the same way they would through
+ * the Windows driver.
+ */
+#include "src/interprocess.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "src/logging.h"
+
+DoorbellEvent::DoorbellEvent() : m_handle(-1), m_initialized(false) {}
+
+DoorbellEvent::~DoorbellEvent() {
+  DeInitialize();
+}
+
+bool DoorbellEvent::Initialize() {
+  if (m_initialized)
+    DeInitialize();
+
+  m_handle = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (m_handle < 0) {
+    BOOST_LOG(error) << "eventfd failed: " << strerror(errno);
+    return false;
+  }
+
+  m_initialized = true;
+  return true;
+}
+
+void DoorbellEvent::DeInitialize() {
+  if (m_handle >= 0) {
+    close(m_handle);
+    m_handle = -1;
+  }
+  m_initialized = false;
+}
+
+EventHandle DoorbellEvent::GetHandle() {
+  return m_handle;
+}
+
+bool DoorbellEvent::Wait(uint32_t timeoutMs) {
+  if (!m_initialized)
+    return false;
+
+  pollfd pfd{m_handle, POLLIN, 0};
+  if (poll(&pfd, 1, (int)timeoutMs) <= 0)
+    return false;
+
+  // Reading resets the counter, which makes the event auto-reset like its Win32 counterpart
+  uint64_t count;
+  return read(m_handle, &count, sizeof(count)) == sizeof(count);
+}
+
+bool DoorbellEvent::Signal() {
+  if (!m_initialized)
+    return false;
+
+  uint64_t one = 1;
+  return write(m_handle, &one, sizeof(one)) == sizeof(one);
+}
+
+IVSHMEM *IVSHMEM::m_instance = NULL;
+
+IVSHMEM::IVSHMEM(const char *path)
+    : m_initialized(false), m_gotSize(false), m_memory(NULL), m_gotMemory(false), m_fd(-1) {
+  memset(m_devPath, 0, 512);
+  strncpy(m_devPath, path, 511);
+}
+
+IVSHMEM::~IVSHMEM() {
+  DeInitialize();
+}
+
+bool IVSHMEM::Initialize() {
+  if (m_initialized)
+    DeInitialize();
+
+  m_fd = open(m_devPath, O_RDWR | O_CLOEXEC);
+  if (m_fd < 0) {
+    BOOST_LOG(error) << "open failed for " << m_devPath << ": " << strerror(errno);
+    return false;
+  }
+
+  m_initialized = true;
+  return m_initialized;
+}
+
+void IVSHMEM::DeInitialize() {
+  if (!m_initialized)
+    return;
+
+  if (m_gotMemory) {
+    if (munmap(m_memory, m_size))
+      BOOST_LOG(error) << "Deintialize munmap failed: " << strerror(errno);
+    m_memory = NULL;
+  }
+
+  if (m_fd >= 0)
+    close(m_fd);
+
+  {
+    std::lock_guard lg{m_eventsLock};
+    for (auto &events : m_events)
+      events.clear();
+  }
+
+  m_initialized = false;
+  m_fd = -1;
+  m_gotSize = false;
+  m_gotMemory = false;
+}
+
+uint64_t IVSHMEM::GetSize() {
+  if (!m_initialized)
+    return 0;
+
+  if (m_gotSize)
+    return m_size;
+
+  struct stat st;
+  if (fstat(m_fd, &st)) {
+    BOOST_LOG(error) << "GetSize fstat failed: " << strerror(errno);
+    return 0;
+  }
+
+  m_gotSize = true;
+  m_size = static_cast<uint64_t>(st.st_size);
+  return m_size;
+}
+
+void *IVSHMEM::GetMemory() {
+  if (!m_initialized)
+    return NULL;
+
+  if (m_gotMemory)
+    return m_memory;
+
+  auto size = GetSize();
+  if (size == 0)
+    return NULL;
+
+  auto memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (memory == MAP_FAILED) {
+    BOOST_LOG(error) << "GetMemory mmap failed: " << strerror(errno);
+    return NULL;
+  }
+
+  m_gotMemory = true;
+  m_memory = memory;
+
+  return m_memory;
+}
+
+bool IVSHMEM::RegisterEvent(EventHandle event, uint16_t vector) {
+  if (!m_initialized || event < 0 || vector >= MAX_VECTORS) {
+    return false;
+  }
+
+  std::lock_guard lg{m_eventsLock};
+  m_events[vector].push_back(event);
+
+  return true;
+}
+
+bool IVSHMEM::RingDoorbell([[maybe_unused]] uint16_t peerID, uint16_t vector) {
+  if (!m_initialized || vector >= MAX_VECTORS) {
+    return false;
+  }
+
+  std::lock_guard lg{m_eventsLock};
+  bool rung = false;
+  for (auto event : m_events[vector]) {
+    uint64_t one = 1;
+    rung |= write(event, &one, sizeof(one)) == sizeof(one);
+  }
+
+  return rung;
+}
+
+SharedMemory::SharedMemory(const char *name, size_t size, unsigned flags)
+    : m_size(size), m_flags(flags), m_memory(NULL), m_initialized(false), m_fd(-1),
+      m_created(false) {
+  memset(m_name, 0, 512);
+  if (name && name[0]) {
+    // POSIX shared memory objects are named "/name"
+    if (name[0] != '/') {
+      m_name[0] = '/';
+    }
+    strncat(m_name, name, 510);
+  }
+}
+
+SharedMemory::~SharedMemory() {
+  DeInitialize();
+}
+
+bool SharedMemory::Initialize() {
+  if (m_initialized)
+    DeInitialize();
+
+  if (!m_name[0]) {
+    unsigned memfdFlags = MFD_CLOEXEC;
+    if (m_flags & HugePages) {
+      // hugetlbfs only accepts whole huge pages
+      constexpr size_t hugePageSize = 2 * 1024 * 1024;
+      m_size = (m_size + hugePageSize - 1) & ~(hugePageSize - 1);
+      memfdFlags |= MFD_HUGETLB;
+    }
+
+    m_fd = memfd_create("sunshine-shm", memfdFlags);
+    if (m_fd < 0 && (memfdFlags & MFD_HUGETLB)) {
+      BOOST_LOG(warning) << "Huge pages unavailable, using regular pages: " << strerror(errno);
+      m_flags &= ~HugePages;
+      m_fd = memfd_create("sunshine-shm", MFD_CLOEXEC);
+    }
+    if (m_fd < 0) {
+      BOOST_LOG(error) << "memfd_create failed: " << strerror(errno);
+      return false;
+    }
+  } else if (m_flags & Create) {
+    m_fd = shm_open(m_name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_fd < 0) {
+      BOOST_LOG(error) << "shm_open failed for " << m_name << ": " << strerror(errno);
+      return false;
+    }
+    m_created = true;
+  } else {
+    m_fd = shm_open(m_name, O_RDWR | O_CLOEXEC, 0);
+    if (m_fd < 0) {
+      BOOST_LOG(error) << "shm_open failed for " << m_name << ": " << strerror(errno);
+      return false;
+    }
+
+    // Touching a mapping past the end of a smaller object raises SIGBUS
+    struct stat st;
+    if (fstat(m_fd, &st)) {
+      BOOST_LOG(error) << "fstat failed for " << m_name << ": " << strerror(errno);
+      DeInitialize();
+      return false;
+    }
+    if ((size_t)st.st_size < m_size) {
+      BOOST_LOG(error) << m_name << " holds " << st.st_size << " bytes, " << m_size << " expected";
+      DeInitialize();
+      return false;
+    }
+  }
+
+  if ((!m_name[0] || m_created) && ftruncate(m_fd, (off_t)m_size)) {
+    BOOST_LOG(error) << "ftruncate failed: " << strerror(errno);
+    DeInitialize();
+    return false;
+  }
+
+  int mapFlags = MAP_SHARED;
+  if (m_flags & Populate) {
+    mapFlags |= MAP_POPULATE;
+  }
+
+  m_memory = mmap(NULL, m_size, PROT_READ | PROT_WRITE, mapFlags, m_fd, 0);
+  if (m_memory == MAP_FAILED) {
+    auto err = errno;
+    m_memory = NULL;
+    DeInitialize();
+
+    // hugetlbfs only notices that no huge pages are reserved when they are mapped
+    if (!m_name[0] && (m_flags & HugePages)) {
+      BOOST_LOG(warning) << "Huge pages unavailable, using regular pages: " << strerror(err);
+      m_flags &= ~HugePages;
+      return Initialize();
+    }
+
+    BOOST_LOG(error) << "mmap failed: " << strerror(err);
+    return false;
+  }
+
+  // POSIX shared memory lives on tmpfs, which can only use transparent huge pages
+  if (m_name[0] && (m_flags & HugePages)) {
+    madvise(m_memory, m_size, MADV_HUGEPAGE);
+  }
+
+  m_initialized = true;
+  return true;
+}
+
+void SharedMemory::DeInitialize() {
+  if (m_memory) {
+    munmap(m_memory, m_size);
+    m_memory = NULL;
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+    m_fd = -1;
+  }
+  if (m_created) {
+    shm_unlink(m_name);
+    m_created = false;
+  }
+  m_initialized = false;
+}
+
+size_t SharedMemory::GetSize() {
+  return m_size;
+}
+
+void *SharedMemory::GetMemory() {
+  return m_memory;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file src/platform/linux/misc.cpp
+ * @brief Linux process setup, thread priorities and timers.
+ */
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/logging.h"
+#include "src/platform/common.h"
+
+namespace platf {
+void adjust_thread_priority(thread_priority_e priority) {
+  int nice_value;
+
+  switch (priority) {
+  case thread_priority_e::low:
+    nice_value = 10;
+    break;
+  case thread_priority_e::normal:
+    nice_value = 0;
+    break;
+  case thread_priority_e::high:
+    nice_value = -5;
+    break;
+  case thread_priority_e::critical:
+    nice_value = -10;
+    break;
+  default:
+    BOOST_LOG(error) << "Unknown thread priority: "sv << (int)priority;
+    return;
+  }
+
+  // On Linux the nice value belongs to the thread, so this leaves the rest of the process alone.
+  // Raising it above normal needs CAP_SYS_NICE, without which the thread keeps running as is.
+  if (setpriority(PRIO_PROCESS, gettid(), nice_value)) {
+    BOOST_LOG(warning) << "Unable to set thread priority to "sv << nice_value << ": "sv
+                       << strerror(errno);
+  }
+}
+
+class linux_high_precision_timer : public high_precision_timer {
+public:
+  void sleep_for(const std::chrono::nanoseconds &duration) override {
+    if (duration < 0s) {
+      BOOST_LOG(error) << "Attempting high_precision_timer::sleep_for() with negative duration";
+      return;
+    }
+    if (duration > 5s) {
+      BOOST_LOG(error)
+          << "Attempting high_precision_timer::sleep_for() with unexpectedly large duration (>5s)";
+      return;
+    }
+
+    // An absolute deadline, so being woken by a signal doesn't stretch the sleep
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    auto nsec = deadline.tv_nsec + duration.count();
+    deadline.tv_sec += nsec / 1'000'000'000;
+    deadline.tv_nsec = nsec % 1'000'000'000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+    }
+  }
+
+  operator bool() override {
+    return true;
+  }
+};
+
+std::unique_ptr<high_precision_timer> create_high_precision_timer() {
+  return std::make_unique<linux_high_precision_timer>();
+}
+
+// Nothing needs setting up or tearing down for the synthetic display and the shm transport
+std::unique_ptr<deinit_t> init() {
+  return std::make_unique<deinit_t>();
+}
+} // namespace platf
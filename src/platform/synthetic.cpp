@@ -0,0 +1,342 @@
+/**
+ * @file src/platform/synthetic.cpp
+ * @brief Test patterns for the synthetic display.
+ */
+#include "synthetic.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+using namespace std::literals;
+
+namespace platf::synthetic {
+namespace {
+constexpr int kCellWidth = 8;
+constexpr int kCellHeight = 16;
+constexpr int kLinesPerSecond = 4;
+
+constexpr std::uint32_t rgb(std::uint32_t r, std::uint32_t g, std::uint32_t b) {
+  return r << 16 | g << 8 | b;
+}
+
+/** Cheap and well mixed; patterns only need it to look random and be reproducible. */
+constexpr std::uint64_t mix(std::uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+// Classic arrow, 12x19; 'X' is the outline and '.' the fill
+constexpr std::array<std::string_view, 19> kCursor{{
+    "X           ",
+    "XX          ",
+    "X.X         ",
+    "X..X        ",
+    "X...X       ",
+    "X....X      ",
+    "X.....X     ",
+    "X......X    ",
+    "X.......X   ",
+    "X........X  ",
+    "X.........X ",
+    "X..........X",
+    "X......XXXXX",
+    "X...X..X    ",
+    "X..XX..X    ",
+    "X.X  X..X   ",
+    "XX   X..X   ",
+    "X     X..X  ",
+    "      XXX   ",
+}};
+
+bool parse_int(std::string_view text, int &value) {
+  auto end = text.data() + text.size();
+  auto result = std::from_chars(text.data(), end, value);
+  return result.ec == std::errc{} && result.ptr == end && value > 0;
+}
+
+/** `WxH`, `WxH@F` or `@F` */
+bool parse_mode(std::string_view token, spec_t &spec) {
+  auto at = token.find('@');
+  if (at != std::string_view::npos) {
+    if (!parse_int(token.substr(at + 1), spec.framerate)) {
+      return false;
+    }
+    token = token.substr(0, at);
+    if (token.empty()) {
+      return true;
+    }
+  }
+
+  auto x = token.find('x');
+  if (x == std::string_view::npos || !parse_int(token.substr(0, x), spec.width) ||
+      !parse_int(token.substr(x + 1), spec.height)) {
+    return false;
+  }
+
+  // 4:2:0 needs whole chroma samples
+  return spec.width % 2 == 0 && spec.height % 2 == 0;
+}
+} // namespace
+
+std::string_view to_string(pattern_e pattern) {
+  switch (pattern) {
+  case pattern_e::text:
+    return "text"sv;
+  case pattern_e::noise:
+    return "noise"sv;
+  case pattern_e::desktop:
+    return "desktop"sv;
+  }
+
+  return "unknown"sv;
+}
+
+std::optional<spec_t> parse_spec(std::string_view name, const spec_t &defaults) {
+  auto spec = defaults;
+
+  auto next = [&name]() {
+    auto colon = name.find(':');
+    auto token = name.substr(0, colon);
+    name = colon == std::string_view::npos ? std::string_view{} : name.substr(colon + 1);
+    return token;
+  };
+
+  auto pattern = next();
+  bool found = false;
+  for (auto candidate : {pattern_e::text, pattern_e::noise, pattern_e::desktop}) {
+    if (to_string(candidate) == pattern) {
+      spec.pattern = candidate;
+      found = true;
+    }
+  }
+  if (!found) {
+    return std::nullopt;
+  }
+
+  while (!name.empty()) {
+    auto token = next();
+    if (token == "hdr"sv) {
+      spec.hdr = true;
+    } else if (!parse_mode(token, spec)) {
+      return std::nullopt;
+    }
+  }
+
+  return spec;
+}
+
+generator_t::generator_t(const spec_t &spec) : _spec{spec} {
+  if (_spec.pattern != pattern_e::desktop) {
+    return;
+  }
+
+  auto width = _spec.width;
+  auto height = _spec.height;
+  _background.resize((std::size_t)width * height);
+
+  auto fill = [&](int x0, int y0, int x1, int y1, std::uint32_t color) {
+    x0 = std::clamp(x0, 0, width);
+    x1 = std::clamp(x1, 0, width);
+    y0 = std::clamp(y0, 0, height);
+    y1 = std::clamp(y1, 0, height);
+    for (int y = y0; y < y1; ++y) {
+      std::fill_n(&_background[(std::size_t)y * width + x0], std::max(0, x1 - x0), color);
+    }
+  };
+
+  // Wallpaper: a vertical gradient, so the encoder can't treat it as flat
+  for (int y = 0; y < height; ++y) {
+    auto shade = (std::uint32_t)(y * 96 / height);
+    fill(0, y, width, y + 1, rgb(16 + shade / 2, 64 + shade / 2, 96 + shade));
+  }
+
+  // Taskbar
+  auto taskbar = std::max(height / 27, 8);
+  fill(0, height - taskbar, width, height, rgb(32, 32, 40));
+
+  // A few windows with a title bar and lines of "text"
+  for (int window = 0; window < 3; ++window) {
+    int x0 = width * (2 + window * 5) / 20;
+    int y0 = height * (2 + window * 3) / 20;
+    int x1 = x0 + width * 9 / 20;
+    int y1 = y0 + height * 9 / 20;
+    int title = std::max(height / 36, 4);
+
+    fill(x0, y0, x1, y1, rgb(236, 236, 236));
+    fill(x0, y0, x1, y0 + title, rgb(40, 80 + window * 40, 160));
+    auto span = std::max(x1 - x0 - 4 * kCellWidth, 1);
+    for (int line = 0; y0 + title + (line + 2) * kCellHeight < y1; ++line) {
+      auto length = (int)(mix((std::uint64_t)window << 32 | line) % span);
+      auto y = y0 + title + (line + 1) * kCellHeight;
+      fill(x0 + 2 * kCellWidth, y, x0 + 2 * kCellWidth + length, y + kCellHeight / 2,
+           rgb(96, 96, 96));
+    }
+  }
+}
+
+void generator_t::render(std::int64_t frame, std::uint8_t *data, int row_pitch,
+                         bool cursor) const {
+  switch (_spec.pattern) {
+  case pattern_e::text:
+    render_text(frame, data, row_pitch);
+    break;
+  case pattern_e::noise:
+    render_noise(frame, data, row_pitch);
+    break;
+  case pattern_e::desktop:
+    render_desktop(frame, data, row_pitch, cursor);
+    break;
+  }
+}
+
+std::pair<int, int> generator_t::cursor_position(std::int64_t frame) const {
+  // A Lissajous figure, so the cursor covers the screen without repeating for a while
+  constexpr double kPi = 3.14159265358979323846;
+  auto seconds = (double)frame / _spec.framerate;
+  auto x = 0.5 + 0.5 * std::sin(2 * kPi * seconds / 4);
+  auto y = 0.5 + 0.5 * std::cos(2 * kPi * seconds / 3);
+
+  return {(int)(x * (_spec.width - 1)), (int)(y * (_spec.height - 1))};
+}
+
+std::optional<generator_t::cursor_image_t> generator_t::cursor_image() const {
+  if (_spec.pattern != pattern_e::desktop) {
+    return std::nullopt;
+  }
+
+  cursor_image_t image{(int)kCursor[0].size(), (int)kCursor.size(), {}};
+  image.pixels.resize((std::size_t)image.width * image.height);
+  for (int y = 0; y < image.height; ++y) {
+    for (int x = 0; x < image.width; ++x) {
+      auto &pixel = image.pixels[(std::size_t)y * image.width + x];
+      switch (kCursor[y][x]) {
+      case 'X':
+        pixel = 0xff000000 | rgb(0, 0, 0);
+        break;
+      case '.':
+        pixel = 0xff000000 | rgb(255, 255, 255);
+        break;
+      default:
+        pixel = 0;
+      }
+    }
+  }
+
+  return image;
+}
+
+std::vector<video::damage::rect_t> generator_t::damage(std::int64_t from, bool cursor_from,
+                                                      std::int64_t to, bool cursor_to) const {
+  if (_spec.pattern != pattern_e::desktop) {
+    // Text scrolls by a pixel or so every frame, which moves nearly every pixel
+    return {{0, 0, _spec.width, _spec.height}};
+  }
+
+  // Only the cursor moves over the desktop
+  std::vector<video::damage::rect_t> rects;
+  for (auto [frame, cursor] : {std::pair{from, cursor_from}, std::pair{to, cursor_to}}) {
+    if (cursor) {
+      auto [x, y] = cursor_position(frame);
+      rects.push_back({x, y, (int)kCursor[0].size(), (int)kCursor.size()});
+    }
+  }
+  return rects;
+}
+
+void generator_t::render_text(std::int64_t frame, std::uint8_t *data, int row_pitch) const {
+  constexpr auto background = rgb(30, 30, 30);
+  constexpr auto foreground = rgb(204, 204, 204);
+  constexpr auto prompt = rgb(106, 190, 48);
+
+  auto columns = (_spec.width + kCellWidth - 1) / kCellWidth;
+  auto scrolled = frame * kLinesPerSecond * kCellHeight / _spec.framerate;
+
+  for (int y = 0; y < _spec.height; ++y) {
+    auto row = (std::uint32_t *)(data + (std::ptrdiff_t)y * row_pitch);
+    auto line = (std::uint64_t)((scrolled + y) / kCellHeight);
+    auto cell_y = (int)((scrolled + y) % kCellHeight);
+
+    // Glyphs are 5x7 bits drawn two pixels tall, with a margin around them
+    auto glyph_row = (cell_y - 1) / 2;
+    auto line_hash = mix(line);
+    auto length = (int)(line_hash % (columns + 1));
+    auto color = line_hash % 5 == 0 ? prompt : foreground;
+
+    for (int column = 0; column < columns; ++column) {
+      std::uint32_t bits = 0;
+      if (column < length && glyph_row >= 0 && glyph_row < 7 && cell_y >= 1) {
+        auto glyph = mix(line << 16 | (std::uint64_t)column);
+        // Roughly one in six characters is a space
+        if (glyph % 6) {
+          bits = (std::uint32_t)(glyph >> (8 + glyph_row * 5)) & 0x1f;
+        }
+      }
+
+      auto x0 = column * kCellWidth;
+      auto x1 = std::min(x0 + kCellWidth, _spec.width);
+      for (int x = x0; x < x1; ++x) {
+        auto bit = x - x0 - 1;
+        row[x] = bit >= 0 && bit < 5 && (bits >> bit & 1) ? color : background;
+      }
+    }
+  }
+}
+
+void generator_t::render_noise(std::int64_t frame, std::uint8_t *data, int row_pitch) const {
+  for (int y = 0; y < _spec.height; ++y) {
+    auto row = (std::uint32_t *)(data + (std::ptrdiff_t)y * row_pitch);
+
+    // xorshift64, seeded per row so rows don't depend on each other
+    auto state = mix((std::uint64_t)frame << 32 | (std::uint64_t)y) | 1;
+    for (int x = 0; x < _spec.width; ++x) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      row[x] = (std::uint32_t)state & 0xffffff;
+    }
+  }
+}
+
+void generator_t::render_desktop(std::int64_t frame, std::uint8_t *data, int row_pitch,
+                                 bool cursor) const {
+  for (int y = 0; y < _spec.height; ++y) {
+    std::memcpy(data + (std::ptrdiff_t)y * row_pitch, &_background[(std::size_t)y * _spec.width],
+                (std::size_t)_spec.width * 4);
+  }
+
+  if (!cursor) {
+    return;
+  }
+
+  auto [cursor_x, cursor_y] = cursor_position(frame);
+  for (int dy = 0; dy < (int)kCursor.size() && cursor_y + dy < _spec.height; ++dy) {
+    auto row = (std::uint32_t *)(data + (std::ptrdiff_t)(cursor_y + dy) * row_pitch);
+    for (int dx = 0; dx < (int)kCursor[dy].size() && cursor_x + dx < _spec.width; ++dx) {
+      switch (kCursor[dy][dx]) {
+      case 'X':
+        row[cursor_x + dx] = rgb(0, 0, 0);
+        break;
+      case '.':
+        row[cursor_x + dx] = rgb(255, 255, 255);
+        break;
+      }
+    }
+  }
+}
+
+std::vector<std::string> display_names(const std::string &wanted) {
+  std::vector<std::string> names{std::string{to_string(pattern_e::desktop)}};
+  if (wanted != names.front() && parse_spec(wanted, {})) {
+    names.push_back(wanted);
+  }
+
+  return names;
+}
+} // namespace platf::synthetic
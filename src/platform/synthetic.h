@@ -0,0 +1,111 @@
+/**
+ * @file src/platform/synthetic.h
+ * @brief Procedurally animated test content standing in for a real display.
+ *
+ * Selected with `--capture synthetic`. Display names describe what to generate, e.g.
+ * `desktop`, `text:1280x720@60` or `noise:3840x2160@30:hdr`; anything left out follows the
+ * session's video::config_t. Frames are 32-bit BGRX in system memory, like display_ram_t
+ * produces, so they go through the same software conversion as a real capture.
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "src/video_damage.h"
+
+namespace video {
+struct config_t;
+} // namespace video
+
+namespace platf {
+class display_t;
+} // namespace platf
+
+namespace platf::synthetic {
+enum class pattern_e {
+  text,    ///< A terminal scrolling up a few lines per second
+  noise,   ///< Every pixel changes every frame; the worst case for the encoder
+  desktop, ///< Static windows with the cursor moving across them
+};
+
+struct spec_t {
+  pattern_e pattern = pattern_e::desktop;
+  int width = 1920;
+  int height = 1080;
+  int framerate = 60;
+  bool hdr = false; ///< Report an HDR display, so 10-bit sessions encode in 10 bits
+};
+
+std::string_view to_string(pattern_e pattern);
+
+/**
+ * Parse a display name of the form `pattern[:WxH[@fps]][:hdr]`.
+ * @param defaults Used for whatever the name leaves out.
+ * @return std::nullopt if the name doesn't describe a synthetic display.
+ */
+std::optional<spec_t> parse_spec(std::string_view name, const spec_t &defaults);
+
+/** Renders frames of one spec; the same frame index always gives the same pixels. */
+class generator_t {
+public:
+  explicit generator_t(const spec_t &spec);
+
+  /**
+   * Draw frame `frame` into `data`, which holds spec.height rows of `row_pitch` bytes.
+   * @param cursor Whether to draw the cursor, for the patterns that have one.
+   */
+  void render(std::int64_t frame, std::uint8_t *data, int row_pitch, bool cursor) const;
+
+  const spec_t &spec() const {
+    return _spec;
+  }
+
+  /** Top-left corner of the cursor's hotspot in `frame`. */
+  std::pair<int, int> cursor_position(std::int64_t frame) const;
+
+  /** The cursor as render() draws it, with its hotspot in the top-left corner. */
+  struct cursor_image_t {
+    int width;
+    int height;
+    std::vector<std::uint32_t> pixels; ///< BGRA, transparent around the arrow
+  };
+
+  /** std::nullopt for the patterns without a cursor. */
+  std::optional<cursor_image_t> cursor_image() const;
+
+  /**
+   * Everything that may differ between frame `from` and frame `to`, each rendered with or
+   * without the cursor as given.
+   */
+  std::vector<video::damage::rect_t> damage(std::int64_t from, bool cursor_from, std::int64_t to,
+                                            bool cursor_to) const;
+
+private:
+  void render_text(std::int64_t frame, std::uint8_t *data, int row_pitch) const;
+  void render_noise(std::int64_t frame, std::uint8_t *data, int row_pitch) const;
+  void render_desktop(std::int64_t frame, std::uint8_t *data, int row_pitch, bool cursor) const;
+
+  spec_t _spec;
+
+  /** The desktop pattern's background, drawn once. */
+  std::vector<std::uint32_t> _background;
+};
+
+/**
+ * `desktop`, then `wanted` if it names another synthetic display. Synthetic displays exist as
+ * soon as they're named, so a pinned spec is listed for refresh_displays() to find it.
+ */
+std::vector<std::string> display_names(const std::string &wanted = {});
+
+/** The spec of the synthetic display opened last, so benchmarks can check what they measured. */
+std::optional<spec_t> last_display();
+
+/** nullptr if `display_name` doesn't parse. */
+std::shared_ptr<display_t> display(const std::string &display_name, const video::config_t &config);
+} // namespace platf::synthetic
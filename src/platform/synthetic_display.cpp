@@ -0,0 +1,147 @@
+/**
+ * @file src/platform/synthetic_display.cpp
+ * @brief A display_t that renders test patterns instead of capturing a screen.
+ */
+#include "synthetic.h"
+
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/video.h"
+
+namespace platf::synthetic {
+namespace {
+struct img_t : public ::platf::img_t {
+  ~img_t() override {
+    delete[] data;
+    data = nullptr;
+  }
+};
+
+class display_t : public ::platf::display_t {
+public:
+  explicit display_t(const spec_t &spec) : generator{spec} {
+    width = env_width = spec.width;
+    height = env_height = spec.height;
+  }
+
+  capture_e capture(const push_captured_image_cb_t &push_captured_image_cb,
+                    const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+    const auto interval = std::chrono::nanoseconds{1s} / generator.spec().framerate;
+    const auto start = std::chrono::steady_clock::now();
+
+    // The sink gets the shape once, then a position per frame
+    auto image = cursor_sink ? generator.cursor_image() : std::nullopt;
+    if (image) {
+      cursor_sink->shape({cursor_shape_e::color, (std::uint32_t)image->width,
+                          (std::uint32_t)image->height, (std::uint32_t)image->width * 4, 0, 0,
+                          (const std::uint8_t *)image->pixels.data()});
+    }
+
+    std::int64_t frame = 0;
+    std::optional<std::pair<std::int64_t, bool>> previous; // Frame and cursor pushed last
+    while (true) {
+      // The time this frame reaches the glass
+      auto vblank = start + interval * frame;
+      std::this_thread::sleep_until(vblank);
+
+      std::shared_ptr<::platf::img_t> img_out;
+      if (!pull_free_image_cb(img_out)) {
+        return capture_e::interrupted;
+      }
+
+      auto draw_cursor = *cursor;
+      if (image) {
+        auto [x, y] = generator.cursor_position(frame);
+        cursor_sink->position(true, x, y, vblank);
+      }
+      generator.render(frame, img_out->data, img_out->row_pitch, draw_cursor);
+      img_out->frame_timestamp = vblank;
+      if (previous) {
+        img_out->damage = generator.damage(previous->first, previous->second, frame, draw_cursor);
+      }
+      previous.emplace(frame, draw_cursor);
+
+      if (!push_captured_image_cb(std::move(img_out), true)) {
+        return capture_e::ok;
+      }
+
+      // Like a real display, frames we were too slow for are gone rather than queued up
+      auto behind = (std::chrono::steady_clock::now() - vblank) / interval;
+      frame += std::max<std::int64_t>(behind, 1);
+    }
+  }
+
+  std::shared_ptr<::platf::img_t> alloc_img() override {
+    auto img = std::make_shared<img_t>();
+    img->width = width;
+    img->height = height;
+    img->pixel_pitch = 4;
+    img->row_pitch = img->pixel_pitch * width;
+    img->data = new std::uint8_t[(std::size_t)img->row_pitch * height];
+
+    return img;
+  }
+
+  int dummy_img(::platf::img_t *img) override {
+    generator.render(0, img->data, img->row_pitch, false);
+
+    return 0;
+  }
+
+  std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override {
+    // No data, so video.cpp converts the BGRX images in software, as for display_ram_t
+    return std::make_unique<avcodec_encode_device_t>();
+  }
+
+  bool is_hdr() override {
+    return generator.spec().hdr;
+  }
+
+private:
+  generator_t generator;
+};
+
+std::mutex last_display_lock;
+std::optional<spec_t> last_spec;
+} // namespace
+
+std::shared_ptr<::platf::display_t> display(const std::string &display_name,
+                                            const video::config_t &config) {
+  spec_t defaults;
+  if (config.width > 0 && config.height > 0) {
+    defaults.width = config.width;
+    defaults.height = config.height;
+  }
+  if (config.framerate > 0) {
+    defaults.framerate = config.framerate;
+  }
+
+  auto spec = parse_spec(display_name.empty() ? display_names().front() : display_name, defaults);
+  if (!spec) {
+    BOOST_LOG(error) << "Not a synthetic display: "sv << display_name;
+    return nullptr;
+  }
+
+  BOOST_LOG(info) << "Synthetic display ["sv << to_string(spec->pattern) << "] "sv << spec->width
+                  << 'x' << spec->height << '@' << spec->framerate
+                  << (spec->hdr ? " HDR"sv : ""sv);
+
+  {
+    std::lock_guard lg{last_display_lock};
+    last_spec = spec;
+  }
+
+  return std::make_shared<display_t>(*spec);
+}
+
+std::optional<spec_t> last_display() {
+  std::lock_guard lg{last_display_lock};
+  return last_spec;
+}
+} // namespace platf::synthetic
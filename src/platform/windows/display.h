@@ -314,6 +314,13 @@ public:
   ~duplication_t();
 };
 
+/** Hand a pointer shape from GetFramePointerShape() to `sink`. */
+void publish_cursor_shape(cursor_sink_t &sink, const DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info,
+                          const std::uint8_t *data);
+
+/** Hand the pointer position of a frame with LastMouseUpdateTime set to `sink`. */
+void publish_cursor_position(cursor_sink_t &sink, const DXGI_OUTDUPL_FRAME_INFO &frame_info);
+
 /**
  * Display backend that uses DDAPI with a software encoder.
  */
@@ -327,6 +334,12 @@ public:
 
   duplication_t dup;
   cursor_t cursor;
+
+  // For img_t::damage: whether the last image held the desktop, where its cursor was drawn,
+  // and room for the frame's move and dirty rects
+  bool last_img_complete{};
+  std::optional<video::damage::rect_t> last_cursor_rect;
+  std::vector<std::uint8_t> frame_metadata;
 };
 
 /**
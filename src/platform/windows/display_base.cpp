@@ -15,6 +15,7 @@ typedef long NTSTATUS;
 #include "src/config.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/platform/synthetic.h"
 #include "src/video.h"
 
 namespace platf {
@@ -188,6 +189,21 @@ duplication_t::~duplication_t() {
   release_frame();
 }
 
+void publish_cursor_shape(cursor_sink_t &sink, const DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info,
+                          const std::uint8_t *data) {
+  sink.shape({(cursor_shape_e)shape_info.Type, shape_info.Width, shape_info.Height,
+              shape_info.Pitch, shape_info.HotSpot.x, shape_info.HotSpot.y, data});
+}
+
+void publish_cursor_position(cursor_sink_t &sink, const DXGI_OUTDUPL_FRAME_INFO &frame_info) {
+  // Translate QueryPerformanceCounter() value to steady_clock time point
+  auto timestamp = std::chrono::steady_clock::now() -
+                   qpc_time_difference(qpc_counter(), frame_info.LastMouseUpdateTime.QuadPart);
+
+  sink.position(frame_info.PointerPosition.Visible, frame_info.PointerPosition.Position.x,
+                frame_info.PointerPosition.Position.y, timestamp);
+}
+
 capture_e display_base_t::capture(const push_captured_image_cb_t &push_captured_image_cb,
                                   const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) {
   DXGI_RATIONAL client_frame_rate_adjusted = display_refresh_rate;
@@ -962,6 +978,10 @@ const char *display_base_t::colorspace_to_string(DXGI_COLOR_SPACE_TYPE type) {
 namespace platf {
 std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name,
                                    const video::config_t &config) {
+  if (config::video.capture == "synthetic"sv) {
+    return synthetic::display(display_name, config);
+  }
+
   if (hwdevice_type == mem_type_e::dxgi) {
     auto disp = std::make_shared<dxgi::display_wgc_vram_t>();
 
@@ -993,7 +1013,11 @@ std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &
   return nullptr;
 }
 
-std::vector<std::string> display_names(mem_type_e) {
+std::vector<std::string> display_names(mem_type_e, const std::string &wanted) {
+  if (config::video.capture == "synthetic"sv) {
+    return synthetic::display_names(wanted);
+  }
+
   std::vector<std::string> display_names;
 
   HRESULT status;
@@ -170,6 +170,67 @@ void blend_cursor(const cursor_t &cursor, img_t &img) {
   }
 }
 
+/** The pixels blend_cursor() draws over */
+video::damage::rect_t cursor_rect(const cursor_t &cursor) {
+  auto height = cursor.shape_info.Height;
+  if (cursor.shape_info.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME) {
+    // AND mask above XOR mask
+    height /= 2;
+  }
+
+  return {cursor.x, cursor.y, (int)cursor.shape_info.Width, (int)height};
+}
+
+/**
+ * The move and dirty rectangles of the frame just acquired, which cover every change to
+ * the desktop image since the previous one, or std::nullopt if DXGI didn't provide them.
+ */
+std::optional<std::vector<video::damage::rect_t>>
+desktop_damage(duplication_t &dup, const DXGI_OUTDUPL_FRAME_INFO &frame_info,
+               std::vector<std::uint8_t> &metadata) {
+  if (!frame_info.TotalMetadataBufferSize) {
+    return std::nullopt;
+  }
+  metadata.resize(frame_info.TotalMetadataBufferSize);
+
+  std::vector<video::damage::rect_t> damage;
+  auto add = [&](const RECT &rect) {
+    damage.push_back({rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top});
+  };
+
+  UINT size = 0;
+  auto status = dup.dup->GetFrameMoveRects(
+      metadata.size(), (DXGI_OUTDUPL_MOVE_RECT *)metadata.data(), &size);
+  if (FAILED(status)) {
+    BOOST_LOG(debug) << "Couldn't get move rects [0x"sv << util::hex(status).to_string_view()
+                     << ']';
+    return std::nullopt;
+  }
+  auto moves = (const DXGI_OUTDUPL_MOVE_RECT *)metadata.data();
+  for (UINT i = 0; i < size / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++i) {
+    auto &destination = moves[i].DestinationRect;
+    add(destination);
+
+    // Where it moved from is usually in the dirty rects too, but nothing says it must be
+    add({moves[i].SourcePoint.x, moves[i].SourcePoint.y,
+         moves[i].SourcePoint.x + destination.right - destination.left,
+         moves[i].SourcePoint.y + destination.bottom - destination.top});
+  }
+
+  status = dup.dup->GetFrameDirtyRects(metadata.size(), (RECT *)metadata.data(), &size);
+  if (FAILED(status)) {
+    BOOST_LOG(debug) << "Couldn't get dirty rects [0x"sv << util::hex(status).to_string_view()
+                     << ']';
+    return std::nullopt;
+  }
+  auto dirty = (const RECT *)metadata.data();
+  for (UINT i = 0; i < size / sizeof(RECT); ++i) {
+    add(dirty[i]);
+  }
+
+  return damage;
+}
+
 capture_e display_ddup_ram_t::snapshot(const pull_free_image_cb_t &pull_free_image_cb,
                                        std::shared_ptr<platf::img_t> &img_out,
                                        std::chrono::milliseconds timeout, bool cursor_visible) {
@@ -216,12 +277,33 @@ capture_e display_ddup_ram_t::snapshot(const pull_free_image_cb_t &pull_free_ima
 
       return capture_e::error;
     }
+
+    if (cursor_sink) {
+      publish_cursor_shape(*cursor_sink, cursor.shape_info, cursor.img_data.data());
+    }
   }
 
   if (frame_info.LastMouseUpdateTime.QuadPart) {
     cursor.x = frame_info.PointerPosition.Position.x;
     cursor.y = frame_info.PointerPosition.Position.y;
     cursor.visible = frame_info.PointerPosition.Visible;
+
+    if (cursor_sink) {
+      publish_cursor_position(*cursor_sink, frame_info);
+    }
+  }
+
+  // The host draws the pointer, so it moving over a static desktop isn't a new frame
+  if (cursor_sink && !frame_update_flag) {
+    return capture_e::timeout;
+  }
+
+  // The staging texture only changes with the desktop
+  std::optional<std::vector<video::damage::rect_t>> damage;
+  if (frame_update_flag) {
+    damage = desktop_damage(dup, frame_info, frame_metadata);
+  } else {
+    damage.emplace();
   }
 
   if (frame_update_flag) {
@@ -321,12 +403,26 @@ capture_e display_ddup_ram_t::snapshot(const pull_free_image_cb_t &pull_free_ima
     img_info.pData = nullptr;
   }
 
+  std::optional<video::damage::rect_t> cursor_drawn;
   if (cursor_visible && cursor.visible) {
     blend_cursor(cursor, *img);
+    cursor_drawn = cursor_rect(cursor);
   }
 
   if (img) {
     img->frame_timestamp = frame_timestamp;
+
+    // The cursor is gone from where it was drawn in the last image, and is drawn in this one
+    if (damage && last_img_complete && capture_format != DXGI_FORMAT_UNKNOWN) {
+      for (auto &rect : {last_cursor_rect, cursor_drawn}) {
+        if (rect) {
+          damage->push_back(*rect);
+        }
+      }
+      img->damage = std::move(damage);
+    }
+    last_img_complete = capture_format != DXGI_FORMAT_UNKNOWN;
+    last_cursor_rect = cursor_drawn;
   }
 
   return capture_e::ok;
@@ -1044,6 +1044,10 @@ capture_e display_ddup_vram_t::snapshot(const pull_free_image_cb_t &pull_free_im
       return capture_e::error;
     }
 
+    if (cursor_sink) {
+      publish_cursor_shape(*cursor_sink, shape_info, std::begin(img_data));
+    }
+
     auto alpha_cursor_img = make_cursor_alpha_image(img_data, shape_info);
     auto xor_cursor_img = make_cursor_xor_image(img_data, shape_info);
 
@@ -1060,6 +1064,15 @@ capture_e display_ddup_vram_t::snapshot(const pull_free_image_cb_t &pull_free_im
 
     cursor_xor.set_pos(frame_info.PointerPosition.Position.x, frame_info.PointerPosition.Position.y,
                        width, height, display_rotation, frame_info.PointerPosition.Visible);
+
+    if (cursor_sink) {
+      publish_cursor_position(*cursor_sink, frame_info);
+    }
+  }
+
+  // The host draws the pointer, so it moving over a static desktop isn't a new frame
+  if (cursor_sink && !frame_update_flag) {
+    return capture_e::timeout;
   }
 
   const bool blend_mouse_cursor_flag =
@@ -17,7 +17,7 @@ this program; if not, write to the Free Software Foundation, Inc., 59 Temple
 Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
-#include "interprocess.h"
+#include "src/interprocess.h"
 #include <SetupAPI.h>
 #include <malloc.h>
 #include <stdio.h>
@@ -27,7 +27,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <initguid.h>
 
-#include "logging.h"
+#include "src/logging.h"
 
 DEFINE_GUID(GUID_DEVINTERFACE_IVSHMEM, 0xdf576976, 0x569d, 0x4672, 0x95, 0xa0, 0xf5, 0x7e, 0x4e,
             0xa0, 0xb2, 0x10);
@@ -95,10 +95,56 @@ typedef struct IVSHMEM_EVENT {
 #define IOCTL_IVSHMEM_REGISTER_EVENT                                                               \
   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+DoorbellEvent::DoorbellEvent() : m_handle(NULL), m_initialized(false) {}
+
+DoorbellEvent::~DoorbellEvent() {
+  DeInitialize();
+}
+
+bool DoorbellEvent::Initialize() {
+  if (m_initialized)
+    DeInitialize();
+
+  m_handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (m_handle == NULL) {
+    BOOST_LOG(error) << "CreateEvent failed: " << GetLastError();
+    return false;
+  }
+
+  m_initialized = true;
+  return true;
+}
+
+void DoorbellEvent::DeInitialize() {
+  if (m_handle) {
+    CloseHandle(m_handle);
+    m_handle = NULL;
+  }
+  m_initialized = false;
+}
+
+EventHandle DoorbellEvent::GetHandle() {
+  return m_handle;
+}
+
+bool DoorbellEvent::Wait(uint32_t timeoutMs) {
+  if (!m_initialized)
+    return false;
+
+  return WaitForSingleObject(m_handle, timeoutMs) == WAIT_OBJECT_0;
+}
+
+bool DoorbellEvent::Signal() {
+  if (!m_initialized)
+    return false;
+
+  return SetEvent(m_handle);
+}
+
 IVSHMEM *IVSHMEM::m_instance = NULL;
 
 IVSHMEM::IVSHMEM(const char *path)
-    : m_initialized(false), m_handle(INVALID_HANDLE_VALUE), m_gotSize(false), m_gotMemory(false) {
+    : m_initialized(false), m_gotSize(false), m_gotMemory(false), m_handle(INVALID_HANDLE_VALUE) {
   memset(m_devPath, 0, 512);
   memcpy(m_devPath, path, strlen(path));
 }
@@ -140,7 +186,7 @@ void IVSHMEM::DeInitialize() {
   m_gotMemory = false;
 }
 
-UINT64 IVSHMEM::GetSize() {
+uint64_t IVSHMEM::GetSize() {
   if (!m_initialized)
     return 0;
 
@@ -195,11 +241,7 @@ void *IVSHMEM::GetMemory() {
   return m_memory;
 }
 
-HANDLE IVSHMEM::getHandle() {
-  return m_handle;
-}
-
-bool IVSHMEM::RegisterEvent(HANDLE event, UINT16 vector) {
+bool IVSHMEM::RegisterEvent(EventHandle event, uint16_t vector) {
   if (!m_initialized || m_handle == INVALID_HANDLE_VALUE) {
     return false;
   }
@@ -219,7 +261,7 @@ bool IVSHMEM::RegisterEvent(HANDLE event, UINT16 vector) {
   return true;
 }
 
-bool IVSHMEM::RingDoorbell(UINT16 peerID, UINT16 vector) {
+bool IVSHMEM::RingDoorbell(uint16_t peerID, uint16_t vector) {
   if (!m_initialized || m_handle == INVALID_HANDLE_VALUE) {
     return false;
   }
@@ -237,8 +279,8 @@ bool IVSHMEM::RingDoorbell(UINT16 peerID, UINT16 vector) {
   return true;
 }
 
-SharedMemory::SharedMemory(const char *name, size_t size)
-    : m_size(size), m_handle(NULL), m_memory(NULL), m_initialized(false) {
+SharedMemory::SharedMemory(const char *name, size_t size, unsigned flags)
+    : m_size(size), m_flags(flags), m_memory(NULL), m_initialized(false), m_handle(NULL) {
   memset(m_name, 0, 512);
   if (name) {
     strncpy(m_name, name, 511);
@@ -253,10 +295,21 @@ bool SharedMemory::Initialize() {
   if (m_initialized)
     DeInitialize();
 
-  m_handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, m_name);
-  if (m_handle == NULL) {
-    BOOST_LOG(error) << "OpenFileMappingA failed for " << m_name << ": " << GetLastError();
-    return false;
+  // Large pages need SeLockMemoryPrivilege and Populate has no equivalent here, so both are
+  // left to the host that creates the mapping
+  if (m_flags & Create) {
+    m_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                  (DWORD)((UINT64)m_size >> 32), (DWORD)m_size, m_name);
+    if (m_handle == NULL) {
+      BOOST_LOG(error) << "CreateFileMappingA failed for " << m_name << ": " << GetLastError();
+      return false;
+    }
+  } else {
+    m_handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, m_name);
+    if (m_handle == NULL) {
+      BOOST_LOG(error) << "OpenFileMappingA failed for " << m_name << ": " << GetLastError();
+      return false;
+    }
   }
 
   m_memory = MapViewOfFile(m_handle, FILE_MAP_ALL_ACCESS, 0, 0, m_size);
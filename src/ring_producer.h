@@ -0,0 +1,97 @@
+#pragma once
+
+/**
+ * @file src/ring_producer.h
+ * @brief Writes encoded video packets into a VideoRing.
+ */
+
+#include "ivshmem_protocol.h"
+#include "smemory.h"
+#include "video.h"
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * Owns the writer of one video ring and lends its free space to the encoder, so a packet can be
+ * published where it was encoded instead of being copied. Shared by the encode thread, which
+ * reserves space, and the forwarding thread, which commits it.
+ */
+class ring_producer_t : public video::packet_allocator_t {
+public:
+  explicit ring_producer_t(VideoRing *ring) : writer{ring} {}
+
+  void *allocate(std::size_t size) override {
+    std::lock_guard lg{mutex};
+
+    auto reservation = writer.reserve(ivshmem_protocol::kVideoPacketHeaderSize + size);
+    if (!reservation) {
+      return nullptr;
+    }
+
+    auto data = reservation->payload + ivshmem_protocol::kVideoPacketHeaderSize;
+    reservations.emplace(data, reservation_t{*reservation, false});
+    return data;
+  }
+
+  void release(void *data) override {
+    std::lock_guard lg{mutex};
+
+    auto it = reservations.find(data);
+    if (it == std::end(reservations)) {
+      return;
+    }
+
+    // Dropped before it reached the ring, e.g. while waiting for an IDR frame
+    if (!it->second.committed) {
+      writer.cancel(it->second.reservation);
+    }
+    reservations.erase(it);
+  }
+
+  /**
+   * Publish a packet the encoder wrote into space from allocate().
+   * @return false if `data` didn't come from allocate(); the caller must copy it instead.
+   */
+  bool commit_in_place(const void *data, std::size_t size, uint64_t findex,
+                       uint64_t rtp_sample_duration, uint8_t flags) {
+    std::lock_guard lg{mutex};
+
+    auto it = reservations.find(data);
+    if (it == std::end(reservations) || it->second.committed) {
+      return false;
+    }
+
+    auto &reservation = it->second.reservation;
+    auto header = reservation.payload;
+    std::memcpy(header, &findex, sizeof(findex));
+    std::memcpy(header + sizeof(findex), &rtp_sample_duration, sizeof(rtp_sample_duration));
+    std::memcpy(header + sizeof(findex) + sizeof(rtp_sample_duration), &flags, sizeof(flags));
+
+    writer.commit(reservation, RING_RECORD_VIDEO, ivshmem_protocol::kVideoPacketHeaderSize + size);
+    it->second.committed = true;
+    return true;
+  }
+
+  template <class CanDrop>
+  ivshmem_protocol::ring::write_result_t
+  write(std::initializer_list<ivshmem_protocol::ring::segment_t> segments,
+        const ivshmem_protocol::ring::backpressure_t &backpressure, CanDrop &&can_drop) {
+    std::lock_guard lg{mutex};
+
+    return writer.write(RING_RECORD_VIDEO, segments, backpressure, std::forward<CanDrop>(can_drop));
+  }
+
+private:
+  struct reservation_t {
+    ivshmem_protocol::ring::reservation_t reservation;
+    bool committed;
+  };
+
+  std::mutex mutex;
+  ivshmem_protocol::ring::writer_t writer;
+  std::unordered_map<const void *, reservation_t> reservations;
+};
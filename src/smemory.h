@@ -1,5 +1,7 @@
 #ifndef __SMEMORY__
 #define __SMEMORY__
+#include <stdint.h>
+
 #define OUT_QUEUE_SIZE 8
 #define IN_QUEUE_SIZE 8
 
@@ -68,4 +70,152 @@ typedef struct _DataMemory {
   int worker_info_size;
 } DataMemory;
 
+/*
+ * Byte-ring layout (MEDIA_RING_VERSION 1).
+ *
+ * Replaces the fixed MediaPacket slots with one contiguous data region per
+ * stream. Records are RingRecordHeader + payload, padded to RING_RECORD_ALIGN,
+ * and never straddle the end of the data region: a RING_RECORD_PADDING header
+ * fills the tail instead. Cursors are monotonically increasing byte offsets;
+ * the position inside data[] is cursor & (size - 1).
+ *
+ * The host selects this layout by writing MEDIA_RING_MAGIC and the requested
+ * version into MediaRingHeader before the guest starts. The guest answers in
+ * accepted_version; a zero there means the guest fell back to MediaMemory.
+ */
+#define MEDIA_RING_MAGIC 0x474E5253 /* "SRNG" */
+#define MEDIA_RING_VERSION 1
+
+#define RING_CACHE_LINE 64
+#define RING_RECORD_ALIGN 16
+
+#define VIDEO_RING_SIZE 32 * 1024 * 1024
+#define AUDIO_RING_SIZE 1024 * 1024
+
+#define RING_RECORD_PADDING 0
+#define RING_RECORD_VIDEO 1
+#define RING_RECORD_AUDIO 2
+/* Space the guest reserved but didn't fill; skip record_span(size) bytes. */
+#define RING_RECORD_SKIP 3
+
+typedef struct {
+  uint64_t write_cursor;
+  char write_pad[RING_CACHE_LINE - sizeof(uint64_t)];
+  uint64_t read_cursor;
+  char read_pad[RING_CACHE_LINE - sizeof(uint64_t)];
+} RingCursors;
+
+typedef struct {
+  uint32_t size;
+  uint32_t type;
+  uint64_t sequence;
+} RingRecordHeader;
+
+typedef struct _VideoRing {
+  RingCursors cursors;
+  char data[VIDEO_RING_SIZE];
+} VideoRing;
+
+typedef struct _AudioRing {
+  RingCursors cursors;
+  char data[AUDIO_RING_SIZE];
+} AudioRing;
+
+typedef struct _ControlQueue {
+  int inindex;
+  int outindex;
+  DataPacket outgoing[OUT_QUEUE_SIZE];
+} ControlQueue;
+
+typedef struct _RingDisplayQueue {
+  VideoRing ring;
+  QueueMetadata metadata;
+  ControlQueue control;
+  char pad[RING_CACHE_LINE - (sizeof(QueueMetadata) + sizeof(ControlQueue)) % RING_CACHE_LINE];
+} RingDisplayQueue;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t accepted_version;
+  int32_t doorbell_peer_id;
+  char pad[RING_CACHE_LINE - 4 * sizeof(uint32_t)];
+} MediaRingHeader;
+
+typedef struct _MediaRingMemory {
+  MediaRingHeader header;
+  RingDisplayQueue video[MAX_DISPLAY];
+  AudioRing audio;
+} MediaRingMemory;
+
+/*
+ * Cursor channel (CURSOR_MEMORY_VERSION 1), in its own mapping.
+ *
+ * Lets the host draw the pointer itself instead of receiving it blended into
+ * every video frame. Each display has a byte ring of RING_RECORD_CURSOR_SHAPE
+ * records, written only when the pointer's shape changes, and one
+ * CursorPosition that the guest overwrites on every pointer update.
+ *
+ * CursorPosition is guarded by its sequence: the guest makes it odd before
+ * writing and even again after, so the host copies the fields and retries
+ * until it reads the same even sequence before and after.
+ *
+ * Like the ring layout, the host writes CURSOR_MEMORY_MAGIC and the version
+ * into CursorMemoryHeader, and the guest answers in accepted_version.
+ */
+#define CURSOR_MEMORY_MAGIC 0x53525543 /* "CURS" */
+#define CURSOR_MEMORY_VERSION 1
+
+#define CURSOR_RING_SIZE 1024 * 1024
+
+#define RING_RECORD_CURSOR_SHAPE 4
+
+/* Same values as DXGI_OUTDUPL_POINTER_SHAPE_TYPE */
+#define CURSOR_SHAPE_MONOCHROME 1   /* 1 bpp AND mask rows, then as many XOR mask rows */
+#define CURSOR_SHAPE_COLOR 2        /* BGRA, blended by alpha */
+#define CURSOR_SHAPE_MASKED_COLOR 4 /* BGRX; alpha 0xFF XORs the pixel, 0 replaces it */
+
+/* Payload of a RING_RECORD_CURSOR_SHAPE record, followed by pitch * height bytes. */
+typedef struct {
+  uint64_t id;     /* Counts shapes from 1; CursorPosition.shape_id refers to it */
+  uint32_t type;   /* CURSOR_SHAPE_* */
+  uint32_t width;  /* Pixels */
+  uint32_t height; /* Rows of data, twice the pointer's height for monochrome */
+  uint32_t pitch;  /* Bytes per row */
+  int32_t hotspot_x;
+  int32_t hotspot_y;
+} CursorShapeHeader;
+
+typedef struct {
+  uint32_t sequence;    /* Odd while the guest writes */
+  uint32_t visible;
+  int32_t x, y;         /* Where the shape's top-left corner goes, in display pixels */
+  uint64_t shape_id;    /* The shape to draw there */
+  int64_t timestamp_ns; /* When the pointer got there, on the guest's monotonic clock */
+  uint64_t updates;     /* Positions published so far; 0 until the first */
+  char pad[RING_CACHE_LINE - 40];
+} CursorPosition;
+
+typedef struct _CursorRing {
+  RingCursors cursors;
+  char data[CURSOR_RING_SIZE];
+} CursorRing;
+
+typedef struct _CursorChannel {
+  CursorPosition position;
+  CursorRing shapes;
+} CursorChannel;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t accepted_version;
+  char pad[RING_CACHE_LINE - 3 * sizeof(uint32_t)];
+} CursorMemoryHeader;
+
+typedef struct _CursorMemory {
+  CursorMemoryHeader header;
+  CursorChannel display[MAX_DISPLAY];
+} CursorMemory;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+/**
+ * @file src/stripe_pool.cpp
+ * @brief Definitions for stripe_pool_t.
+ */
+#include "stripe_pool.h"
+
+stripe_pool_t::stripe_pool_t(int workers) {
+  for (int i = 0; i < workers; ++i) {
+    _threads.emplace_back(&stripe_pool_t::worker, this);
+  }
+}
+
+stripe_pool_t::~stripe_pool_t() {
+  {
+    std::lock_guard lock{_mutex};
+    _stop = true;
+  }
+  _wake.notify_all();
+
+  for (auto &thread : _threads) {
+    thread.join();
+  }
+}
+
+void stripe_pool_t::run(int stripes, const std::function<void(int)> &job) {
+  std::unique_lock busy{_busy, std::try_to_lock};
+  if (!busy || _threads.empty() || stripes <= 1) {
+    for (int stripe = 0; stripe < stripes; ++stripe) {
+      job(stripe);
+    }
+    return;
+  }
+
+  batch_t batch{&job, stripes};
+  {
+    std::lock_guard lock{_mutex};
+    _batch = &batch;
+    ++_generation;
+  }
+  _wake.notify_all();
+
+  take_stripes(batch);
+
+  // Every stripe has been taken; wait for the workers still running theirs. Workers that
+  // haven't looked at the batch yet won't see it at all.
+  std::unique_lock lock{_mutex};
+  _batch = nullptr;
+  _done.wait(lock, [&]() { return batch.users == 0; });
+}
+
+void stripe_pool_t::take_stripes(batch_t &batch) {
+  for (int stripe; (stripe = batch.next.fetch_add(1, std::memory_order_relaxed)) < batch.stripes;) {
+    (*batch.job)(stripe);
+  }
+}
+
+void stripe_pool_t::worker() {
+  std::uint64_t seen = 0;
+
+  std::unique_lock lock{_mutex};
+  while (true) {
+    _wake.wait(lock, [&]() { return _stop || (_batch && _generation != seen); });
+    if (_stop) {
+      return;
+    }
+
+    seen = _generation;
+    auto batch = _batch;
+    ++batch->users;
+
+    lock.unlock();
+    take_stripes(*batch);
+    lock.lock();
+
+    if (--batch->users == 0) {
+      _done.notify_all();
+    }
+  }
+}
@@ -0,0 +1,60 @@
+/**
+ * @file src/stripe_pool.h
+ * @brief Worker threads that split one job into stripes and finish it together.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads for fork-join work such as converting a frame in horizontal
+ * stripes. The thread calling run() takes stripes too, so a pool of N workers runs N + 1
+ * stripes at once.
+ *
+ * One pool is shared by every display's encode thread. Only one run() uses the workers at a
+ * time; a caller that finds them busy converts its stripes itself rather than waiting, so
+ * displays never stall each other.
+ */
+class stripe_pool_t {
+public:
+  explicit stripe_pool_t(int workers);
+  ~stripe_pool_t();
+
+  stripe_pool_t(const stripe_pool_t &) = delete;
+  stripe_pool_t &operator=(const stripe_pool_t &) = delete;
+
+  int workers() const {
+    return (int)_threads.size();
+  }
+
+  /** Call job(0) through job(stripes - 1), each exactly once, and return when all are done. */
+  void run(int stripes, const std::function<void(int)> &job);
+
+private:
+  struct batch_t {
+    const std::function<void(int)> *job;
+    int stripes;
+    std::atomic<int> next{0};
+    int users = 0; ///< Workers still holding this batch; guarded by _mutex
+  };
+
+  void worker();
+  static void take_stripes(batch_t &batch);
+
+  std::mutex _busy; ///< Held by the run() that owns the workers
+
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _done;
+  batch_t *_batch = nullptr;
+  std::uint64_t _generation = 0;
+  bool _stop = false;
+
+  std::vector<std::thread> _threads;
+};
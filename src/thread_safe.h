@@ -14,6 +14,8 @@
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
+#include <thread>
 #include <vector>
 
 #include "logging.h"
@@ -232,14 +234,200 @@ template <class T> alarm_t<T> make_alarm() {
   return std::make_shared<alarm_raw_t<T>>();
 }
 
+/** How a queue_t synchronizes its producer and consumer. */
+enum class queue_mode_e {
+  locked, ///< Mutex and condition variable; any number of producers and consumers
+  spsc,   ///< Lock-free ring; exactly one producer thread and one consumer thread
+};
+
+/**
+ * Bounded single-producer/single-consumer ring with queue_t's drop-oldest overflow.
+ *
+ * Every slot carries a sequence number: `pos` when free for the producer's pos-th item,
+ * `pos + 1` once that item is published. The consumer claims items by advancing `_head`
+ * with a CAS, because a producer that finds the ring full claims the oldest item the same
+ * way to drop it. The mutex is only taken to put the consumer to sleep and wake it up.
+ */
+template <class T> class spsc_queue_t {
+public:
+  using status_t = util::optional_t<T>;
+
+  explicit spsc_queue_t(std::uint32_t max_elements)
+      : _capacity{max_elements}, _slots{std::make_unique<slot_t[]>(max_elements)} {
+    for (std::uint32_t i = 0; i < _capacity; ++i) {
+      _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  template <class... Args> void raise(Args &&...args) {
+    if (!_continue.load(std::memory_order_relaxed) || _capacity == 0) {
+      return;
+    }
+
+    auto pos = _tail.load(std::memory_order_relaxed);
+    auto &slot = _slots[pos % _capacity];
+    while (slot.sequence.load(std::memory_order_acquire) != pos) {
+      // Full: drop the oldest item, unless the consumer just claimed it
+      auto oldest = pos - _capacity;
+      if (_head.compare_exchange_strong(oldest, oldest + 1, std::memory_order_acq_rel)) {
+        slot.value.reset();
+        log_overflow();
+        break;
+      }
+
+      // The consumer is moving it out right now
+      std::this_thread::yield();
+    }
+
+    slot.value.emplace(std::forward<Args>(args)...);
+    slot.sequence.store(pos + 1, std::memory_order_release);
+    _tail.store(pos + 1, std::memory_order_release);
+
+    // Pairs with the fence in wait(): we see the consumer asleep, or it sees the item
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleeping.load(std::memory_order_relaxed)) {
+      std::lock_guard lg{_lock};
+      _cv.notify_one();
+    }
+  }
+
+  bool peek() {
+    return _continue.load(std::memory_order_relaxed) &&
+           _head.load(std::memory_order_acquire) != _tail.load(std::memory_order_acquire);
+  }
+
+  /** Take the oldest item without blocking. */
+  status_t try_pop() {
+    if (_capacity == 0) {
+      return util::false_v<status_t>;
+    }
+
+    auto pos = _head.load(std::memory_order_relaxed);
+    while (true) {
+      auto &slot = _slots[pos % _capacity];
+      if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+        // Empty, unless the producer dropped the item at `pos` meanwhile
+        auto head = _head.load(std::memory_order_relaxed);
+        if (head == pos) {
+          return util::false_v<status_t>;
+        }
+        pos = head;
+        continue;
+      }
+
+      if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_acq_rel)) {
+        status_t val = std::move(*slot.value);
+        slot.value.reset();
+        slot.sequence.store(pos + _capacity, std::memory_order_release);
+        return val;
+      }
+    }
+  }
+
+  template <class Rep, class Period> status_t pop(std::chrono::duration<Rep, Period> delay) {
+    return wait(std::chrono::steady_clock::now() + delay);
+  }
+
+  status_t pop() {
+    return wait(std::nullopt);
+  }
+
+  void stop() {
+    std::lock_guard lg{_lock};
+
+    _continue.store(false);
+
+    _cv.notify_all();
+  }
+
+  [[nodiscard]] bool running() const {
+    return _continue.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct slot_t {
+    std::atomic<std::uint64_t> sequence;
+    std::optional<T> value;
+  };
+
+  status_t wait(std::optional<std::chrono::steady_clock::time_point> deadline) {
+    if (!_continue.load(std::memory_order_relaxed)) {
+      return util::false_v<status_t>;
+    }
+
+    if (auto val = try_pop()) {
+      return val;
+    }
+
+    std::unique_lock ul{_lock};
+    _sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    while (true) {
+      if (!_continue.load(std::memory_order_relaxed)) {
+        break;
+      }
+
+      if (auto val = try_pop()) {
+        _sleeping.store(false, std::memory_order_relaxed);
+        return val;
+      }
+
+      if (!deadline) {
+        _cv.wait(ul);
+      } else if (_cv.wait_until(ul, *deadline) == std::cv_status::timeout) {
+        break;
+      }
+    }
+
+    _sleeping.store(false, std::memory_order_relaxed);
+    return util::false_v<status_t>;
+  }
+
+  void log_overflow() {
+    ++_overflow_count;
+
+    auto now = std::chrono::steady_clock::now();
+    if (!_last_overflow_log || now - *_last_overflow_log >= std::chrono::seconds{1}) {
+      BOOST_LOG(warning) << "Dropping oldest item from full queue; dropped " << _overflow_count
+                         << " item(s) so far";
+      _last_overflow_log = now;
+    }
+  }
+
+  std::uint32_t _capacity;
+  std::unique_ptr<slot_t[]> _slots;
+
+  alignas(64) std::atomic<std::uint64_t> _head{0};
+  alignas(64) std::atomic<std::uint64_t> _tail{0};
+  alignas(64) std::atomic<bool> _sleeping{false};
+  std::atomic<bool> _continue{true};
+
+  std::mutex _lock;
+  std::condition_variable _cv;
+
+  // Only touched by the producer
+  std::uint64_t _overflow_count{};
+  std::optional<std::chrono::steady_clock::time_point> _last_overflow_log;
+};
+
 template <class T> class queue_t {
 public:
   using status_t = util::optional_t<T>;
 
-  queue_t(std::uint32_t max_elements = 32) : _max_elements{max_elements} {
+  queue_t(std::uint32_t max_elements = 32, queue_mode_e mode = queue_mode_e::locked)
+      : _max_elements{max_elements} {
+    if (mode == queue_mode_e::spsc) {
+      _spsc = std::make_unique<spsc_queue_t<T>>(max_elements);
+    }
   }
 
   template <class... Args> void raise(Args &&...args) {
+    if (_spsc) {
+      _spsc->raise(std::forward<Args>(args)...);
+      return;
+    }
+
     std::lock_guard ul{_lock};
 
     if (!_continue) {
@@ -268,10 +456,18 @@ public:
   }
 
   bool peek() {
+    if (_spsc) {
+      return _spsc->peek();
+    }
+
     return _continue && !_queue.empty();
   }
 
   template <class Rep, class Period> status_t pop(std::chrono::duration<Rep, Period> delay) {
+    if (_spsc) {
+      return _spsc->pop(delay);
+    }
+
     std::unique_lock ul{_lock};
 
     if (!_continue) {
@@ -291,6 +487,10 @@ public:
   }
 
   status_t pop() {
+    if (_spsc) {
+      return _spsc->pop();
+    }
+
     std::unique_lock ul{_lock};
 
     if (!_continue) {
@@ -311,11 +511,17 @@ public:
     return val;
   }
 
+  // Always empty in queue_mode_e::spsc
   std::vector<T> &unsafe() {
     return _queue;
   }
 
   void stop() {
+    if (_spsc) {
+      _spsc->stop();
+      return;
+    }
+
     std::lock_guard lg{_lock};
 
     _continue = false;
@@ -324,7 +530,11 @@ public:
   }
 
   [[nodiscard]] bool running() const {
-    return _continue;
+    return _spsc ? _spsc->running() : _continue;
+  }
+
+  [[nodiscard]] queue_mode_e mode() const {
+    return _spsc ? queue_mode_e::spsc : queue_mode_e::locked;
   }
 
 private:
@@ -337,6 +547,8 @@ private:
   std::vector<T> _queue;
   std::uint64_t _overflow_count{};
   std::optional<std::chrono::steady_clock::time_point> _last_overflow_log;
+
+  std::unique_ptr<spsc_queue_t<T>> _spsc;
 };
 
 template <class T> class shared_t {
@@ -441,7 +653,7 @@ private:
 
   std::array<std::uint8_t, sizeof(element_type)> _object_buf;
 
-  std::uint32_t _count;
+  std::uint32_t _count{};
   std::mutex _lock;
 };
 
@@ -479,7 +691,26 @@ public:
 
   template <class T> using queue_t = std::shared_ptr<post_t<queue_t<T>>>;
 
+  /**
+   * A mailbox with channels of its own, except for the `inherited` ones, which resolve in
+   * this mailbox. Gives every display its own packets and control events while they all
+   * still share e.g. the session's shutdown event.
+   */
+  mail_t child(std::initializer_list<std::string_view> inherited) {
+    auto mail = std::make_shared<mail_raw_t>();
+    mail->parent = shared_from_this();
+    for (auto &id : inherited) {
+      mail->inherited.emplace(id);
+    }
+
+    return mail;
+  }
+
   template <class T> event_t<T> event(const std::string_view &id) {
+    if (inherits(id)) {
+      return parent->event<T>(id);
+    }
+
     std::lock_guard lg{mutex};
 
     auto it = id_to_post.find(id);
@@ -494,6 +725,10 @@ public:
   }
 
   template <class T> queue_t<T> queue(const std::string_view &id) {
+    if (inherits(id)) {
+      return parent->queue<T>(id);
+    }
+
     std::lock_guard lg{mutex};
 
     auto it = id_to_post.find(id);
@@ -501,12 +736,29 @@ public:
       return lock<queue_t<T>>(it->second);
     }
 
-    auto post = std::make_shared<typename queue_t<T>::element_type>(shared_from_this(), 32);
+    auto mode_it = queue_modes.find(id);
+    auto mode = mode_it != std::end(queue_modes) ? mode_it->second : queue_mode_e::locked;
+    auto post = std::make_shared<typename queue_t<T>::element_type>(shared_from_this(), 32, mode);
     id_to_post.emplace(std::pair<std::string, std::weak_ptr<void>>{std::string{id}, post});
 
     return post;
   }
 
+  /**
+   * Choose how the queue `id` synchronizes; takes effect when queue() next creates it.
+   * Only use queue_mode_e::spsc when a single thread raises and a single thread pops.
+   */
+  void set_queue_mode(const std::string_view &id, queue_mode_e mode) {
+    if (inherits(id)) {
+      parent->set_queue_mode(id, mode);
+      return;
+    }
+
+    std::lock_guard lg{mutex};
+
+    queue_modes.insert_or_assign(std::string{id}, mode);
+  }
+
   void cleanup() {
     std::lock_guard lg{mutex};
 
@@ -524,6 +776,16 @@ public:
   std::mutex mutex;
 
   std::map<std::string, std::weak_ptr<void>, std::less<>> id_to_post;
+  std::map<std::string, queue_mode_e, std::less<>> queue_modes;
+
+private:
+  bool inherits(const std::string_view &id) const {
+    return parent && inherited.find(id) != std::end(inherited);
+  }
+
+  // Set once by child(), before the mailbox is shared
+  mail_t parent;
+  std::set<std::string, std::less<>> inherited;
 };
 
 inline void cleanup(mail_raw_t *mail) {
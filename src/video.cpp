@@ -5,7 +5,12 @@
 #include <algorithm>
 #include <atomic>
 #include <bitset>
+#include <condition_variable>
+#include <functional>
 #include <list>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <thread>
 
 #include <boost/pointer_cast.hpp>
@@ -23,8 +28,24 @@ extern "C" {
 #include "logging.h"
 #include "nvenc/nvenc_base.h"
 #include "platform/common.h"
+#include "stripe_pool.h"
 #include "sync.h"
 #include "video.h"
+#include "video_convert.h"
+#include "video_damage.h"
+#include "video_rfi.h"
+
+// libavcodec doesn't wrap x264_encoder_invalidate_reference(), so the x264_t it opened is read
+// from its private context. SUNSHINE_X264_BUILD is only defined when libavcodec and libx264 are
+// the bundled build-deps, built together against this x264.h at the X264_BUILD pinned in
+// cmake/dependencies/common.cmake; any other x264 could lay the context out differently.
+#ifdef SUNSHINE_X264_BUILD
+#define VIDEO_RFI_X264
+extern "C" {
+#include <x264.h>
+}
+static_assert(X264_BUILD == SUNSHINE_X264_BUILD, "x264.h isn't the pinned x264 build");
+#endif
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -116,21 +137,138 @@ dxgi_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
 util::Either<avcodec_buffer_t, int>
 cuda_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
 
+/** Formats video::convert has kernels for */
+std::optional<convert::format_e> convert_format_from_av(AVPixelFormat format) {
+  switch (format) {
+  case AV_PIX_FMT_YUV420P:
+    return convert::format_e::yuv420p;
+  case AV_PIX_FMT_YUV420P10:
+    return convert::format_e::yuv420p10;
+  case AV_PIX_FMT_NV12:
+    return convert::format_e::nv12;
+  case AV_PIX_FMT_P010:
+    return convert::format_e::p010;
+  case AV_PIX_FMT_YUV444P:
+    return convert::format_e::yuv444p;
+  case AV_PIX_FMT_YUV444P10:
+    return convert::format_e::yuv444p10;
+  default:
+    return std::nullopt;
+  }
+}
+
+/** Stripes the software encode device converts each frame in */
+int convert_stripes() {
+  if (config::video.convert_stripes > 0) {
+    return config::video.convert_stripes;
+  }
+
+  // Past a handful of threads, conversion is limited by memory bandwidth
+  return std::clamp((int)std::thread::hardware_concurrency(), 1, 8);
+}
+
+/** Shared by every display's encode thread, which converts one of the stripes itself */
+stripe_pool_t &convert_pool() {
+  static stripe_pool_t pool{convert_stripes() - 1};
+  return pool;
+}
+
 class avcodec_software_encode_device_t : public platf::avcodec_encode_device_t {
 public:
   int convert(platf::img_t &img) override {
-    // If we need to add aspect ratio padding, we need to scale into an intermediate output buffer
-    bool requires_padding = (sw_frame->width != sws_output_frame->width ||
-                             sw_frame->height != sws_output_frame->height);
+    if (convert_into(sw_frame.get(), img)) {
+      return -1;
+    }
+
+    return transfer();
+  }
+
+  /** Convert into ahead_frame, which nothing else touches until present_ahead() */
+  int convert_ahead(platf::img_t &img) {
+    return convert_into(ahead_frame.get(), img);
+  }
+
+  /** Swap ahead_frame in as the frame that's encoded */
+  int present_ahead() {
+    auto converted = ahead_frame.release();
+    ahead_frame.reset(sw_frame.release());
+    sw_frame.reset(converted);
+    std::swap(sw_stale, ahead_stale);
+
+    if (!hw_frame) {
+      // The codec encodes this->frame directly; keep any pending IDR request
+      sw_frame->pict_type = frame->pict_type;
+      sw_frame->flags = (sw_frame->flags & ~AV_FRAME_FLAG_KEY) | (frame->flags & AV_FRAME_FLAG_KEY);
+      frame = sw_frame.get();
+    }
+
+    return transfer();
+  }
+
+  int convert_into(AVFrame *target, platf::img_t &img) {
+    if (direct_format) {
+      // Both buffers fall behind by what changed, and the target catches up now
+      for (auto buffer : {&sw_stale, &ahead_stale}) {
+        if (img.damage) {
+          buffer->mark(*img.damage);
+        } else {
+          buffer->mark_all();
+        }
+      }
+      auto &stale = target == sw_frame.get() ? sw_stale : ahead_stale;
+
+      // Same size in and out, so it's a color conversion only
+      video::convert::planes_t planes{
+          {target->data[0], target->data[1], target->data[2]},
+          {target->linesize[0], target->linesize[1], target->linesize[2]},
+      };
+      video::convert::image_t image{img.data, img.row_pitch, target->width, target->height};
+      if (stale.count() * 2 >= stale.size()) {
+        // Mostly changed, so whole stripes are cheaper than many small regions
+        convert_pool().run(stripes, [&](int stripe) {
+          auto [first, last] =
+              video::convert::stripe_rows(*direct_format, image.height, stripes, stripe);
+          video::convert::convert_rows(*direct_format, image, planes, coefficients,
+                                       video::convert::best_isa(), first, last);
+        });
+      } else {
+        auto rects = stale.rects();
+        auto workers = std::min(stripes, (int)rects.size());
+        convert_pool().run(workers, [&](int worker) {
+          for (auto i = (std::size_t)worker; i < rects.size(); i += workers) {
+            auto &rect = rects[i];
+            video::convert::convert_region(*direct_format, image, planes, coefficients,
+                                           video::convert::best_isa(), rect.x,
+                                           rect.x + rect.width, rect.y, rect.y + rect.height);
+          }
+        });
+      }
+      stale.clear();
+
+      // Software encoders take the frame as is; hardware ones get hw_frame without side data
+      if (config::video.roi_static_qp > 0 && !hw_frame) {
+        attach_roi(target, img);
+      }
+      return 0;
+    }
 
     // Setup the input frame using the caller's img_t
     sws_input_frame->data[0] = img.data;
     sws_input_frame->linesize[0] = img.row_pitch;
 
-    // Perform color conversion and scaling to the final size
-    auto status =
-        sws_scale_frame(sws.get(), requires_padding ? sws_output_frame.get() : sw_frame.get(),
-                        sws_input_frame.get());
+    // Scale straight into the part of the frame inside the aspect ratio padding. The view
+    // shares target's buffers, and the borders prefill() painted are never written again.
+    auto status = av_frame_ref(sws_output_view.get(), target);
+    if (status >= 0) {
+      sws_output_view->width = scaled_width;
+      sws_output_view->height = scaled_height;
+      for (int plane = 0; plane < AV_NUM_DATA_POINTERS && sws_output_view->data[plane]; plane++) {
+        sws_output_view->data[plane] += padding_offset[plane];
+      }
+
+      status = sws_scale_frame(sws.get(), sws_output_view.get(), sws_input_frame.get());
+      av_frame_unref(sws_output_view.get());
+    }
     if (status < 0) {
       char string[AV_ERROR_MAX_STRING_SIZE];
       BOOST_LOG(error) << "Couldn't scale frame: "sv
@@ -138,27 +276,48 @@ public:
       return -1;
     }
 
-    // If we require aspect ratio padding, copy the output frame into the final padded frame
-    if (requires_padding) {
-      auto fmt_desc = av_pix_fmt_desc_get((AVPixelFormat)sws_output_frame->format);
-      auto planes = av_pix_fmt_count_planes((AVPixelFormat)sws_output_frame->format);
-      for (int plane = 0; plane < planes; plane++) {
-        auto shift_h = plane == 0 ? 0 : fmt_desc->log2_chroma_h;
-        auto shift_w = plane == 0 ? 0 : fmt_desc->log2_chroma_w;
-        auto offset = ((offsetW >> shift_w) * fmt_desc->comp[plane].step) +
-                      (offsetH >> shift_h) * sw_frame->linesize[plane];
-
-        // Copy line-by-line to preserve leading padding for each row
-        for (int line = 0; line < sws_output_frame->height >> shift_h; line++) {
-          memcpy(sw_frame->data[plane] + offset + (line * sw_frame->linesize[plane]),
-                 sws_output_frame->data[plane] + (line * sws_output_frame->linesize[plane]),
-                 (size_t)(sws_output_frame->width >> shift_w) * fmt_desc->comp[plane].step);
-        }
-      }
+    return 0;
+  }
+
+  /**
+   * Mark the parts of `target` that changed since the last image as regions of interest,
+   * and everything else as roi_static_qp coarser, so static areas give up bits to moving
+   * ones. libx264 and libx265 apply it through adaptive quantization. Without damage, or
+   * when it all changed, the frame gets no regions and is quantized as usual.
+   */
+  void attach_roi(AVFrame *target, const platf::img_t &img) {
+    av_frame_remove_side_data(target, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+    if (!img.damage) {
+      return;
+    }
+
+    roi_tiles.clear();
+    roi_tiles.mark(*img.damage);
+    if (roi_tiles.count() == roi_tiles.size()) {
+      return;
     }
 
-    // If frame is not a software frame, it means we still need to transfer from main memory
-    // to vram memory
+    auto rects = roi_tiles.rects();
+    auto side_data = av_frame_new_side_data(target, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                                            (rects.size() + 1) * sizeof(AVRegionOfInterest));
+    if (!side_data) {
+      return;
+    }
+
+    // Encoders scale the offset by their QP range, and the first region covering a block wins,
+    // so the changed tiles go before the region for the whole frame
+    auto qp_range = 51 + 6 * (video::convert::bit_depth(*direct_format) - 8);
+    auto regions = (AVRegionOfInterest *)side_data->data;
+    for (auto &rect : rects) {
+      *regions++ = {sizeof(AVRegionOfInterest), rect.y, rect.y + rect.height, rect.x,
+                    rect.x + rect.width, {0, 1}};
+    }
+    *regions = {sizeof(AVRegionOfInterest), 0, target->height, 0, target->width,
+                {config::video.roi_static_qp, qp_range}};
+  }
+
+  /** If frame is not a software frame, we still need to transfer from main memory to vram */
+  int transfer() {
     if (frame->hw_frames_ctx) {
       auto status = av_hwframe_transfer_data(frame, sw_frame.get(), 0);
       if (status < 0) {
@@ -189,6 +348,18 @@ public:
   }
 
   void apply_colorspace() override {
+    if (direct_format) {
+      auto colors = color_vectors_from_colorspace(colorspace);
+      coefficients = video::convert::make_coefficients(
+          colors->color_vec_y, colors->color_vec_u, colors->color_vec_v, colors->range_y,
+          colors->range_uv, video::convert::bit_depth(*direct_format));
+
+      // What's been converted used the old colors
+      sw_stale.mark_all();
+      ahead_stale.mark_all();
+      return;
+    }
+
     auto avcodec_colorspace = avcodec_colorspace_from_sunshine_colorspace(colorspace);
     sws_setColorspaceDetails(sws.get(), sws_getCoefficients(SWS_CS_DEFAULT), 0,
                              sws_getCoefficients(avcodec_colorspace.software_format),
@@ -198,8 +369,7 @@ public:
   /**
    * When preserving aspect ratio, ensure that padding is black
    */
-  void prefill() {
-    auto frame = sw_frame ? sw_frame.get() : this->frame;
+  void prefill(AVFrame *frame) {
     av_frame_get_buffer(frame, 0);
     av_frame_make_writable(frame);
     ptrdiff_t linesize[4] = {frame->linesize[0], frame->linesize[1], frame->linesize[2],
@@ -220,8 +390,20 @@ public:
       this->frame = frame;
     }
 
+    auto padded = sw_frame ? sw_frame.get() : frame;
+
     // Fill aspect ratio padding in the destination frame
-    prefill();
+    prefill(padded);
+
+    if (config::video.convert_ahead) {
+      // A second buffer of the same geometry, so padding_offset holds for both
+      ahead_frame.reset(av_frame_alloc());
+      ahead_frame->width = padded->width;
+      ahead_frame->height = padded->height;
+      ahead_frame->format = padded->format;
+      av_frame_copy_props(ahead_frame.get(), padded);
+      prefill(ahead_frame.get());
+    }
 
     auto out_width = frame->width;
     auto out_height = frame->height;
@@ -236,15 +418,41 @@ public:
     sws_input_frame->height = in_height;
     sws_input_frame->format = AV_PIX_FMT_BGR0;
 
-    sws_output_frame.reset(av_frame_alloc());
-    sws_output_frame->width = out_width;
-    sws_output_frame->height = out_height;
-    sws_output_frame->format = format;
+    scaled_width = out_width;
+    scaled_height = out_height;
+
+    // Result is always positive; kept even so chroma samples line up with luma
+    auto offsetW = (frame->width - out_width) / 2 & ~1;
+    auto offsetH = (frame->height - out_height) / 2 & ~1;
 
-    // Result is always positive
-    offsetW = (frame->width - out_width) / 2;
-    offsetH = (frame->height - out_height) / 2;
+    auto fmt_desc = av_pix_fmt_desc_get(format);
+    for (int plane = 0; plane < av_pix_fmt_count_planes(format); plane++) {
+      auto shift_w = plane == 0 ? 0 : fmt_desc->log2_chroma_w;
+      auto shift_h = plane == 0 ? 0 : fmt_desc->log2_chroma_h;
+      padding_offset[plane] = (std::ptrdiff_t)(offsetW >> shift_w) * fmt_desc->comp[plane].step +
+                              (std::ptrdiff_t)(offsetH >> shift_h) * padded->linesize[plane];
+    }
+
+    stripes = convert_stripes();
 
+    // Without scaling, our own kernels are much cheaper than swscale
+    if (in_width == frame->width && in_height == frame->height) {
+      direct_format = convert_format_from_av(format);
+    }
+    if (direct_format) {
+      BOOST_LOG(info) << "Converting to "sv << video::convert::to_string(*direct_format)
+                      << " with "sv << video::convert::to_string(video::convert::best_isa())
+                      << " kernels in "sv << stripes << " stripes"sv;
+
+      // Nothing has been converted into either buffer yet
+      sw_stale = video::damage::tiles_t{frame->width, frame->height};
+      sw_stale.mark_all();
+      ahead_stale = sw_stale;
+      roi_tiles = video::damage::tiles_t{frame->width, frame->height};
+      return 0;
+    }
+
+    sws_output_view.reset(av_frame_alloc());
     sws.reset(sws_alloc_context());
     if (!sws) {
       return -1;
@@ -254,11 +462,12 @@ public:
     av_dict_set_int(&options, "srcw", sws_input_frame->width, 0);
     av_dict_set_int(&options, "srch", sws_input_frame->height, 0);
     av_dict_set_int(&options, "src_format", sws_input_frame->format, 0);
-    av_dict_set_int(&options, "dstw", sws_output_frame->width, 0);
-    av_dict_set_int(&options, "dsth", sws_output_frame->height, 0);
-    av_dict_set_int(&options, "dst_format", sws_output_frame->format, 0);
+    av_dict_set_int(&options, "dstw", scaled_width, 0);
+    av_dict_set_int(&options, "dsth", scaled_height, 0);
+    av_dict_set_int(&options, "dst_format", format, 0);
     av_dict_set_int(&options, "sws_flags", SWS_LANCZOS | SWS_ACCURATE_RND, 0);
-    av_dict_set_int(&options, "threads", config::video.min_threads, 0);
+    // swscale has its own slice threads
+    av_dict_set_int(&options, "threads", stripes, 0);
 
     auto status = av_opt_set_dict(sws.get(), &options);
     av_dict_free(&options);
@@ -284,13 +493,29 @@ public:
   avcodec_frame_t hw_frame;
 
   avcodec_frame_t sw_frame;
+  avcodec_frame_t ahead_frame; ///< Converted into while sw_frame is encoded, if enabled
   avcodec_frame_t sws_input_frame;
-  avcodec_frame_t sws_output_frame;
+  avcodec_frame_t sws_output_view;
   sws_t sws;
 
-  // Offset of input image to output frame in pixels
-  int offsetW;
-  int offsetH;
+  // Set when the image needs no scaling, and video::convert replaces swscale
+  std::optional<video::convert::format_e> direct_format;
+  video::convert::coefficients_t coefficients;
+
+  // Tiles of sw_frame and ahead_frame that differ from the last image converted into either;
+  // they trade places along with the frames
+  video::damage::tiles_t sw_stale;
+  video::damage::tiles_t ahead_stale;
+
+  // What changed in the image attach_roi() was last given
+  video::damage::tiles_t roi_tiles;
+
+  int stripes;
+
+  // Size of the scaled image, and where it starts in each plane of the padded frame in bytes
+  int scaled_width;
+  int scaled_height;
+  std::ptrdiff_t padding_offset[AV_NUM_DATA_POINTERS]{};
 };
 
 enum flag_e : uint32_t {
@@ -306,6 +531,7 @@ enum flag_e : uint32_t {
   ALWAYS_REPROBE = 1 << 9,  ///< This is an encoder of last resort and we want to aggressively probe
                             ///< for a better one
   YUV444_SUPPORT = 1 << 10, ///< Encoder may support 4:4:4 chroma sampling depending on hardware
+  INTRA_REFRESH = 1 << 11,  ///< Encoder can refresh the picture with rolling intra waves
 };
 
 class avcodec_encode_session_t : public encode_session_t {
@@ -333,6 +559,12 @@ public:
     vps = std::move(other.vps);
 
     inject = other.inject;
+    intra_refresh_period = other.intra_refresh_period;
+    idr_by_intra_refresh = other.idr_by_intra_refresh;
+    refresh_frames = other.refresh_frames;
+    recovery_left = other.recovery_left;
+    dpb = std::move(other.dpb);
+    invalidate_from = std::move(other.invalidate_from);
 
     return *this;
   }
@@ -350,6 +582,15 @@ public:
   }
 
   void request_idr_frame() override {
+    if (idr_by_intra_refresh && refresh_frames >= 0) {
+      // The wave after the current one repaints all of the picture, without an IDR frame's burst.
+      // Neither encoder can start one sooner: waves run back to back, x264_encoder_intra_refresh()
+      // only queues one behind the current wave, and with a closed GOP libx264 encodes a forced
+      // keyframe as an IDR frame whatever forced-idr says.
+      recovery_left = 2 * intra_refresh_period - refresh_frames - 1;
+      return;
+    }
+
     if (device && device->frame) {
       auto &frame = device->frame;
       frame->pict_type = AV_PICTURE_TYPE_I;
@@ -366,7 +607,31 @@ public:
   }
 
   void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
-    BOOST_LOG(error) << "Encoder doesn't support reference frame invalidation";
+    if (!dpb || !invalidate_from) {
+      BOOST_LOG(error) << "Encoder doesn't support reference frame invalidation";
+      request_idr_frame();
+      return;
+    }
+
+    switch (dpb->invalidate(first_frame, last_frame)) {
+    case rfi::dpb_t::action_e::none:
+      BOOST_LOG(debug) << "Reference frames "sv << first_frame << '-' << last_frame
+                       << " need no invalidation"sv;
+      return;
+    case rfi::dpb_t::action_e::invalidate:
+      if (invalidate_from(first_frame)) {
+        BOOST_LOG(debug) << "Reference frames "sv << first_frame << '-' << last_frame
+                         << " invalidated, predicting from frame "sv << *dpb->newest_usable();
+        return;
+      }
+      BOOST_LOG(error) << "Encoder refused to invalidate reference frames, generating IDR"sv;
+      break;
+    case rfi::dpb_t::action_e::idr:
+      BOOST_LOG(debug) << "No reference frame left before frame "sv << first_frame
+                       << ", generating IDR"sv;
+      break;
+    }
+
     request_idr_frame();
   }
 
@@ -395,6 +660,23 @@ public:
     }
   }
 
+  int recovery_frames() override {
+    return recovery_left;
+  }
+
+  bool can_convert_ahead() override {
+    auto software = dynamic_cast<avcodec_software_encode_device_t *>(device.get());
+    return software && software->ahead_frame;
+  }
+
+  int convert_ahead(platf::img_t &img) override {
+    return static_cast<avcodec_software_encode_device_t *>(device.get())->convert_ahead(img);
+  }
+
+  int present_ahead() override {
+    return static_cast<avcodec_software_encode_device_t *>(device.get())->present_ahead();
+  }
+
   avcodec_ctx_t avcodec_ctx;
   std::unique_ptr<platf::avcodec_encode_device_t> device;
 
@@ -406,6 +688,20 @@ public:
   // inject sps/vps data into idr pictures
   int inject;
   int consecutive_no_packet{};
+
+  // Frames per intra refresh wave, 0 when the encoder only recovers with IDR frames
+  int intra_refresh_period{};
+  // Answer request_idr_frame() with the next intra refresh wave
+  bool idr_by_intra_refresh{};
+  // Frames since the last refresh wave or IDR frame started, -1 before the first frame
+  int refresh_frames{-1};
+  // Frames until a wave that started after the last request_idr_frame() has finished
+  int recovery_left{};
+
+  // The encoder's reference frames, when it can be told to stop predicting from lost ones
+  std::optional<rfi::dpb_t> dpb;
+  // Stops the encoder from predicting from this frame and those after it
+  std::function<bool(std::int64_t)> invalidate_from;
 };
 
 class nvenc_encode_session_t : public encode_session_t {
@@ -468,6 +764,7 @@ private:
 struct capture_ctx_t {
   img_event_t images;
   config_t *config;
+  platf::cursor_sink_t *cursor_sink;
 };
 
 struct capture_thread_async_ctx_t {
@@ -477,14 +774,46 @@ struct capture_thread_async_ctx_t {
   safe::signal_t reinit_event;
   const encoder_t *encoder_p;
   sync_util::sync_t<std::weak_ptr<platf::display_t>> display_wp;
+
+  // Empty for the display chosen by config::video.output_name
+  std::string display_name;
 };
 int start_capture_async(capture_thread_async_ctx_t &ctx);
 void end_capture_async(capture_thread_async_ctx_t &ctx);
 
-// Keep a reference counter to ensure the capture thread only runs when other threads have a
-// reference to the capture thread
-auto capture_thread_async =
-    safe::make_shared<capture_thread_async_ctx_t>(start_capture_async, end_capture_async);
+/**
+ * One capture thread per display, each with its own display session, image pool and reinit
+ * event, so capturing several displays doesn't make them take turns on a single thread.
+ */
+class capture_thread_registry_t {
+public:
+  using shared_ctx_t = safe::shared_t<capture_thread_async_ctx_t>;
+
+  // Keep a reference counter to ensure each capture thread only runs when other threads have a
+  // reference to it
+  shared_ctx_t::ptr_t ref(const std::optional<std::string> &display) {
+    auto display_name = display.value_or(std::string{});
+
+    std::lock_guard lg{lock};
+    auto &shared = threads[display_name];
+    if (!shared) {
+      shared = std::make_unique<shared_ctx_t>(
+          [display_name](capture_thread_async_ctx_t &ctx) {
+            ctx.display_name = display_name;
+            return start_capture_async(ctx);
+          },
+          end_capture_async);
+    }
+
+    return shared->ref();
+  }
+
+private:
+  std::mutex lock;
+  std::map<std::string, std::unique_ptr<shared_ctx_t>> threads;
+};
+
+capture_thread_registry_t capture_threads;
 
 encoder_t nvenc{
     "nvenc"sv,
@@ -697,6 +1026,44 @@ encoder_t amdvce{
     },
     0};
 
+#ifdef VIDEO_RFI_X264
+// H.264 only; x265 has no way to invalidate reference frames
+constexpr std::uint32_t software_rfi = REF_FRAMES_INVALIDATION;
+
+/**
+ * The start of the pinned libavcodec's private X264Context, holding the encoder it opened.
+ * Mirrors X264Context in libavcodec/libx264.c of FFmpeg 7.1 (libavcodec 61), which has begun
+ * this way since FFmpeg 4. Check it against libx264.c whenever FFmpeg or SUNSHINE_X264_BUILD
+ * is bumped.
+ */
+struct libx264_context_t {
+  const AVClass *av_class;
+  x264_param_t params;
+  x264_t *enc;
+};
+
+/**
+ * The x264 encoder behind a libx264 codec context. libavcodec was built against the same
+ * x264.h as we were, but nothing is returned unless the context looks the way we expect.
+ */
+x264_t *libx264_encoder(AVCodecContext *ctx) {
+  if (!ctx->codec || ctx->codec->name != "libx264"sv || !ctx->priv_data) {
+    return nullptr;
+  }
+
+  auto context = (libx264_context_t *)ctx->priv_data;
+  if (context->av_class != ctx->codec->priv_class || context->params.i_width != ctx->width ||
+      context->params.i_height != ctx->height) {
+    BOOST_LOG(warning) << "Unexpected libx264 context, reference frame invalidation disabled"sv;
+    return nullptr;
+  }
+
+  return context->enc;
+}
+#else
+constexpr std::uint32_t software_rfi = 0;
+#endif
+
 encoder_t software{
     "software"sv,
     std::make_unique<encoder_platform_formats_avcodec>(
@@ -757,7 +1124,7 @@ encoder_t software{
         {}, // Fallback options
         "libx264"s,
     },
-    ALWAYS_REPROBE | YUV444_SUPPORT};
+    ALWAYS_REPROBE | YUV444_SUPPORT | INTRA_REFRESH | software_rfi};
 
 static const std::vector<encoder_t *> encoders{&nvenc, &quicksync, &amdvce, &software};
 
@@ -802,7 +1169,8 @@ void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &disp
 
   // Refresh the display names
   auto old_display_names = std::move(display_names);
-  display_names = platf::display_names(dev_type);
+  display_names = platf::display_names(
+      dev_type, current_display_name.empty() ? config::video.output_name : current_display_name);
 
   // If we now have no displays, let's put the old display array back and fail
   if (display_names.empty() && !old_display_names.empty()) {
@@ -840,7 +1208,8 @@ void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &disp
 
 void captureThread(std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue,
                    sync_util::sync_t<std::weak_ptr<platf::display_t>> &display_wp,
-                   safe::signal_t &reinit_event, const encoder_t &encoder) {
+                   safe::signal_t &reinit_event, const encoder_t &encoder,
+                   const std::string &display_name) {
   std::vector<capture_ctx_t> capture_ctxs;
 
   auto fg = util::fail_guard([&]() {
@@ -863,9 +1232,14 @@ void captureThread(std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_que
   capture_ctxs.emplace_back(std::move(*initial_capture_ctx));
 
   // Get all the monitor names now, rather than at boot, to
-  // get the most up-to-date list available monitors
+  // get the most up-to-date list available monitors. Seeding the list with our display makes
+  // refresh_displays() look for it.
   std::vector<std::string> display_names;
   int display_p = -1;
+  if (!display_name.empty()) {
+    display_names.emplace_back(display_name);
+    display_p = 0;
+  }
   refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
   auto disp = platf::display(encoder.platform_formats->dev_type, display_names[display_p],
                              *capture_ctxs.front().config);
@@ -877,6 +1251,15 @@ void captureThread(std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_que
   capture_ctxs.front().config->height = disp->height;
   display_wp = disp;
 
+  // Only images in system memory can be hashed; the others hold GPU textures
+  auto fingerprint_images =
+      config::video.skip_static && encoder.platform_formats->dev_type == platf::mem_type_e::system;
+  auto track_damage = config::video.track_damage &&
+                      encoder.platform_formats->dev_type == platf::mem_type_e::system;
+
+  // The image pushed last, which the next one's damage is relative to
+  std::shared_ptr<platf::img_t> previous_img;
+
   constexpr auto capture_buffer_size = 12;
   std::list<std::shared_ptr<platf::img_t>> imgs(capture_buffer_size);
 
@@ -969,6 +1352,11 @@ void captureThread(std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_que
         // trim allocated but unused portion of the pool based on timeouts
         trim_imgs();
         img_out->frame_timestamp.reset();
+        img_out->pool_acquire_timestamp.reset();
+        img_out->damage.reset();
+        if (frame_trace::enabled()) {
+          img_out->pool_acquire_timestamp = std::chrono::steady_clock::now();
+        }
         return true;
       } else {
         auto now = std::chrono::steady_clock::now();
@@ -999,6 +1387,43 @@ void captureThread(std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_que
 
     auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img,
                                             bool frame_captured) -> bool {
+      if (frame_captured && img) {
+        // Lets encode threads skip converting an image that matches the previous one
+        img->fingerprint.reset();
+        if (fingerprint_images && img->data) {
+          img->fingerprint = video::damage::fingerprint(img->data, img->row_pitch,
+                                                        img->width * img->pixel_pitch, img->height);
+        }
+
+        // Lets the software encode device convert only what changed
+        if (!track_damage || !img->data || !previous_img || previous_img->width != img->width ||
+            previous_img->height != img->height) {
+          img->damage.reset();
+        } else {
+          if (!img->damage) {
+            img->damage = video::damage::diff(
+                {previous_img->data, previous_img->row_pitch, previous_img->width,
+                 previous_img->height},
+                {img->data, img->row_pitch, img->width, img->height});
+          }
+
+          // An encoder that hasn't taken the previous image yet gets this one instead, so this
+          // one covers what changed in both. Taken since or not, that's never too little.
+          auto previous_pending =
+              std::any_of(std::begin(capture_ctxs), std::end(capture_ctxs),
+                          [](const auto &capture_ctx) { return capture_ctx.images->peek(); });
+          if (previous_pending && !previous_img->damage) {
+            img->damage.reset();
+          } else if (previous_pending) {
+            video::damage::tiles_t tiles{img->width, img->height};
+            tiles.mark(*img->damage);
+            tiles.mark(*previous_img->damage);
+            img->damage = tiles.rects();
+          }
+        }
+        previous_img = img;
+      }
+
       KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs),
                        capture_ctx != std::end(capture_ctxs), {
                          if (!capture_ctx->images->running()) {
@@ -1031,8 +1456,11 @@ void captureThread(std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_que
       return true;
     };
 
-    auto status =
-        disp->capture(push_captured_image_callback, pull_free_image_callback, &display_cursor);
+    // With a cursor channel the host draws the pointer, so it's never blended into the images
+    bool no_cursor = false;
+    disp->cursor_sink = capture_ctxs.empty() ? nullptr : capture_ctxs.front().cursor_sink;
+    auto status = disp->capture(push_captured_image_callback, pull_free_image_callback,
+                                disp->cursor_sink ? &no_cursor : &display_cursor);
 
     if (artificial_reinit && status != platf::capture_e::error) {
       status = platf::capture_e::reinit;
@@ -1049,6 +1477,7 @@ void captureThread(std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_que
       for (auto &img : imgs) {
         img.reset();
       }
+      previous_img.reset();
 
       // display_wp is modified in this thread only
       // Wait for the other shared_ptr's of display to be destroyed.
@@ -1153,14 +1582,46 @@ void captureThread(std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_que
   }
 }
 
+/** How a frame's image reached the encoder's frame buffer; unset if it wasn't measured */
+struct convert_timing_t {
+  std::optional<double> duration_us;
+  std::optional<double> wait_us; ///< Encoder blocked on a conversion running ahead
+  std::optional<std::chrono::steady_clock::time_point> capture_timestamp;
+
+  // Work skipped for static content since the previous frame, and its estimated CPU time
+  std::uint32_t skipped_converts = 0;
+  std::uint32_t skipped_encodes = 0;
+  double skipped_us = 0;
+};
+
+void set_convert_timing(packet_raw_t &packet, const convert_timing_t &timing,
+                        std::chrono::steady_clock::time_point encode_start) {
+  packet.convert_duration_us = timing.duration_us;
+  packet.convert_wait_us = timing.wait_us;
+  packet.skipped_converts = timing.skipped_converts;
+  packet.skipped_encodes = timing.skipped_encodes;
+  packet.skipped_us = timing.skipped_us;
+  if (timing.capture_timestamp) {
+    packet.capture_age_us =
+        std::chrono::duration<double, std::micro>(encode_start - *timing.capture_timestamp)
+            .count();
+  }
+}
+
 int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session,
                    safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data,
                    std::optional<std::chrono::steady_clock::time_point> frame_timestamp,
-                   std::uint64_t rtp_sample_duration) {
+                   std::uint64_t rtp_sample_duration, const convert_timing_t &convert_timing,
+                   const frame_trace::record_t *trace) {
   auto encode_start = std::chrono::steady_clock::now();
   auto &frame = session.device->frame;
   frame->pts = frame_nr;
 
+  // A key frame codes everything afresh, so static areas shouldn't come out coarser
+  if (frame->pict_type == AV_PICTURE_TYPE_I) {
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+  }
+
   auto &ctx = session.avcodec_ctx;
 
   auto &sps = session.sps;
@@ -1195,10 +1656,32 @@ int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session,
       return ret;
     }
 
+    // x264 flags the first frame of every refresh wave as a keyframe, though it's a P frame
+    bool wave_keyframe = false;
+    if (session.intra_refresh_period && (av_packet->flags & AV_PKT_FLAG_KEY)) {
+      std::size_t stats_size = 0;
+      auto stats = av_packet_get_side_data(av_packet, AV_PKT_DATA_QUALITY_STATS, &stats_size);
+      if (stats && stats_size > 4 && stats[4] != AV_PICTURE_TYPE_I) {
+        av_packet->flags &= ~AV_PKT_FLAG_KEY;
+        wave_keyframe = true;
+      }
+    }
+
     if ((frame->flags & AV_FRAME_FLAG_KEY) && !(av_packet->flags & AV_PKT_FLAG_KEY)) {
       BOOST_LOG(error) << "Encoder did not produce IDR frame when requested!"sv;
     }
 
+    // x265 doesn't flag its waves, but they start every intra_refresh_period frames all the same
+    if (session.intra_refresh_period) {
+      if (av_packet->flags & AV_PKT_FLAG_KEY) {
+        session.refresh_frames = 0;
+      } else if (wave_keyframe || ++session.refresh_frames >= session.intra_refresh_period) {
+        session.refresh_frames = 0;
+        packet->starts_intra_refresh = true;
+      }
+      session.recovery_left = std::max(0, session.recovery_left - 1);
+    }
+
     if (session.inject) {
       if (session.inject == 1) {
         auto h264 = cbs::make_sps_h264(ctx.get(), av_packet);
@@ -1225,6 +1708,16 @@ int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session,
     if (av_packet && av_packet->pts == frame_nr) {
       packet->frame_timestamp = frame_timestamp;
       packet->rtp_sample_duration = rtp_sample_duration;
+      set_convert_timing(*packet, convert_timing, encode_start);
+      if (trace) {
+        packet->trace = *trace;
+        packet->trace->mark(frame_trace::stage_e::encode_start, encode_start);
+        packet->trace->mark(frame_trace::stage_e::encode_end);
+      }
+    }
+
+    if (session.dpb && session.dpb->encoded(av_packet->pts, av_packet->flags & AV_PKT_FLAG_KEY)) {
+      packet->after_ref_frame_invalidation = true;
     }
 
     packet->replacements = &session.replacements;
@@ -1234,6 +1727,9 @@ int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session,
             .count();
     session.consecutive_no_packet = 0;
     produced_packet = true;
+    if (packet->trace) {
+      packet->trace->mark(frame_trace::stage_e::enqueue);
+    }
     packets->raise(std::move(packet));
   }
 
@@ -1243,12 +1739,13 @@ int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session,
 int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session,
                  safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data,
                  std::optional<std::chrono::steady_clock::time_point> frame_timestamp,
-                 std::uint64_t rtp_sample_duration) {
+                 std::uint64_t rtp_sample_duration, const convert_timing_t &convert_timing,
+                 const frame_trace::record_t *trace) {
   auto encode_start = std::chrono::steady_clock::now();
   auto encoded_frame = session.encode_frame(frame_nr);
+  auto encode_end = std::chrono::steady_clock::now();
   auto encode_duration_us =
-      std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - encode_start)
-          .count();
+      std::chrono::duration<double, std::micro>(encode_end - encode_start).count();
   if (encoded_frame.data.empty()) {
     BOOST_LOG(error) << "NvENC returned empty packet";
     return -1;
@@ -1266,6 +1763,13 @@ int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session,
   packet->frame_timestamp = frame_timestamp;
   packet->rtp_sample_duration = rtp_sample_duration;
   packet->encode_duration_us = encode_duration_us;
+  set_convert_timing(*packet, convert_timing, encode_start);
+  if (trace) {
+    packet->trace = *trace;
+    packet->trace->mark(frame_trace::stage_e::encode_start, encode_start);
+    packet->trace->mark(frame_trace::stage_e::encode_end, encode_end);
+    packet->trace->mark(frame_trace::stage_e::enqueue);
+  }
   packets->raise(std::move(packet));
 
   return 0;
@@ -1274,22 +1778,52 @@ int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session,
 int encode(int64_t frame_nr, encode_session_t &session,
            safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data,
            std::optional<std::chrono::steady_clock::time_point> frame_timestamp,
-           std::uint64_t rtp_sample_duration) {
+           std::uint64_t rtp_sample_duration, const convert_timing_t &convert_timing = {},
+           const frame_trace::record_t *trace = nullptr) {
   if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(&session)) {
     return encode_avcodec(frame_nr, *avcodec_session, packets, channel_data, frame_timestamp,
-                          rtp_sample_duration);
+                          rtp_sample_duration, convert_timing, trace);
   } else if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(&session)) {
     return encode_nvenc(frame_nr, *nvenc_session, packets, channel_data, frame_timestamp,
-                        rtp_sample_duration);
+                        rtp_sample_duration, convert_timing, trace);
   }
 
   return -1;
 }
 
+/**
+ * AVCodecContext::get_encode_buffer that places the bitstream in the buffer of a
+ * packet_allocator_t stored in AVCodecContext::opaque.
+ */
+int get_encode_buffer(AVCodecContext *ctx, AVPacket *pkt, int flags) {
+  auto allocator = (packet_allocator_t *)ctx->opaque;
+
+  auto size = (std::size_t)pkt->size + AV_INPUT_BUFFER_PADDING_SIZE;
+  auto data = (uint8_t *)allocator->allocate(size);
+  if (!data) {
+    return avcodec_default_get_encode_buffer(ctx, pkt, flags);
+  }
+
+  pkt->buf = av_buffer_create(
+      data, size,
+      [](void *opaque, uint8_t *data) { ((packet_allocator_t *)opaque)->release(data); },
+      allocator, 0);
+  if (!pkt->buf) {
+    allocator->release(data);
+    return AVERROR(ENOMEM);
+  }
+
+  memset(data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  pkt->data = pkt->buf->data;
+
+  return 0;
+}
+
 std::unique_ptr<avcodec_encode_session_t>
 make_avcodec_encode_session(platf::display_t *disp, const encoder_t &encoder,
                             const config_t &config, int width, int height,
-                            std::unique_ptr<platf::avcodec_encode_device_t> encode_device) {
+                            std::unique_ptr<platf::avcodec_encode_device_t> encode_device,
+                            packet_allocator_t *packet_allocator) {
   auto platform_formats =
       dynamic_cast<const encoder_platform_formats_avcodec *>(encoder.platform_formats.get());
   if (!platform_formats) {
@@ -1332,6 +1866,12 @@ make_avcodec_encode_session(platf::display_t *disp, const encoder_t &encoder,
                     ? platform_formats->avcodec_pix_fmt_yuv444_10bit
                     : AV_PIX_FMT_NONE;
 
+  // libx264 and libx265 can heal the picture with a rolling intra column instead of IDR frames
+  int refresh_period = 0;
+  if (config.enableIntraRefresh && (encoder.flags & INTRA_REFRESH) && config.videoFormat <= 1) {
+    refresh_period = intra_refresh_period(config);
+  }
+
   // Allow up to 1 retry to apply the set of fallback options.
   //
   // Note: If we later end up needing multiple sets of
@@ -1345,6 +1885,12 @@ make_avcodec_encode_session(platf::display_t *disp, const encoder_t &encoder,
     ctx->time_base = AVRational{1, config.framerate};
     ctx->framerate = AVRational{config.framerate, 1};
 
+    // Let the encoder write the bitstream straight into the consumer's memory
+    if (packet_allocator && (codec->capabilities & AV_CODEC_CAP_DR1)) {
+      ctx->opaque = packet_allocator;
+      ctx->get_encode_buffer = get_encode_buffer;
+    }
+
     switch (config.videoFormat) {
     case 0:
       // 10-bit h264 encoding is not supported by our streaming protocol
@@ -1378,6 +1924,18 @@ make_avcodec_encode_session(platf::display_t *disp, const encoder_t &encoder,
 
     ctx->keyint_min = std::numeric_limits<int>::max();
 
+    // Refresh waves restart at every keyframe interval
+    if (refresh_period) {
+      ctx->gop_size = refresh_period;
+    }
+
+    // Keep older frames to predict from when the host loses the newest ones. libx264 refuses to
+    // invalidate references during intra refresh.
+    if (!hardware && (encoder.flags & REF_FRAMES_INVALIDATION) && config.videoFormat == 0 &&
+        !refresh_period && config::video.rfi_refs > 1) {
+      ctx->refs = config::video.rfi_refs;
+    }
+
     // Some client decoders have limits on the number of reference frames
     if (config.numRefFrames) {
       if (video_format[encoder_t::REF_FRAMES_RESTRICT]) {
@@ -1520,6 +2078,21 @@ make_avcodec_encode_session(platf::display_t *disp, const encoder_t &encoder,
       }
     }
 
+    if (refresh_period) {
+      if (config.videoFormat == 0) {
+        av_dict_set_int(&options, "intra-refresh", 1, 0);
+
+        // Requested I frames must still be IDR frames
+        av_dict_set_int(&options, "forced-idr", 1, 0);
+      } else {
+        // x265 takes the keyframe interval from its own parameters, the last one wins
+        auto params = av_dict_get(options, "x265-params", nullptr, 0);
+        auto value = (params ? params->value + ":"s : ""s) + "keyint=" +
+                     std::to_string(refresh_period) + ":intra-refresh=1";
+        av_dict_set(&options, "x265-params", value.c_str(), 0);
+      }
+    }
+
     auto bitrate = config.bitrate * 1000;
     ctx->rc_max_rate = bitrate;
     ctx->bit_rate = bitrate;
@@ -1649,6 +2222,23 @@ make_avcodec_encode_session(platf::display_t *disp, const encoder_t &encoder,
           ? (1 - (int)video_format[encoder_t::VUI_PARAMETERS]) * (1 + config.videoFormat)
           : 0);
 
+  session->intra_refresh_period = refresh_period;
+  session->idr_by_intra_refresh = refresh_period && config.idrByIntraRefresh;
+
+#ifdef VIDEO_RFI_X264
+  if (auto x264 = libx264_encoder(session->avcodec_ctx.get())) {
+    // What the encoder actually runs with, after the client's reference frame limit
+    x264_param_t params;
+    x264_encoder_parameters(x264, &params);
+    if (params.i_frame_reference > 1 && !params.i_bframe && !params.b_intra_refresh) {
+      session->dpb.emplace(params.i_frame_reference);
+      session->invalidate_from = [x264](std::int64_t frame) {
+        return x264_encoder_invalidate_reference(x264, frame) == 0;
+      };
+    }
+  }
+#endif
+
   return session;
 }
 
@@ -1664,7 +2254,8 @@ make_nvenc_encode_session(const config_t &client_config,
 
 std::unique_ptr<encode_session_t>
 make_encode_session(platf::display_t *disp, const encoder_t &encoder, const config_t &config,
-                    int width, int height, std::unique_ptr<platf::encode_device_t> encode_device) {
+                    int width, int height, std::unique_ptr<platf::encode_device_t> encode_device,
+                    packet_allocator_t *packet_allocator) {
   if (encode_device) {
     switch (encode_device->colorspace.colorspace) {
     case colorspace_e::bt2020:
@@ -1692,7 +2283,7 @@ make_encode_session(platf::display_t *disp, const encoder_t &encoder, const conf
     auto avcodec_encode_device =
         boost::dynamic_pointer_cast<platf::avcodec_encode_device_t>(std::move(encode_device));
     return make_avcodec_encode_session(disp, encoder, config, width, height,
-                                       std::move(avcodec_encode_device));
+                                       std::move(avcodec_encode_device), packet_allocator);
   } else if (dynamic_cast<platf::nvenc_encode_device_t *>(encode_device.get())) {
     auto nvenc_encode_device =
         boost::dynamic_pointer_cast<platf::nvenc_encode_device_t>(std::move(encode_device));
@@ -1702,13 +2293,143 @@ make_encode_session(platf::display_t *disp, const encoder_t &encoder, const conf
   return nullptr;
 }
 
+/**
+ * Converts captured images into the session's second frame buffer on its own thread, so
+ * converting frame N + 1 overlaps encoding frame N. The newest image wins: one that arrives
+ * before the encoder took the previous conversion is converted over it.
+ */
+class convert_stage_t {
+public:
+  struct converted_t {
+    int status;
+    convert_timing_t timing;
+    std::optional<std::chrono::steady_clock::time_point> pool_acquire_timestamp;
+    std::chrono::steady_clock::time_point convert_start;
+    std::chrono::steady_clock::time_point convert_end;
+  };
+
+  convert_stage_t(encode_session_t &session, img_event_t images)
+      : session{session}, images{std::move(images)}, thread{&convert_stage_t::run, this} {
+  }
+
+  ~convert_stage_t() {
+    stop = true;
+    thread.join();
+  }
+
+  /**
+   * Present the newest conversion the encoder hasn't taken yet, first waiting for one that's
+   * in progress. Returns std::nullopt if there's nothing new, so the last frame is repeated.
+   */
+  std::optional<converted_t> take() {
+    auto wait_start = std::chrono::steady_clock::now();
+
+    std::unique_lock lock{mutex};
+    changed.wait(lock, [&]() { return !converting; });
+    if (!ready) {
+      return std::nullopt;
+    }
+    ready = false;
+
+    auto converted = result;
+    converted.timing.wait_us =
+        std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - wait_start)
+            .count();
+    if (!converted.status) {
+      // Under the lock, so the stage can't start writing the buffer being swapped out
+      converted.status = session.present_ahead();
+    }
+
+    return converted;
+  }
+
+  /** Unchanged captures skipped since the last call */
+  std::uint32_t take_skipped() {
+    return skipped.exchange(0);
+  }
+
+  /** Wait until a conversion is ready or in progress, or until deadline; true if one is */
+  bool wait(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock lock{mutex};
+    return changed.wait_until(lock, deadline, [&]() { return ready || converting; });
+  }
+
+private:
+  void run() {
+    while (!stop) {
+      // Bounded, so a stopping encoder isn't kept waiting on a capture that stalled
+      auto img = images->pop(20ms);
+      if (!img) {
+        if (!images->running()) {
+          return;
+        }
+        continue;
+      }
+
+      // The newest conversion already has these pixels
+      if (img->fingerprint && img->fingerprint == last_fingerprint) {
+        skipped.fetch_add(1);
+        continue;
+      }
+
+      {
+        std::lock_guard lock{mutex};
+        converting = true;
+      }
+      changed.notify_all();
+
+      converted_t converted{};
+      converted.timing.capture_timestamp = img->frame_timestamp;
+      converted.pool_acquire_timestamp = img->pool_acquire_timestamp;
+      converted.convert_start = std::chrono::steady_clock::now();
+      converted.status = session.convert_ahead(*img);
+      converted.convert_end = std::chrono::steady_clock::now();
+      converted.timing.duration_us =
+          std::chrono::duration<double, std::micro>(converted.convert_end -
+                                                    converted.convert_start)
+              .count();
+      last_fingerprint = converted.status ? std::nullopt : img->fingerprint;
+
+      // Give the image back to the capture pool before waiting on the next one
+      img.reset();
+
+      {
+        std::lock_guard lock{mutex};
+        converting = false;
+        ready = true;
+        result = converted;
+      }
+      changed.notify_all();
+
+      if (converted.status) {
+        // The encoder reports the error when it takes this result
+        return;
+      }
+    }
+  }
+
+  encode_session_t &session;
+  img_event_t images;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool converting = false; ///< The stage is writing the second frame buffer
+  bool ready = false;      ///< result holds a conversion the encoder hasn't taken
+  converted_t result{};
+
+  std::optional<std::uint64_t> last_fingerprint; ///< Of the newest conversion; stage thread only
+  std::atomic<std::uint32_t> skipped{0};
+  std::atomic<bool> stop{false};
+  std::thread thread;
+};
+
 void encode_run(int &frame_nr, // Store progress of the frame number
                 safe::mail_t mail, img_event_t images, config_t *config,
                 std::shared_ptr<platf::display_t> disp,
                 std::unique_ptr<platf::encode_device_t> encode_device, safe::signal_t &reinit_event,
-                const encoder_t &encoder, void *channel_data) {
+                const encoder_t &encoder, void *channel_data, packet_allocator_t *packet_allocator) {
   auto session = make_encode_session(disp.get(), encoder, *config, disp->width, disp->height,
-                                     std::move(encode_device));
+                                     std::move(encode_device), packet_allocator);
   if (!session) {
     BOOST_LOG(error) << "Failed to create video encode session"sv;
     return;
@@ -1736,6 +2457,13 @@ void encode_run(int &frame_nr, // Store progress of the frame number
     }
   }
 
+  // Declared after the session, so the stage thread stops before the session is destroyed
+  std::unique_ptr<convert_stage_t> convert_stage;
+  if (session->can_convert_ahead()) {
+    BOOST_LOG(info) << "Converting frames ahead of the encoder on a separate thread"sv;
+    convert_stage = std::make_unique<convert_stage_t>(*session, images);
+  }
+
   auto timer = platf::create_high_precision_timer();
   std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
   auto last_frametimestamp = frame_timestamp;
@@ -1745,6 +2473,46 @@ void encode_run(int &frame_nr, // Store progress of the frame number
   constexpr std::uint64_t video_rtp_clock_rate = 90000;
   std::uint64_t video_rtp_remainder = 0;
 
+  // Capture pacing encodes each new image as soon as it's converted. Frames are at least
+  // min_interval apart, which absorbs capture jitter while still capping bursts, and the last
+  // frame is repeated after keepalive without a new image.
+  auto capture_paced = config::video.capture_paced;
+  auto keepalive = std::chrono::milliseconds(std::max(config::video.keepalive_ms, 1));
+  std::optional<std::chrono::steady_clock::time_point> last_encode;
+  if (capture_paced) {
+    BOOST_LOG(info) << "Encoding frames as they're captured, repeating after "sv
+                    << keepalive.count() << "ms without one"sv;
+  }
+
+  // Captures whose fingerprint matches the last conversion aren't converted again. Capture
+  // pacing then has nothing new to encode until keepalive; fixed pacing repeats the frame,
+  // which costs the encoder little, or with static_backoff repeats it less and less often.
+  auto static_backoff = config::video.static_backoff && !capture_paced;
+  std::optional<std::uint64_t> last_fingerprint; // Of the last inline conversion
+  std::int64_t static_ticks = 0;
+  std::int64_t next_static_tick = 1;
+  if (static_backoff) {
+    BOOST_LOG(info) << "Repeating unchanged frames less often, down to one per "sv
+                    << keepalive.count() << "ms"sv;
+  }
+
+  // Skipped work not yet reported with a frame, and what the work usually costs
+  std::uint32_t skipped_converts = 0;
+  std::uint32_t skipped_encodes = 0;
+  double convert_us_avg = 0;
+  double encode_us_avg = 0;
+  auto average = [](double &avg, double sample) {
+    avg = avg ? avg + (sample - avg) / 16 : sample;
+  };
+
+  // Whether a new image is ready to encode by deadline
+  auto wait_for_capture = [&](std::chrono::steady_clock::time_point deadline) -> bool {
+    if (convert_stage) {
+      return convert_stage->wait(deadline);
+    }
+    return (bool)images->view(deadline - std::chrono::steady_clock::now());
+  };
+
   bool requested_idr_frame = true;
   bool decouple_teardown = false;
   while (true) {
@@ -1764,9 +2532,13 @@ void encode_run(int &frame_nr, // Store progress of the frame number
       break;
     }
 
+    // Recovery frames go out without waiting for a capture, as do the frames of a refresh wave
+    // standing in for an IDR frame
+    bool recovery_due = requested_idr_frame || session->recovery_frames() > 0;
     while (invalidate_ref_frames_events->peek()) {
       if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
         session->invalidate_ref_frames(frames->first, frames->second);
+        recovery_due = true;
       }
     }
 
@@ -1795,6 +2567,7 @@ void encode_run(int &frame_nr, // Store progress of the frame number
       session->set_bitrate(config->bitrate, config->framerate);
     } else if (idr_events->peek()) {
       requested_idr_frame = true;
+      recovery_due = true;
       idr_events->pop();
     }
 
@@ -1803,32 +2576,174 @@ void encode_run(int &frame_nr, // Store progress of the frame number
       requested_idr_frame = false;
     }
 
-    if (images->peek()) {
-      if (auto img = images->pop(0ms)) {
-        if (session->convert(*img)) {
+    if (capture_paced && last_encode) {
+      auto now = std::chrono::steady_clock::now();
+      if (!recovery_due && now < *last_encode + keepalive) {
+        // Wake at least once per frame interval to look at the events above again
+        if (!wait_for_capture(std::min(*last_encode + keepalive, now + frame_duration))) {
+          continue;
+        }
+      }
+
+      auto earliest = *last_encode + frame_duration * 3 / 4;
+      if (earliest > now) {
+        wait_until_frame_time(*timer, earliest);
+      }
+    }
+
+    std::optional<frame_trace::record_t> trace;
+    if (frame_trace::enabled()) {
+      trace.emplace();
+      trace->frame = frame_nr;
+    }
+
+    convert_timing_t convert_timing;
+    if (convert_stage) {
+      if (auto converted = convert_stage->take()) {
+        if (converted->status) {
           BOOST_LOG(error) << "Could not convert image"sv;
           return;
         }
+        if (trace) {
+          if (converted->pool_acquire_timestamp) {
+            trace->mark(frame_trace::stage_e::pool_acquire, *converted->pool_acquire_timestamp);
+          }
+          if (converted->timing.capture_timestamp) {
+            trace->mark(frame_trace::stage_e::capture, *converted->timing.capture_timestamp);
+          }
+          trace->mark(frame_trace::stage_e::convert_start, converted->convert_start);
+          trace->mark(frame_trace::stage_e::convert_end, converted->convert_end);
+        }
+        convert_timing = converted->timing;
+      } else if (!images->running()) {
+        break;
+      }
+
+      auto skipped = convert_stage->take_skipped();
+      skipped_converts += skipped;
+      if (capture_paced) {
+        // Each of those would have been encoded as it arrived
+        skipped_encodes += skipped;
+      }
+    } else if (images->peek()) {
+      if (auto img = images->pop(0ms)) {
+        if (img->fingerprint && img->fingerprint == last_fingerprint) {
+          // The frame already holds these pixels
+          ++skipped_converts;
+        } else {
+          if (trace) {
+            if (img->pool_acquire_timestamp) {
+              trace->mark(frame_trace::stage_e::pool_acquire, *img->pool_acquire_timestamp);
+            }
+            if (img->frame_timestamp) {
+              trace->mark(frame_trace::stage_e::capture, *img->frame_timestamp);
+            }
+          }
+          auto convert_start = std::chrono::steady_clock::now();
+          if (session->convert(*img)) {
+            BOOST_LOG(error) << "Could not convert image"sv;
+            return;
+          }
+          auto convert_end = std::chrono::steady_clock::now();
+          if (trace) {
+            trace->mark(frame_trace::stage_e::convert_start, convert_start);
+            trace->mark(frame_trace::stage_e::convert_end, convert_end);
+          }
+          convert_timing.duration_us =
+              std::chrono::duration<double, std::micro>(convert_end - convert_start).count();
+          convert_timing.capture_timestamp = img->frame_timestamp;
+          last_fingerprint = img->fingerprint;
+        }
       } else if (!images->running())
         break;
     }
 
-    // Force perfectly paced monotonic timestamps for WebRTC client stability
-    // ignoring the capture DWM jitter entirely.
-    frame_timestamp = next_frame_time;
-    last_frametimestamp = frame_timestamp;
-    video_rtp_remainder += video_rtp_clock_rate;
-    auto rtp_sample_duration = video_rtp_remainder / config->framerate;
-    video_rtp_remainder %= config->framerate;
+    // Decide whether a frame without new pixels goes out this time
+    auto now = std::chrono::steady_clock::now();
+    bool encode_due = true;
+    if (convert_timing.duration_us || recovery_due || !last_encode) {
+      static_ticks = 0;
+      next_static_tick = 1;
+    } else if (capture_paced) {
+      encode_due = now >= *last_encode + keepalive;
+    } else if (static_backoff) {
+      // Skip 0, 1, 2, 4, 8... ticks between repeats, up to a keepalive's worth
+      auto max_stride = std::max<std::int64_t>(1, keepalive / frame_duration);
+      encode_due = ++static_ticks >= next_static_tick;
+      if (encode_due) {
+        next_static_tick = static_ticks + std::min(static_ticks, max_stride);
+      }
+    }
 
-    if (encode(frame_nr++, *session, packets, channel_data, frame_timestamp, rtp_sample_duration)) {
-      BOOST_LOG(error) << "Could not encode video packet"sv;
-      return;
+    if (!encode_due) {
+      ++skipped_encodes;
+      if (capture_paced) {
+        continue;
+      }
+
+      // The next frame's RTP duration covers this tick too
+      video_rtp_remainder += video_rtp_clock_rate;
+    } else {
+      std::uint64_t rtp_sample_duration;
+      if (capture_paced) {
+        // Stamp new frames with their capture time and repeats with the time they're sent,
+        // kept monotonic. The RTP duration is the time since the previous frame, with the
+        // remainder carried over so the durations add up to the timestamps.
+        frame_timestamp = convert_timing.capture_timestamp.value_or(now);
+        if (last_frametimestamp && *frame_timestamp <= *last_frametimestamp) {
+          frame_timestamp = *last_frametimestamp + 1us;
+        }
+
+        if (last_frametimestamp) {
+          auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              *frame_timestamp - *last_frametimestamp);
+          video_rtp_remainder += (std::uint64_t)elapsed.count() * video_rtp_clock_rate;
+          rtp_sample_duration = video_rtp_remainder / 1'000'000'000;
+          video_rtp_remainder %= 1'000'000'000;
+        } else {
+          rtp_sample_duration = video_rtp_clock_rate / config->framerate;
+        }
+        last_frametimestamp = frame_timestamp;
+      } else {
+        // Force perfectly paced monotonic timestamps for WebRTC client stability
+        // ignoring the capture DWM jitter entirely.
+        frame_timestamp = next_frame_time;
+        last_frametimestamp = frame_timestamp;
+        video_rtp_remainder += video_rtp_clock_rate;
+        rtp_sample_duration = video_rtp_remainder / config->framerate;
+        video_rtp_remainder %= config->framerate;
+      }
+      last_encode = now;
+
+      if (convert_timing.duration_us) {
+        average(convert_us_avg, *convert_timing.duration_us);
+      }
+      convert_timing.skipped_converts = skipped_converts;
+      convert_timing.skipped_encodes = skipped_encodes;
+      convert_timing.skipped_us =
+          skipped_converts * convert_us_avg + skipped_encodes * encode_us_avg;
+      skipped_converts = 0;
+      skipped_encodes = 0;
+
+      auto encode_start = std::chrono::steady_clock::now();
+      if (encode(frame_nr++, *session, packets, channel_data, frame_timestamp,
+                 rtp_sample_duration, convert_timing, trace ? &*trace : nullptr)) {
+        BOOST_LOG(error) << "Could not encode video packet"sv;
+        return;
+      }
+      auto encode_end = std::chrono::steady_clock::now();
+      average(encode_us_avg,
+              std::chrono::duration<double, std::micro>(encode_end - encode_start).count());
+
+      if (capture_paced) {
+        session->request_normal_frame();
+        continue;
+      }
     }
 
     // Calculate sleep period based on absolute target
     next_frame_time += frame_duration;
-    auto now = std::chrono::steady_clock::now();
+    now = std::chrono::steady_clock::now();
 
     if (next_frame_time > now) {
       auto duration = next_frame_time - now;
@@ -1848,6 +2763,9 @@ void encode_run(int &frame_nr, // Store progress of the frame number
     session->request_normal_frame();
   }
 
+  // The stage converts into the session's frames; stop it before the session goes anywhere
+  convert_stage.reset();
+
   // When pausing for a display reinit, the capture thread is blocked waiting for every other
   // shared_ptr<display_t> to be released (it spins until use_count() == 1). This encode thread
   // holds three of those references: the by-value 'disp' parameter, the display kept inside the
@@ -1897,7 +2815,8 @@ make_encode_device(platf::display_t &disp, const encoder_t &encoder, const confi
   return result;
 }
 
-void capture(safe::mail_t mail, config_t config, void *channel_data) {
+void capture(safe::mail_t mail, config_t config, void *channel_data,
+             packet_allocator_t *packet_allocator, platf::cursor_sink_t *cursor_sink) {
   auto shutdown_event = mail->event<bool>(mail::shutdown);
 
   auto images = std::make_shared<img_event_t::element_type>();
@@ -1906,12 +2825,12 @@ void capture(safe::mail_t mail, config_t config, void *channel_data) {
     shutdown_event->raise(true);
   });
 
-  auto ref = capture_thread_async.ref();
+  auto ref = capture_threads.ref(config.display);
   if (!ref) {
     return;
   }
 
-  ref->capture_ctx_queue->raise(capture_ctx_t{images, &config});
+  ref->capture_ctx_queue->raise(capture_ctx_t{images, &config, cursor_sink});
 
   if (!ref->capture_ctx_queue->running()) {
     return;
@@ -1994,7 +2913,7 @@ void capture(safe::mail_t mail, config_t config, void *channel_data) {
     hdr_event->raise(std::move(hdr_info));
 
     encode_run(frame_nr, mail, images, &config, display, std::move(encode_device),
-               ref->reinit_event, *ref->encoder_p, channel_data);
+               ref->reinit_event, *ref->encoder_p, channel_data, packet_allocator);
   }
 }
 
@@ -2010,7 +2929,7 @@ int validate_config(std::shared_ptr<platf::display_t> disp, const encoder_t &enc
   }
 
   auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height,
-                                     std::move(encode_device));
+                                     std::move(encode_device), nullptr);
   if (!session) {
     return -1;
   }
@@ -2383,7 +3302,10 @@ int probe_encoders() {
 
   auto &encoder = *chosen_encoder;
 
-  last_encoder_probe_supported_ref_frames_invalidation = (encoder.flags & REF_FRAMES_INVALIDATION);
+  // The software encoder only keeps older frames to fall back on when asked to
+  last_encoder_probe_supported_ref_frames_invalidation =
+      (encoder.flags & REF_FRAMES_INVALIDATION) &&
+      (&encoder != &software || config::video.rfi_refs > 1);
 
   BOOST_LOG(debug) << "------  h264 ------"sv;
   for (int x = 0; x < encoder_t::MAX_FLAGS; ++x) {
@@ -2493,7 +3415,8 @@ int start_capture_async(capture_thread_async_ctx_t &capture_thread_ctx) {
 
   capture_thread_ctx.capture_thread = std::thread{
       captureThread, capture_thread_ctx.capture_ctx_queue, std::ref(capture_thread_ctx.display_wp),
-      std::ref(capture_thread_ctx.reinit_event), std::ref(*capture_thread_ctx.encoder_p)};
+      std::ref(capture_thread_ctx.reinit_event), std::ref(*capture_thread_ctx.encoder_p),
+      std::cref(capture_thread_ctx.display_name)};
 
   return 0;
 }
@@ -2539,4 +3462,12 @@ platf::pix_fmt_e map_pix_fmt(AVPixelFormat fmt) {
   return platf::pix_fmt_e::unknown;
 }
 
+int intra_refresh_period(const config_t &config) {
+  if (config.intraRefreshPeriod > 0) {
+    return config.intraRefreshPeriod;
+  }
+
+  return std::max(1, (config.framerate * 200) / 1000);
+}
+
 } // namespace video
@@ -4,6 +4,7 @@
  */
 #pragma once
 
+#include "frame_trace.h"
 #include "platform/common.h"
 #include "thread_safe.h"
 #include "video_colorspace.h"
@@ -44,8 +45,13 @@ struct config_t {
   int chromaSamplingType; // 0 - 4:2:0, 1 - 4:4:4
 
   int enableIntraRefresh; // 0 - disabled, 1 - enabled
+  int intraRefreshPeriod; // Frames per intra refresh wave, 0 - a fifth of a second
+  int idrByIntraRefresh;  // With intra refresh, 1 - IDR frame requests wait for the next wave
 };
 
+/** Frames an intra refresh wave of a config with enableIntraRefresh takes to cover the picture. */
+int intra_refresh_period(const config_t &config);
+
 platf::mem_type_e map_base_dev_type(AVHWDeviceType type);
 platf::pix_fmt_e map_pix_fmt(AVPixelFormat fmt);
 
@@ -207,6 +213,32 @@ struct encode_session_t {
   virtual void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
 
   virtual void set_bitrate(int bitrate, int framerate) = 0;
+
+  /**
+   * Frames still to be encoded before the recovery the last request_idr_frame() asked for is
+   * complete, for sessions that recover through an intra refresh wave instead of an IDR frame.
+   */
+  virtual int recovery_frames() {
+    return 0;
+  }
+
+  /**
+   * Sessions with a second frame buffer can convert the next image into it while the current
+   * frame is being encoded; convert_ahead() may run on another thread than the encoder.
+   */
+  virtual bool can_convert_ahead() {
+    return false;
+  }
+
+  /** Convert into the second frame buffer, which the encoder doesn't read. */
+  virtual int convert_ahead(platf::img_t &img) {
+    return -1;
+  }
+
+  /** Encode the frame convert_ahead() filled next. Never called during convert_ahead(). */
+  virtual int present_ahead() {
+    return -1;
+  }
 };
 
 // encoders
@@ -241,9 +273,17 @@ struct packet_raw_t {
   std::vector<replace_t> *replacements = nullptr;
   void *channel_data = nullptr;
   bool after_ref_frame_invalidation = false;
+  bool starts_intra_refresh = false; ///< The picture is whole again once this wave has run
   std::optional<double> encode_duration_us;
+  std::optional<double> convert_duration_us;
+  std::optional<double> convert_wait_us; ///< Time the encoder waited for a conversion to finish
+  std::optional<double> capture_age_us;  ///< Time from capture to the start of encoding
+  std::uint32_t skipped_converts = 0;    ///< Unchanged captures not converted since the last frame
+  std::uint32_t skipped_encodes = 0;     ///< Unchanged frames not encoded since the last frame
+  double skipped_us = 0;                 ///< Estimated CPU time the skips saved
   std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
   std::uint64_t rtp_sample_duration = 0;
+  std::optional<frame_trace::record_t> trace;
 };
 
 struct packet_raw_avcodec : packet_raw_t {
@@ -317,7 +357,32 @@ extern int active_hevc_mode;
 extern int active_av1_mode;
 extern bool last_encoder_probe_supported_ref_frames_invalidation;
 
-void capture(safe::mail_t mail, config_t config, void *channel_data);
+/**
+ * @brief Destination for encoded bitstreams, so encoders can write straight into the consumer's
+ *        memory instead of a heap buffer that gets copied later.
+ *
+ * Only used by avcodec encoders that support AV_CODEC_CAP_DR1. Must be thread-safe: packets
+ * are released on whichever thread drops the last reference.
+ */
+class packet_allocator_t {
+public:
+  virtual ~packet_allocator_t() = default;
+
+  /**
+   * @return At least `size` writable bytes, or nullptr to fall back to FFmpeg's own buffer.
+   */
+  virtual void *allocate(std::size_t size) = 0;
+
+  /** Called once for every buffer returned by allocate(). */
+  virtual void release(void *data) = 0;
+};
+
+/**
+ * @param cursor_sink When set, the pointer is published there instead of drawn into the frames.
+ */
+void capture(safe::mail_t mail, config_t config, void *channel_data,
+             packet_allocator_t *packet_allocator = nullptr,
+             platf::cursor_sink_t *cursor_sink = nullptr);
 
 int probe_encoders();
 
@@ -0,0 +1,677 @@
+/**
+ * @file src/video_convert.cpp
+ * @brief Scalar and SIMD BGRX to YUV kernels.
+ *
+ * Every kernel computes the same integer expression, so they agree bit for bit:
+ *
+ *   sample = clamp((kb * B + kg * G + kr * R + offset) >> kShift)
+ *
+ * where B, G and R are 8-bit, or for 4:2:0 chroma the sums over a 2x2 block with two more
+ * bits of shift. The SIMD versions mask each BGRX pixel into (B, R) and (G, X) pairs of
+ * 16-bit lanes so a single multiply-add per pair does the dot product.
+ */
+#include "video_convert.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define VIDEO_CONVERT_X86
+  #include <immintrin.h>
+
+  // Kernels are compiled for their instruction set regardless of the build's -march
+  #define TARGET_SSE41 __attribute__((target("sse4.1")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+  #define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#endif
+
+using namespace std::literals;
+
+namespace video::convert {
+namespace {
+using weights_t = std::int32_t[4];
+
+template <class T>
+constexpr int kMax = sizeof(T) == 1 ? 255 : 1023;
+
+/** One sample from B, G and R that each sum 2^log2_pixels pixels. */
+template <class T, int Shift>
+T sample(const weights_t &k, int b, int g, int r, int log2_pixels) {
+  auto value = (k[0] * b + k[1] * g + k[2] * r + k[3] * (1 << log2_pixels)) >>
+               (kShift + log2_pixels);
+  return (T)(std::clamp(value, 0, kMax<T>) << Shift);
+}
+
+const std::uint32_t *row(const image_t &image, int y) {
+  return (const std::uint32_t *)(image.data + (std::ptrdiff_t)y * image.row_pitch);
+}
+
+template <class T>
+T *row(const planes_t &planes, int plane, int y) {
+  return (T *)(planes.data[plane] + (std::ptrdiff_t)y * planes.linesize[plane]);
+}
+
+/**
+ * The reference kernels, and the tails the SIMD kernels leave over.
+ * @param begin First pixel to convert; the SIMD kernels have done the ones before it.
+ */
+struct scalar_t {
+  template <class T, int Shift>
+  static void pixels(const std::uint32_t *src, int begin, int width, T *dst,
+                     const weights_t &k) {
+    for (int x = begin; x < width; ++x) {
+      auto px = src[x];
+      dst[x] = sample<T, Shift>(k, px & 0xff, px >> 8 & 0xff, px >> 16 & 0xff, 0);
+    }
+  }
+
+  /** @param u Interleaved UV if `Interleaved`, and `v` is unused. */
+  template <class T, int Shift, bool Interleaved>
+  static void chroma420(const std::uint32_t *src0, const std::uint32_t *src1, int begin,
+                        int width, T *u, T *v, const coefficients_t &k) {
+    for (int x = begin; x < width; x += 2) {
+      auto x1 = std::min(x + 1, width - 1);
+
+      int b = 0, g = 0, r = 0;
+      for (auto px : {src0[x], src0[x1], src1[x], src1[x1]}) {
+        b += px & 0xff;
+        g += px >> 8 & 0xff;
+        r += px >> 16 & 0xff;
+      }
+
+      auto i = x / 2;
+      if constexpr (Interleaved) {
+        u[i * 2] = sample<T, Shift>(k.u, b, g, r, 2);
+        u[i * 2 + 1] = sample<T, Shift>(k.v, b, g, r, 2);
+      } else {
+        u[i] = sample<T, Shift>(k.u, b, g, r, 2);
+        v[i] = sample<T, Shift>(k.v, b, g, r, 2);
+      }
+    }
+  }
+};
+
+#ifdef VIDEO_CONVERT_X86
+std::int32_t pair(std::int32_t low, std::int32_t high) {
+  return (std::int32_t)((std::uint32_t)high << 16 | ((std::uint32_t)low & 0xffff));
+}
+
+struct sse41_t {
+  /** (B, R) and (G, X) multipliers, and the offset, broadcast for madd. */
+  struct lanes {
+    __m128i br;
+    __m128i g;
+    __m128i offset;
+  };
+
+  TARGET_SSE41 static lanes broadcast(const weights_t &k, int log2_pixels) {
+    return {_mm_set1_epi32(pair(k[0], k[2])), _mm_set1_epi32(pair(k[1], 0)),
+            _mm_set1_epi32(k[3] * (1 << log2_pixels))};
+  }
+
+  TARGET_SSE41 static __m128i br(__m128i px) {
+    return _mm_and_si128(px, _mm_set1_epi32(0x00ff00ff));
+  }
+
+  TARGET_SSE41 static __m128i gx(__m128i px) {
+    return _mm_and_si128(_mm_srli_epi32(px, 8), _mm_set1_epi32(0x00ff00ff));
+  }
+
+  template <int Bits>
+  TARGET_SSE41 static __m128i dot(__m128i br, __m128i gx, const lanes &k) {
+    auto sum = _mm_add_epi32(_mm_madd_epi16(br, k.br), _mm_madd_epi16(gx, k.g));
+    return _mm_srai_epi32(_mm_add_epi32(sum, k.offset), Bits);
+  }
+
+  /** Two vectors of 32-bit samples to eight 16-bit ones, clamped and shifted. */
+  template <class T, int Shift>
+  TARGET_SSE41 static __m128i narrow(__m128i a, __m128i b) {
+    auto words = _mm_packus_epi32(a, b);
+    if constexpr (sizeof(T) == 2) {
+      words = _mm_slli_epi16(_mm_min_epu16(words, _mm_set1_epi16(kMax<T>)), Shift);
+    }
+    return words;
+  }
+
+  template <class T>
+  TARGET_SSE41 static void store(T *dst, __m128i words) {
+    if constexpr (sizeof(T) == 1) {
+      _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(words, words));
+    } else {
+      _mm_storeu_si128((__m128i *)dst, words);
+    }
+  }
+
+  template <class T>
+  TARGET_SSE41 static void store_interleaved(T *dst, __m128i u, __m128i v) {
+    auto low = _mm_unpacklo_epi16(u, v);
+    auto high = _mm_unpackhi_epi16(u, v);
+    if constexpr (sizeof(T) == 1) {
+      _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(low, high));
+    } else {
+      _mm_storeu_si128((__m128i *)dst, low);
+      _mm_storeu_si128((__m128i *)dst + 1, high);
+    }
+  }
+
+  template <class T, int Shift>
+  TARGET_SSE41 static void pixels(const std::uint32_t *src, int width, T *dst,
+                                  const weights_t &weights) {
+    auto k = broadcast(weights, 0);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+      auto a = _mm_loadu_si128((const __m128i *)(src + x));
+      auto b = _mm_loadu_si128((const __m128i *)(src + x + 4));
+      store(dst + x, narrow<T, Shift>(dot<kShift>(br(a), gx(a), k), dot<kShift>(br(b), gx(b), k)));
+    }
+
+    scalar_t::pixels<T, Shift>(src, x, width, dst, weights);
+  }
+
+  /** Sums of 2x2 blocks for 8 pixels of two rows, as four (B, R) and (G, X) pairs. */
+  TARGET_SSE41 static void sum4(const std::uint32_t *src0, const std::uint32_t *src1,
+                                __m128i &sum_br, __m128i &sum_gx) {
+    auto a0 = _mm_loadu_si128((const __m128i *)src0);
+    auto a1 = _mm_loadu_si128((const __m128i *)src1);
+    auto b0 = _mm_loadu_si128((const __m128i *)src0 + 1);
+    auto b1 = _mm_loadu_si128((const __m128i *)src1 + 1);
+
+    // Sums stay under 2^16, so 32-bit adds keep the two halves apart
+    sum_br = _mm_hadd_epi32(_mm_add_epi32(br(a0), br(a1)), _mm_add_epi32(br(b0), br(b1)));
+    sum_gx = _mm_hadd_epi32(_mm_add_epi32(gx(a0), gx(a1)), _mm_add_epi32(gx(b0), gx(b1)));
+  }
+
+  template <class T, int Shift, bool Interleaved>
+  TARGET_SSE41 static void chroma420(const std::uint32_t *src0, const std::uint32_t *src1,
+                                     int width, T *u, T *v, const coefficients_t &weights) {
+    auto ku = broadcast(weights.u, 2);
+    auto kv = broadcast(weights.v, 2);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i br_a, gx_a, br_b, gx_b;
+      sum4(src0 + x, src1 + x, br_a, gx_a);
+      sum4(src0 + x + 8, src1 + x + 8, br_b, gx_b);
+
+      auto u_words = narrow<T, Shift>(dot<kShift + 2>(br_a, gx_a, ku),
+                                      dot<kShift + 2>(br_b, gx_b, ku));
+      auto v_words = narrow<T, Shift>(dot<kShift + 2>(br_a, gx_a, kv),
+                                      dot<kShift + 2>(br_b, gx_b, kv));
+      if constexpr (Interleaved) {
+        store_interleaved(u + x, u_words, v_words);
+      } else {
+        store(u + x / 2, u_words);
+        store(v + x / 2, v_words);
+      }
+    }
+
+    scalar_t::chroma420<T, Shift, Interleaved>(src0, src1, x, width, u, v, weights);
+  }
+};
+
+struct avx2_t {
+  /** (B, R) and (G, X) multipliers, and the offset, broadcast for madd. */
+  struct lanes {
+    __m256i br;
+    __m256i g;
+    __m256i offset;
+  };
+
+  TARGET_AVX2 static lanes broadcast(const weights_t &k, int log2_pixels) {
+    return {_mm256_set1_epi32(pair(k[0], k[2])), _mm256_set1_epi32(pair(k[1], 0)),
+            _mm256_set1_epi32(k[3] * (1 << log2_pixels))};
+  }
+
+  TARGET_AVX2 static __m256i br(__m256i px) {
+    return _mm256_and_si256(px, _mm256_set1_epi32(0x00ff00ff));
+  }
+
+  TARGET_AVX2 static __m256i gx(__m256i px) {
+    return _mm256_and_si256(_mm256_srli_epi32(px, 8), _mm256_set1_epi32(0x00ff00ff));
+  }
+
+  template <int Bits>
+  TARGET_AVX2 static __m256i dot(__m256i br, __m256i gx, const lanes &k) {
+    auto sum = _mm256_add_epi32(_mm256_madd_epi16(br, k.br), _mm256_madd_epi16(gx, k.g));
+    return _mm256_srai_epi32(_mm256_add_epi32(sum, k.offset), Bits);
+  }
+
+  /** 16 words in order; packs work within 128-bit lanes, so undo their interleaving. */
+  template <class T, int Shift>
+  TARGET_AVX2 static __m256i narrow(__m256i a, __m256i b) {
+    auto words = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+    if constexpr (sizeof(T) == 2) {
+      words = _mm256_slli_epi16(_mm256_min_epu16(words, _mm256_set1_epi16(kMax<T>)), Shift);
+    }
+    return words;
+  }
+
+  template <class T>
+  TARGET_AVX2 static void store(T *dst, __m256i words) {
+    if constexpr (sizeof(T) == 1) {
+      auto bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0xd8);
+      _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(bytes));
+    } else {
+      _mm256_storeu_si256((__m256i *)dst, words);
+    }
+  }
+
+  template <class T>
+  TARGET_AVX2 static void store_interleaved(T *dst, __m256i u, __m256i v) {
+    auto low = _mm256_unpacklo_epi16(u, v);
+    auto high = _mm256_unpackhi_epi16(u, v);
+    auto first = _mm256_permute2x128_si256(low, high, 0x20);
+    auto second = _mm256_permute2x128_si256(low, high, 0x31);
+    if constexpr (sizeof(T) == 1) {
+      auto bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(first, second), 0xd8);
+      _mm256_storeu_si256((__m256i *)dst, bytes);
+    } else {
+      _mm256_storeu_si256((__m256i *)dst, first);
+      _mm256_storeu_si256((__m256i *)dst + 1, second);
+    }
+  }
+
+  template <class T, int Shift>
+  TARGET_AVX2 static void pixels(const std::uint32_t *src, int width, T *dst,
+                                 const weights_t &weights) {
+    auto k = broadcast(weights, 0);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      auto a = _mm256_loadu_si256((const __m256i *)(src + x));
+      auto b = _mm256_loadu_si256((const __m256i *)(src + x + 8));
+      store(dst + x, narrow<T, Shift>(dot<kShift>(br(a), gx(a), k), dot<kShift>(br(b), gx(b), k)));
+    }
+
+    scalar_t::pixels<T, Shift>(src, x, width, dst, weights);
+  }
+
+  /** Sums of 2x2 blocks for 16 pixels of two rows, as eight (B, R) and (G, X) pairs. */
+  TARGET_AVX2 static void sum4(const std::uint32_t *src0, const std::uint32_t *src1,
+                               __m256i &sum_br, __m256i &sum_gx) {
+    auto a0 = _mm256_loadu_si256((const __m256i *)src0);
+    auto a1 = _mm256_loadu_si256((const __m256i *)src1);
+    auto b0 = _mm256_loadu_si256((const __m256i *)src0 + 1);
+    auto b1 = _mm256_loadu_si256((const __m256i *)src1 + 1);
+
+    // hadd works within 128-bit lanes, leaving the blocks in 0 1 4 5 2 3 6 7 order
+    auto br_sum = _mm256_hadd_epi32(_mm256_add_epi32(br(a0), br(a1)),
+                                    _mm256_add_epi32(br(b0), br(b1)));
+    auto gx_sum = _mm256_hadd_epi32(_mm256_add_epi32(gx(a0), gx(a1)),
+                                    _mm256_add_epi32(gx(b0), gx(b1)));
+    sum_br = _mm256_permute4x64_epi64(br_sum, 0xd8);
+    sum_gx = _mm256_permute4x64_epi64(gx_sum, 0xd8);
+  }
+
+  template <class T, int Shift, bool Interleaved>
+  TARGET_AVX2 static void chroma420(const std::uint32_t *src0, const std::uint32_t *src1,
+                                    int width, T *u, T *v, const coefficients_t &weights) {
+    auto ku = broadcast(weights.u, 2);
+    auto kv = broadcast(weights.v, 2);
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+      __m256i br_a, gx_a, br_b, gx_b;
+      sum4(src0 + x, src1 + x, br_a, gx_a);
+      sum4(src0 + x + 16, src1 + x + 16, br_b, gx_b);
+
+      auto u_words = narrow<T, Shift>(dot<kShift + 2>(br_a, gx_a, ku),
+                                      dot<kShift + 2>(br_b, gx_b, ku));
+      auto v_words = narrow<T, Shift>(dot<kShift + 2>(br_a, gx_a, kv),
+                                      dot<kShift + 2>(br_b, gx_b, kv));
+      if constexpr (Interleaved) {
+        store_interleaved(u + x, u_words, v_words);
+      } else {
+        store(u + x / 2, u_words);
+        store(v + x / 2, v_words);
+      }
+    }
+
+    scalar_t::chroma420<T, Shift, Interleaved>(src0, src1, x, width, u, v, weights);
+  }
+};
+
+/** Same as avx2_t with twice the width; stores go through avx2_t once narrowed. */
+struct avx512_t {
+  /** (B, R) and (G, X) multipliers, and the offset, broadcast for madd. */
+  struct lanes {
+    __m512i br;
+    __m512i g;
+    __m512i offset;
+  };
+
+  TARGET_AVX512 static lanes broadcast(const weights_t &k, int log2_pixels) {
+    return {_mm512_set1_epi32(pair(k[0], k[2])), _mm512_set1_epi32(pair(k[1], 0)),
+            _mm512_set1_epi32(k[3] * (1 << log2_pixels))};
+  }
+
+  TARGET_AVX512 static __m512i br(__m512i px) {
+    return _mm512_and_si512(px, _mm512_set1_epi32(0x00ff00ff));
+  }
+
+  TARGET_AVX512 static __m512i gx(__m512i px) {
+    return _mm512_and_si512(_mm512_srli_epi32(px, 8), _mm512_set1_epi32(0x00ff00ff));
+  }
+
+  template <int Bits>
+  TARGET_AVX512 static __m512i dot(__m512i br, __m512i gx, const lanes &k) {
+    auto sum = _mm512_add_epi32(_mm512_madd_epi16(br, k.br), _mm512_madd_epi16(gx, k.g));
+    return _mm512_srai_epi32(_mm512_add_epi32(sum, k.offset), Bits);
+  }
+
+  /** 16 samples to 16 words in order, clamped and shifted. */
+  template <class T, int Shift>
+  TARGET_AVX512 static __m256i narrow(__m512i samples) {
+    auto clamped = _mm512_min_epi32(_mm512_max_epi32(samples, _mm512_setzero_si512()),
+                                    _mm512_set1_epi32(kMax<T>));
+    return _mm256_slli_epi16(_mm512_cvtepi32_epi16(clamped), Shift);
+  }
+
+  template <class T, int Shift>
+  TARGET_AVX512 static void pixels(const std::uint32_t *src, int width, T *dst,
+                                   const weights_t &weights) {
+    auto k = broadcast(weights, 0);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      auto a = _mm512_loadu_si512((const void *)(src + x));
+      avx2_t::store(dst + x, narrow<T, Shift>(dot<kShift>(br(a), gx(a), k)));
+    }
+
+    scalar_t::pixels<T, Shift>(src, x, width, dst, weights);
+  }
+
+  /** Sums of 2x2 blocks for 16 pixels of two rows, in the low halves of 64-bit lanes. */
+  TARGET_AVX512 static __m256i sum4(__m512i row0, __m512i row1) {
+    auto sum = _mm512_add_epi32(row0, row1);
+    return _mm512_cvtepi64_epi32(_mm512_add_epi32(sum, _mm512_srli_epi64(sum, 32)));
+  }
+
+  TARGET_AVX512 static __m512i join(__m256i low, __m256i high) {
+    return _mm512_inserti64x4(_mm512_castsi256_si512(low), high, 1);
+  }
+
+  template <class T, int Shift, bool Interleaved>
+  TARGET_AVX512 static void chroma420(const std::uint32_t *src0, const std::uint32_t *src1,
+                                      int width, T *u, T *v, const coefficients_t &weights) {
+    auto ku = broadcast(weights.u, 2);
+    auto kv = broadcast(weights.v, 2);
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+      auto a0 = _mm512_loadu_si512((const void *)(src0 + x));
+      auto a1 = _mm512_loadu_si512((const void *)(src1 + x));
+      auto b0 = _mm512_loadu_si512((const void *)(src0 + x + 16));
+      auto b1 = _mm512_loadu_si512((const void *)(src1 + x + 16));
+
+      auto sum_br = join(sum4(br(a0), br(a1)), sum4(br(b0), br(b1)));
+      auto sum_gx = join(sum4(gx(a0), gx(a1)), sum4(gx(b0), gx(b1)));
+
+      auto u_words = narrow<T, Shift>(dot<kShift + 2>(sum_br, sum_gx, ku));
+      auto v_words = narrow<T, Shift>(dot<kShift + 2>(sum_br, sum_gx, kv));
+      if constexpr (Interleaved) {
+        avx2_t::store_interleaved(u + x, u_words, v_words);
+      } else {
+        avx2_t::store(u + x / 2, u_words);
+        avx2_t::store(v + x / 2, v_words);
+      }
+    }
+
+    scalar_t::chroma420<T, Shift, Interleaved>(src0, src1, x, width, u, v, weights);
+  }
+};
+#endif
+
+/** scalar_t has the same interface as the SIMD kernels, starting from the first pixel. */
+struct reference_t {
+  template <class T, int Shift>
+  static void pixels(const std::uint32_t *src, int width, T *dst, const weights_t &weights) {
+    scalar_t::pixels<T, Shift>(src, 0, width, dst, weights);
+  }
+
+  template <class T, int Shift, bool Interleaved>
+  static void chroma420(const std::uint32_t *src0, const std::uint32_t *src1, int width, T *u,
+                        T *v, const coefficients_t &weights) {
+    scalar_t::chroma420<T, Shift, Interleaved>(src0, src1, 0, width, u, v, weights);
+  }
+};
+
+template <class Kernel, class T, int Shift, bool Interleaved>
+void convert_420(const image_t &image, const planes_t &planes, const coefficients_t &k,
+                 int first_row, int last_row) {
+  for (int y = first_row; y < last_row; y += 2) {
+    auto last = y + 1 >= image.height;
+    auto src0 = row(image, y);
+    auto src1 = last ? src0 : row(image, y + 1);
+
+    Kernel::template pixels<T, Shift>(src0, image.width, row<T>(planes, 0, y), k.y);
+    if (!last) {
+      Kernel::template pixels<T, Shift>(src1, image.width, row<T>(planes, 0, y + 1), k.y);
+    }
+
+    auto v = Interleaved ? nullptr : row<T>(planes, 2, y / 2);
+    Kernel::template chroma420<T, Shift, Interleaved>(src0, src1, image.width,
+                                                      row<T>(planes, 1, y / 2), v, k);
+  }
+}
+
+template <class Kernel, class T>
+void convert_444(const image_t &image, const planes_t &planes, const coefficients_t &k,
+                 int first_row, int last_row) {
+  for (int y = first_row; y < last_row; ++y) {
+    auto src = row(image, y);
+    Kernel::template pixels<T, 0>(src, image.width, row<T>(planes, 0, y), k.y);
+    Kernel::template pixels<T, 0>(src, image.width, row<T>(planes, 1, y), k.u);
+    Kernel::template pixels<T, 0>(src, image.width, row<T>(planes, 2, y), k.v);
+  }
+}
+
+using convert_fn = void (*)(const image_t &, const planes_t &, const coefficients_t &, int, int);
+
+template <class Kernel>
+convert_fn kernel(format_e format) {
+  switch (format) {
+  case format_e::yuv420p:
+    return &convert_420<Kernel, std::uint8_t, 0, false>;
+  case format_e::yuv420p10:
+    return &convert_420<Kernel, std::uint16_t, 0, false>;
+  case format_e::nv12:
+    return &convert_420<Kernel, std::uint8_t, 0, true>;
+  case format_e::p010:
+    return &convert_420<Kernel, std::uint16_t, 6, true>;
+  case format_e::yuv444p:
+    return &convert_444<Kernel, std::uint8_t>;
+  case format_e::yuv444p10:
+    return &convert_444<Kernel, std::uint16_t>;
+  }
+
+  return nullptr;
+}
+} // namespace
+
+coefficients_t make_coefficients(const float color_vec_y[4], const float color_vec_u[4],
+                                 const float color_vec_v[4], const float range_y[2],
+                                 const float range_uv[2], int bit_depth) {
+  // Limited range scales with the bit depth (16..235 becomes 64..940), full range spans
+  // every code
+  auto full_range = range_y[1] == 0.0f;
+  auto peak = full_range ? (double)((1 << bit_depth) - 1) : (double)(255 << (bit_depth - 8));
+  auto one = (double)(1 << kShift);
+
+  auto scale = [&](const float vec[4], const float range[2], weights_t &k) {
+    // color_vec_* multiplies R, G and B; the kernels take B, G and R
+    auto gain = range[0] * peak / 255 * one;
+    k[0] = (std::int32_t)std::lround(vec[2] * gain);
+    k[1] = (std::int32_t)std::lround(vec[1] * gain);
+    k[2] = (std::int32_t)std::lround(vec[0] * gain);
+    k[3] = (std::int32_t)std::lround((vec[3] * range[0] + range[1]) * peak * one) +
+           (1 << (kShift - 1));
+  };
+
+  coefficients_t coefficients;
+  scale(color_vec_y, range_y, coefficients.y);
+  scale(color_vec_u, range_uv, coefficients.u);
+  scale(color_vec_v, range_uv, coefficients.v);
+  return coefficients;
+}
+
+std::string_view to_string(format_e format) {
+  switch (format) {
+  case format_e::yuv420p:
+    return "yuv420p"sv;
+  case format_e::yuv420p10:
+    return "yuv420p10"sv;
+  case format_e::nv12:
+    return "nv12"sv;
+  case format_e::p010:
+    return "p010"sv;
+  case format_e::yuv444p:
+    return "yuv444p"sv;
+  case format_e::yuv444p10:
+    return "yuv444p10"sv;
+  }
+
+  return "unknown"sv;
+}
+
+std::string_view to_string(isa_e isa) {
+  switch (isa) {
+  case isa_e::scalar:
+    return "scalar"sv;
+  case isa_e::sse41:
+    return "sse4.1"sv;
+  case isa_e::avx2:
+    return "avx2"sv;
+  case isa_e::avx512:
+    return "avx512"sv;
+  }
+
+  return "unknown"sv;
+}
+
+std::optional<isa_e> isa_from_string(std::string_view name) {
+  for (auto isa : {isa_e::scalar, isa_e::sse41, isa_e::avx2, isa_e::avx512}) {
+    if (to_string(isa) == name) {
+      return isa;
+    }
+  }
+
+  return std::nullopt;
+}
+
+int bit_depth(format_e format) {
+  switch (format) {
+  case format_e::yuv420p10:
+  case format_e::p010:
+  case format_e::yuv444p10:
+    return 10;
+  default:
+    return 8;
+  }
+}
+
+bool supported(isa_e isa) {
+#ifdef VIDEO_CONVERT_X86
+  __builtin_cpu_init();
+  switch (isa) {
+  case isa_e::scalar:
+    return true;
+  case isa_e::sse41:
+    return __builtin_cpu_supports("sse4.1");
+  case isa_e::avx2:
+    return __builtin_cpu_supports("avx2");
+  case isa_e::avx512:
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+  }
+#endif
+
+  return isa == isa_e::scalar;
+}
+
+isa_e best_isa() {
+  static const auto best = []() {
+    for (auto isa : {isa_e::avx512, isa_e::avx2, isa_e::sse41}) {
+      if (supported(isa)) {
+        return isa;
+      }
+    }
+    return isa_e::scalar;
+  }();
+
+  return best;
+}
+
+void convert(format_e format, const image_t &image, const planes_t &planes,
+             const coefficients_t &coefficients) {
+  convert(format, image, planes, coefficients, best_isa());
+}
+
+void convert(format_e format, const image_t &image, const planes_t &planes,
+             const coefficients_t &coefficients, isa_e isa) {
+  convert_rows(format, image, planes, coefficients, isa, 0, image.height);
+}
+
+std::pair<int, int> stripe_rows(format_e format, int height, int stripes, int stripe) {
+  // 4:2:0 chroma rows come from pairs of image rows, so stripes are cut between pairs
+  auto unit = format == format_e::yuv444p || format == format_e::yuv444p10 ? 1 : 2;
+  auto units = (height + unit - 1) / unit;
+
+  auto first = std::min((int)((std::int64_t)units * stripe / stripes) * unit, height);
+  auto last = std::min((int)((std::int64_t)units * (stripe + 1) / stripes) * unit, height);
+  return {first, last};
+}
+
+void convert_rows(format_e format, const image_t &image, const planes_t &planes,
+                  const coefficients_t &coefficients, isa_e isa, int first_row, int last_row) {
+  convert_fn fn = nullptr;
+  switch (isa) {
+#ifdef VIDEO_CONVERT_X86
+  case isa_e::sse41:
+    fn = kernel<sse41_t>(format);
+    break;
+  case isa_e::avx2:
+    fn = kernel<avx2_t>(format);
+    break;
+  case isa_e::avx512:
+    fn = kernel<avx512_t>(format);
+    break;
+#endif
+  default:
+    fn = kernel<reference_t>(format);
+    break;
+  }
+
+  fn(image, planes, coefficients, first_row, last_row);
+}
+
+void convert_region(format_e format, const image_t &image, const planes_t &planes,
+                    const coefficients_t &coefficients, isa_e isa, int first_column,
+                    int last_column, int first_row, int last_row) {
+  // The columns as an image of their own, with the planes moved along to match. Rows stay
+  // where they are, so the last row of the image is still found for 4:2:0 chroma.
+  auto sample = bit_depth(format) > 8 ? 2 : 1;
+  auto chroma_column = first_column;
+  switch (format) {
+  case format_e::yuv420p:
+  case format_e::yuv420p10:
+    chroma_column = first_column / 2;
+    break;
+  default:
+    // Interleaved chroma has a U and a V sample for every other column
+    break;
+  }
+
+  image_t columns{image.data + (std::ptrdiff_t)first_column * 4, image.row_pitch,
+                  last_column - first_column, image.height};
+  planes_t shifted = planes;
+  shifted.data[0] += (std::ptrdiff_t)first_column * sample;
+  for (int plane = 1; plane < 3; ++plane) {
+    if (shifted.data[plane]) {
+      shifted.data[plane] += (std::ptrdiff_t)chroma_column * sample;
+    }
+  }
+
+  convert_rows(format, columns, shifted, coefficients, isa, first_row, last_row);
+}
+} // namespace video::convert
@@ -0,0 +1,118 @@
+/**
+ * @file src/video_convert.h
+ * @brief BGRX to YUV conversion for the software encode device.
+ *
+ * When the captured image already has the encoder's size, converting it is a matrix
+ * multiply per pixel plus 2x2 averaging for 4:2:0 chroma; swscale's Lanczos path is far
+ * more than that needs. These kernels do it in fixed point with SSE4.1, AVX2 or AVX-512,
+ * whichever the CPU has, and a scalar version that defines the expected output: every
+ * kernel produces exactly the same bytes. swscale is still used whenever scaling is needed.
+ *
+ * Nothing here depends on FFmpeg; video.cpp maps AVPixelFormat and video::color_t onto it.
+ */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+namespace video::convert {
+enum class format_e {
+  yuv420p,   ///< 8-bit, three planes
+  yuv420p10, ///< 10-bit in the low bits of 16, three planes
+  nv12,      ///< 8-bit, luma plane and interleaved chroma plane
+  p010,      ///< 10-bit in the high bits of 16, luma plane and interleaved chroma plane
+  yuv444p,   ///< 8-bit, three full-size planes
+  yuv444p10, ///< 10-bit in the low bits of 16, three full-size planes
+};
+
+enum class isa_e {
+  scalar,
+  sse41,
+  avx2,
+  avx512, ///< AVX-512 F and BW
+};
+
+/** Fractional bits of coefficients_t */
+constexpr int kShift = 13;
+
+/**
+ * A video::color_t scaled to integers for one output bit depth.
+ * Each row holds the B, G and R multipliers and the offset, times 2^kShift, with the
+ * rounding term already folded into the offset.
+ */
+struct coefficients_t {
+  std::int32_t y[4];
+  std::int32_t u[4];
+  std::int32_t v[4];
+};
+
+/**
+ * @param color_vec_y,color_vec_u,color_vec_v,range_y,range_uv As in video::color_t.
+ * @param bit_depth 8 or 10.
+ */
+coefficients_t make_coefficients(const float color_vec_y[4], const float color_vec_u[4],
+                                 const float color_vec_v[4], const float range_y[2],
+                                 const float range_uv[2], int bit_depth);
+
+/** A BGRX image, 4 bytes per pixel. */
+struct image_t {
+  const std::uint8_t *data;
+  int row_pitch;
+  int width;
+  int height;
+};
+
+/** Destination planes, laid out like AVFrame::data and AVFrame::linesize. */
+struct planes_t {
+  std::uint8_t *data[3];
+  int linesize[3];
+};
+
+std::string_view to_string(format_e format);
+std::string_view to_string(isa_e isa);
+
+std::optional<isa_e> isa_from_string(std::string_view name);
+
+int bit_depth(format_e format);
+
+/** Whether this build has kernels for `isa` and the CPU can run them. */
+bool supported(isa_e isa);
+
+/** The fastest supported isa_e, detected once. */
+isa_e best_isa();
+
+/**
+ * Convert `image` into `planes`, which have the same width and height, with best_isa().
+ * Odd sizes are handled by repeating the last column or row for 4:2:0 chroma.
+ */
+void convert(format_e format, const image_t &image, const planes_t &planes,
+             const coefficients_t &coefficients);
+
+/** @param isa Must be supported(). */
+void convert(format_e format, const image_t &image, const planes_t &planes,
+             const coefficients_t &coefficients, isa_e isa);
+
+/**
+ * Rows [first, last) of stripe `stripe` when splitting an image `height` rows tall into
+ * `stripes`. For 4:2:0 formats stripes start on even rows, so no chroma row is split.
+ * Trailing stripes may be empty when there are more stripes than rows.
+ */
+std::pair<int, int> stripe_rows(format_e format, int height, int stripes, int stripe);
+
+/**
+ * Convert only rows [first_row, last_row) of `image`, as from stripe_rows(); stripes of one
+ * image can be converted in parallel.
+ */
+void convert_rows(format_e format, const image_t &image, const planes_t &planes,
+                  const coefficients_t &coefficients, isa_e isa, int first_row, int last_row);
+
+/**
+ * Convert only columns [first_column, last_column) of rows [first_row, last_row), leaving
+ * the rest of `planes` as it was. For 4:2:0 formats the first column and row must be even.
+ */
+void convert_region(format_e format, const image_t &image, const planes_t &planes,
+                    const coefficients_t &coefficients, isa_e isa, int first_column,
+                    int last_column, int first_row, int last_row);
+} // namespace video::convert
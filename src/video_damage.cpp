@@ -0,0 +1,398 @@
+/**
+ * @file src/video_damage.cpp
+ * @brief Scalar and SIMD frame fingerprints.
+ *
+ * The fingerprint follows the accumulate step of XXH3. Each row is read in 64-byte blocks
+ * of eight 64-bit words, and word i of a block updates eight accumulators as
+ *
+ *   acc[i ^ 1] += word
+ *   acc[i] += low32(word ^ key[i]) * high32(word ^ key[i])
+ *
+ * The keys advance with every block and the accumulators are scrambled after every row, so
+ * content moved to another block or row hashes differently. A row's last partial block is
+ * zero-padded and always done in scalar code, like the scrambling and the final mix.
+ *
+ * diff() compares two images a row of a tile at a time, ORing the XOR of both into a vector
+ * and testing it once per row. Tiles already found changed aren't read again.
+ */
+#include "video_damage.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define VIDEO_DAMAGE_X86
+  #include <immintrin.h>
+
+  // Kernels are compiled for their instruction set regardless of the build's -march
+  #define TARGET_SSE41 __attribute__((target("sse4.1")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+  #define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+namespace video::damage {
+namespace {
+constexpr int kLanes = 8;
+constexpr int kBlock = kLanes * sizeof(std::uint64_t);
+
+/** Random initial keys, and what's added to them for every block of a row */
+alignas(64) constexpr std::uint64_t kSecret[kLanes]{
+    0xbe4ba423396cfeb8, 0x1cad21f72c81017c, 0xdb979083e96dd4de, 0x1f67b3b7a4a44072,
+    0x78e5c0cc4ee679cb, 0x2172ffcc7dd05a82, 0x8e2443f7744608b8, 0x4c263a81e69035e0,
+};
+alignas(64) constexpr std::uint64_t kStep[kLanes]{
+    0x9e3779b97f4a7c15, 0xc2b2ae3d27d4eb4f, 0x165667b19e3779f9, 0x85ebca77c2b2ae63,
+    0x27d4eb2f165667c5, 0xd6e8feb86659fd93, 0xff51afd7ed558ccd, 0xc4ceb9fe1a85ec53,
+};
+alignas(64) constexpr std::uint64_t kInit[kLanes]{
+    0x00000000c2b2ae3d, 0x9e3779b185ebca87, 0xc2b2ae3d27d4eb4f, 0x165667b19e3779f9,
+    0x85ebca77c2b2ae63, 0x0000000085ebca77, 0x27d4eb2f165667c5, 0x000000009e3779b1,
+};
+constexpr std::uint64_t kPrime32 = 0x9e3779b1;
+
+const std::uint8_t *row(const std::uint8_t *data, int row_pitch, int y) {
+  return data + (std::ptrdiff_t)y * row_pitch;
+}
+
+/**
+ * The reference kernel, and the one for partial blocks.
+ * @param key The keys of the first block, advanced past the last one on return.
+ */
+void accumulate_scalar(std::uint64_t acc[kLanes], const std::uint8_t *src, int blocks,
+                       std::uint64_t key[kLanes]) {
+  for (int block = 0; block < blocks; ++block, src += kBlock) {
+    for (int i = 0; i < kLanes; ++i) {
+      std::uint64_t word;
+      std::memcpy(&word, src + i * sizeof(word), sizeof(word));
+
+      auto keyed = word ^ key[i];
+      acc[i ^ 1] += word;
+      acc[i] += (keyed & 0xffffffff) * (keyed >> 32);
+      key[i] += kStep[i];
+    }
+  }
+}
+
+/** Whether `bytes` bytes at a and b differ */
+bool differs_scalar(const std::uint8_t *a, const std::uint8_t *b, int bytes) {
+  return std::memcmp(a, b, bytes) != 0;
+}
+
+#ifdef VIDEO_DAMAGE_X86
+TARGET_SSE41 bool differs_sse41(const std::uint8_t *a, const std::uint8_t *b, int bytes) {
+  auto any = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= bytes; i += 16) {
+    auto va = _mm_loadu_si128((const __m128i *)(a + i));
+    auto vb = _mm_loadu_si128((const __m128i *)(b + i));
+    any = _mm_or_si128(any, _mm_xor_si128(va, vb));
+  }
+  return !_mm_testz_si128(any, any) || differs_scalar(a + i, b + i, bytes - i);
+}
+
+TARGET_AVX2 bool differs_avx2(const std::uint8_t *a, const std::uint8_t *b, int bytes) {
+  auto any = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 32 <= bytes; i += 32) {
+    auto va = _mm256_loadu_si256((const __m256i *)(a + i));
+    auto vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    any = _mm256_or_si256(any, _mm256_xor_si256(va, vb));
+  }
+  return !_mm256_testz_si256(any, any) || differs_scalar(a + i, b + i, bytes - i);
+}
+
+TARGET_AVX512 bool differs_avx512(const std::uint8_t *a, const std::uint8_t *b, int bytes) {
+  auto any = _mm512_setzero_si512();
+  int i = 0;
+  for (; i + 64 <= bytes; i += 64) {
+    auto va = _mm512_loadu_si512(a + i);
+    auto vb = _mm512_loadu_si512(b + i);
+    any = _mm512_or_si512(any, _mm512_xor_si512(va, vb));
+  }
+  return _mm512_test_epi64_mask(any, any) || differs_scalar(a + i, b + i, bytes - i);
+}
+
+TARGET_SSE41 void accumulate_sse41(std::uint64_t acc[kLanes], const std::uint8_t *src,
+                                   int blocks, std::uint64_t key[kLanes]) {
+  __m128i a[4], k[4], step[4];
+  for (int j = 0; j < 4; ++j) {
+    a[j] = _mm_loadu_si128((const __m128i *)acc + j);
+    k[j] = _mm_loadu_si128((const __m128i *)key + j);
+    step[j] = _mm_load_si128((const __m128i *)kStep + j);
+  }
+
+  for (int block = 0; block < blocks; ++block, src += kBlock) {
+    for (int j = 0; j < 4; ++j) {
+      auto word = _mm_loadu_si128((const __m128i *)src + j);
+      auto keyed = _mm_xor_si128(word, k[j]);
+      auto product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+      auto swapped = _mm_shuffle_epi32(word, _MM_SHUFFLE(1, 0, 3, 2));
+      a[j] = _mm_add_epi64(a[j], _mm_add_epi64(swapped, product));
+      k[j] = _mm_add_epi64(k[j], step[j]);
+    }
+  }
+
+  for (int j = 0; j < 4; ++j) {
+    _mm_storeu_si128((__m128i *)acc + j, a[j]);
+    _mm_storeu_si128((__m128i *)key + j, k[j]);
+  }
+}
+
+TARGET_AVX2 void accumulate_avx2(std::uint64_t acc[kLanes], const std::uint8_t *src, int blocks,
+                                 std::uint64_t key[kLanes]) {
+  __m256i a[2], k[2], step[2];
+  for (int j = 0; j < 2; ++j) {
+    a[j] = _mm256_loadu_si256((const __m256i *)acc + j);
+    k[j] = _mm256_loadu_si256((const __m256i *)key + j);
+    step[j] = _mm256_load_si256((const __m256i *)kStep + j);
+  }
+
+  for (int block = 0; block < blocks; ++block, src += kBlock) {
+    for (int j = 0; j < 2; ++j) {
+      auto word = _mm256_loadu_si256((const __m256i *)src + j);
+      auto keyed = _mm256_xor_si256(word, k[j]);
+      auto product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+      auto swapped = _mm256_shuffle_epi32(word, _MM_SHUFFLE(1, 0, 3, 2));
+      a[j] = _mm256_add_epi64(a[j], _mm256_add_epi64(swapped, product));
+      k[j] = _mm256_add_epi64(k[j], step[j]);
+    }
+  }
+
+  for (int j = 0; j < 2; ++j) {
+    _mm256_storeu_si256((__m256i *)acc + j, a[j]);
+    _mm256_storeu_si256((__m256i *)key + j, k[j]);
+  }
+}
+
+TARGET_AVX512 void accumulate_avx512(std::uint64_t acc[kLanes], const std::uint8_t *src,
+                                     int blocks, std::uint64_t key[kLanes]) {
+  auto a = _mm512_loadu_si512(acc);
+  auto k = _mm512_loadu_si512(key);
+  auto step = _mm512_load_si512(kStep);
+
+  for (int block = 0; block < blocks; ++block, src += kBlock) {
+    auto word = _mm512_loadu_si512(src);
+    auto keyed = _mm512_xor_si512(word, k);
+    auto product = _mm512_mul_epu32(keyed, _mm512_srli_epi64(keyed, 32));
+    auto swapped = _mm512_shuffle_epi32(word, _MM_PERM_BADC);
+    a = _mm512_add_epi64(a, _mm512_add_epi64(swapped, product));
+    k = _mm512_add_epi64(k, step);
+  }
+
+  _mm512_storeu_si512(acc, a);
+  _mm512_storeu_si512(key, k);
+}
+#endif
+
+using accumulate_t = void (*)(std::uint64_t *, const std::uint8_t *, int, std::uint64_t *);
+
+accumulate_t kernel(convert::isa_e isa) {
+  switch (isa) {
+#ifdef VIDEO_DAMAGE_X86
+  case convert::isa_e::sse41:
+    return accumulate_sse41;
+  case convert::isa_e::avx2:
+    return accumulate_avx2;
+  case convert::isa_e::avx512:
+    return accumulate_avx512;
+#endif
+  default:
+    return accumulate_scalar;
+  }
+}
+
+using differs_t = bool (*)(const std::uint8_t *, const std::uint8_t *, int);
+
+differs_t differs(convert::isa_e isa) {
+  switch (isa) {
+#ifdef VIDEO_DAMAGE_X86
+  case convert::isa_e::sse41:
+    return differs_sse41;
+  case convert::isa_e::avx2:
+    return differs_avx2;
+  case convert::isa_e::avx512:
+    return differs_avx512;
+#endif
+  default:
+    return differs_scalar;
+  }
+}
+
+std::uint64_t mix(std::uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53;
+  h ^= h >> 33;
+  return h;
+}
+} // namespace
+
+tiles_t::tiles_t(int width, int height)
+    : width{std::max(width, 0)}, height{std::max(height, 0)},
+      columns{(this->width + kTileWidth - 1) / kTileWidth},
+      rows{(this->height + kTileHeight - 1) / kTileHeight},
+      marked((std::size_t)columns * rows) {
+}
+
+void tiles_t::mark(const rect_t &rect) {
+  auto x0 = std::max(rect.x, 0);
+  auto y0 = std::max(rect.y, 0);
+  auto x1 = std::min((std::int64_t)rect.x + rect.width, (std::int64_t)width);
+  auto y1 = std::min((std::int64_t)rect.y + rect.height, (std::int64_t)height);
+  if (x0 >= x1 || y0 >= y1) {
+    return;
+  }
+
+  auto column_end = (int)((x1 + kTileWidth - 1) / kTileWidth);
+  auto row_end = (int)((y1 + kTileHeight - 1) / kTileHeight);
+  for (int row = y0 / kTileHeight; row < row_end; ++row) {
+    auto first = marked.begin() + (std::ptrdiff_t)row * columns;
+    std::fill(first + x0 / kTileWidth, first + column_end, 1);
+  }
+}
+
+void tiles_t::mark(const std::vector<rect_t> &rects) {
+  for (auto &rect : rects) {
+    mark(rect);
+  }
+}
+
+void tiles_t::mark_all() {
+  std::fill(marked.begin(), marked.end(), 1);
+}
+
+void tiles_t::clear() {
+  std::fill(marked.begin(), marked.end(), 0);
+}
+
+int tiles_t::count() const {
+  return (int)std::count(marked.begin(), marked.end(), 1);
+}
+
+int tiles_t::size() const {
+  return (int)marked.size();
+}
+
+std::vector<rect_t> tiles_t::rects() const {
+  std::vector<rect_t> result;
+
+  // Rectangles that reach the bottom of the previous row, left to right
+  std::vector<std::size_t> open;
+  std::vector<std::size_t> still_open;
+  for (int row = 0; row < rows; ++row) {
+    auto y = row * kTileHeight;
+    auto tile_height = std::min(kTileHeight, height - y);
+    auto row_marked = &marked[(std::size_t)row * columns];
+
+    still_open.clear();
+    std::size_t candidate = 0;
+    for (int column = 0; column < columns;) {
+      if (!row_marked[column]) {
+        ++column;
+        continue;
+      }
+
+      auto end = column;
+      while (end < columns && row_marked[end]) {
+        ++end;
+      }
+      auto x = column * kTileWidth;
+      rect_t run{x, y, std::min(end * kTileWidth, width) - x, tile_height};
+      column = end;
+
+      while (candidate < open.size() && result[open[candidate]].x < run.x) {
+        ++candidate;
+      }
+      if (candidate < open.size() && result[open[candidate]].x == run.x &&
+          result[open[candidate]].width == run.width) {
+        result[open[candidate]].height += run.height;
+        still_open.push_back(open[candidate++]);
+      } else {
+        result.push_back(run);
+        still_open.push_back(result.size() - 1);
+      }
+    }
+    std::swap(open, still_open);
+  }
+
+  return result;
+}
+
+std::vector<rect_t> diff(const convert::image_t &previous, const convert::image_t &current) {
+  return diff(previous, current, convert::best_isa());
+}
+
+std::vector<rect_t> diff(const convert::image_t &previous, const convert::image_t &current,
+                         convert::isa_e isa) {
+  auto compare = differs(isa);
+  tiles_t tiles{current.width, current.height};
+
+  auto columns = (current.width + kTileWidth - 1) / kTileWidth;
+  std::vector<std::uint8_t> changed(columns);
+  for (int y0 = 0; y0 < current.height; y0 += kTileHeight) {
+    std::fill(changed.begin(), changed.end(), 0);
+
+    auto y1 = std::min(y0 + kTileHeight, current.height);
+    for (int y = y0; y < y1; ++y) {
+      auto a = row(previous.data, previous.row_pitch, y);
+      auto b = row(current.data, current.row_pitch, y);
+      for (int column = 0; column < columns; ++column) {
+        if (changed[column]) {
+          continue;
+        }
+
+        auto x = column * kTileWidth;
+        auto bytes = (std::min(x + kTileWidth, current.width) - x) * 4;
+        changed[column] = compare(a + (std::ptrdiff_t)x * 4, b + (std::ptrdiff_t)x * 4, bytes);
+      }
+    }
+
+    for (int column = 0; column < columns; ++column) {
+      if (changed[column]) {
+        tiles.mark({column * kTileWidth, y0, kTileWidth, y1 - y0});
+      }
+    }
+  }
+
+  return tiles.rects();
+}
+
+std::uint64_t fingerprint(const std::uint8_t *data, int row_pitch, int width_bytes, int height) {
+  return fingerprint(data, row_pitch, width_bytes, height, convert::best_isa());
+}
+
+std::uint64_t fingerprint(const std::uint8_t *data, int row_pitch, int width_bytes, int height,
+                          convert::isa_e isa) {
+  auto accumulate = kernel(isa);
+  auto blocks = width_bytes / kBlock;
+  auto tail = width_bytes % kBlock;
+
+  std::uint64_t acc[kLanes];
+  std::memcpy(acc, kInit, sizeof(acc));
+  for (int y = 0; y < height; ++y) {
+    auto src = row(data, row_pitch, y);
+
+    std::uint64_t key[kLanes];
+    std::memcpy(key, kSecret, sizeof(key));
+    accumulate(acc, src, blocks, key);
+
+    if (tail) {
+      std::uint8_t padded[kBlock]{};
+      std::memcpy(padded, src + (std::ptrdiff_t)blocks * kBlock, tail);
+      accumulate_scalar(acc, padded, 1, key);
+    }
+
+    // Make the rows' order matter
+    for (int i = 0; i < kLanes; ++i) {
+      acc[i] = (acc[i] ^ acc[i] >> 47 ^ kSecret[i]) * kPrime32;
+    }
+  }
+
+  auto h = mix((std::uint64_t)width_bytes << 32 | (std::uint32_t)height);
+  for (auto lane : acc) {
+    h = mix(h ^ lane);
+  }
+  return h;
+}
+} // namespace video::damage
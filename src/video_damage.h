@@ -0,0 +1,86 @@
+/**
+ * @file src/video_damage.h
+ * @brief Finding out what changed between captured frames.
+ *
+ * Desktop captures are mostly identical from one frame to the next. A fingerprint of the
+ * pixels lets the encode thread skip converting a capture that matches the one it already
+ * converted, and where only part of a capture changed, the rectangles that did let it
+ * convert just those. Both are computed with SSE4.1, AVX2 or AVX-512 where the CPU has them,
+ * and every kernel gives the same result as the scalar one.
+ *
+ * Nothing here depends on FFmpeg or the capture backends.
+ */
+#pragma once
+
+#include "video_convert.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace video::damage {
+/** Pixels of an image; empty if width or height isn't positive. */
+struct rect_t {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+/** Size of the tiles damage is tracked in, in pixels. Even, so 4:2:0 chroma isn't split. */
+constexpr int kTileWidth = 64;
+constexpr int kTileHeight = 32;
+
+/** The tiles of a width x height image, each marked when something in it may have changed. */
+class tiles_t {
+public:
+  tiles_t() = default;
+  tiles_t(int width, int height);
+
+  /** Mark every tile `rect` touches; the part outside the image is ignored. */
+  void mark(const rect_t &rect);
+  void mark(const std::vector<rect_t> &rects);
+  void mark_all();
+  void clear();
+
+  /** Marked tiles */
+  int count() const;
+
+  /** All tiles */
+  int size() const;
+
+  /**
+   * The marked tiles as rectangles clipped to the image, in rows from the top. Runs of
+   * marked tiles along a row are one rectangle, which grows downwards while the rows below
+   * have the same run.
+   */
+  std::vector<rect_t> rects() const;
+
+private:
+  int width = 0;
+  int height = 0;
+  int columns = 0;
+  int rows = 0;
+  std::vector<std::uint8_t> marked;
+};
+
+/**
+ * Tiles where `current` differs from `previous`, as from tiles_t::rects(). Both images must
+ * have the same size.
+ */
+std::vector<rect_t> diff(const convert::image_t &previous, const convert::image_t &current);
+
+/** @param isa Must be video::convert::supported(). */
+std::vector<rect_t> diff(const convert::image_t &previous, const convert::image_t &current,
+                         convert::isa_e isa);
+
+/**
+ * A 64-bit hash of `width_bytes` bytes in each of `height` rows, `row_pitch` bytes apart.
+ * Bytes in the padding past `width_bytes` are ignored. Not meant to resist deliberate
+ * collisions; moving content around the image does change it.
+ */
+std::uint64_t fingerprint(const std::uint8_t *data, int row_pitch, int width_bytes, int height);
+
+/** @param isa Must be video::convert::supported(). */
+std::uint64_t fingerprint(const std::uint8_t *data, int row_pitch, int width_bytes, int height,
+                          convert::isa_e isa);
+} // namespace video::damage
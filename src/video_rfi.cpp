@@ -0,0 +1,76 @@
+/**
+ * @file src/video_rfi.cpp
+ * @brief Which reference frames a software encoder can fall back on after the host loses some.
+ */
+#include "video_rfi.h"
+
+#include <algorithm>
+
+namespace video::rfi {
+dpb_t::dpb_t(int size) : size{(std::size_t)std::max(size, 1)} {
+}
+
+bool dpb_t::encoded(std::int64_t frame, bool idr) {
+  if (idr) {
+    frames.clear();
+    last_idr = frame;
+    last_invalidated.reset();
+  }
+
+  frames.push_back({frame, true});
+  if (frames.size() > size) {
+    frames.pop_front();
+  }
+
+  return std::exchange(confirm, false);
+}
+
+dpb_t::action_e dpb_t::invalidate(std::int64_t first, std::int64_t last) {
+  if (frames.empty() || last < first || first > frames.back().frame) {
+    return action_e::idr;
+  }
+
+  // Asked again before the encoder caught up; marking again would throw away the frames
+  // encoded since, which don't depend on the lost ones
+  if (last_invalidated && first >= last_invalidated->first && last <= last_invalidated->second) {
+    return action_e::none;
+  }
+
+  // Frames before the last IDR frame aren't referenced anymore, but losing the IDR frame itself
+  // leaves nothing to predict from
+  if (last < last_idr) {
+    return action_e::none;
+  }
+  if (first <= last_idr) {
+    return action_e::idr;
+  }
+
+  for (auto &reference : frames) {
+    if (reference.frame >= first) {
+      reference.usable = false;
+    }
+  }
+  if (!newest_usable()) {
+    return action_e::idr;
+  }
+
+  // Every frame up to the newest one depends on the lost ones
+  last_invalidated.emplace(first, frames.back().frame);
+  confirm = true;
+  return action_e::invalidate;
+}
+
+std::optional<std::int64_t> dpb_t::newest_usable() const {
+  for (auto reference = frames.rbegin(); reference != frames.rend(); ++reference) {
+    if (reference->usable) {
+      return reference->frame;
+    }
+  }
+
+  return std::nullopt;
+}
+
+const std::deque<dpb_t::reference_t> &dpb_t::references() const {
+  return frames;
+}
+} // namespace video::rfi
@@ -0,0 +1,63 @@
+/**
+ * @file src/video_rfi.h
+ * @brief Which reference frames a software encoder can fall back on after the host loses some.
+ *
+ * An encoder that keeps several reference frames can stop predicting from the frames the host
+ * lost and predict from an older one the host still has, which costs far less than an IDR
+ * frame. dpb_t follows the sliding window of references x264 keeps when there are no B-frames,
+ * the way x264_encoder_invalidate_reference() marks them, to tell whether such a frame is left.
+ *
+ * Nothing here depends on FFmpeg or the encoders.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <utility>
+
+namespace video::rfi {
+class dpb_t {
+public:
+  struct reference_t {
+    std::int64_t frame;
+    bool usable; ///< Not invalidated
+  };
+
+  enum class action_e {
+    none,       ///< Nothing the encoder still references was lost, or it was invalidated already
+    invalidate, ///< Have the encoder stop predicting from the first lost frame and later ones
+    idr,        ///< No usable reference would be left, so send an IDR frame
+  };
+
+  /** size is the number of reference frames the encoder keeps, at least 1 */
+  explicit dpb_t(int size);
+
+  /**
+   * A frame came out of the encoder and is the newest reference now; an IDR frame replaces all
+   * the others. Returns whether it's the first frame since invalidate() asked for an
+   * invalidation, which the host is told about.
+   */
+  bool encoded(std::int64_t frame, bool idr);
+
+  /**
+   * The host lost frames first to last. When the answer is action_e::invalidate, every
+   * reference from first on is marked unusable, as everything encoded since depends on them.
+   */
+  action_e invalidate(std::int64_t first, std::int64_t last);
+
+  /** The newest reference the encoder may still predict from */
+  std::optional<std::int64_t> newest_usable() const;
+
+  /** Oldest first */
+  const std::deque<reference_t> &references() const;
+
+private:
+  std::size_t size;
+  std::deque<reference_t> frames;
+  std::int64_t last_idr = 0;
+  std::optional<std::pair<std::int64_t, std::int64_t>> last_invalidated;
+  bool confirm = false;
+};
+} // namespace video::rfi
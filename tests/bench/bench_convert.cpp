@@ -0,0 +1,330 @@
+/**
+ * @file tests/bench/bench_convert.cpp
+ * @brief Time per frame of the video::convert kernels, and of swscale where it's linked.
+ *
+ * Converts a synthetic display frame at each resolution to each format, with every kernel
+ * the CPU supports, split into as many stripes as there are --threads on a stripe_pool_t
+ * like the software encode device does. Speedup is relative to the first kernel and thread
+ * count. Built with BENCH_CONVERT_SWSCALE, it also runs swscale with the flags the software
+ * encode device used before these kernels, and reports the largest difference between its
+ * output and ours, in code values.
+ *
+ * Usage: bench_convert [--resolutions WxH,...] [--formats f,...] [--isa i,...]
+ *                      [--threads N,...] [--pattern desktop|text|noise] [--frames N]
+ */
+#include "platform/synthetic.h"
+#include "stripe_pool.h"
+#include "video_convert.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef BENCH_CONVERT_SWSCALE
+extern "C" {
+#include <libswscale/swscale.h>
+}
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+namespace convert = video::convert;
+
+struct options_t {
+  std::vector<std::pair<int, int>> resolutions{{1920, 1080}, {2560, 1440}, {3840, 2160}};
+  std::vector<convert::format_e> formats{convert::format_e::yuv420p, convert::format_e::nv12,
+                                         convert::format_e::yuv444p, convert::format_e::p010};
+  std::vector<convert::isa_e> isas{convert::isa_e::scalar, convert::isa_e::sse41,
+                                   convert::isa_e::avx2, convert::isa_e::avx512};
+  std::vector<int> threads{1};
+  platf::synthetic::pattern_e pattern = platf::synthetic::pattern_e::desktop;
+  int frames = 200;
+};
+
+/** BT.709 limited range, the default for SDR sessions; see video_colorspace.cpp */
+convert::coefficients_t bt709(int bit_depth) {
+  constexpr float Cr = 0.2126f, Cb = 0.0722f, Cg = 1.0f - Cr - Cb;
+  const float y[4]{Cr, Cg, Cb, 0.0f};
+  const float u[4]{-(Cr * 0.5f / (1.0f - Cb)), -(Cg * 0.5f / (1.0f - Cb)), 0.5f, 0.5f};
+  const float v[4]{0.5f, -(Cg * 0.5f / (1.0f - Cr)), -(Cb * 0.5f / (1.0f - Cr)), 0.5f};
+  const float range_y[2]{219.0f / 255, 16.0f / 255};
+  const float range_uv[2]{224.0f / 255, 16.0f / 255};
+  return convert::make_coefficients(y, u, v, range_y, range_uv, bit_depth);
+}
+
+/** Planes of one frame, tightly packed apart from 64-byte aligned rows. */
+struct frame_t {
+  frame_t(convert::format_e format, int width, int height) {
+    auto sample = convert::bit_depth(format) > 8 ? 2 : 1;
+    auto full = format == convert::format_e::yuv444p || format == convert::format_e::yuv444p10;
+    auto interleaved = format == convert::format_e::nv12 || format == convert::format_e::p010;
+    auto chroma_width = full ? width : (width + 1) / 2;
+    auto chroma_height = full ? height : (height + 1) / 2;
+
+    samples[0] = width;
+    samples[1] = samples[2] = chroma_width;
+    if (interleaved) {
+      samples[1] *= 2;
+      samples[2] = 0;
+    }
+
+    for (int plane = 0; plane < 3; ++plane) {
+      linesize[plane] = (samples[plane] * sample + 63) / 64 * 64;
+      rows[plane] = plane ? chroma_height : height;
+      storage[plane].resize((std::size_t)linesize[plane] * rows[plane]);
+    }
+  }
+
+  convert::planes_t planes() {
+    return {{storage[0].data(), storage[1].data(), storage[2].data()},
+            {linesize[0], linesize[1], linesize[2]}};
+  }
+
+  int samples[3]; ///< Per row; U and V count separately when interleaved
+  int linesize[3];
+  int rows[3];
+  std::vector<std::uint8_t> storage[3];
+};
+
+double ms_per_frame(std::chrono::nanoseconds elapsed, int frames) {
+  return std::chrono::duration<double, std::milli>(elapsed).count() / frames;
+}
+
+#ifdef BENCH_CONVERT_SWSCALE
+AVPixelFormat av_format(convert::format_e format) {
+  switch (format) {
+  case convert::format_e::yuv420p:
+    return AV_PIX_FMT_YUV420P;
+  case convert::format_e::yuv420p10:
+    return AV_PIX_FMT_YUV420P10;
+  case convert::format_e::nv12:
+    return AV_PIX_FMT_NV12;
+  case convert::format_e::p010:
+    return AV_PIX_FMT_P010;
+  case convert::format_e::yuv444p:
+    return AV_PIX_FMT_YUV444P;
+  case convert::format_e::yuv444p10:
+    return AV_PIX_FMT_YUV444P10;
+  }
+
+  return AV_PIX_FMT_NONE;
+}
+
+/** Largest difference between two frames in code values. */
+int max_difference(convert::format_e format, const frame_t &a, const frame_t &b) {
+  auto wide = convert::bit_depth(format) > 8;
+  auto shift = format == convert::format_e::p010 ? 6 : 0;
+
+  int result = 0;
+  for (int plane = 0; plane < 3; ++plane) {
+    for (int y = 0; y < a.rows[plane]; ++y) {
+      auto row_a = a.storage[plane].data() + (std::size_t)y * a.linesize[plane];
+      auto row_b = b.storage[plane].data() + (std::size_t)y * b.linesize[plane];
+      for (int x = 0; x < a.samples[plane]; ++x) {
+        int value_a = row_a[x], value_b = row_b[x];
+        if (wide) {
+          std::uint16_t word_a, word_b;
+          std::memcpy(&word_a, row_a + x * 2, 2);
+          std::memcpy(&word_b, row_b + x * 2, 2);
+          value_a = word_a >> shift;
+          value_b = word_b >> shift;
+        }
+        result = std::max(result, std::abs(value_a - value_b));
+      }
+    }
+  }
+  return result;
+}
+
+/** What the software encode device ran for every frame before video::convert. */
+double run_swscale(convert::format_e format, const convert::image_t &image, const frame_t &ours,
+                   int frames, int &difference) {
+  auto sws = sws_getContext(image.width, image.height, AV_PIX_FMT_BGR0, image.width, image.height,
+                            av_format(format), SWS_LANCZOS | SWS_ACCURATE_RND, nullptr, nullptr,
+                            nullptr);
+  sws_setColorspaceDetails(sws, sws_getCoefficients(SWS_CS_DEFAULT), 0,
+                           sws_getCoefficients(SWS_CS_ITU709), 0, 0, 1 << 16, 1 << 16);
+
+  frame_t theirs{format, image.width, image.height};
+  const std::uint8_t *src[4]{image.data};
+  const int src_stride[4]{image.row_pitch};
+  std::uint8_t *dst[4]{theirs.storage[0].data(), theirs.storage[1].data(),
+                       theirs.storage[2].data()};
+  const int dst_stride[4]{theirs.linesize[0], theirs.linesize[1], theirs.linesize[2]};
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; ++i) {
+    sws_scale(sws, src, src_stride, 0, image.height, dst, dst_stride);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  sws_freeContext(sws);
+
+  difference = max_difference(format, ours, theirs);
+
+  return ms_per_frame(elapsed, frames);
+}
+#endif
+
+std::vector<std::string> split(std::string_view list) {
+  std::vector<std::string> items;
+  while (!list.empty()) {
+    auto comma = list.find(',');
+    items.emplace_back(list.substr(0, comma));
+    list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+  }
+  return items;
+}
+
+bool parse_args(int argc, char *argv[], options_t &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string_view value = argv[++i];
+
+    if (arg == "--resolutions"sv) {
+      options.resolutions.clear();
+      for (auto &item : split(value)) {
+        int width, height;
+        if (std::sscanf(item.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 ||
+            height <= 0) {
+          return false;
+        }
+        options.resolutions.emplace_back(width, height);
+      }
+    } else if (arg == "--formats"sv) {
+      options.formats.clear();
+      for (auto &item : split(value)) {
+        bool found = false;
+        for (auto format : {convert::format_e::yuv420p, convert::format_e::yuv420p10,
+                            convert::format_e::nv12, convert::format_e::p010,
+                            convert::format_e::yuv444p, convert::format_e::yuv444p10}) {
+          if (convert::to_string(format) == item) {
+            options.formats.push_back(format);
+            found = true;
+          }
+        }
+        if (!found) {
+          return false;
+        }
+      }
+    } else if (arg == "--isa"sv) {
+      options.isas.clear();
+      for (auto &item : split(value)) {
+        auto isa = convert::isa_from_string(item);
+        if (!isa) {
+          return false;
+        }
+        options.isas.push_back(*isa);
+      }
+    } else if (arg == "--threads"sv) {
+      options.threads.clear();
+      for (auto &item : split(value)) {
+        auto threads = std::atoi(item.c_str());
+        if (threads <= 0) {
+          return false;
+        }
+        options.threads.push_back(threads);
+      }
+    } else if (arg == "--pattern"sv) {
+      auto spec = platf::synthetic::parse_spec(value, {});
+      if (!spec) {
+        return false;
+      }
+      options.pattern = spec->pattern;
+    } else if (arg == "--frames"sv) {
+      options.frames = std::atoi(argv[i]);
+    } else {
+      return false;
+    }
+  }
+
+  return !options.resolutions.empty() && !options.formats.empty() && !options.isas.empty() &&
+         !options.threads.empty() && options.frames > 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  if (!parse_args(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "usage: %s [--resolutions WxH,...] [--formats f,...] [--isa i,...]\n"
+                 "          [--threads N,...] [--pattern desktop|text|noise] [--frames N]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  stripe_pool_t pool{*std::max_element(options.threads.begin(), options.threads.end()) - 1};
+
+  std::printf("%-10s %-10s %-8s %7s %10s %8s\n", "resolution", "format", "kernel", "threads",
+              "ms/frame", "speedup");
+  for (auto [width, height] : options.resolutions) {
+    platf::synthetic::spec_t spec;
+    spec.pattern = options.pattern;
+    spec.width = width;
+    spec.height = height;
+
+    std::vector<std::uint8_t> pixels((std::size_t)width * height * 4);
+    platf::synthetic::generator_t{spec}.render(0, pixels.data(), width * 4, true);
+    convert::image_t image{pixels.data(), width * 4, width, height};
+
+    auto name = std::to_string(width) + 'x' + std::to_string(height);
+    for (auto format : options.formats) {
+      auto coefficients = bt709(convert::bit_depth(format));
+      frame_t frame{format, width, height};
+      auto planes = frame.planes();
+
+      double baseline = 0;
+      for (auto isa : options.isas) {
+        if (!convert::supported(isa)) {
+          continue;
+        }
+
+        for (auto threads : options.threads) {
+          auto convert_frame = [&]() {
+            pool.run(threads, [&](int stripe) {
+              auto [first, last] = convert::stripe_rows(format, height, threads, stripe);
+              convert::convert_rows(format, image, planes, coefficients, isa, first, last);
+            });
+          };
+
+          // One untimed frame to fault the planes in
+          convert_frame();
+
+          auto start = std::chrono::steady_clock::now();
+          for (int i = 0; i < options.frames; ++i) {
+            convert_frame();
+          }
+          auto ms = ms_per_frame(std::chrono::steady_clock::now() - start, options.frames);
+
+          if (baseline == 0) {
+            baseline = ms;
+          }
+          std::printf("%-10s %-10s %-8s %7d %10.3f %7.1fx\n", name.c_str(),
+                      std::string{convert::to_string(format)}.c_str(),
+                      std::string{convert::to_string(isa)}.c_str(), threads, ms, baseline / ms);
+        }
+      }
+
+#ifdef BENCH_CONVERT_SWSCALE
+      int difference = 0;
+      auto ms = run_swscale(format, image, frame, options.frames, difference);
+      std::printf("%-10s %-10s %-8s %7d %10.3f %8s  max difference %d\n", name.c_str(),
+                  std::string{convert::to_string(format)}.c_str(), "swscale", 1, ms, "",
+                  difference);
+#endif
+    }
+  }
+
+  return 0;
+}
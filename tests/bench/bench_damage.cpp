@@ -0,0 +1,295 @@
+/**
+ * @file tests/bench/bench_damage.cpp
+ * @brief Time per frame to find and convert only what changed, against converting it all.
+ *
+ * Plays synthetic desktop content through video::damage::diff() and converts the changed
+ * tiles the way the software encode device does, with as many workers as --threads on a
+ * stripe_pool_t. Scenarios are the desktop pattern with its moving cursor, and a window of a
+ * given share of the screen whose contents change every frame, like a video playing. The
+ * damaged column is the share of tiles converted; convert time should follow it, where
+ * converting the whole frame costs the same whatever changed.
+ *
+ * Usage: bench_damage [--resolutions WxH,...] [--windows percent,...] [--format f]
+ *                     [--threads N] [--frames N]
+ */
+#include "platform/synthetic.h"
+#include "stripe_pool.h"
+#include "video_convert.h"
+#include "video_damage.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+namespace convert = video::convert;
+namespace damage = video::damage;
+
+struct options_t {
+  std::vector<std::pair<int, int>> resolutions{{1920, 1080}, {3840, 2160}};
+  std::vector<int> windows{1, 5, 10, 25, 50, 100};
+  convert::format_e format = convert::format_e::yuv420p;
+  int threads = 1;
+  int frames = 100;
+};
+
+/** BT.709 limited range, as in bench_convert */
+convert::coefficients_t bt709(int bit_depth) {
+  constexpr float Cr = 0.2126f, Cb = 0.0722f, Cg = 1.0f - Cr - Cb;
+  const float y[4]{Cr, Cg, Cb, 0.0f};
+  const float u[4]{-(Cr * 0.5f / (1.0f - Cb)), -(Cg * 0.5f / (1.0f - Cb)), 0.5f, 0.5f};
+  const float v[4]{0.5f, -(Cg * 0.5f / (1.0f - Cr)), -(Cb * 0.5f / (1.0f - Cr)), 0.5f};
+  const float range_y[2]{219.0f / 255, 16.0f / 255};
+  const float range_uv[2]{224.0f / 255, 16.0f / 255};
+  return convert::make_coefficients(y, u, v, range_y, range_uv, bit_depth);
+}
+
+/** Planes of one frame, tightly packed */
+struct frame_t {
+  frame_t(convert::format_e format, int width, int height) {
+    auto sample = convert::bit_depth(format) > 8 ? 2 : 1;
+    auto full = format == convert::format_e::yuv444p || format == convert::format_e::yuv444p10;
+    auto interleaved = format == convert::format_e::nv12 || format == convert::format_e::p010;
+    auto chroma_width = full ? width : (width + 1) / 2;
+    auto chroma_height = full ? height : (height + 1) / 2;
+
+    linesize[0] = width * sample;
+    linesize[1] = linesize[2] = chroma_width * sample;
+    if (interleaved) {
+      linesize[1] *= 2;
+      linesize[2] = 0;
+    }
+    for (int plane = 0; plane < 3; ++plane) {
+      storage[plane].resize((std::size_t)linesize[plane] * (plane ? chroma_height : height));
+    }
+  }
+
+  convert::planes_t planes() {
+    return {{storage[0].data(), storage[1].data(), storage[2].data()},
+            {linesize[0], linesize[1], linesize[2]}};
+  }
+
+  int linesize[3];
+  std::vector<std::uint8_t> storage[3];
+};
+
+struct result_t {
+  double damaged = 0; ///< Share of tiles converted
+  double diff_ms = 0;
+  double convert_ms = 0;
+  double full_ms = 0;
+};
+
+double ms(std::chrono::steady_clock::duration elapsed) {
+  return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+/**
+ * Run `frames` frames, each drawn by `draw(frame, pixels)` over the previous one's pixels.
+ */
+template <class Draw>
+result_t run(const options_t &options, stripe_pool_t &pool, int width, int height, Draw &&draw) {
+  auto coefficients = bt709(convert::bit_depth(options.format));
+  auto row_pitch = width * 4;
+  std::vector<std::uint8_t> previous((std::size_t)row_pitch * height);
+  std::vector<std::uint8_t> current(previous.size());
+  draw(0, previous.data());
+  current = previous;
+
+  frame_t frame{options.format, width, height};
+  auto planes = frame.planes();
+  damage::tiles_t tiles{width, height};
+
+  auto convert_full = [&](const convert::image_t &image) {
+    pool.run(options.threads, [&](int stripe) {
+      auto [first, last] = convert::stripe_rows(options.format, height, options.threads, stripe);
+      convert::convert_rows(options.format, image, planes, coefficients, convert::best_isa(),
+                            first, last);
+    });
+  };
+  convert_full({previous.data(), row_pitch, width, height});
+
+  result_t result;
+  std::int64_t marked = 0;
+  for (int i = 1; i <= options.frames; ++i) {
+    draw(i, current.data());
+    convert::image_t before{previous.data(), row_pitch, width, height};
+    convert::image_t image{current.data(), row_pitch, width, height};
+
+    auto start = std::chrono::steady_clock::now();
+    auto rects = damage::diff(before, image);
+    auto diffed = std::chrono::steady_clock::now();
+
+    // As avcodec_software_encode_device_t::convert_into() does
+    tiles.clear();
+    tiles.mark(rects);
+    marked += tiles.count();
+    if (tiles.count() * 2 >= tiles.size()) {
+      convert_full(image);
+    } else {
+      auto regions = tiles.rects();
+      auto workers = std::min(options.threads, (int)regions.size());
+      pool.run(workers, [&](int worker) {
+        for (auto j = (std::size_t)worker; j < regions.size(); j += workers) {
+          auto &rect = regions[j];
+          convert::convert_region(options.format, image, planes, coefficients,
+                                  convert::best_isa(), rect.x, rect.x + rect.width, rect.y,
+                                  rect.y + rect.height);
+        }
+      });
+    }
+    auto converted = std::chrono::steady_clock::now();
+
+    convert_full(image);
+    auto full = std::chrono::steady_clock::now();
+
+    result.diff_ms += ms(diffed - start);
+    result.convert_ms += ms(converted - diffed);
+    result.full_ms += ms(full - converted);
+    std::swap(previous, current);
+  }
+
+  result.damaged = (double)marked / ((std::int64_t)tiles.size() * options.frames);
+  result.diff_ms /= options.frames;
+  result.convert_ms /= options.frames;
+  result.full_ms /= options.frames;
+  return result;
+}
+
+std::vector<std::string> split(std::string_view list) {
+  std::vector<std::string> items;
+  while (!list.empty()) {
+    auto comma = list.find(',');
+    items.emplace_back(list.substr(0, comma));
+    list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+  }
+  return items;
+}
+
+bool parse_args(int argc, char *argv[], options_t &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string_view value = argv[++i];
+
+    if (arg == "--resolutions"sv) {
+      options.resolutions.clear();
+      for (auto &item : split(value)) {
+        int width, height;
+        if (std::sscanf(item.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 ||
+            height <= 0 || width % 2 || height % 2) {
+          return false;
+        }
+        options.resolutions.emplace_back(width, height);
+      }
+    } else if (arg == "--windows"sv) {
+      options.windows.clear();
+      for (auto &item : split(value)) {
+        auto percent = std::atoi(item.c_str());
+        if (percent <= 0 || percent > 100) {
+          return false;
+        }
+        options.windows.push_back(percent);
+      }
+    } else if (arg == "--format"sv) {
+      bool found = false;
+      for (auto format : {convert::format_e::yuv420p, convert::format_e::yuv420p10,
+                          convert::format_e::nv12, convert::format_e::p010,
+                          convert::format_e::yuv444p, convert::format_e::yuv444p10}) {
+        if (convert::to_string(format) == value) {
+          options.format = format;
+          found = true;
+        }
+      }
+      if (!found) {
+        return false;
+      }
+    } else if (arg == "--threads"sv) {
+      options.threads = std::atoi(argv[i]);
+    } else if (arg == "--frames"sv) {
+      options.frames = std::atoi(argv[i]);
+    } else {
+      return false;
+    }
+  }
+
+  return !options.resolutions.empty() && options.threads > 0 && options.frames > 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  if (!parse_args(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "usage: %s [--resolutions WxH,...] [--windows percent,...] [--format f]\n"
+                 "          [--threads N] [--frames N]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  stripe_pool_t pool{options.threads - 1};
+
+  std::printf("%s with %s kernels, %d threads\n",
+              std::string{convert::to_string(options.format)}.c_str(),
+              std::string{convert::to_string(convert::best_isa())}.c_str(), options.threads);
+  std::printf("%-10s %-12s %8s %9s %11s %9s %8s\n", "resolution", "scenario", "damaged",
+              "diff ms", "convert ms", "full ms", "speedup");
+
+  for (auto [width, height] : options.resolutions) {
+    platf::synthetic::spec_t spec;
+    spec.pattern = platf::synthetic::pattern_e::desktop;
+    spec.width = width;
+    spec.height = height;
+    platf::synthetic::generator_t generator{spec};
+    auto name = std::to_string(width) + 'x' + std::to_string(height);
+
+    auto print = [&](const std::string &scenario, const result_t &result) {
+      std::printf("%-10s %-12s %7.1f%% %9.3f %11.3f %9.3f %7.1fx\n", name.c_str(),
+                  scenario.c_str(), result.damaged * 100, result.diff_ms, result.convert_ms,
+                  result.full_ms, result.full_ms / result.convert_ms);
+    };
+
+    print("cursor", run(options, pool, width, height, [&](int frame, std::uint8_t *pixels) {
+            generator.render(frame, pixels, width * 4, true);
+          }));
+
+    for (auto percent : options.windows) {
+      // A centered window of that share of the screen, with the screen's aspect ratio
+      auto side = std::sqrt(percent / 100.0);
+      auto window_width = std::max((int)(width * side), 1);
+      auto window_height = std::max((int)(height * side), 1);
+      auto x0 = (width - window_width) / 2;
+      auto y0 = (height - window_height) / 2;
+
+      auto result = run(options, pool, width, height, [&](int frame, std::uint8_t *pixels) {
+        if (frame == 0) {
+          generator.render(0, pixels, width * 4, false);
+        }
+
+        std::mt19937 rng{(std::uint32_t)frame};
+        for (int y = y0; y < y0 + window_height; ++y) {
+          auto row = (std::uint32_t *)(pixels + (std::ptrdiff_t)y * width * 4);
+          for (int x = x0; x < x0 + window_width; ++x) {
+            row[x] = rng() & 0xffffff;
+          }
+        }
+      });
+      print("window " + std::to_string(percent) + "%", result);
+    }
+  }
+
+  return 0;
+}
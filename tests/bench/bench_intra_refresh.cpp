@@ -0,0 +1,421 @@
+/**
+ * @file tests/bench/bench_intra_refresh.cpp
+ * @brief Frame size spread of the software encoders recovering with IDR frames or intra refresh.
+ *
+ * Encodes a synthetic desktop with a terminal window scrolling in the middle of it, with the
+ * rate control the software encoder uses for a session: CBR with a one-frame VBV buffer, no
+ * B-frames and, for IDR recovery, an infinite GOP. Every --loss-every frames the host asks for
+ * an IDR frame, after losing the frame before. "idr" forces one as request_idr_frame() does;
+ * "refresh" runs libx264's or libx265's intra refresh with --period frames per wave and leaves
+ * the request to the next wave, as --idr-refresh does.
+ *
+ * Recovery is measured on the output: one decoder gets every packet, the other loses the packet
+ * before each request, as the host did. It counts the frames from a request until both decode
+ * the same picture again. Requests still waiting at the next one count as missed, so
+ * --loss-every should leave room for two waves.
+ *
+ * Usage: bench_intra_refresh [--resolution WxH] [--codecs h264,hevc] [--modes idr,refresh]
+ *                            [--period N] [--loss-every N] [--window percent]
+ *                            [--bitrate kbps] [--preset p] [--fps N] [--frames N]
+ */
+#include "platform/synthetic.h"
+#include "video_convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/opt.h>
+}
+
+using namespace std::literals;
+
+namespace {
+
+namespace convert = video::convert;
+
+struct options_t {
+  int width = 1920;
+  int height = 1080;
+  std::vector<std::string> codecs{"h264", "hevc"};
+  std::vector<std::string> modes{"idr", "refresh"};
+  int period = 12;
+  int loss_every = 60;
+  int window = 25;
+  int bitrate = 5000;
+  std::string preset = "superfast";
+  int fps = 60;
+  int frames = 300;
+};
+
+/** BT.709 limited range, as in bench_convert */
+convert::coefficients_t bt709() {
+  constexpr float Cr = 0.2126f, Cb = 0.0722f, Cg = 1.0f - Cr - Cb;
+  const float y[4]{Cr, Cg, Cb, 0.0f};
+  const float u[4]{-(Cr * 0.5f / (1.0f - Cb)), -(Cg * 0.5f / (1.0f - Cb)), 0.5f, 0.5f};
+  const float v[4]{0.5f, -(Cg * 0.5f / (1.0f - Cr)), -(Cb * 0.5f / (1.0f - Cr)), 0.5f};
+  const float range_y[2]{219.0f / 255, 16.0f / 255};
+  const float range_uv[2]{224.0f / 255, 16.0f / 255};
+  return convert::make_coefficients(y, u, v, range_y, range_uv, 8);
+}
+
+struct result_t {
+  double kbps = 0;
+  double mean = 0;     ///< Bytes per frame
+  double stddev = 0;   ///< Bytes
+  double max = 0;      ///< Bytes
+  int over_budget = 0; ///< Frames larger than the one-frame VBV buffer
+  double recovery = 0; ///< Frames from an IDR request to a whole picture, on average
+  int missed = 0;      ///< Requests still waiting for a whole picture at the next one or the end
+};
+
+void print_error(const char *what, int status) {
+  char string[AV_ERROR_MAX_STRING_SIZE];
+  std::fprintf(stderr, "%s: %s\n", what, av_make_error_string(string, sizeof(string), status));
+}
+
+/** Whether two decoded 4:2:0 frames hold the same pixels */
+bool same_picture(const AVFrame *a, const AVFrame *b) {
+  for (int plane = 0; plane < 3; ++plane) {
+    auto rows = plane ? (a->height + 1) / 2 : a->height;
+    auto bytes = plane ? (a->width + 1) / 2 : a->width;
+    for (int y = 0; y < rows; ++y) {
+      if (std::memcmp(a->data[plane] + (std::ptrdiff_t)y * a->linesize[plane],
+                      b->data[plane] + (std::ptrdiff_t)y * b->linesize[plane], bytes)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/** Decodes a packet, or flushes with nullptr, passing every frame that comes out to on_frame */
+template <class F>
+void decode(AVCodecContext *ctx, const AVPacket *packet, AVFrame *frame, F &&on_frame) {
+  // The decoder that lost a packet may complain, but conceals the damage and goes on
+  avcodec_send_packet(ctx, packet);
+  while (avcodec_receive_frame(ctx, frame) >= 0) {
+    on_frame(frame);
+    av_frame_unref(frame);
+  }
+}
+
+bool run(const options_t &options, const std::string &codec_name, bool refresh,
+         result_t &result) {
+  auto width = options.width;
+  auto height = options.height;
+
+  auto encoder = avcodec_find_encoder_by_name(codec_name == "h264"sv ? "libx264" : "libx265");
+  if (!encoder) {
+    std::fprintf(stderr, "No encoder for %s\n", codec_name.c_str());
+    return false;
+  }
+
+  // As make_avcodec_encode_session() sets up the software encoder
+  auto encode_ctx = avcodec_alloc_context3(encoder);
+  encode_ctx->width = width;
+  encode_ctx->height = height;
+  encode_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  encode_ctx->time_base = AVRational{1, options.fps};
+  encode_ctx->framerate = AVRational{options.fps, 1};
+  encode_ctx->max_b_frames = 0;
+  encode_ctx->gop_size = refresh ? options.period : std::numeric_limits<int>::max();
+  encode_ctx->keyint_min = std::numeric_limits<int>::max();
+  encode_ctx->flags |= AV_CODEC_FLAG_CLOSED_GOP | AV_CODEC_FLAG_LOW_DELAY;
+  encode_ctx->bit_rate = encode_ctx->rc_max_rate = encode_ctx->rc_min_rate =
+      (std::int64_t)options.bitrate * 1000;
+  encode_ctx->rc_buffer_size = options.bitrate * 1000 / options.fps;
+  if (codec_name == "hevc"sv) {
+    encode_ctx->rc_buffer_size = options.bitrate * 1000 / ((options.fps * 10) / 15);
+  }
+
+  AVDictionary *codec_options = nullptr;
+  av_dict_set(&codec_options, "preset", options.preset.c_str(), 0);
+  av_dict_set(&codec_options, "tune", "zerolatency", 0);
+  av_dict_set(&codec_options, "forced-idr", "1", 0);
+  if (codec_name == "hevc"sv) {
+    auto params = "info=0:log-level=error:keyint="s +
+                  (refresh ? std::to_string(options.period) + ":intra-refresh=1" : "-1"s);
+    av_dict_set(&codec_options, "x265-params", params.c_str(), 0);
+  } else if (refresh) {
+    av_dict_set(&codec_options, "intra-refresh", "1", 0);
+  }
+  auto status = avcodec_open2(encode_ctx, encoder, &codec_options);
+  av_dict_free(&codec_options);
+  if (status < 0) {
+    print_error("Couldn't open the encoder", status);
+    avcodec_free_context(&encode_ctx);
+    return false;
+  }
+
+  // A terminal window of that share of the screen, with the screen's aspect ratio
+  auto side = std::sqrt(options.window / 100.0);
+  auto window_width = std::max((int)(width * side) & ~1, 2);
+  auto window_height = std::max((int)(height * side) & ~1, 2);
+  auto window_x = (width - window_width) / 2 & ~1;
+  auto window_y = (height - window_height) / 2 & ~1;
+
+  platf::synthetic::spec_t spec;
+  spec.width = width;
+  spec.height = height;
+  spec.framerate = options.fps;
+  platf::synthetic::generator_t desktop{spec};
+  spec.pattern = platf::synthetic::pattern_e::text;
+  spec.width = window_width;
+  spec.height = window_height;
+  platf::synthetic::generator_t terminal{spec};
+
+  // Whole is fed every packet, lossy all but the ones lost before a request
+  auto decoder = avcodec_find_decoder(encoder->id);
+  if (!decoder) {
+    std::fprintf(stderr, "No decoder for %s\n", codec_name.c_str());
+    avcodec_free_context(&encode_ctx);
+    return false;
+  }
+  AVCodecContext *whole = avcodec_alloc_context3(decoder);
+  AVCodecContext *lossy = avcodec_alloc_context3(decoder);
+  for (auto decode_ctx : {whole, lossy}) {
+    decode_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    decode_ctx->thread_count = 1;
+    status = avcodec_open2(decode_ctx, decoder, nullptr);
+    if (status < 0) {
+      print_error("Couldn't open the decoder", status);
+      avcodec_free_context(&whole);
+      avcodec_free_context(&lossy);
+      avcodec_free_context(&encode_ctx);
+      return false;
+    }
+  }
+
+  auto coefficients = bt709();
+  std::vector<std::uint8_t> pixels((std::size_t)width * 4 * height);
+  std::vector<double> sizes;
+  std::int64_t recovery_frames = 0;
+  int requests = 0;
+  std::optional<std::int64_t> pending; // The oldest request whose picture isn't whole yet
+  std::map<std::int64_t, AVFrame *> whole_frames; // Not compared with lossy's yet, by pts
+  auto decoded = av_frame_alloc();
+
+  auto frame = av_frame_alloc();
+  frame->width = width;
+  frame->height = height;
+  frame->format = AV_PIX_FMT_YUV420P;
+  av_frame_get_buffer(frame, 0);
+  auto packet = av_packet_alloc();
+
+  auto compare = [&](AVFrame *lossy_frame) {
+    auto found = whole_frames.find(lossy_frame->pts);
+    if (found == whole_frames.end()) {
+      return;
+    }
+    if (pending && lossy_frame->pts >= *pending && same_picture(found->second, lossy_frame)) {
+      recovery_frames += lossy_frame->pts - *pending + 1;
+      ++requests;
+      pending.reset();
+    }
+
+    // Including those of the lost packets, which lossy never outputs
+    for (auto it = whole_frames.begin(); it != whole_frames.end() && it->first <= found->first;) {
+      av_frame_free(&it->second);
+      it = whole_frames.erase(it);
+    }
+  };
+
+  // The packet before every request is lost
+  auto lost = [&](std::int64_t pts) {
+    return (pts + 1) % options.loss_every == 0;
+  };
+
+  auto decode_packet = [&](const AVPacket *output) {
+    decode(whole, output, decoded, [&](AVFrame *whole_frame) {
+      whole_frames[whole_frame->pts] = av_frame_clone(whole_frame);
+    });
+    if (!output || !lost(output->pts)) {
+      decode(lossy, output, decoded, compare);
+    }
+  };
+
+  auto drain = [&]() {
+    while (avcodec_receive_packet(encode_ctx, packet) >= 0) {
+      sizes.push_back(packet->size);
+      decode_packet(packet);
+      av_packet_unref(packet);
+    }
+  };
+
+  for (int i = 0; i < options.frames; ++i) {
+    desktop.render(i, pixels.data(), width * 4, true);
+    terminal.render(i, pixels.data() + (std::ptrdiff_t)window_y * width * 4 + window_x * 4,
+                    width * 4, false);
+
+    av_frame_make_writable(frame);
+    convert::planes_t planes{{frame->data[0], frame->data[1], frame->data[2]},
+                             {frame->linesize[0], frame->linesize[1], frame->linesize[2]}};
+    convert::convert(convert::format_e::yuv420p, {pixels.data(), width * 4, width, height},
+                     planes, coefficients);
+    frame->pts = i;
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    frame->flags &= ~AV_FRAME_FLAG_KEY;
+
+    if (i > 0 && lost(i - 1)) {
+      if (pending) {
+        ++result.missed;
+      } else {
+        pending = i;
+      }
+      if (!refresh) {
+        frame->pict_type = AV_PICTURE_TYPE_I;
+        frame->flags |= AV_FRAME_FLAG_KEY;
+      }
+    }
+
+    status = avcodec_send_frame(encode_ctx, frame);
+    if (status < 0) {
+      print_error("Couldn't encode", status);
+      break;
+    }
+    drain();
+  }
+
+  avcodec_send_frame(encode_ctx, nullptr);
+  drain();
+  decode_packet(nullptr);
+
+  double total = 0;
+  double squared_total = 0;
+  auto budget = (double)encode_ctx->rc_buffer_size / 8;
+  for (auto size : sizes) {
+    total += size;
+    squared_total += size * size;
+    result.max = std::max(result.max, size);
+    result.over_budget += size > budget;
+  }
+  if (!sizes.empty()) {
+    result.mean = total / sizes.size();
+    auto variance = squared_total / sizes.size() - result.mean * result.mean;
+    result.stddev = std::sqrt(std::max(0.0, variance));
+  }
+  result.kbps = total * 8.0 * options.fps / options.frames / 1000;
+  result.recovery = requests ? (double)recovery_frames / requests : 0;
+  result.missed += pending.has_value();
+
+  for (auto &[pts, whole_frame] : whole_frames) {
+    av_frame_free(&whole_frame);
+  }
+  av_frame_free(&decoded);
+  av_packet_free(&packet);
+  av_frame_free(&frame);
+  avcodec_free_context(&whole);
+  avcodec_free_context(&lossy);
+  avcodec_free_context(&encode_ctx);
+  return status >= 0;
+}
+
+std::vector<std::string> split(std::string_view list) {
+  std::vector<std::string> items;
+  while (!list.empty()) {
+    auto comma = list.find(',');
+    items.emplace_back(list.substr(0, comma));
+    list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+  }
+  return items;
+}
+
+bool parse_args(int argc, char *argv[], options_t &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string_view value = argv[++i];
+
+    if (arg == "--resolution"sv) {
+      if (std::sscanf(argv[i], "%dx%d", &options.width, &options.height) != 2 ||
+          options.width <= 0 || options.height <= 0 || options.width % 2 || options.height % 2) {
+        return false;
+      }
+    } else if (arg == "--codecs"sv) {
+      options.codecs = split(value);
+      for (auto &codec : options.codecs) {
+        if (codec != "h264"sv && codec != "hevc"sv) {
+          return false;
+        }
+      }
+    } else if (arg == "--modes"sv) {
+      options.modes = split(value);
+      for (auto &mode : options.modes) {
+        if (mode != "idr"sv && mode != "refresh"sv) {
+          return false;
+        }
+      }
+    } else if (arg == "--period"sv) {
+      options.period = std::atoi(argv[i]);
+    } else if (arg == "--loss-every"sv) {
+      options.loss_every = std::atoi(argv[i]);
+    } else if (arg == "--window"sv) {
+      options.window = std::atoi(argv[i]);
+    } else if (arg == "--bitrate"sv) {
+      options.bitrate = std::atoi(argv[i]);
+    } else if (arg == "--preset"sv) {
+      options.preset = value;
+    } else if (arg == "--fps"sv) {
+      options.fps = std::atoi(argv[i]);
+    } else if (arg == "--frames"sv) {
+      options.frames = std::atoi(argv[i]);
+    } else {
+      return false;
+    }
+  }
+
+  return !options.codecs.empty() && !options.modes.empty() && options.period > 1 &&
+         options.loss_every > 1 && options.window > 0 && options.window <= 100 &&
+         options.bitrate > 0 && options.fps > 0 && options.frames > 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  if (!parse_args(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "usage: %s [--resolution WxH] [--codecs h264,hevc] [--modes idr,refresh]\n"
+                 "          [--period N] [--loss-every N] [--window percent] [--bitrate kbps]\n"
+                 "          [--preset p] [--fps N] [--frames N]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  std::printf("%dx%d@%d, %d kbps, %s, terminal window over %d%% of the screen, IDR request "
+              "every %d frames, %d frames per wave\n",
+              options.width, options.height, options.fps, options.bitrate, options.preset.c_str(),
+              options.window, options.loss_every, options.period);
+  std::printf("%-6s %-8s %8s %9s %9s %9s %8s %11s %9s %7s\n", "codec", "mode", "kbps", "mean B",
+              "stddev B", "max B", "max/mean", "over budget", "recovery", "missed");
+
+  for (auto &codec : options.codecs) {
+    for (auto &mode : options.modes) {
+      result_t result;
+      if (!run(options, codec, mode == "refresh"sv, result)) {
+        return 1;
+      }
+      std::printf("%-6s %-8s %8.0f %9.0f %9.0f %9.0f %8.2f %11d %9.1f %7d\n", codec.c_str(),
+                  mode.c_str(), result.kbps, result.mean, result.stddev, result.max,
+                  result.mean > 0 ? result.max / result.mean : 0, result.over_budget,
+                  result.recovery, result.missed);
+    }
+  }
+
+  return 0;
+}
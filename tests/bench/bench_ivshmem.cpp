@@ -0,0 +1,373 @@
+/**
+ * @file tests/bench/bench_ivshmem.cpp
+ * @brief Producer-to-consumer latency and throughput of the media channels.
+ *
+ * The producer and the consumer map the same POSIX shared memory object through
+ * different interfaces (IVSHMEM and SharedMemory), like the guest and the host do,
+ * and run on separate threads. Every packet carries its publish time, so latency is
+ * measured from just before the producer publishes it to when the consumer sees it.
+ *
+ * Usage: bench_ivshmem [--layout ring|legacy|all] [--mode poll|spin|adaptive|doorbell|all]
+ *                      [--dist audio|video|idr|all] [--frames N] [--fps N]
+ *                      [--poll-us N] [--spin-us N] [--yield-us N]
+ */
+#include "interprocess.h"
+#include "ivshmem_consumer.h"
+#include "ivshmem_protocol.h"
+#include "ivshmem_wait.h"
+#include "smemory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+
+namespace consumer = ivshmem_protocol::consumer;
+namespace ring = ivshmem_protocol::ring;
+
+enum class mode_e {
+  poll,     ///< Check, then sleep for poll_interval
+  spin,     ///< Check continuously for spin_duration, then block on the doorbell
+  adaptive, ///< Like spin, but yield for yield_duration before blocking
+  doorbell, ///< Block on the doorbell right away
+};
+
+enum class dist_e {
+  audio, ///< Small fixed-size packets
+  video, ///< Delta frames around 25 KiB with a large IDR frame every 120 frames
+  idr,   ///< Nothing but large frames
+};
+
+struct options_t {
+  std::vector<ring::layout_e> layouts{ring::layout_e::ring, ring::layout_e::legacy};
+  std::vector<mode_e> modes{mode_e::poll, mode_e::spin, mode_e::adaptive, mode_e::doorbell};
+  std::vector<dist_e> dists{dist_e::audio, dist_e::video, dist_e::idr};
+  std::uint64_t frames = 2000;
+  int fps = 240; ///< 0 publishes as fast as the consumer allows
+  std::chrono::microseconds poll_interval = 1ms;
+  std::chrono::microseconds spin_duration = 50us;
+  std::chrono::microseconds yield_duration = 200us;
+};
+
+constexpr std::uint16_t kDoorbellVector = 1;
+
+std::uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::size_t payload_size(dist_e dist, std::uint64_t frame) {
+  switch (dist) {
+  case dist_e::audio:
+    return 256;
+  case dist_e::video:
+    return frame % 120 == 0 ? 256 * 1024 : 10 * 1024 + (frame * 2654435761u) % (30 * 1024);
+  case dist_e::idr:
+    return 512 * 1024;
+  }
+  return 0;
+}
+
+const char *to_string(ring::layout_e layout) {
+  return layout == ring::layout_e::ring ? "ring" : "legacy";
+}
+
+const char *to_string(mode_e mode) {
+  switch (mode) {
+  case mode_e::poll:
+    return "poll";
+  case mode_e::spin:
+    return "spin";
+  case mode_e::adaptive:
+    return "adaptive";
+  case mode_e::doorbell:
+    return "doorbell";
+  }
+  return "";
+}
+
+const char *to_string(dist_e dist) {
+  switch (dist) {
+  case dist_e::audio:
+    return "audio";
+  case dist_e::video:
+    return "video";
+  case dist_e::idr:
+    return "idr";
+  }
+  return "";
+}
+
+/** Publishes frames into one video channel of either layout. */
+class producer_t {
+public:
+  producer_t(void *memory, ring::layout_e layout) {
+    if (layout == ring::layout_e::ring) {
+      writer.emplace(&((MediaRingMemory *)memory)->video[0].ring);
+    } else {
+      queue = &((MediaMemory *)memory)->video[0].internal;
+    }
+  }
+
+  /** @param consumed Frames the consumer is done with; the legacy layout can't tell us. */
+  void publish(std::uint64_t frame, std::vector<char> &payload, bool idr,
+               ivshmem_protocol::padded_cursor_t<std::uint64_t> &consumed) {
+    std::uint64_t rtp_sample_duration = 0;
+    std::uint8_t flags = idr ? ivshmem_protocol::kVideoFlagKeyframe : 0;
+
+    if (writer) {
+      while (true) {
+        auto timestamp = now_ns();
+        std::memcpy(payload.data(), &timestamp, sizeof(timestamp));
+        if (writer->write(RING_RECORD_VIDEO, {{&frame, sizeof(frame)},
+                                              {&rtp_sample_duration, sizeof(rtp_sample_duration)},
+                                              {&flags, sizeof(flags)},
+                                              {payload.data(), payload.size()}})) {
+          return;
+        }
+        std::this_thread::yield();
+      }
+    }
+
+    while (frame - consumed.consume() >= IN_QUEUE_SIZE - 1) {
+      std::this_thread::yield();
+    }
+
+    auto index = ivshmem_protocol::load_relaxed(queue->inindex);
+    auto slot = &queue->incoming[index];
+    auto timestamp = now_ns();
+    std::memcpy(payload.data(), &timestamp, sizeof(timestamp));
+    ivshmem_protocol::reset_packet(slot);
+    ivshmem_protocol::append_to_packet(slot, &frame, sizeof(frame));
+    ivshmem_protocol::append_to_packet(slot, &rtp_sample_duration, sizeof(rtp_sample_duration));
+    ivshmem_protocol::append_to_packet(slot, &flags, sizeof(flags));
+    ivshmem_protocol::append_to_packet(slot, payload.data(), payload.size());
+    ivshmem_protocol::publish(queue->inindex,
+                              ivshmem_protocol::advance_index(index, IN_QUEUE_SIZE));
+  }
+
+private:
+  std::optional<ring::writer_t> writer;
+  MediaQueue *queue = nullptr;
+};
+
+struct result_t {
+  std::vector<std::uint64_t> latencies_ns;
+  std::uint64_t bytes = 0;
+  std::uint64_t elapsed_ns = 0;
+};
+
+double percentile_us(const std::vector<std::uint64_t> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto index = std::min(sorted.size() - 1, (std::size_t)(p / 100 * sorted.size()));
+  return sorted[index] / 1000.0;
+}
+
+bool run(const options_t &options, ring::layout_e layout, mode_e mode, dist_e dist,
+         result_t &result) {
+  auto size = layout == ring::layout_e::ring ? sizeof(MediaRingMemory) : sizeof(MediaMemory);
+  auto name = "sunshine-bench-" + std::to_string(getpid());
+
+  // The host side creates the memory; the guest side finds it through its IVSHMEM "device"
+  SharedMemory host{name.c_str(), size, SharedMemory::Create | SharedMemory::Populate};
+  if (!host.Initialize()) {
+    return false;
+  }
+  IVSHMEM guest{("/dev/shm/" + name).c_str()};
+  if (!guest.Initialize() || !guest.GetMemory()) {
+    return false;
+  }
+
+  if (layout == ring::layout_e::ring) {
+    consumer::init_ring_memory((MediaRingMemory *)host.GetMemory());
+    ring::accept_layout(&((MediaRingMemory *)guest.GetMemory())->header);
+  }
+
+  DoorbellEvent doorbell;
+  if (!doorbell.Initialize() || !guest.RegisterEvent(doorbell.GetHandle(), kDoorbellVector)) {
+    return false;
+  }
+
+  // Created before the producer starts so the legacy reader doesn't skip anything
+  std::unique_ptr<consumer::video_reader_t> reader;
+  if (layout == ring::layout_e::ring) {
+    auto memory = (MediaRingMemory *)host.GetMemory();
+    reader = std::make_unique<consumer::video_reader_t>(&memory->video[0].ring);
+  } else {
+    auto memory = (MediaMemory *)host.GetMemory();
+    reader = std::make_unique<consumer::video_reader_t>(&memory->video[0].internal);
+  }
+
+  ivshmem_protocol::wait_policy_t wait_policy;
+  wait_policy.spin = mode == mode_e::doorbell ? 0us : options.spin_duration;
+  wait_policy.yield = mode == mode_e::adaptive ? options.yield_duration : 0us;
+  wait_policy.block = 100ms;
+
+  ivshmem_protocol::padded_cursor_t<std::uint64_t> consumed;
+  auto start = now_ns();
+
+  std::thread producer_thread{[&]() {
+    producer_t producer{guest.GetMemory(), layout};
+    std::vector<char> payload;
+    auto frame_interval = options.fps ? 1'000'000'000ull / options.fps : 0;
+
+    for (std::uint64_t frame = 0; frame < options.frames; ++frame) {
+      if (frame_interval) {
+        auto deadline = start + frame * frame_interval;
+        while (now_ns() < deadline) {
+          std::this_thread::sleep_for(std::chrono::nanoseconds{deadline - now_ns()});
+        }
+      }
+
+      payload.resize(payload_size(dist, frame));
+      producer.publish(frame, payload, dist == dist_e::idr || payload.size() > 128 * 1024,
+                       consumed);
+      if (mode != mode_e::poll) {
+        guest.RingDoorbell(0, kDoorbellVector);
+      }
+    }
+  }};
+
+  result.latencies_ns.reserve(options.frames);
+  for (std::uint64_t received = 0; received < options.frames;) {
+    std::optional<consumer::frame_t> frame;
+    if (mode == mode_e::poll) {
+      if (!(frame = reader->peek())) {
+        std::this_thread::sleep_for(options.poll_interval);
+        continue;
+      }
+    } else {
+      auto wake = ivshmem_protocol::wait_for(
+          [&]() { return (frame = reader->peek()).has_value(); }, wait_policy,
+          [&](std::chrono::milliseconds timeout) { doorbell.Wait((uint32_t)timeout.count()); });
+      if (wake == ivshmem_protocol::wake_e::timeout) {
+        continue;
+      }
+    }
+
+    auto seen = now_ns();
+    std::uint64_t timestamp;
+    std::memcpy(&timestamp, frame->data, sizeof(timestamp));
+    auto frame_size = frame->size;
+
+    reader->release();
+    consumed.publish(++received);
+
+    result.latencies_ns.push_back(seen - timestamp);
+    result.bytes += frame_size;
+  }
+
+  result.elapsed_ns = now_ns() - start;
+  producer_thread.join();
+
+  return true;
+}
+
+void print_result(ring::layout_e layout, mode_e mode, dist_e dist, result_t &result) {
+  std::sort(std::begin(result.latencies_ns), std::end(result.latencies_ns));
+
+  auto seconds = result.elapsed_ns / 1e9;
+  std::printf("%-7s %-9s %-6s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", to_string(layout),
+              to_string(mode), to_string(dist), result.latencies_ns.size(),
+              percentile_us(result.latencies_ns, 50), percentile_us(result.latencies_ns, 99),
+              percentile_us(result.latencies_ns, 99.9), result.latencies_ns.back() / 1000.0,
+              result.latencies_ns.size() / seconds, result.bytes / seconds / (1024 * 1024));
+}
+
+bool parse_args(int argc, char *argv[], options_t &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string_view value = argv[++i];
+
+    if (arg == "--layout"sv) {
+      options.layouts.clear();
+      if (value == "ring"sv || value == "all"sv) {
+        options.layouts.push_back(ring::layout_e::ring);
+      }
+      if (value == "legacy"sv || value == "all"sv) {
+        options.layouts.push_back(ring::layout_e::legacy);
+      }
+    } else if (arg == "--mode"sv) {
+      options.modes.clear();
+      for (auto mode : {mode_e::poll, mode_e::spin, mode_e::adaptive, mode_e::doorbell}) {
+        if (value == to_string(mode) || value == "all"sv) {
+          options.modes.push_back(mode);
+        }
+      }
+    } else if (arg == "--dist"sv) {
+      options.dists.clear();
+      for (auto dist : {dist_e::audio, dist_e::video, dist_e::idr}) {
+        if (value == to_string(dist) || value == "all"sv) {
+          options.dists.push_back(dist);
+        }
+      }
+    } else if (arg == "--frames"sv) {
+      options.frames = std::strtoull(argv[i], nullptr, 10);
+    } else if (arg == "--fps"sv) {
+      options.fps = std::atoi(argv[i]);
+    } else if (arg == "--poll-us"sv) {
+      options.poll_interval = std::chrono::microseconds{std::atoi(argv[i])};
+    } else if (arg == "--spin-us"sv) {
+      options.spin_duration = std::chrono::microseconds{std::atoi(argv[i])};
+    } else if (arg == "--yield-us"sv) {
+      options.yield_duration = std::chrono::microseconds{std::atoi(argv[i])};
+    } else {
+      return false;
+    }
+  }
+
+  return options.frames > 0 && !options.layouts.empty() && !options.modes.empty() &&
+         !options.dists.empty();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  if (!parse_args(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "usage: %s [--layout ring|legacy|all] [--mode poll|spin|adaptive|doorbell|all]\n"
+                 "          [--dist audio|video|idr|all] [--frames N] [--fps N]\n"
+                 "          [--poll-us N] [--spin-us N] [--yield-us N]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  std::printf("%-7s %-9s %-6s %8s %10s %10s %10s %10s %10s %10s\n", "layout", "mode", "dist",
+              "frames", "p50 us", "p99 us", "p99.9 us", "max us", "frames/s", "MiB/s");
+  for (auto layout : options.layouts) {
+    for (auto mode : options.modes) {
+      for (auto dist : options.dists) {
+        result_t result;
+        if (!run(options, layout, mode, dist, result)) {
+          std::fprintf(stderr, "%s/%s/%s: failed to set up shared memory\n", to_string(layout),
+                       to_string(mode), to_string(dist));
+          return 1;
+        }
+        print_result(layout, mode, dist, result);
+      }
+    }
+  }
+
+  return 0;
+}
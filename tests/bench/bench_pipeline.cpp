@@ -0,0 +1,444 @@
+/**
+ * @file tests/bench/bench_pipeline.cpp
+ * @brief Glass-to-ring latency of the whole video pipeline.
+ *
+ * A synthetic display stamps every frame with the time it would have reached the glass.
+ * The frame then goes through captureThread, encode_run with the software encoder and a
+ * forwarder that publishes it into an in-process VideoRing like push_video does, through
+ * ring_producer_t. A reference consumer reads the ring and records how long ago each
+ * frame was stamped.
+ *
+ * Every combination of resolution, codec, preset and encode pacing runs for --seconds after
+ * a warm-up. Reported per run: latency percentiles, how long captures waited for the encoder,
+ * achieved fps and process CPU time per published frame, which includes the consumer's
+ * polling. --json writes the same as JSON. A run fails if the display it captured isn't the
+ * requested pattern and resolution.
+ *
+ * Usage: bench_pipeline [--resolutions WxH,...] [--codecs h264,hevc,av1] [--presets p,...]
+ *                       [--pacing fixed,capture] [--pattern desktop|text|noise] [--fps N]
+ *                       [--bitrate kbps] [--seconds N] [--warmup N] [--json path|-]
+ */
+#include "config.h"
+#include "globals.h"
+#include "ivshmem_consumer.h"
+#include "ivshmem_protocol.h"
+#include "ivshmem_wait.h"
+#include "logging.h"
+#include "platform/common.h"
+#include "platform/synthetic.h"
+#include "ring_producer.h"
+#include "video.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+namespace consumer = ivshmem_protocol::consumer;
+
+struct options_t {
+  std::vector<std::pair<int, int>> resolutions{{1280, 720}, {1920, 1080}};
+  std::vector<int> codecs{0}; ///< video::config_t::videoFormat
+  std::vector<std::string> presets{"superfast", "veryfast"};
+  std::vector<bool> capture_paced{false}; ///< config::video.capture_paced
+  std::string pattern = "desktop";
+  int fps = 60;
+  int bitrate = 6000;
+  int seconds = 10;
+  int warmup = 2;
+  std::string json;
+};
+
+struct run_t {
+  std::pair<int, int> resolution;
+  int codec;
+  std::string preset;
+  bool capture_paced;
+};
+
+struct result_t {
+  bool ok = false;
+  ivshmem_protocol::latency_histogram_t latency;
+  ivshmem_protocol::latency_histogram_t capture_to_encode;
+  std::uint64_t frames = 0;
+  double seconds = 0;
+  double cpu_seconds = 0;
+};
+
+const char *codec_name(int codec) {
+  switch (codec) {
+  case 1:
+    return "hevc";
+  case 2:
+    return "av1";
+  default:
+    return "h264";
+  }
+}
+
+std::int64_t to_ns(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+/** CPU time used by every thread of this process so far. */
+double process_cpu_seconds() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+  auto ticks = [](const FILETIME &time) {
+    return (double)(((std::uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime);
+  };
+  return (ticks(kernel) + ticks(user)) / 1e7;
+#else
+  timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+#endif
+}
+
+result_t run(const options_t &options, const run_t &run) {
+  auto [width, height] = run.resolution;
+
+  config::video.sw.sw_preset = run.preset;
+  config::video.capture_paced = run.capture_paced;
+  if (run.codec == 2) {
+    // SVT-AV1 presets are numbers; anything else keeps its default
+    char *end;
+    auto preset = std::strtol(run.preset.c_str(), &end, 10);
+    config::video.sw.svtav1_preset =
+        *end || run.preset.empty() ? std::nullopt : std::optional<int>{(int)preset};
+  }
+
+  video::config_t config{};
+  config.display = options.pattern + ':' + std::to_string(width) + 'x' + std::to_string(height) +
+                   '@' + std::to_string(options.fps);
+  config.width = width;
+  config.height = height;
+  config.framerate = options.fps;
+  config.bitrate = options.bitrate;
+  config.slicesPerFrame = 1;
+  config.encoderCscMode = 1;
+  config.videoFormat = run.codec;
+
+  // The host would have done this before starting the guest
+  auto memory = std::make_unique<MediaRingMemory>();
+  consumer::init_ring_memory(memory.get());
+  ivshmem_protocol::ring::accept_layout(&memory->header);
+  auto producer = std::make_shared<ring_producer_t>(&memory->video[0].ring);
+
+  auto mail = std::make_shared<safe::mail_raw_t>();
+  mail->set_queue_mode(mail::video_packets, safe::queue_mode_e::spsc);
+  auto shutdown = mail->event<bool>(mail::shutdown);
+  auto packets = mail->queue<video::packet_t>(mail::video_packets);
+
+  // When each frame reached the glass, by frame index; published before the frame is
+  std::vector<std::atomic<std::int64_t>> stamped(4096);
+  std::atomic<bool> measuring{false};
+  std::atomic<bool> stop{false};
+  std::atomic<std::uint64_t> published{0};
+  result_t result;
+
+  std::thread capture{[&]() { video::capture(mail, config, nullptr, producer.get()); }};
+
+  // push_video without the legacy layout, doorbells and output watchdog. SPS/VUI
+  // replacements are skipped; they change no timing and the consumer doesn't decode.
+  std::thread forward{[&]() {
+    ivshmem_protocol::ring::backpressure_t backpressure;
+    auto can_drop = [](const auto &record) { return !ivshmem_protocol::ring::is_keyframe(record); };
+    while (!shutdown->peek()) {
+      auto packet = packets->pop(100ms);
+      if (!packet) {
+        continue;
+      }
+
+      std::uint64_t findex = packet->frame_index();
+      if (measuring.load(std::memory_order_relaxed) && packet->capture_age_us) {
+        result.capture_to_encode.record(
+            std::chrono::nanoseconds{(std::int64_t)(*packet->capture_age_us * 1000)});
+      }
+      if (packet->frame_timestamp) {
+        stamped[findex % stamped.size()].store(to_ns(*packet->frame_timestamp),
+                                               std::memory_order_relaxed);
+      }
+
+      std::uint64_t rtp_sample_duration = packet->rtp_sample_duration;
+      std::uint8_t flags = packet->is_idr() ? ivshmem_protocol::kVideoFlagKeyframe : 0;
+      if (!producer->commit_in_place(packet->data(), packet->data_size(), findex,
+                                     rtp_sample_duration, flags)) {
+        producer->write({{&findex, sizeof(findex)},
+                         {&rtp_sample_duration, sizeof(rtp_sample_duration)},
+                         {&flags, sizeof(flags)},
+                         {packet->data(), packet->data_size()}},
+                        backpressure, can_drop);
+      }
+    }
+  }};
+
+  // The host consumer: poll briefly, then sleep in short steps, so it neither hides
+  // latency behind long sleeps nor takes the encoder's CPU
+  std::thread receive{[&]() {
+    consumer::video_reader_t reader{&memory->video[0].ring};
+    ivshmem_protocol::wait_policy_t policy;
+    policy.spin = 0ns;
+    policy.yield = 50us;
+
+    while (!stop.load()) {
+      auto frame = reader.peek();
+      if (!frame) {
+        ivshmem_protocol::wait_for([&]() { return reader.peek().has_value() || stop.load(); },
+                                   policy, [](auto) { std::this_thread::sleep_for(100us); });
+        continue;
+      }
+
+      auto now = to_ns(std::chrono::steady_clock::now());
+      auto stamp = stamped[frame->frame_index % stamped.size()].load(std::memory_order_relaxed);
+      if (measuring.load(std::memory_order_relaxed) && stamp) {
+        result.latency.record(std::chrono::nanoseconds{now - stamp});
+        ++result.frames;
+      }
+      published.fetch_add(1, std::memory_order_relaxed);
+      reader.release();
+    }
+  }};
+
+  // Wait for the encoder to come up before starting the clock
+  auto deadline = std::chrono::steady_clock::now() + 15s;
+  while (!published.load() && !shutdown->peek() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(10ms);
+  }
+
+  if (published.load() && !shutdown->peek()) {
+    std::this_thread::sleep_for(std::chrono::seconds{options.warmup});
+
+    auto cpu_start = process_cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    measuring = true;
+    std::this_thread::sleep_for(std::chrono::seconds{options.seconds});
+    measuring = false;
+    result.seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.cpu_seconds = process_cpu_seconds() - cpu_start;
+    result.ok = !shutdown->peek();
+
+    // Falling back to another display would measure the wrong content
+    auto captured = platf::synthetic::last_display();
+    if (!captured || platf::synthetic::to_string(captured->pattern) != options.pattern ||
+        captured->width != width || captured->height != height) {
+      std::fprintf(stderr, "Captured %s instead of %s\n",
+                   captured ? std::string{platf::synthetic::to_string(captured->pattern)}.c_str()
+                            : "nothing",
+                   config.display->c_str());
+      result.ok = false;
+    }
+  }
+
+  shutdown->raise(true);
+  capture.join();
+  forward.join();
+  stop = true;
+  receive.join();
+
+  return result;
+}
+
+std::vector<std::string> split(std::string_view list) {
+  std::vector<std::string> items;
+  while (!list.empty()) {
+    auto comma = list.find(',');
+    items.emplace_back(list.substr(0, comma));
+    list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+  }
+  return items;
+}
+
+bool parse_args(int argc, char *argv[], options_t &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string_view value = argv[++i];
+
+    if (arg == "--resolutions"sv) {
+      options.resolutions.clear();
+      for (auto &item : split(value)) {
+        int width, height;
+        if (std::sscanf(item.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 ||
+            height <= 0) {
+          return false;
+        }
+        options.resolutions.emplace_back(width, height);
+      }
+    } else if (arg == "--codecs"sv) {
+      options.codecs.clear();
+      for (auto &item : split(value)) {
+        int codec = item == "h264"sv ? 0 : item == "hevc"sv ? 1 : item == "av1"sv ? 2 : -1;
+        if (codec < 0) {
+          return false;
+        }
+        options.codecs.push_back(codec);
+      }
+    } else if (arg == "--presets"sv) {
+      options.presets = split(value);
+    } else if (arg == "--pacing"sv) {
+      options.capture_paced.clear();
+      for (auto &item : split(value)) {
+        if (item != "fixed"sv && item != "capture"sv) {
+          return false;
+        }
+        options.capture_paced.push_back(item == "capture"sv);
+      }
+    } else if (arg == "--pattern"sv) {
+      auto spec = platf::synthetic::parse_spec(value, {});
+      if (!spec || platf::synthetic::to_string(spec->pattern) != value) {
+        return false;
+      }
+      options.pattern = value;
+    } else if (arg == "--fps"sv) {
+      options.fps = std::atoi(argv[i]);
+    } else if (arg == "--bitrate"sv) {
+      options.bitrate = std::atoi(argv[i]);
+    } else if (arg == "--seconds"sv) {
+      options.seconds = std::atoi(argv[i]);
+    } else if (arg == "--warmup"sv) {
+      options.warmup = std::atoi(argv[i]);
+    } else if (arg == "--json"sv) {
+      options.json = value;
+    } else {
+      return false;
+    }
+  }
+
+  return !options.resolutions.empty() && !options.codecs.empty() && !options.presets.empty() &&
+         !options.capture_paced.empty() && options.fps > 0 && options.bitrate > 0 &&
+         options.seconds > 0 && options.warmup >= 0;
+}
+
+void write_json(std::ostream &out, const options_t &options,
+                const std::vector<std::pair<run_t, result_t>> &results) {
+  auto us = [](std::chrono::nanoseconds ns) { return ns.count() / 1000.0; };
+
+  out << "{\"pattern\":\"" << options.pattern << "\",\"target_fps\":" << options.fps
+      << ",\"bitrate_kbps\":" << options.bitrate << ",\"runs\":[";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    auto &[run, result] = results[i];
+    out << (i ? "," : "") << "\n  {\"resolution\":\"" << run.resolution.first << 'x'
+        << run.resolution.second << "\",\"codec\":\"" << codec_name(run.codec)
+        << "\",\"preset\":\"" << run.preset << "\",\"pacing\":\""
+        << (run.capture_paced ? "capture" : "fixed") << "\",\"ok\":"
+        << (result.ok ? "true" : "false");
+    if (result.ok) {
+      out << ",\"frames\":" << result.frames << ",\"fps\":" << result.frames / result.seconds
+          << ",\"latency_us\":{\"p50\":" << us(result.latency.percentile(50))
+          << ",\"p90\":" << us(result.latency.percentile(90))
+          << ",\"p99\":" << us(result.latency.percentile(99))
+          << ",\"p99.9\":" << us(result.latency.percentile(99.9))
+          << ",\"max\":" << us(result.latency.max())
+          << "},\"capture_to_encode_us\":{\"p50\":" << us(result.capture_to_encode.percentile(50))
+          << ",\"p99\":" << us(result.capture_to_encode.percentile(99))
+          << ",\"max\":" << us(result.capture_to_encode.max()) << "},\"cpu_ms_per_frame\":"
+          << (result.frames ? result.cpu_seconds * 1000 / result.frames : 0.0);
+    }
+    out << '}';
+  }
+  out << "\n]}\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  if (!parse_args(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "usage: %s [--resolutions WxH,...] [--codecs h264,hevc,av1] [--presets p,...]\n"
+                 "       [--pacing fixed,capture] [--pattern desktop|text|noise] [--fps N]\n"
+                 "       [--bitrate kbps] [--seconds N] [--warmup N] [--json path|-]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  config::video.capture = "synthetic";
+  config::sunshine.flags.set(config::flag::FORCE_SOFTWARE_ENCODER);
+
+  // Warnings and up, so the table stays readable
+  auto log_deinit_guard = logging::init(3);
+  mail::man = std::make_shared<safe::mail_raw_t>();
+
+  auto platf_deinit_guard = platf::init();
+  if (!platf_deinit_guard || video::probe_encoders()) {
+    std::fprintf(stderr, "No software encoder available\n");
+    return 1;
+  }
+
+  // Bucket upper bounds, so percentiles are rounded up to a power of two nanoseconds.
+  // c2e is how long captures waited to start encoding.
+  std::printf("%-10s %-5s %-10s %-7s %8s %10s %10s %10s %10s %10s %10s %10s\n", "resolution",
+              "codec", "preset", "pacing", "fps", "p50 us", "p99 us", "p99.9 us", "max us",
+              "c2e p50", "c2e p99", "cpu ms/f");
+
+  std::vector<std::pair<run_t, result_t>> results;
+  bool all_ok = true;
+  for (auto &resolution : options.resolutions) {
+    for (auto codec : options.codecs) {
+      for (auto &preset : options.presets) {
+        for (bool capture_paced : options.capture_paced) {
+          run_t current{resolution, codec, preset, capture_paced};
+          auto result = run(options, current);
+          all_ok = all_ok && result.ok;
+
+          auto name = std::to_string(resolution.first) + 'x' + std::to_string(resolution.second);
+          auto pacing = capture_paced ? "capture" : "fixed";
+          if (!result.ok) {
+            std::printf("%-10s %-5s %-10s %-7s %8s\n", name.c_str(), codec_name(codec),
+                        preset.c_str(), pacing, "failed");
+          } else {
+            auto us = [](std::chrono::nanoseconds ns) { return ns.count() / 1000.0; };
+            std::printf("%-10s %-5s %-10s %-7s %8.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f "
+                        "%10.2f\n",
+                        name.c_str(), codec_name(codec), preset.c_str(), pacing,
+                        result.frames / result.seconds, us(result.latency.percentile(50)),
+                        us(result.latency.percentile(99)), us(result.latency.percentile(99.9)),
+                        us(result.latency.max()), us(result.capture_to_encode.percentile(50)),
+                        us(result.capture_to_encode.percentile(99)),
+                        result.frames ? result.cpu_seconds * 1000 / result.frames : 0.0);
+          }
+          std::fflush(stdout);
+
+          results.emplace_back(std::move(current), std::move(result));
+        }
+      }
+    }
+  }
+
+  if (options.json == "-"sv) {
+    write_json(std::cout, options, results);
+  } else if (!options.json.empty()) {
+    std::ofstream out{options.json, std::ios::trunc};
+    write_json(out, options, results);
+    if (!out) {
+      std::fprintf(stderr, "Could not write %s\n", options.json.c_str());
+      return 1;
+    }
+  }
+
+  return all_ok ? 0 : 1;
+}
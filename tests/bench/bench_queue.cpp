@@ -0,0 +1,192 @@
+/**
+ * @file tests/bench/bench_queue.cpp
+ * @brief Hand-off latency and throughput of safe::queue_t in each queue_mode_e.
+ *
+ * One thread raises heap-allocated packets, like encode_run does, and another pops them,
+ * like push_video does. The paced run measures latency from raise() to pop() returning;
+ * the flood run raises as fast as possible and counts what the consumer had to drop.
+ *
+ * With --displays N, N producer/consumer pairs run at once, each on its own queue like the
+ * per-display pipelines, and the table shows their combined totals. Nothing is shared
+ * between displays, so raised/s should scale with N until the cores run out.
+ *
+ * Usage: bench_queue [--mode locked|spsc|all] [--items N] [--rate N] [--capacity N]
+ *                    [--displays N]
+ */
+#include "ivshmem_wait.h"
+#include "thread_safe.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+struct options_t {
+  std::vector<safe::queue_mode_e> modes{safe::queue_mode_e::locked, safe::queue_mode_e::spsc};
+  std::uint64_t items = 200000;
+  int rate = 10000; ///< Packets per second in the paced run
+  std::uint32_t capacity = 32;
+  int displays = 1;
+};
+
+struct packet_t {
+  std::chrono::steady_clock::time_point raised;
+  std::uint64_t index;
+};
+
+struct result_t {
+  ivshmem_protocol::latency_histogram_t latency;
+  std::uint64_t received = 0;
+  std::chrono::nanoseconds raising{}; ///< Time the producer spent raising every packet
+};
+
+/** Totals across displays; raised/s counts every display's packets over the slowest one. */
+struct totals_t {
+  ivshmem_protocol::latency_histogram_t latency;
+  std::uint64_t received = 0;
+  std::uint64_t raised = 0;
+  std::chrono::nanoseconds raising{};
+
+  void add(const result_t &result, std::uint64_t items) {
+    latency.merge(result.latency);
+    received += result.received;
+    raised += items;
+    raising = std::max(raising, result.raising);
+  }
+};
+
+const char *to_string(safe::queue_mode_e mode) {
+  return mode == safe::queue_mode_e::spsc ? "spsc" : "locked";
+}
+
+/** @param interval Time between raises, or zero to raise as fast as possible. */
+result_t run(const options_t &options, safe::queue_t<std::unique_ptr<packet_t>> &queue,
+             std::chrono::nanoseconds interval, std::chrono::steady_clock::time_point start) {
+  result_t result;
+
+  std::thread producer{[&]() {
+    auto next = start;
+    for (std::uint64_t i = 0; i < options.items; ++i) {
+      if (interval.count()) {
+        next += interval;
+        std::this_thread::sleep_until(next);
+      }
+      queue.raise(std::make_unique<packet_t>(packet_t{std::chrono::steady_clock::now(), i}));
+    }
+    result.raising = std::chrono::steady_clock::now() - start;
+  }};
+
+  while (auto packet = queue.pop(5s)) {
+    result.latency.record(std::chrono::steady_clock::now() - packet->raised);
+    ++result.received;
+    if (packet->index + 1 == options.items) {
+      break;
+    }
+  }
+
+  producer.join();
+  return result;
+}
+
+totals_t run_displays(const options_t &options, safe::queue_mode_e mode,
+                      std::chrono::nanoseconds interval) {
+  std::vector<std::unique_ptr<safe::queue_t<std::unique_ptr<packet_t>>>> queues;
+  for (int display = 0; display < options.displays; ++display) {
+    queues.push_back(
+        std::make_unique<safe::queue_t<std::unique_ptr<packet_t>>>(options.capacity, mode));
+  }
+
+  std::vector<result_t> results(queues.size());
+  std::vector<std::thread> consumers;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t display = 0; display < queues.size(); ++display) {
+    consumers.emplace_back([&, display]() {
+      results[display] = run(options, *queues[display], interval, start);
+    });
+  }
+
+  totals_t totals;
+  for (std::size_t display = 0; display < consumers.size(); ++display) {
+    consumers[display].join();
+    totals.add(results[display], options.items);
+  }
+  return totals;
+}
+
+void print_result(safe::queue_mode_e mode, const char *run, const totals_t &result) {
+  auto us = [](std::chrono::nanoseconds ns) { return ns.count() / 1000.0; };
+  auto seconds = result.raising.count() / 1e9;
+  std::printf("%-7s %-6s %10llu %10.1f %10.1f %10.1f %10.1f %12.0f\n", to_string(mode), run,
+              (unsigned long long)(result.raised - result.received),
+              us(result.latency.percentile(50)),
+              us(result.latency.percentile(99)), us(result.latency.percentile(99.9)),
+              us(result.latency.max()), result.raised / seconds);
+}
+
+bool parse_args(int argc, char *argv[], options_t &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string_view value = argv[++i];
+
+    if (arg == "--mode"sv) {
+      options.modes.clear();
+      for (auto mode : {safe::queue_mode_e::locked, safe::queue_mode_e::spsc}) {
+        if (value == to_string(mode) || value == "all"sv) {
+          options.modes.push_back(mode);
+        }
+      }
+    } else if (arg == "--items"sv) {
+      options.items = std::strtoull(argv[i], nullptr, 10);
+    } else if (arg == "--rate"sv) {
+      options.rate = std::atoi(argv[i]);
+    } else if (arg == "--capacity"sv) {
+      options.capacity = (std::uint32_t)std::strtoul(argv[i], nullptr, 10);
+    } else if (arg == "--displays"sv) {
+      options.displays = std::atoi(argv[i]);
+    } else {
+      return false;
+    }
+  }
+
+  return options.items > 0 && options.rate > 0 && options.capacity > 0 &&
+         options.displays > 0 && !options.modes.empty();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  if (!parse_args(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "usage: %s [--mode locked|spsc|all] [--items N] [--rate N] [--capacity N] "
+                 "[--displays N]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  // Overflow warnings would drown the table
+  boost::log::core::get()->set_logging_enabled(false);
+
+  // Bucket upper bounds, so percentiles are rounded up to a power of two nanoseconds
+  std::printf("%-7s %-6s %10s %10s %10s %10s %10s %12s\n", "mode", "run", "dropped", "p50 us",
+              "p99 us", "p99.9 us", "max us", "raised/s");
+  for (auto mode : options.modes) {
+    auto interval = std::chrono::nanoseconds{1s} / options.rate;
+    print_result(mode, "paced", run_displays(options, mode, interval));
+    print_result(mode, "flood", run_displays(options, mode, 0ns));
+  }
+
+  return 0;
+}
@@ -0,0 +1,375 @@
+/**
+ * @file tests/bench/bench_roi.cpp
+ * @brief Bitrate and PSNR of the software encoders with and without region-of-interest hints.
+ *
+ * Encodes a synthetic desktop with a terminal window scrolling in the middle of it, with the
+ * rate control the software encoder uses for a session: CBR with a one-frame VBV buffer, no
+ * B-frames and an infinite GOP. Each frame carries the AV_FRAME_DATA_REGIONS_OF_INTEREST side
+ * data avcodec_software_encode_device_t::attach_roi() would give it for --static-qp; 0 runs
+ * without. The output is decoded again and compared with the source's luma, inside the window
+ * that moves and outside it, from the mean squared error over every frame.
+ *
+ * Usage: bench_roi [--resolution WxH] [--codecs h264,hevc] [--static-qp N,...]
+ *                  [--window percent] [--bitrate kbps] [--preset p] [--fps N] [--frames N]
+ */
+#include "platform/synthetic.h"
+#include "video_convert.h"
+#include "video_damage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/opt.h>
+}
+
+using namespace std::literals;
+
+namespace {
+
+namespace convert = video::convert;
+namespace damage = video::damage;
+
+struct options_t {
+  int width = 1920;
+  int height = 1080;
+  std::vector<std::string> codecs{"h264", "hevc"};
+  std::vector<int> static_qps{0, 2, 4, 8};
+  int window = 25;
+  int bitrate = 5000;
+  std::string preset = "superfast";
+  int fps = 60;
+  int frames = 300;
+};
+
+/** BT.709 limited range, as in bench_convert */
+convert::coefficients_t bt709() {
+  constexpr float Cr = 0.2126f, Cb = 0.0722f, Cg = 1.0f - Cr - Cb;
+  const float y[4]{Cr, Cg, Cb, 0.0f};
+  const float u[4]{-(Cr * 0.5f / (1.0f - Cb)), -(Cg * 0.5f / (1.0f - Cb)), 0.5f, 0.5f};
+  const float v[4]{0.5f, -(Cg * 0.5f / (1.0f - Cr)), -(Cb * 0.5f / (1.0f - Cr)), 0.5f};
+  const float range_y[2]{219.0f / 255, 16.0f / 255};
+  const float range_uv[2]{224.0f / 255, 16.0f / 255};
+  return convert::make_coefficients(y, u, v, range_y, range_uv, 8);
+}
+
+/** Squared error and samples, inside and outside the window */
+struct error_t {
+  double moving = 0;
+  double still = 0;
+  std::int64_t moving_samples = 0;
+  std::int64_t still_samples = 0;
+};
+
+double psnr(double squared_error, std::int64_t samples) {
+  if (!samples) {
+    return 0;
+  }
+  auto mse = squared_error / samples;
+  return mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse) : 99;
+}
+
+struct result_t {
+  double kbps = 0;
+  double psnr = 0;
+  double psnr_moving = 0;
+  double psnr_still = 0;
+};
+
+/** The side data attach_roi() builds, from the same tiles */
+void attach_roi(AVFrame *frame, damage::tiles_t &tiles, const std::vector<damage::rect_t> &rects,
+                int static_qp) {
+  av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+  tiles.clear();
+  tiles.mark(rects);
+  if (tiles.count() == tiles.size()) {
+    return;
+  }
+
+  auto moving = tiles.rects();
+  auto side_data = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                                          (moving.size() + 1) * sizeof(AVRegionOfInterest));
+  if (!side_data) {
+    return;
+  }
+
+  auto regions = (AVRegionOfInterest *)side_data->data;
+  for (auto &rect : moving) {
+    *regions++ = {sizeof(AVRegionOfInterest), rect.y, rect.y + rect.height, rect.x,
+                  rect.x + rect.width, {0, 1}};
+  }
+  *regions = {sizeof(AVRegionOfInterest), 0, frame->height, 0, frame->width, {static_qp, 51}};
+}
+
+void print_error(const char *what, int status) {
+  char string[AV_ERROR_MAX_STRING_SIZE];
+  std::fprintf(stderr, "%s: %s\n", what, av_make_error_string(string, sizeof(string), status));
+}
+
+bool run(const options_t &options, const std::string &codec_name, int static_qp,
+         result_t &result) {
+  auto width = options.width;
+  auto height = options.height;
+
+  auto encoder = avcodec_find_encoder_by_name(codec_name == "h264"sv ? "libx264" : "libx265");
+  auto decoder =
+      avcodec_find_decoder(codec_name == "h264"sv ? AV_CODEC_ID_H264 : AV_CODEC_ID_HEVC);
+  if (!encoder || !decoder) {
+    std::fprintf(stderr, "No encoder or decoder for %s\n", codec_name.c_str());
+    return false;
+  }
+
+  // As make_avcodec_encode_session() sets up the software encoder
+  auto encode_ctx = avcodec_alloc_context3(encoder);
+  encode_ctx->width = width;
+  encode_ctx->height = height;
+  encode_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  encode_ctx->time_base = AVRational{1, options.fps};
+  encode_ctx->framerate = AVRational{options.fps, 1};
+  encode_ctx->max_b_frames = 0;
+  encode_ctx->gop_size = std::numeric_limits<int>::max();
+  encode_ctx->keyint_min = std::numeric_limits<int>::max();
+  encode_ctx->flags |= AV_CODEC_FLAG_CLOSED_GOP | AV_CODEC_FLAG_LOW_DELAY;
+  encode_ctx->bit_rate = encode_ctx->rc_max_rate = encode_ctx->rc_min_rate =
+      (std::int64_t)options.bitrate * 1000;
+  encode_ctx->rc_buffer_size = options.bitrate * 1000 / options.fps;
+  if (codec_name == "hevc"sv) {
+    encode_ctx->rc_buffer_size = options.bitrate * 1000 / ((options.fps * 10) / 15);
+  }
+
+  AVDictionary *codec_options = nullptr;
+  av_dict_set(&codec_options, "preset", options.preset.c_str(), 0);
+  av_dict_set(&codec_options, "tune", "zerolatency", 0);
+  if (codec_name == "hevc"sv) {
+    av_dict_set(&codec_options, "forced-idr", "1", 0);
+    av_dict_set(&codec_options, "x265-params", "info=0:keyint=-1:log-level=error", 0);
+  }
+  auto status = avcodec_open2(encode_ctx, encoder, &codec_options);
+  av_dict_free(&codec_options);
+  if (status < 0) {
+    print_error("Couldn't open the encoder", status);
+    avcodec_free_context(&encode_ctx);
+    return false;
+  }
+
+  auto decode_ctx = avcodec_alloc_context3(decoder);
+  status = avcodec_open2(decode_ctx, decoder, nullptr);
+  if (status < 0) {
+    print_error("Couldn't open the decoder", status);
+    avcodec_free_context(&encode_ctx);
+    avcodec_free_context(&decode_ctx);
+    return false;
+  }
+
+  // A terminal window of that share of the screen, with the screen's aspect ratio
+  auto side = std::sqrt(options.window / 100.0);
+  damage::rect_t window{0, 0, std::max((int)(width * side) & ~1, 2),
+                        std::max((int)(height * side) & ~1, 2)};
+  window.x = (width - window.width) / 2 & ~1;
+  window.y = (height - window.height) / 2 & ~1;
+
+  platf::synthetic::spec_t spec;
+  spec.width = width;
+  spec.height = height;
+  spec.framerate = options.fps;
+  platf::synthetic::generator_t desktop{spec};
+  spec.pattern = platf::synthetic::pattern_e::text;
+  spec.width = window.width;
+  spec.height = window.height;
+  platf::synthetic::generator_t terminal{spec};
+
+  auto coefficients = bt709();
+  std::vector<std::uint8_t> pixels((std::size_t)width * 4 * height);
+  damage::tiles_t tiles{width, height};
+  std::map<std::int64_t, std::vector<std::uint8_t>> sources; ///< Luma by pts, until decoded
+  std::int64_t bytes = 0;
+  error_t error;
+
+  auto frame = av_frame_alloc();
+  frame->width = width;
+  frame->height = height;
+  frame->format = AV_PIX_FMT_YUV420P;
+  av_frame_get_buffer(frame, 0);
+  auto decoded = av_frame_alloc();
+  auto packet = av_packet_alloc();
+
+  auto compare = [&]() {
+    while (avcodec_receive_frame(decode_ctx, decoded) >= 0) {
+      auto source = sources.find(decoded->pts);
+      if (source != sources.end()) {
+        for (int y = 0; y < height; ++y) {
+          auto row = decoded->data[0] + (std::ptrdiff_t)y * decoded->linesize[0];
+          auto expected = source->second.data() + (std::ptrdiff_t)y * width;
+          for (int x = 0; x < width; ++x) {
+            double difference = (int)row[x] - (int)expected[x];
+            auto inside = x >= window.x && x < window.x + window.width && y >= window.y &&
+                          y < window.y + window.height;
+            (inside ? error.moving : error.still) += difference * difference;
+            ++(inside ? error.moving_samples : error.still_samples);
+          }
+        }
+        sources.erase(source);
+      }
+      av_frame_unref(decoded);
+    }
+  };
+
+  auto drain = [&]() {
+    while (avcodec_receive_packet(encode_ctx, packet) >= 0) {
+      bytes += packet->size;
+      avcodec_send_packet(decode_ctx, packet);
+      av_packet_unref(packet);
+      compare();
+    }
+  };
+
+  for (int i = 0; i < options.frames; ++i) {
+    desktop.render(i, pixels.data(), width * 4, true);
+    terminal.render(i, pixels.data() + (std::ptrdiff_t)window.y * width * 4 + window.x * 4,
+                    width * 4, false);
+
+    av_frame_make_writable(frame);
+    convert::planes_t planes{{frame->data[0], frame->data[1], frame->data[2]},
+                             {frame->linesize[0], frame->linesize[1], frame->linesize[2]}};
+    convert::convert(convert::format_e::yuv420p, {pixels.data(), width * 4, width, height},
+                     planes, coefficients);
+    frame->pts = i;
+
+    // What the capture thread would report: the window, and where the cursor was and is
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+    if (static_qp > 0 && i > 0) {
+      auto rects = desktop.damage(i - 1, true, i, true);
+      rects.push_back(window);
+      attach_roi(frame, tiles, rects, static_qp);
+    }
+
+    auto &luma = sources[i];
+    luma.resize((std::size_t)width * height);
+    for (int y = 0; y < height; ++y) {
+      std::memcpy(luma.data() + (std::ptrdiff_t)y * width,
+                  frame->data[0] + (std::ptrdiff_t)y * frame->linesize[0], width);
+    }
+
+    status = avcodec_send_frame(encode_ctx, frame);
+    if (status < 0) {
+      print_error("Couldn't encode", status);
+      break;
+    }
+    drain();
+  }
+
+  avcodec_send_frame(encode_ctx, nullptr);
+  drain();
+  avcodec_send_packet(decode_ctx, nullptr);
+  compare();
+
+  result.kbps = bytes * 8.0 * options.fps / options.frames / 1000;
+  result.psnr = psnr(error.moving + error.still, error.moving_samples + error.still_samples);
+  result.psnr_moving = psnr(error.moving, error.moving_samples);
+  result.psnr_still = psnr(error.still, error.still_samples);
+
+  av_packet_free(&packet);
+  av_frame_free(&decoded);
+  av_frame_free(&frame);
+  avcodec_free_context(&decode_ctx);
+  avcodec_free_context(&encode_ctx);
+  return status >= 0;
+}
+
+std::vector<std::string> split(std::string_view list) {
+  std::vector<std::string> items;
+  while (!list.empty()) {
+    auto comma = list.find(',');
+    items.emplace_back(list.substr(0, comma));
+    list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+  }
+  return items;
+}
+
+bool parse_args(int argc, char *argv[], options_t &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string_view value = argv[++i];
+
+    if (arg == "--resolution"sv) {
+      if (std::sscanf(argv[i], "%dx%d", &options.width, &options.height) != 2 ||
+          options.width <= 0 || options.height <= 0 || options.width % 2 || options.height % 2) {
+        return false;
+      }
+    } else if (arg == "--codecs"sv) {
+      options.codecs = split(value);
+      for (auto &codec : options.codecs) {
+        if (codec != "h264"sv && codec != "hevc"sv) {
+          return false;
+        }
+      }
+    } else if (arg == "--static-qp"sv) {
+      options.static_qps.clear();
+      for (auto &item : split(value)) {
+        options.static_qps.push_back(std::clamp(std::atoi(item.c_str()), 0, 51));
+      }
+    } else if (arg == "--window"sv) {
+      options.window = std::atoi(argv[i]);
+    } else if (arg == "--bitrate"sv) {
+      options.bitrate = std::atoi(argv[i]);
+    } else if (arg == "--preset"sv) {
+      options.preset = value;
+    } else if (arg == "--fps"sv) {
+      options.fps = std::atoi(argv[i]);
+    } else if (arg == "--frames"sv) {
+      options.frames = std::atoi(argv[i]);
+    } else {
+      return false;
+    }
+  }
+
+  return !options.codecs.empty() && !options.static_qps.empty() && options.window > 0 &&
+         options.window <= 100 && options.bitrate > 0 && options.fps > 0 && options.frames > 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  if (!parse_args(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "usage: %s [--resolution WxH] [--codecs h264,hevc] [--static-qp N,...]\n"
+                 "          [--window percent] [--bitrate kbps] [--preset p] [--fps N]"
+                 " [--frames N]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  std::printf("%dx%d@%d, %d kbps, %s, terminal window over %d%% of the screen\n", options.width,
+              options.height, options.fps, options.bitrate, options.preset.c_str(),
+              options.window);
+  std::printf("%-6s %9s %9s %9s %11s %11s\n", "codec", "static qp", "kbps", "PSNR", "PSNR window",
+              "PSNR rest");
+
+  for (auto &codec : options.codecs) {
+    for (auto static_qp : options.static_qps) {
+      result_t result;
+      if (!run(options, codec, static_qp, result)) {
+        return 1;
+      }
+      std::printf("%-6s %9d %9.0f %9.2f %11.2f %11.2f\n", codec.c_str(), static_qp, result.kbps,
+                  result.psnr, result.psnr_moving, result.psnr_still);
+    }
+  }
+
+  return 0;
+}
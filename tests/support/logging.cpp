@@ -0,0 +1,14 @@
+/**
+ * @file tests/support/logging.cpp
+ * @brief The application's loggers, for test binaries that don't link logging.cpp.
+ *
+ * Nothing is attached to the core, so Boost.Log prints records to stderr.
+ */
+#include "logging.h"
+
+boost::log::sources::severity_logger<int> verbose(0);
+boost::log::sources::severity_logger<int> debug(1);
+boost::log::sources::severity_logger<int> info(2);
+boost::log::sources::severity_logger<int> warning(3);
+boost::log::sources::severity_logger<int> error(4);
+boost::log::sources::severity_logger<int> fatal(5);
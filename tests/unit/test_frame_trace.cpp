@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include "frame_trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+using frame_trace::stage_e;
+
+frame_trace::record_t make_record(std::int64_t frame, int channel = 0) {
+  frame_trace::record_t record;
+  record.frame = frame;
+  record.channel = channel;
+  for (std::size_t i = 0; i < frame_trace::kStages; ++i) {
+    record.ns[i] = 1000000 + frame * 100000 + (std::int64_t)i * 1000;
+  }
+  return record;
+}
+
+std::size_t count(const std::string &text, const std::string &needle) {
+  std::size_t found = 0;
+  for (auto pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + 1)) {
+    ++found;
+  }
+  return found;
+}
+
+TEST(FrameTrace, RingKeepsNewestRecords) {
+  frame_trace::ring_t ring{4};
+  for (int frame = 0; frame < 10; ++frame) {
+    ring.push(make_record(frame));
+  }
+
+  auto records = ring.snapshot();
+  ASSERT_EQ(records.size(), 4u);
+  for (std::size_t i = 0; i < records.size(); ++i) {
+    EXPECT_EQ(records[i].frame, (std::int64_t)(6 + i));
+    EXPECT_EQ(records[i].ns, make_record(6 + i).ns);
+  }
+}
+
+TEST(FrameTrace, SnapshotNeverReturnsTornRecords) {
+  frame_trace::ring_t ring{8};
+  std::atomic<bool> done{false};
+
+  std::vector<std::thread> writers;
+  for (int channel = 0; channel < 2; ++channel) {
+    writers.emplace_back([&, channel]() {
+      for (int frame = 0; frame < 50000; ++frame) {
+        ring.push(make_record(frame, channel));
+      }
+    });
+  }
+
+  std::size_t checked = 0;
+  std::thread reader{[&]() {
+    while (!done.load()) {
+      for (auto &record : ring.snapshot()) {
+        ASSERT_EQ(record.ns, make_record(record.frame, record.channel).ns);
+        ++checked;
+      }
+    }
+  }};
+
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  done = true;
+  reader.join();
+
+  EXPECT_EQ(ring.snapshot().size(), 8u);
+}
+
+TEST(FrameTrace, WritesChromeTraceEvents) {
+  auto complete = make_record(7, 1);
+
+  // A repeated frame has nothing captured or converted
+  frame_trace::record_t repeat;
+  repeat.frame = 8;
+  repeat.mark(stage_e::encode_start, std::chrono::steady_clock::time_point{3ms});
+  repeat.mark(stage_e::encode_end, std::chrono::steady_clock::time_point{4ms});
+
+  std::ostringstream out;
+  frame_trace::write_chrome_json(out, {complete, repeat});
+  auto json = out.str();
+
+  EXPECT_EQ(json.front(), '[');
+  EXPECT_EQ(json.substr(json.size() - 2), "]\n");
+  EXPECT_EQ(count(json, R"("ph":"X")"), 6u + 1u);
+  EXPECT_EQ(count(json, R"("name":"convert")"), 1u);
+  EXPECT_EQ(count(json, R"("name":"encode")"), 2u);
+  EXPECT_EQ(count(json, R"("frame":8)"), 1u);
+  EXPECT_NE(json.find(R"("name":"display 1: publish")"), std::string::npos);
+
+  // Relative to the earliest timestamp, which is the repeated frame's encode_start
+  EXPECT_NE(json.find(R"("ts":0.000)"), std::string::npos);
+  EXPECT_NE(json.find(R"("dur":1000.000)"), std::string::npos);
+}
+
+TEST(FrameTrace, SubmitIsIgnoredUntilEnabled) {
+  // Tracing can't be turned off again, so only the first run in a process sees it disabled
+  if (!frame_trace::enabled()) {
+    frame_trace::submit(make_record(1));
+    EXPECT_TRUE(frame_trace::snapshot().empty());
+    frame_trace::enable(16);
+  }
+
+  ASSERT_TRUE(frame_trace::enabled());
+  frame_trace::submit(make_record(2));
+
+  auto records = frame_trace::snapshot();
+  ASSERT_FALSE(records.empty());
+  EXPECT_EQ(records.back().frame, 2);
+  EXPECT_NE(records.front().frame, 1);
+}
+
+} // namespace
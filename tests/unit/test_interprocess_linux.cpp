@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+
+#include "interprocess.h"
+#include "ivshmem_protocol.h"
+#include "smemory.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+namespace {
+
+namespace ring = ivshmem_protocol::ring;
+
+std::string unique_name(const char *prefix) {
+  return std::string{prefix} + "-" + std::to_string(getpid());
+}
+
+TEST(InterprocessLinux, DoorbellEventIsAutoReset) {
+  DoorbellEvent event;
+  ASSERT_TRUE(event.Initialize());
+
+  EXPECT_FALSE(event.Wait(0));
+  EXPECT_TRUE(event.Signal());
+  EXPECT_TRUE(event.Signal());
+  EXPECT_TRUE(event.Wait(0));
+  EXPECT_FALSE(event.Wait(0));
+}
+
+TEST(InterprocessLinux, NamedSharedMemoryIsShared) {
+  auto name = unique_name("sunshine-test-shm");
+  SharedMemory host{name.c_str(), 1 << 20, SharedMemory::Create | SharedMemory::Populate};
+  ASSERT_TRUE(host.Initialize());
+
+  SharedMemory guest{name.c_str(), 1 << 20};
+  ASSERT_TRUE(guest.Initialize());
+  ASSERT_NE(host.GetMemory(), guest.GetMemory());
+
+  std::strcpy((char *)host.GetMemory(), "hello");
+  EXPECT_STREQ((char *)guest.GetMemory(), "hello");
+
+  // The creator removes the object
+  guest.DeInitialize();
+  host.DeInitialize();
+  SharedMemory gone{name.c_str(), 1 << 20};
+  EXPECT_FALSE(gone.Initialize());
+}
+
+TEST(InterprocessLinux, OpeningASmallerObjectFails) {
+  auto name = unique_name("sunshine-test-shm-small");
+  SharedMemory host{name.c_str(), 4096, SharedMemory::Create};
+  ASSERT_TRUE(host.Initialize());
+
+  // Mapping all of it would raise SIGBUS on the first touch past the object's end
+  SharedMemory guest{name.c_str(), 1 << 20};
+  EXPECT_FALSE(guest.Initialize());
+  EXPECT_EQ(guest.GetMemory(), nullptr);
+
+  SharedMemory fits{name.c_str(), 4096};
+  EXPECT_TRUE(fits.Initialize());
+}
+
+TEST(InterprocessLinux, AnonymousHugePagesFallBack) {
+  // Succeeds whether or not huge pages are reserved on this machine
+  SharedMemory memory{NULL, 1 << 20, SharedMemory::HugePages};
+  ASSERT_TRUE(memory.Initialize());
+  EXPECT_GE(memory.GetSize(), 1u << 20);
+
+  std::memset(memory.GetMemory(), 0xAB, 1 << 20);
+}
+
+TEST(InterprocessLinux, IvshmemMapsFileAndRingsDoorbells) {
+  auto path = "/tmp/" + unique_name("sunshine-test-ivshmem");
+  {
+    auto file = std::fopen(path.c_str(), "wb");
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(ftruncate(fileno(file), sizeof(MediaRingMemory)), 0);
+    std::fclose(file);
+  }
+
+  IVSHMEM ivshmem{path.c_str()};
+  ASSERT_TRUE(ivshmem.Initialize());
+  ASSERT_EQ(ivshmem.GetSize(), sizeof(MediaRingMemory));
+  auto memory = (MediaRingMemory *)ivshmem.GetMemory();
+  ASSERT_NE(memory, nullptr);
+
+  DoorbellEvent event;
+  ASSERT_TRUE(event.Initialize());
+  ASSERT_TRUE(ivshmem.RegisterEvent(event.GetHandle(), 1));
+
+  std::thread consumer{[&]() {
+    ring::reader_t reader{&memory->video[0].ring};
+    std::optional<ring::record_t> record;
+    while (!(record = reader.peek())) {
+      ASSERT_TRUE(event.Wait(5000));
+    }
+    EXPECT_EQ(record->size, 5u);
+    EXPECT_TRUE(reader.release());
+  }};
+
+  std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  ring::writer_t writer{&memory->video[0].ring};
+  ASSERT_TRUE(writer.write(RING_RECORD_VIDEO, {{"frame", 5}}));
+  EXPECT_TRUE(ivshmem.RingDoorbell(0, 1));
+  EXPECT_FALSE(ivshmem.RingDoorbell(0, 2));
+
+  consumer.join();
+  ivshmem.DeInitialize();
+  std::remove(path.c_str());
+}
+
+} // namespace
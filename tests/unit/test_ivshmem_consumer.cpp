@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include "ivshmem_consumer.h"
+#include "ivshmem_protocol.h"
+#include "smemory.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+namespace consumer = ivshmem_protocol::consumer;
+namespace ring = ivshmem_protocol::ring;
+
+TEST(IvshmemConsumer, ParsesVideoHeader) {
+  char payload[ivshmem_protocol::kVideoPacketHeaderSize + 3];
+  std::uint64_t frame_index = 42;
+  std::uint64_t rtp_sample_duration = 1500;
+  std::memcpy(payload, &frame_index, sizeof(frame_index));
+  std::memcpy(payload + 8, &rtp_sample_duration, sizeof(rtp_sample_duration));
+  payload[16] =
+      ivshmem_protocol::kVideoFlagKeyframe | ivshmem_protocol::kVideoFlagAfterRefFrameInvalidation;
+  std::memcpy(payload + 17, "abc", 3);
+
+  auto frame = consumer::parse_frame(payload, sizeof(payload));
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(frame->frame_index, 42u);
+  EXPECT_EQ(frame->rtp_sample_duration, 1500u);
+  EXPECT_TRUE(frame->is_idr());
+  EXPECT_TRUE(frame->after_ref_frame_invalidation());
+  EXPECT_EQ(frame->size, 3u);
+  EXPECT_EQ(std::memcmp(frame->data, "abc", 3), 0);
+
+  EXPECT_FALSE(consumer::parse_frame(payload, ivshmem_protocol::kVideoPacketHeaderSize - 1));
+}
+
+TEST(IvshmemConsumer, ReadsLegacyQueue) {
+  auto memory = std::make_unique<MediaMemory>();
+  auto queue = &memory->video[0].internal;
+  consumer::video_reader_t reader{queue};
+  EXPECT_FALSE(reader.peek());
+
+  for (std::uint64_t frame_index = 0; frame_index < IN_QUEUE_SIZE + 2; ++frame_index) {
+    auto index = ivshmem_protocol::load_relaxed(queue->inindex);
+    auto slot = &queue->incoming[index];
+    std::uint64_t rtp_sample_duration = 0;
+    std::uint8_t flags = 0;
+    ivshmem_protocol::reset_packet(slot);
+    ivshmem_protocol::append_to_packet(slot, &frame_index, sizeof(frame_index));
+    ivshmem_protocol::append_to_packet(slot, &rtp_sample_duration, sizeof(rtp_sample_duration));
+    ivshmem_protocol::append_to_packet(slot, &flags, sizeof(flags));
+    ivshmem_protocol::publish(queue->inindex,
+                              ivshmem_protocol::advance_index(index, IN_QUEUE_SIZE));
+
+    auto frame = reader.peek();
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame->frame_index, frame_index);
+    EXPECT_EQ(frame->size, 0u);
+    EXPECT_TRUE(reader.release());
+    EXPECT_FALSE(reader.peek());
+  }
+}
+
+TEST(IvshmemConsumer, ReadsRingAndSkipsRunts) {
+  auto memory = std::make_unique<MediaRingMemory>();
+  consumer::init_ring_memory(memory.get(), 7);
+  EXPECT_EQ(ring::detect_layout(memory.get(), sizeof(MediaRingMemory)), ring::layout_e::ring);
+  EXPECT_FALSE(consumer::ring_accepted(memory.get()));
+  ring::accept_layout(&memory->header);
+  EXPECT_TRUE(consumer::ring_accepted(memory.get()));
+
+  ring::writer_t writer{&memory->audio};
+  consumer::audio_reader_t reader{&memory->audio};
+
+  std::uint64_t frame_index = 9;
+  std::uint64_t rtp_sample_duration = 480;
+  std::uint8_t flags = 0;
+  ASSERT_TRUE(writer.write(RING_RECORD_AUDIO, {{"runt", 4}}));
+  ASSERT_TRUE(writer.write(RING_RECORD_AUDIO, {{&frame_index, sizeof(frame_index)},
+                                               {&rtp_sample_duration, sizeof(rtp_sample_duration)},
+                                               {&flags, sizeof(flags)},
+                                               {"opus", 4}}));
+
+  auto frame = reader.peek();
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(frame->frame_index, 9u);
+  EXPECT_EQ(frame->rtp_sample_duration, 480u);
+  EXPECT_FALSE(frame->is_idr());
+  EXPECT_EQ(frame->size, 4u);
+  EXPECT_TRUE(reader.release());
+  EXPECT_FALSE(reader.peek());
+}
+
+} // namespace
@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+
+#include "ivshmem_protocol.h"
+#include "smemory.h"
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+namespace control = ivshmem_protocol::control;
+
+TEST(IvshmemControl, RoundTripsFullWidthFields) {
+  DataPacket packet;
+  control::writer_t writer{packet.data, sizeof(packet.data)};
+  ASSERT_TRUE(writer.bitrate(150000));
+  ASSERT_TRUE(writer.framerate(144));
+  ASSERT_TRUE(writer.resolution(3840, 2160));
+  ASSERT_TRUE(writer.invalidate_ref_frames(1ull << 40, (1ull << 40) + 7));
+  ASSERT_TRUE(writer.add(control::type_e::idr));
+  packet.size = (int)writer.size();
+
+  ASSERT_TRUE(control::is_batch(packet.data, packet.size));
+  control::reader_t reader{packet.data, (std::size_t)packet.size};
+  ASSERT_TRUE(reader.ok());
+
+  auto message = reader.next();
+  ASSERT_TRUE(message);
+  EXPECT_EQ(message->type, control::type_e::bitrate);
+  EXPECT_EQ(message->version, control::kVersion);
+  std::uint32_t kbps;
+  ASSERT_TRUE(message->read(0, kbps));
+  EXPECT_EQ(kbps, 150000u);
+
+  message = reader.next();
+  ASSERT_TRUE(message);
+  EXPECT_EQ(message->type, control::type_e::framerate);
+  std::uint32_t fps;
+  ASSERT_TRUE(message->read(0, fps));
+  EXPECT_EQ(fps, 144u);
+
+  message = reader.next();
+  ASSERT_TRUE(message);
+  EXPECT_EQ(message->type, control::type_e::resolution);
+  std::uint32_t width, height;
+  ASSERT_TRUE(message->read(0, width));
+  ASSERT_TRUE(message->read(4, height));
+  EXPECT_EQ(width, 3840u);
+  EXPECT_EQ(height, 2160u);
+
+  message = reader.next();
+  ASSERT_TRUE(message);
+  EXPECT_EQ(message->type, control::type_e::invalidate_ref_frames);
+  std::uint64_t first_frame, last_frame;
+  ASSERT_TRUE(message->read(0, first_frame));
+  ASSERT_TRUE(message->read(8, last_frame));
+  EXPECT_EQ(first_frame, 1ull << 40);
+  EXPECT_EQ(last_frame, (1ull << 40) + 7);
+
+  message = reader.next();
+  ASSERT_TRUE(message);
+  EXPECT_EQ(message->type, control::type_e::idr);
+  EXPECT_EQ(message->size, 0u);
+
+  EXPECT_FALSE(reader.next());
+  EXPECT_FALSE(reader.truncated());
+}
+
+TEST(IvshmemControl, LegacyPacketsAreNotBatches) {
+  // Legacy bitrate command: EventType::Bitrate, then Mbps
+  char legacy[DATA_PACKET_SIZE] = {1, 20};
+  EXPECT_FALSE(control::is_batch(legacy, sizeof(legacy)));
+
+  control::reader_t reader{legacy, sizeof(legacy)};
+  EXPECT_FALSE(reader.ok());
+  EXPECT_FALSE(reader.next());
+}
+
+TEST(IvshmemControl, SkipsUnknownTypesAndIgnoresNewerFields) {
+  char buffer[64];
+  control::writer_t writer{buffer, sizeof(buffer)};
+
+  std::uint8_t future[5] = {1, 2, 3, 4, 5};
+  ASSERT_TRUE(writer.add(static_cast<control::type_e>(200), {{future, sizeof(future)}}));
+
+  // A later version of bitrate with an extra field
+  std::uint32_t kbps = 8000, extra = 0xFFFFFFFF;
+  ASSERT_TRUE(
+      writer.add(control::type_e::bitrate, {{&kbps, sizeof(kbps)}, {&extra, sizeof(extra)}}));
+
+  control::reader_t reader{buffer, writer.size()};
+  auto message = reader.next();
+  ASSERT_TRUE(message);
+  EXPECT_EQ(static_cast<int>(message->type), 200);
+
+  message = reader.next();
+  ASSERT_TRUE(message);
+  std::uint32_t value;
+  ASSERT_TRUE(message->read(0, value));
+  EXPECT_EQ(value, 8000u);
+  EXPECT_FALSE(reader.next());
+}
+
+TEST(IvshmemControl, RejectsShortAndTruncatedMessages) {
+  char buffer[64];
+  control::writer_t writer{buffer, sizeof(buffer)};
+  std::uint16_t half = 7;
+  ASSERT_TRUE(writer.add(control::type_e::resolution, {{&half, sizeof(half)}}));
+  ASSERT_TRUE(writer.bitrate(5000));
+
+  control::reader_t reader{buffer, writer.size()};
+  auto message = reader.next();
+  ASSERT_TRUE(message);
+  std::uint32_t width;
+  EXPECT_FALSE(message->read(0, width));
+  EXPECT_FALSE(message->read(SIZE_MAX, width));
+
+  // Cut the bitrate message in half
+  control::reader_t truncated{buffer, writer.size() - 2};
+  ASSERT_TRUE(truncated.next());
+  EXPECT_FALSE(truncated.next());
+  EXPECT_TRUE(truncated.truncated());
+}
+
+TEST(IvshmemControl, WriterStopsWhenFull) {
+  char buffer[control::kBatchHeaderSize + 2 * (sizeof(control::header_t) + 4)];
+  control::writer_t writer{buffer, sizeof(buffer)};
+  EXPECT_TRUE(writer.bitrate(1));
+  EXPECT_TRUE(writer.framerate(2));
+  EXPECT_FALSE(writer.framerate(3));
+  EXPECT_EQ(writer.size(), sizeof(buffer));
+
+  char tiny[1];
+  control::writer_t none{tiny, sizeof(tiny)};
+  EXPECT_FALSE(none.add(control::type_e::idr));
+  EXPECT_EQ(none.size(), 0u);
+}
+
+TEST(IvshmemControl, FuzzedBuffersStayInBounds) {
+  std::mt19937 random{1234};
+  std::vector<char> buffer;
+
+  for (int iteration = 0; iteration < 20000; ++iteration) {
+    buffer.resize(random() % 64);
+    for (auto &byte : buffer) {
+      byte = static_cast<char>(random());
+    }
+    if (buffer.size() >= control::kBatchHeaderSize && random() % 4 != 0) {
+      buffer[0] = static_cast<char>(control::kMagic);
+    }
+
+    control::reader_t reader{buffer.data(), buffer.size()};
+    std::size_t messages = 0;
+    while (auto message = reader.next()) {
+      ASSERT_GE(message->payload,
+                buffer.data() + control::kBatchHeaderSize + sizeof(control::header_t));
+      ASSERT_LE(message->payload + message->size, buffer.data() + buffer.size());
+
+      std::uint64_t field;
+      if (message->read(0, field)) {
+        ASSERT_GE(message->size, sizeof(field));
+      }
+      ASSERT_LE(++messages, buffer.size() / sizeof(control::header_t));
+    }
+  }
+}
+
+} // namespace
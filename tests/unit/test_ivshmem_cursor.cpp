@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+
+#include "ivshmem_consumer.h"
+#include "ivshmem_protocol.h"
+#include "smemory.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+namespace consumer = ivshmem_protocol::consumer;
+namespace cursor = ivshmem_protocol::cursor;
+
+std::vector<std::uint8_t> bgra(int width, int height, std::uint8_t fill) {
+  return std::vector<std::uint8_t>((std::size_t)width * height * 4, fill);
+}
+
+TEST(IvshmemCursor, HandshakeNeedsTheHost) {
+  auto memory = std::make_unique<CursorMemory>();
+  EXPECT_FALSE(cursor::detect(memory.get(), sizeof(CursorMemory)));
+
+  consumer::init_cursor_memory(memory.get());
+  EXPECT_TRUE(cursor::detect(memory.get(), sizeof(CursorMemory)));
+  EXPECT_FALSE(cursor::detect(memory.get(), sizeof(CursorMemory) - 1));
+  EXPECT_FALSE(consumer::cursor_accepted(memory.get()));
+
+  cursor::accept(&memory->header);
+  EXPECT_TRUE(consumer::cursor_accepted(memory.get()));
+}
+
+TEST(IvshmemCursor, NoPositionBeforeTheFirst) {
+  auto memory = std::make_unique<CursorMemory>();
+  consumer::cursor_reader_t reader{&memory->display[0]};
+  EXPECT_FALSE(reader.position());
+  EXPECT_FALSE(reader.poll());
+  EXPECT_FALSE(reader.shape());
+}
+
+TEST(IvshmemCursor, ShapeAndPositionRoundTrip) {
+  auto memory = std::make_unique<CursorMemory>();
+  cursor::writer_t writer{&memory->display[1]};
+  consumer::cursor_reader_t reader{&memory->display[1]};
+
+  auto pixels = bgra(12, 19, 0x7f);
+  ASSERT_TRUE(writer.shape(CURSOR_SHAPE_COLOR, 12, 19, 48, 1, 2, pixels.data()));
+  writer.position(true, 100, -5, 123456789);
+
+  ASSERT_TRUE(reader.poll());
+  auto &shape = reader.shape();
+  ASSERT_TRUE(shape);
+  EXPECT_EQ(shape->header.id, 1u);
+  EXPECT_EQ(shape->header.type, (std::uint32_t)CURSOR_SHAPE_COLOR);
+  EXPECT_EQ(shape->header.width, 12u);
+  EXPECT_EQ(shape->header.height, 19u);
+  EXPECT_EQ(shape->header.pitch, 48u);
+  EXPECT_EQ(shape->header.hotspot_x, 1);
+  EXPECT_EQ(shape->header.hotspot_y, 2);
+  ASSERT_EQ(shape->data.size(), pixels.size());
+  EXPECT_EQ(std::memcmp(shape->data.data(), pixels.data(), pixels.size()), 0);
+
+  auto position = reader.position();
+  ASSERT_TRUE(position);
+  EXPECT_TRUE(position->visible);
+  EXPECT_EQ(position->x, 100);
+  EXPECT_EQ(position->y, -5);
+  EXPECT_EQ(position->shape_id, 1u);
+  EXPECT_EQ(position->timestamp_ns, 123456789);
+  EXPECT_EQ(position->updates, 1u);
+
+  // Moving doesn't resend the shape
+  writer.position(false, 101, -4, 123456800);
+  EXPECT_FALSE(reader.poll());
+  position = reader.position();
+  ASSERT_TRUE(position);
+  EXPECT_FALSE(position->visible);
+  EXPECT_EQ(position->shape_id, 1u);
+  EXPECT_EQ(position->updates, 2u);
+
+  // Other displays are untouched
+  EXPECT_FALSE(cursor::read_position(&memory->display[0].position));
+}
+
+TEST(IvshmemCursor, KeepsTheNewestShape) {
+  auto memory = std::make_unique<CursorMemory>();
+  cursor::writer_t writer{&memory->display[0]};
+  consumer::cursor_reader_t reader{&memory->display[0]};
+
+  for (std::uint8_t fill = 1; fill <= 3; ++fill) {
+    auto pixels = bgra(32, 32, fill);
+    ASSERT_TRUE(writer.shape(CURSOR_SHAPE_COLOR, 32, 32, 128, 0, 0, pixels.data()));
+  }
+  writer.position(true, 0, 0, 0);
+
+  ASSERT_TRUE(reader.poll());
+  EXPECT_EQ(reader.shape()->header.id, 3u);
+  EXPECT_EQ(reader.shape()->data[0], 3);
+  EXPECT_EQ(reader.position()->shape_id, 3u);
+}
+
+TEST(IvshmemCursor, OverwritesShapesTheHostDidNotRead) {
+  auto memory = std::make_unique<CursorMemory>();
+  cursor::writer_t writer{&memory->display[0]};
+  consumer::cursor_reader_t reader{&memory->display[0]};
+
+  // 256x256 BGRA shapes, so the ring fills up after a few
+  auto shapes = 4 * cursor::kRingSize / (256 * 256 * 4);
+  for (std::size_t i = 1; i <= shapes; ++i) {
+    auto pixels = bgra(256, 256, (std::uint8_t)i);
+    ASSERT_TRUE(writer.shape(CURSOR_SHAPE_COLOR, 256, 256, 1024, 0, 0, pixels.data()));
+  }
+
+  ASSERT_TRUE(reader.poll());
+  EXPECT_EQ(reader.shape()->header.id, shapes);
+  EXPECT_EQ(reader.shape()->data.back(), (std::uint8_t)shapes);
+
+  // Too large for the ring at all
+  std::vector<std::uint8_t> huge(cursor::kRingSize);
+  EXPECT_FALSE(writer.shape(CURSOR_SHAPE_COLOR, 512, 512, 2048, 0, 0, huge.data()));
+  EXPECT_FALSE(reader.poll());
+}
+
+TEST(IvshmemCursor, RestartedWriterKeepsCounting) {
+  auto memory = std::make_unique<CursorMemory>();
+  auto pixels = bgra(4, 4, 0);
+  {
+    cursor::writer_t writer{&memory->display[0]};
+    writer.shape(CURSOR_SHAPE_COLOR, 4, 4, 16, 0, 0, pixels.data());
+    writer.position(true, 1, 1, 1);
+  }
+
+  cursor::writer_t writer{&memory->display[0]};
+  writer.position(true, 2, 2, 2);
+  auto position = cursor::read_position(&memory->display[0].position);
+  ASSERT_TRUE(position);
+  EXPECT_EQ(position->updates, 2u);
+  EXPECT_EQ(position->shape_id, 1u);
+
+  writer.shape(CURSOR_SHAPE_COLOR, 4, 4, 16, 0, 0, pixels.data());
+  writer.position(true, 3, 3, 3);
+  EXPECT_EQ(cursor::read_position(&memory->display[0].position)->shape_id, 2u);
+}
+
+TEST(IvshmemCursor, PositionIsNeverTorn) {
+  auto memory = std::make_unique<CursorMemory>();
+  auto slot = &memory->display[0].position;
+  constexpr std::int32_t kUpdates = 200000;
+
+  std::atomic<bool> done{false};
+  std::thread guest{[&]() {
+    cursor::writer_t writer{&memory->display[0]};
+    for (std::int32_t i = 1; i <= kUpdates; ++i) {
+      writer.position(i & 1, i, -i, (std::int64_t)i * 1000);
+    }
+    done = true;
+  }};
+
+  std::uint64_t last = 0;
+  while (!done) {
+    auto position = cursor::read_position(slot);
+    if (!position) {
+      continue;
+    }
+
+    // Every field from the same update, and updates never go back
+    auto i = (std::int32_t)position->updates;
+    ASSERT_EQ(position->x, i);
+    ASSERT_EQ(position->y, -i);
+    ASSERT_EQ(position->visible, (bool)(i & 1));
+    ASSERT_EQ(position->timestamp_ns, (std::int64_t)i * 1000);
+    ASSERT_GE(position->updates, last);
+    last = position->updates;
+  }
+  guest.join();
+
+  EXPECT_EQ(cursor::read_position(slot)->updates, (std::uint64_t)kUpdates);
+}
+
+} // namespace
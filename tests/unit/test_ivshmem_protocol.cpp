@@ -4,9 +4,11 @@
 #include "smemory.h"
 
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <thread>
 #include <vector>
 
 namespace {
@@ -114,4 +116,365 @@ TEST(IvshmemProtocolQueue, MediaQueueRingUsesIncomingIndex) {
   }
 }
 
+namespace ring = ivshmem_protocol::ring;
+
+/** Small ring so wrap-around is reached after a handful of records. */
+struct small_ring_t {
+  RingCursors cursors {};
+  char data[1024] {};
+};
+
+std::vector<char> make_payload(std::size_t size, std::uint64_t seed) {
+  std::vector<char> payload(size);
+  for (std::size_t i = 0; i < size; ++i) {
+    payload[i] = static_cast<char>((seed * 131 + i) & 0xFF);
+  }
+  return payload;
+}
+
+TEST(IvshmemProtocolRing, LayoutIsCacheLineAligned) {
+  EXPECT_EQ(sizeof(RingRecordHeader), ring::kRecordAlign);
+  EXPECT_EQ(offsetof(RingCursors, read_cursor), static_cast<std::size_t>(RING_CACHE_LINE));
+  EXPECT_EQ(offsetof(MediaRingMemory, video) % RING_CACHE_LINE, 0u);
+  EXPECT_EQ(offsetof(MediaRingMemory, video[1]) % RING_CACHE_LINE, 0u);
+  EXPECT_EQ(offsetof(MediaRingMemory, audio) % RING_CACHE_LINE, 0u);
+  EXPECT_LT(sizeof(MediaRingMemory), sizeof(MediaMemory));
+}
+
+TEST(IvshmemProtocolRing, RecordSpanIsAligned) {
+  EXPECT_EQ(ring::record_span(0), 16u);
+  EXPECT_EQ(ring::record_span(1), 32u);
+  EXPECT_EQ(ring::record_span(16), 32u);
+  EXPECT_EQ(ring::record_span(17), 48u);
+  EXPECT_EQ(ring::max_payload(1024), 512u - ring::kRecordHeaderSize);
+}
+
+TEST(IvshmemProtocolRing, DetectLayoutRequiresMagicAndSize) {
+  auto memory = std::make_unique<MediaRingMemory>();
+  EXPECT_EQ(ring::detect_layout(memory.get(), sizeof(MediaRingMemory)), ring::layout_e::legacy);
+
+  memory->header.magic = ring::kMagic;
+  memory->header.version = ring::kVersion;
+  EXPECT_EQ(ring::detect_layout(memory.get(), sizeof(MediaRingMemory)), ring::layout_e::ring);
+  EXPECT_EQ(ring::detect_layout(memory.get(), sizeof(MediaRingMemory) - 1),
+            ring::layout_e::legacy);
+
+  ring::accept_layout(&memory->header);
+  EXPECT_EQ(memory->header.accepted_version, ring::kVersion);
+}
+
+TEST(IvshmemProtocolRing, WriteReadRoundTrip) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+  ring::reader_t reader{buffer.get()};
+
+  std::uint64_t findex = 7;
+  std::uint8_t flags = 1;
+  auto payload = make_payload(40, findex);
+  ASSERT_TRUE(writer.write(RING_RECORD_VIDEO, {{&findex, sizeof(findex)},
+                                               {&flags, sizeof(flags)},
+                                               {payload.data(), payload.size()}}));
+
+  auto record = reader.peek();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->type, static_cast<std::uint32_t>(RING_RECORD_VIDEO));
+  EXPECT_EQ(record->sequence, 1u);
+  ASSERT_EQ(record->size, sizeof(findex) + sizeof(flags) + payload.size());
+
+  std::uint64_t out_findex {};
+  std::memcpy(&out_findex, record->payload, sizeof(out_findex));
+  EXPECT_EQ(out_findex, findex);
+  EXPECT_EQ(record->payload[sizeof(findex)], 1);
+  EXPECT_EQ(std::memcmp(record->payload + sizeof(findex) + sizeof(flags), payload.data(),
+                        payload.size()),
+            0);
+
+  reader.release();
+  EXPECT_FALSE(reader.peek());
+  EXPECT_EQ(buffer->cursors.read_cursor, buffer->cursors.write_cursor);
+  EXPECT_EQ(writer.used(), 0u);
+}
+
+TEST(IvshmemProtocolRing, RejectsWhenFullAndOversized) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+
+  auto oversized = make_payload(ring::max_payload(sizeof(buffer->data)) + 1, 0);
+  EXPECT_FALSE(writer.write(RING_RECORD_VIDEO, {{oversized.data(), oversized.size()}}));
+  EXPECT_EQ(buffer->cursors.write_cursor, 0u);
+
+  auto payload = make_payload(100, 0);
+  int written = 0;
+  while (writer.write(RING_RECORD_VIDEO, {{payload.data(), payload.size()}})) {
+    ++written;
+  }
+
+  // 1024 / record_span(100) records fit before the consumer must release space.
+  EXPECT_EQ(written, static_cast<int>(sizeof(buffer->data) / ring::record_span(100)));
+  EXPECT_LE(writer.used(), sizeof(buffer->data));
+
+  ring::reader_t reader{buffer.get()};
+  ASSERT_TRUE(reader.peek());
+  reader.release();
+  EXPECT_TRUE(writer.write(RING_RECORD_VIDEO, {{payload.data(), payload.size()}}));
+}
+
+TEST(IvshmemProtocolRing, WrapAroundKeepsRecordsContiguous) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+  ring::reader_t reader{buffer.get()};
+
+  // Sizes chosen so records regularly land on the tail and force padding.
+  const std::size_t sizes[] = {300, 150, 420, 8, 333, 250, 64, 496};
+  std::uint64_t expected_sequence = 1;
+  for (int round = 0; round < 50; ++round) {
+    auto size = sizes[round % std::size(sizes)];
+    auto payload = make_payload(size, round);
+    ASSERT_TRUE(writer.write(RING_RECORD_AUDIO, {{payload.data(), payload.size()}}));
+
+    auto record = reader.peek();
+    ASSERT_TRUE(record);
+    EXPECT_EQ(record->sequence, expected_sequence++);
+    ASSERT_EQ(record->size, size);
+    ASSERT_GE(record->payload, buffer->data);
+    ASSERT_LE(record->payload + record->size, buffer->data + sizeof(buffer->data));
+    EXPECT_EQ(std::memcmp(record->payload, payload.data(), size), 0);
+    reader.release();
+  }
+
+  EXPECT_GT(buffer->cursors.write_cursor, sizeof(buffer->data) * 4);
+  EXPECT_EQ(writer.used(), 0u);
+}
+
+TEST(IvshmemProtocolRing, VideoRingHoldsManyTypicalFrames) {
+  auto memory = std::make_unique<MediaRingMemory>();
+  ring::writer_t writer{&memory->video[0].ring};
+
+  // ~12 KB P-frames at 6 Mbps used to take a whole 5 MiB slot each.
+  auto payload = make_payload(12 * 1024, 0);
+  int written = 0;
+  while (writer.write(RING_RECORD_VIDEO, {{payload.data(), payload.size()}})) {
+    ++written;
+  }
+
+  EXPECT_GT(written, 8 * 100);
+
+  // A single IDR burst above the legacy 5 MiB slot still fits.
+  ring::reader_t reader{&memory->video[0].ring};
+  while (reader.peek()) {
+    reader.release();
+  }
+  auto idr = make_payload(MEDIA_PACKET_SIZE + 1, 1);
+  EXPECT_TRUE(writer.write(RING_RECORD_VIDEO, {{idr.data(), idr.size()}}));
+}
+
+std::vector<char> make_video_payload(std::size_t size, bool keyframe) {
+  auto payload = make_payload(size, 0);
+  payload[ivshmem_protocol::kVideoPacketHeaderSize - 1] =
+      keyframe ? ivshmem_protocol::kVideoFlagKeyframe : 0;
+  return payload;
+}
+
+bool not_keyframe(const ring::record_t &record) {
+  return !ring::is_keyframe(record);
+}
+
+TEST(IvshmemProtocolBackpressure, WaitGivesUpAfterDeadline) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+  auto payload = make_video_payload(200, false);
+  while (writer.write(RING_RECORD_VIDEO, {{payload.data(), payload.size()}})) {
+  }
+
+  ring::backpressure_t backpressure{ring::backpressure_e::wait, std::chrono::milliseconds{2}};
+  auto start = std::chrono::steady_clock::now();
+  auto result =
+      writer.write(RING_RECORD_VIDEO, {{payload.data(), payload.size()}}, backpressure, not_keyframe);
+
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds{2});
+  EXPECT_FALSE(result.written);
+  EXPECT_TRUE(result.stalled);
+  EXPECT_EQ(result.overwritten, 0u);
+}
+
+TEST(IvshmemProtocolBackpressure, WaitSucceedsOnceConsumerCatchesUp) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+  auto payload = make_video_payload(200, false);
+  while (writer.write(RING_RECORD_VIDEO, {{payload.data(), payload.size()}})) {
+  }
+
+  std::thread consumer{[&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    ring::reader_t reader{buffer.get()};
+    ASSERT_TRUE(reader.peek());
+    EXPECT_TRUE(reader.release());
+  }};
+
+  ring::backpressure_t backpressure{ring::backpressure_e::wait, std::chrono::seconds{5}};
+  auto result =
+      writer.write(RING_RECORD_VIDEO, {{payload.data(), payload.size()}}, backpressure, not_keyframe);
+  consumer.join();
+
+  EXPECT_TRUE(result.written);
+  EXPECT_TRUE(result.stalled);
+}
+
+TEST(IvshmemProtocolBackpressure, DropOldestReclaimsOnlyDeltaFrames) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+  ring::reader_t reader{buffer.get()};
+
+  auto key = make_video_payload(200, true);
+  auto delta = make_video_payload(200, false);
+  ASSERT_TRUE(writer.write(RING_RECORD_VIDEO, {{delta.data(), delta.size()}}));
+  ASSERT_TRUE(writer.write(RING_RECORD_VIDEO, {{key.data(), key.size()}}));
+  while (writer.write(RING_RECORD_VIDEO, {{delta.data(), delta.size()}})) {
+  }
+
+  ring::backpressure_t backpressure{ring::backpressure_e::drop_oldest};
+  auto result =
+      writer.write(RING_RECORD_VIDEO, {{delta.data(), delta.size()}}, backpressure, not_keyframe);
+  EXPECT_TRUE(result.written);
+  EXPECT_EQ(result.overwritten, 1u);
+
+  // The keyframe is now the oldest record and must not be reclaimed
+  result =
+      writer.write(RING_RECORD_VIDEO, {{delta.data(), delta.size()}}, backpressure, not_keyframe);
+  EXPECT_FALSE(result.written);
+  EXPECT_EQ(result.overwritten, 0u);
+
+  auto record = reader.peek();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->sequence, 2u);
+  EXPECT_TRUE(ring::is_keyframe(*record));
+  EXPECT_TRUE(reader.release());
+}
+
+TEST(IvshmemProtocolBackpressure, OverwriteInvalidatesRecordBeingRead) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+  ring::reader_t reader{buffer.get()};
+
+  auto key = make_video_payload(200, true);
+  while (writer.write(RING_RECORD_VIDEO, {{key.data(), key.size()}})) {
+  }
+
+  auto record = reader.peek();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->sequence, 1u);
+
+  ring::backpressure_t backpressure{ring::backpressure_e::overwrite};
+  auto result =
+      writer.write(RING_RECORD_VIDEO, {{key.data(), key.size()}}, backpressure, not_keyframe);
+  EXPECT_TRUE(result.written);
+  EXPECT_GE(result.overwritten, 1u);
+
+  // The consumer learns that what it just read may have been overwritten
+  EXPECT_FALSE(reader.release());
+
+  record = reader.peek();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->sequence, 1u + result.overwritten);
+  EXPECT_TRUE(reader.release());
+}
+
+TEST(IvshmemProtocolReservation, CommitShorterThanReserved) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+  ring::reader_t reader{buffer.get()};
+
+  auto reservation = writer.reserve(300);
+  ASSERT_TRUE(reservation);
+  EXPECT_GE(reservation->capacity, 300u);
+
+  // Nothing is visible until the reservation is committed
+  EXPECT_FALSE(reader.peek());
+
+  std::memset(reservation->payload, 'x', 100);
+  writer.commit(*reservation, RING_RECORD_VIDEO, 100);
+  ASSERT_TRUE(writer.write(RING_RECORD_AUDIO, {{"abc", 3}}));
+
+  auto record = reader.peek();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->type, static_cast<std::uint32_t>(RING_RECORD_VIDEO));
+  EXPECT_EQ(record->size, 100u);
+  EXPECT_EQ(record->payload, reservation->payload);
+  EXPECT_EQ(record->payload[99], 'x');
+  EXPECT_TRUE(reader.release());
+
+  // The unused tail of the reservation is skipped
+  record = reader.peek();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->type, static_cast<std::uint32_t>(RING_RECORD_AUDIO));
+  EXPECT_EQ(record->sequence, 2u);
+  EXPECT_TRUE(reader.release());
+
+  EXPECT_EQ(buffer->cursors.read_cursor, buffer->cursors.write_cursor);
+}
+
+TEST(IvshmemProtocolReservation, CancelledSpaceIsReturned) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+  ring::reader_t reader{buffer.get()};
+
+  std::vector<ring::reservation_t> reservations;
+  while (auto reservation = writer.reserve(200)) {
+    reservations.push_back(*reservation);
+  }
+  ASSERT_FALSE(reservations.empty());
+
+  for (auto &reservation : reservations) {
+    writer.cancel(reservation);
+  }
+
+  EXPECT_FALSE(reader.peek());
+  EXPECT_EQ(buffer->cursors.read_cursor, buffer->cursors.write_cursor);
+  EXPECT_TRUE(writer.reserve(200));
+}
+
+TEST(IvshmemProtocolReservation, PublishesInRingOrder) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+  ring::reader_t reader{buffer.get()};
+
+  auto first = writer.reserve(64);
+  auto second = writer.reserve(64);
+  ASSERT_TRUE(first && second);
+
+  writer.commit(*second, RING_RECORD_VIDEO, 64);
+  EXPECT_EQ(buffer->cursors.write_cursor, 0u);
+  EXPECT_FALSE(reader.peek());
+
+  writer.commit(*first, RING_RECORD_VIDEO, 32);
+
+  auto record = reader.peek();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->sequence, first->sequence);
+  EXPECT_TRUE(reader.release());
+
+  record = reader.peek();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->sequence, second->sequence);
+  EXPECT_TRUE(reader.release());
+}
+
+TEST(IvshmemProtocolReservation, ReclaimSkipsCancelledSpace) {
+  auto buffer = std::make_unique<small_ring_t>();
+  ring::writer_t writer{buffer.get()};
+
+  auto delta = make_video_payload(200, false);
+  auto reservation = writer.reserve(200);
+  ASSERT_TRUE(reservation);
+  writer.cancel(*reservation);
+  while (writer.write(RING_RECORD_VIDEO, {{delta.data(), delta.size()}})) {
+  }
+
+  ring::backpressure_t backpressure{ring::backpressure_e::drop_oldest};
+  auto result =
+      writer.write(RING_RECORD_VIDEO, {{delta.data(), delta.size()}}, backpressure, not_keyframe);
+  EXPECT_TRUE(result.written);
+  EXPECT_EQ(result.overwritten, 0u);
+}
+
 } // namespace
@@ -0,0 +1,241 @@
+#include <gtest/gtest.h>
+
+#include "ivshmem_protocol.h"
+#include "smemory.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+namespace ring = ivshmem_protocol::ring;
+
+constexpr std::uint64_t kFrames = 10000;
+
+std::size_t payload_size_for(std::uint64_t frame) {
+  // Mix of tiny, typical and large frames; multiplier keeps sizes uncorrelated with slots.
+  return 1 + (frame * 2654435761u) % (16 * 1024);
+}
+
+char payload_byte(std::uint64_t frame, std::size_t offset) {
+  return static_cast<char>((frame * 31 + offset * 7) & 0xFF);
+}
+
+void fill_payload(std::vector<char> &payload, std::uint64_t frame) {
+  payload.resize(payload_size_for(frame));
+  for (std::size_t i = 0; i < payload.size(); ++i) {
+    payload[i] = payload_byte(frame, i);
+  }
+}
+
+/** Returns the number of mismatching bytes so failures don't flood the log. */
+std::size_t count_mismatches(const char *data, std::size_t size, std::uint64_t frame) {
+  std::size_t mismatches = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    mismatches += data[i] != payload_byte(frame, i);
+  }
+  return mismatches;
+}
+
+TEST(IvshmemProtocolStress, LegacyMediaQueuePublishesPayloadBeforeIndex) {
+  // MediaMemory is ~120 MiB; it must live on the heap.
+  auto memory = std::make_unique<MediaMemory>();
+  auto queue = &memory->video[0].internal;
+
+  // The legacy layout has no consumer cursor, so the test keeps the producer from lapping
+  // the consumer with a guest-local one.
+  ivshmem_protocol::padded_cursor_t<std::uint64_t> consumed;
+
+  std::thread producer{[&]() {
+    std::vector<char> payload;
+    for (std::uint64_t frame = 0; frame < kFrames; ++frame) {
+      while (frame - consumed.consume() >= IN_QUEUE_SIZE - 1) {
+        std::this_thread::yield();
+      }
+
+      fill_payload(payload, frame);
+
+      auto index = ivshmem_protocol::load_relaxed(queue->inindex);
+      auto slot = &queue->incoming[index];
+      ivshmem_protocol::reset_packet(slot);
+      ivshmem_protocol::append_to_packet(slot, &frame, sizeof(frame));
+      ivshmem_protocol::append_to_packet(slot, payload.data(), payload.size());
+      ivshmem_protocol::publish(queue->inindex,
+                                ivshmem_protocol::advance_index(index, IN_QUEUE_SIZE));
+    }
+  }};
+
+  std::size_t mismatches = 0;
+  std::uint64_t out_of_order = 0;
+  int read_index = 0;
+  for (std::uint64_t frame = 0; frame < kFrames; ++frame) {
+    while (ivshmem_protocol::consume(queue->inindex) == read_index) {
+      std::this_thread::yield();
+    }
+
+    auto slot = &queue->incoming[read_index];
+    std::uint64_t seen_frame;
+    std::memcpy(&seen_frame, slot->data, sizeof(seen_frame));
+    out_of_order += seen_frame != frame;
+
+    auto size = static_cast<std::size_t>(slot->size) - sizeof(seen_frame);
+    if (size != payload_size_for(frame)) {
+      ++mismatches;
+    } else {
+      mismatches += count_mismatches(slot->data + sizeof(seen_frame), size, frame);
+    }
+
+    read_index = ivshmem_protocol::advance_index(read_index, IN_QUEUE_SIZE);
+    consumed.publish(frame + 1);
+  }
+
+  producer.join();
+
+  EXPECT_EQ(out_of_order, 0u);
+  EXPECT_EQ(mismatches, 0u);
+}
+
+TEST(IvshmemProtocolStress, LegacyControlQueueDeliversEveryMessage) {
+  auto memory = std::make_unique<MediaMemory>();
+  auto queue = &memory->video[1].internal;
+  ivshmem_protocol::padded_cursor_t<std::uint64_t> consumed;
+
+  // Host side: writes outgoing[] and publishes outindex, as the guest's pull thread expects.
+  std::thread host{[&]() {
+    for (std::uint64_t message = 0; message < kFrames; ++message) {
+      while (message - consumed.consume() >= OUT_QUEUE_SIZE - 1) {
+        std::this_thread::yield();
+      }
+
+      auto index = ivshmem_protocol::load_relaxed(queue->outindex);
+      auto slot = &queue->outgoing[index];
+      ivshmem_protocol::reset_packet(slot);
+      for (std::size_t i = 0; i < 64; ++i) {
+        char byte = payload_byte(message, i);
+        ivshmem_protocol::append_to_packet(slot, &byte, 1);
+      }
+      ivshmem_protocol::publish(queue->outindex,
+                                ivshmem_protocol::advance_index(index, OUT_QUEUE_SIZE));
+    }
+  }};
+
+  std::size_t mismatches = 0;
+  int expected_index = 0;
+  for (std::uint64_t message = 0; message < kFrames; ++message) {
+    while (ivshmem_protocol::consume(queue->outindex) == expected_index) {
+      std::this_thread::yield();
+    }
+
+    auto slot = &queue->outgoing[expected_index];
+    mismatches += slot->size != 64 || count_mismatches(slot->data, 64, message) != 0;
+
+    expected_index = ivshmem_protocol::advance_index(expected_index, OUT_QUEUE_SIZE);
+    consumed.publish(message + 1);
+  }
+
+  host.join();
+
+  EXPECT_EQ(mismatches, 0u);
+}
+
+TEST(IvshmemProtocolStress, ByteRingDeliversEveryRecordIntact) {
+  auto memory = std::make_unique<MediaRingMemory>();
+  auto video_ring = &memory->video[2].ring;
+
+  std::thread producer{[&]() {
+    ring::writer_t writer{video_ring};
+    std::vector<char> payload;
+    for (std::uint64_t frame = 0; frame < kFrames; ++frame) {
+      fill_payload(payload, frame);
+      while (!writer.write(RING_RECORD_VIDEO,
+                           {{&frame, sizeof(frame)}, {payload.data(), payload.size()}})) {
+        std::this_thread::yield();
+      }
+    }
+  }};
+
+  ring::reader_t reader{video_ring};
+  std::size_t mismatches = 0;
+  std::uint64_t out_of_order = 0;
+  for (std::uint64_t frame = 0; frame < kFrames; ++frame) {
+    std::optional<ring::record_t> record;
+    while (!(record = reader.peek())) {
+      std::this_thread::yield();
+    }
+
+    std::uint64_t seen_frame;
+    std::memcpy(&seen_frame, record->payload, sizeof(seen_frame));
+    out_of_order += seen_frame != frame || record->sequence != frame + 1;
+
+    auto size = record->size - sizeof(seen_frame);
+    if (size != payload_size_for(frame)) {
+      ++mismatches;
+    } else {
+      mismatches += count_mismatches(record->payload + sizeof(seen_frame), size, frame);
+    }
+
+    reader.release();
+  }
+
+  producer.join();
+
+  EXPECT_EQ(out_of_order, 0u);
+  EXPECT_EQ(mismatches, 0u);
+  EXPECT_EQ(memory->video[2].ring.cursors.read_cursor, memory->video[2].ring.cursors.write_cursor);
+}
+
+TEST(IvshmemProtocolStress, LossyByteRingNeverAcceptsOverwrittenRecords) {
+  auto memory = std::make_unique<MediaRingMemory>();
+  auto audio_ring = &memory->audio;
+
+  std::thread producer{[&]() {
+    ring::writer_t writer{audio_ring};
+    ring::backpressure_t backpressure{ring::backpressure_e::overwrite};
+    std::vector<char> payload;
+    for (std::uint64_t frame = 0; frame < kFrames; ++frame) {
+      fill_payload(payload, frame);
+      auto result = writer.write(RING_RECORD_AUDIO,
+                                 {{&frame, sizeof(frame)}, {payload.data(), payload.size()}},
+                                 backpressure, [](const ring::record_t &) { return true; });
+      ASSERT_TRUE(result.written);
+    }
+  }};
+
+  ring::reader_t reader{audio_ring};
+  std::vector<char> copy;
+  std::size_t corrupt_accepted = 0;
+  std::uint64_t accepted = 0;
+  std::uint64_t last_frame = 0;
+  while (last_frame + 1 < kFrames) {
+    auto record = reader.peek();
+    if (!record) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    // Copy first, then validate: the producer may be overwriting the record right now
+    copy.assign(record->payload, record->payload + record->size);
+    if (!reader.release()) {
+      continue;
+    }
+
+    std::uint64_t frame;
+    std::memcpy(&frame, copy.data(), sizeof(frame));
+    auto size = copy.size() - sizeof(frame);
+    corrupt_accepted += size != payload_size_for(frame) ||
+                        count_mismatches(copy.data() + sizeof(frame), size, frame) != 0;
+    last_frame = frame;
+    ++accepted;
+  }
+
+  producer.join();
+
+  EXPECT_GT(accepted, 0u);
+  EXPECT_EQ(corrupt_accepted, 0u);
+}
+
+} // namespace
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "ivshmem_wait.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+using ivshmem_protocol::wake_e;
+
+TEST(IvshmemWait, ReadyReturnsWithoutBlocking) {
+  int blocked = 0;
+  auto wake = ivshmem_protocol::wait_for([]() { return true; }, {},
+                                         [&](std::chrono::milliseconds) { ++blocked; });
+  EXPECT_EQ(wake, wake_e::ready);
+  EXPECT_EQ(blocked, 0);
+}
+
+TEST(IvshmemWait, BlocksOnlyAfterSpinAndYield) {
+  ivshmem_protocol::wait_policy_t policy{200us, 300us, 7ms};
+  std::chrono::milliseconds block_timeout{};
+
+  auto start = std::chrono::steady_clock::now();
+  auto wake = ivshmem_protocol::wait_for([]() { return false; }, policy,
+                                         [&](std::chrono::milliseconds timeout) {
+                                           block_timeout = timeout;
+                                         });
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(wake, wake_e::timeout);
+  EXPECT_EQ(block_timeout, 7ms);
+  EXPECT_GE(elapsed, 500us);
+}
+
+TEST(IvshmemWait, ReportsBlockWake) {
+  bool published = false;
+  auto wake = ivshmem_protocol::wait_for([&]() { return published; }, {0us, 0us, 1ms},
+                                         [&](std::chrono::milliseconds) { published = true; });
+  EXPECT_EQ(wake, wake_e::block);
+}
+
+TEST(IvshmemWait, SpinCatchesOtherThread) {
+  std::atomic<bool> published{false};
+  std::thread producer{[&]() { published.store(true, std::memory_order_release); }};
+
+  // Generous phases so a slow machine still catches it before blocking
+  auto wake = ivshmem_protocol::wait_for(
+      [&]() { return published.load(std::memory_order_acquire); }, {1s, 1s, 1ms},
+      [](std::chrono::milliseconds) {});
+  producer.join();
+
+  EXPECT_TRUE(wake == wake_e::ready || wake == wake_e::spin);
+}
+
+TEST(IvshmemWait, HistogramPercentiles) {
+  ivshmem_protocol::latency_histogram_t histogram;
+  EXPECT_EQ(histogram.percentile(50), 0ns);
+
+  for (int i = 0; i < 98; ++i) {
+    histogram.record(10us);
+  }
+  histogram.record(5ms);
+  histogram.record(-1ns);
+
+  EXPECT_EQ(histogram.count(), 100u);
+  EXPECT_EQ(histogram.max(), 5ms);
+
+  // Buckets are powers of two, so 10us reads as 16383ns
+  EXPECT_GE(histogram.percentile(50), 10us);
+  EXPECT_LT(histogram.percentile(50), 20us);
+  EXPECT_GE(histogram.percentile(99.5), 5ms);
+  EXPECT_EQ(histogram.percentile(100), 5ms);
+
+  histogram.reset();
+  EXPECT_EQ(histogram.count(), 0u);
+}
+
+} // namespace
@@ -0,0 +1,221 @@
+#include <gtest/gtest.h>
+
+#include "thread_safe.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+class SafeQueue : public ::testing::TestWithParam<safe::queue_mode_e> {};
+
+TEST_P(SafeQueue, PopsInOrder) {
+  safe::queue_t<int> queue{8, GetParam()};
+  EXPECT_FALSE(queue.peek());
+
+  for (int i = 0; i < 5; ++i) {
+    queue.raise(i);
+  }
+  EXPECT_TRUE(queue.peek());
+
+  for (int i = 0; i < 5; ++i) {
+    auto value = queue.pop(0ms);
+    ASSERT_TRUE(value);
+    EXPECT_EQ(*value, i);
+  }
+  EXPECT_FALSE(queue.peek());
+  EXPECT_FALSE(queue.pop(1ms));
+}
+
+TEST_P(SafeQueue, DropsOldestWhenFull) {
+  safe::queue_t<int> queue{4, GetParam()};
+  for (int i = 0; i < 10; ++i) {
+    queue.raise(i);
+  }
+
+  for (int i = 6; i < 10; ++i) {
+    auto value = queue.pop(0ms);
+    ASSERT_TRUE(value);
+    EXPECT_EQ(*value, i);
+  }
+  EXPECT_FALSE(queue.peek());
+}
+
+TEST_P(SafeQueue, MovesOnlyTypes) {
+  safe::queue_t<std::unique_ptr<int>> queue{2, GetParam()};
+  queue.raise(std::make_unique<int>(1));
+  queue.raise(std::make_unique<int>(2));
+  queue.raise(std::make_unique<int>(3));
+
+  auto value = queue.pop();
+  ASSERT_TRUE(value);
+  EXPECT_EQ(*value, 2);
+}
+
+TEST_P(SafeQueue, StopWakesBlockedConsumer) {
+  safe::queue_t<int> queue{4, GetParam()};
+
+  std::optional<int> popped = 0;
+  std::thread consumer{[&]() { popped = queue.pop(); }};
+
+  std::this_thread::sleep_for(10ms);
+  queue.stop();
+  consumer.join();
+
+  EXPECT_FALSE(popped);
+  EXPECT_FALSE(queue.running());
+
+  queue.raise(1);
+  EXPECT_FALSE(queue.peek());
+}
+
+TEST_P(SafeQueue, HandsOffAcrossThreads) {
+  constexpr int kItems = 200000;
+  safe::queue_t<int> queue{16, GetParam()};
+
+  std::thread producer{[&]() {
+    for (int i = 0; i < kItems; ++i) {
+      queue.raise(i);
+    }
+    queue.raise(-1);
+  }};
+
+  // Items may be dropped when the consumer falls behind, but never reordered or duplicated
+  int last = -1;
+  int received = 0;
+  while (true) {
+    auto value = queue.pop(5s);
+    ASSERT_TRUE(value);
+    if (*value == -1) {
+      break;
+    }
+    ASSERT_GT(*value, last);
+    last = *value;
+    ++received;
+  }
+  producer.join();
+
+  EXPECT_EQ(last, kItems - 1);
+  EXPECT_GT(received, 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(Modes, SafeQueue,
+                         ::testing::Values(safe::queue_mode_e::locked, safe::queue_mode_e::spsc),
+                         [](const auto &info) {
+                           return info.param == safe::queue_mode_e::spsc ? "spsc" : "locked";
+                         });
+
+TEST(SafeQueueMail, ModeIsChosenPerChannel) {
+  auto mail = std::make_shared<safe::mail_raw_t>();
+  mail->set_queue_mode("fast", safe::queue_mode_e::spsc);
+
+  auto fast = mail->queue<int>("fast");
+  auto slow = mail->queue<int>("slow");
+  EXPECT_EQ(fast->mode(), safe::queue_mode_e::spsc);
+  EXPECT_EQ(slow->mode(), safe::queue_mode_e::locked);
+
+  // Everyone asking for the channel gets the same queue
+  EXPECT_EQ(mail->queue<int>("fast"), fast);
+}
+
+TEST(SafeQueueMail, ChildrenShareOnlyInheritedChannels) {
+  auto mail = std::make_shared<safe::mail_raw_t>();
+  auto first = mail->child({"shutdown"});
+  auto second = mail->child({"shutdown"});
+
+  // Mailboxes only hold weak references, so keep the channels alive while comparing
+  auto shutdown = first->event<bool>("shutdown");
+  auto bitrate = first->event<int>("bitrate");
+  auto packets = first->queue<int>("packets");
+
+  EXPECT_EQ(mail->event<bool>("shutdown"), shutdown);
+  EXPECT_EQ(second->event<bool>("shutdown"), shutdown);
+  EXPECT_NE(second->event<int>("bitrate"), bitrate);
+  EXPECT_NE(mail->queue<int>("packets"), packets);
+
+  second->event<bool>("shutdown")->raise(true);
+  EXPECT_TRUE(shutdown->peek());
+}
+
+TEST(SafeQueueMail, DisplaysDontSeeEachOthersPackets) {
+  constexpr int kDisplays = 3;
+  constexpr int kPackets = 20000;
+
+  auto mail = std::make_shared<safe::mail_raw_t>();
+  std::vector<std::thread> threads;
+  std::vector<int> received(kDisplays);
+  std::vector<int> foreign(kDisplays);
+  std::vector<safe::mail_raw_t::queue_t<std::pair<int, int>>> channels;
+
+  for (int display = 0; display < kDisplays; ++display) {
+    auto display_mail = mail->child({"shutdown"});
+    display_mail->set_queue_mode("video_packets", safe::queue_mode_e::spsc);
+    // Like the session, keep the channel alive while the threads look it up by name
+    channels.push_back(display_mail->queue<std::pair<int, int>>("video_packets"));
+
+    // Encoder: tags every packet with its display
+    threads.emplace_back([display_mail, display]() {
+      auto packets = display_mail->queue<std::pair<int, int>>("video_packets");
+      for (int i = 0; i < kPackets; ++i) {
+        packets->raise(display, i);
+      }
+      packets->raise(display, -1);
+    });
+
+    // Forwarder: must only ever see its own display's packets
+    threads.emplace_back([display_mail, display, &received, &foreign]() {
+      auto packets = display_mail->queue<std::pair<int, int>>("video_packets");
+      while (auto packet = packets->pop(5s)) {
+        if (packet->first != display) {
+          ++foreign[display];
+        }
+        if (packet->second == -1) {
+          break;
+        }
+        ++received[display];
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (int display = 0; display < kDisplays; ++display) {
+    EXPECT_EQ(foreign[display], 0) << "display " << display;
+    EXPECT_GT(received[display], 0) << "display " << display;
+  }
+}
+
+TEST(SafeShared, StartsWithFirstReferenceAndStopsWithLast) {
+  int started = 0;
+  int stopped = 0;
+
+  // Allocated on the heap, like the per-display capture threads
+  auto shared = std::make_unique<safe::shared_t<int>>(
+      [&](int &) {
+        ++started;
+        return 0;
+      },
+      [&](int &) { ++stopped; });
+
+  {
+    auto first = shared->ref();
+    auto second = shared->ref();
+    ASSERT_TRUE(first);
+    EXPECT_EQ(started, 1);
+  }
+  EXPECT_EQ(stopped, 1);
+
+  auto again = shared->ref();
+  EXPECT_EQ(started, 2);
+}
+
+} // namespace
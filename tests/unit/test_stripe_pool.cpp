@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+
+#include "stripe_pool.h"
+
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+TEST(StripePool, RunsEveryStripeOnce) {
+  for (int workers : {0, 1, 3}) {
+    stripe_pool_t pool{workers};
+    EXPECT_EQ(pool.workers(), workers);
+
+    for (int stripes : {0, 1, 2, 7, 64}) {
+      std::vector<std::atomic<int>> calls(stripes);
+      pool.run(stripes, [&](int stripe) { calls[stripe].fetch_add(1); });
+
+      for (int stripe = 0; stripe < stripes; ++stripe) {
+        EXPECT_EQ(calls[stripe].load(), 1) << workers << " workers, stripe " << stripe;
+      }
+    }
+  }
+}
+
+TEST(StripePool, UsesTheWorkers) {
+  stripe_pool_t pool{3};
+
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  std::atomic<int> arrived{0};
+  pool.run(4, [&](int) {
+    {
+      std::lock_guard lock{mutex};
+      threads.insert(std::this_thread::get_id());
+    }
+
+    // Hold each stripe until all four are running, so none can take two
+    arrived.fetch_add(1);
+    while (arrived.load() < 4) {
+      std::this_thread::yield();
+    }
+  });
+
+  EXPECT_EQ(threads.size(), 4u);
+  EXPECT_TRUE(threads.count(std::this_thread::get_id()));
+}
+
+TEST(StripePool, ConcurrentCallersAllFinish) {
+  stripe_pool_t pool{2};
+
+  constexpr int kCallers = 4;
+  constexpr int kRuns = 200;
+  constexpr int kStripes = 8;
+
+  std::vector<std::thread> callers;
+  std::atomic<int> total{0};
+  std::atomic<bool> ok{true};
+  for (int caller = 0; caller < kCallers; ++caller) {
+    callers.emplace_back([&]() {
+      for (int run = 0; run < kRuns; ++run) {
+        std::atomic<int> done{0};
+        pool.run(kStripes, [&](int) {
+          done.fetch_add(1);
+          total.fetch_add(1);
+        });
+
+        // run() must not return before its own stripes are done
+        if (done.load() != kStripes) {
+          ok = false;
+        }
+      }
+    });
+  }
+  for (auto &caller : callers) {
+    caller.join();
+  }
+
+  EXPECT_TRUE(ok.load());
+  EXPECT_EQ(total.load(), kCallers * kRuns * kStripes);
+}
+
+} // namespace
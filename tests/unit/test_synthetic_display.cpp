@@ -0,0 +1,255 @@
+#include <gtest/gtest.h>
+
+#include "platform/synthetic.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using platf::synthetic::generator_t;
+using platf::synthetic::parse_spec;
+using platf::synthetic::pattern_e;
+using platf::synthetic::spec_t;
+
+struct frame_t {
+  explicit frame_t(const spec_t &spec, int padding = 0)
+      : row_pitch{spec.width * 4 + padding}, pixels((std::size_t)row_pitch * spec.height) {}
+
+  std::uint32_t at(int x, int y) const {
+    return *(const std::uint32_t *)&pixels[(std::size_t)y * row_pitch + x * 4];
+  }
+
+  int row_pitch;
+  std::vector<std::uint8_t> pixels;
+};
+
+frame_t render(const generator_t &generator, std::int64_t index, bool cursor = true) {
+  frame_t frame{generator.spec()};
+  generator.render(index, frame.pixels.data(), frame.row_pitch, cursor);
+  return frame;
+}
+
+/** Pixels that differ between two frames, with the bounding box of the differences. */
+struct diff_t {
+  int changed = 0;
+  int min_x = INT32_MAX, min_y = INT32_MAX, max_x = -1, max_y = -1;
+};
+
+diff_t diff(const spec_t &spec, const frame_t &a, const frame_t &b) {
+  diff_t result;
+  for (int y = 0; y < spec.height; ++y) {
+    for (int x = 0; x < spec.width; ++x) {
+      if (a.at(x, y) != b.at(x, y)) {
+        ++result.changed;
+        result.min_x = std::min(result.min_x, x);
+        result.min_y = std::min(result.min_y, y);
+        result.max_x = std::max(result.max_x, x);
+        result.max_y = std::max(result.max_y, y);
+      }
+    }
+  }
+  return result;
+}
+
+spec_t small(pattern_e pattern) {
+  spec_t spec;
+  spec.pattern = pattern;
+  spec.width = 320;
+  spec.height = 180;
+  spec.framerate = 60;
+  return spec;
+}
+
+TEST(SyntheticDisplay, ParsesDisplayNames) {
+  spec_t defaults;
+  defaults.width = 1280;
+  defaults.height = 720;
+  defaults.framerate = 120;
+
+  auto spec = parse_spec("noise", defaults);
+  ASSERT_TRUE(spec);
+  EXPECT_EQ(spec->pattern, pattern_e::noise);
+  EXPECT_EQ(spec->width, 1280);
+  EXPECT_EQ(spec->height, 720);
+  EXPECT_EQ(spec->framerate, 120);
+  EXPECT_FALSE(spec->hdr);
+
+  spec = parse_spec("text:3840x2160@30:hdr", defaults);
+  ASSERT_TRUE(spec);
+  EXPECT_EQ(spec->pattern, pattern_e::text);
+  EXPECT_EQ(spec->width, 3840);
+  EXPECT_EQ(spec->height, 2160);
+  EXPECT_EQ(spec->framerate, 30);
+  EXPECT_TRUE(spec->hdr);
+
+  spec = parse_spec("desktop:@240", defaults);
+  ASSERT_TRUE(spec);
+  EXPECT_EQ(spec->width, 1280);
+  EXPECT_EQ(spec->framerate, 240);
+
+  EXPECT_FALSE(parse_spec(R"(\\.\DISPLAY1)", defaults));
+  EXPECT_FALSE(parse_spec("", defaults));
+  EXPECT_FALSE(parse_spec("text:1280", defaults));
+  EXPECT_FALSE(parse_spec("text:1281x720", defaults));
+  EXPECT_FALSE(parse_spec("text:1280x720@0", defaults));
+  EXPECT_FALSE(parse_spec("text:hdr:loud", defaults));
+}
+
+TEST(SyntheticDisplay, ListsAPinnedSpec) {
+  using platf::synthetic::display_names;
+
+  EXPECT_EQ(display_names(), std::vector<std::string>{"desktop"});
+  EXPECT_EQ(display_names("desktop"), std::vector<std::string>{"desktop"});
+  EXPECT_EQ(display_names(R"(\\.\DISPLAY1)"), std::vector<std::string>{"desktop"});
+
+  // The capture thread reinitializes unless the session's display is listed under the very
+  // same name, so a pinned spec must come back verbatim and select its own pattern
+  std::string pinned = "text:1280x720@60";
+  auto names = display_names(pinned);
+  auto found = std::find(names.begin(), names.end(), pinned);
+  ASSERT_NE(found, names.end());
+
+  auto spec = parse_spec(*found, {});
+  ASSERT_TRUE(spec);
+  EXPECT_EQ(spec->pattern, pattern_e::text);
+  EXPECT_EQ(spec->width, 1280);
+  EXPECT_EQ(spec->height, 720);
+}
+
+TEST(SyntheticDisplay, FramesAreReproducible) {
+  for (auto pattern : {pattern_e::text, pattern_e::noise, pattern_e::desktop}) {
+    auto spec = small(pattern);
+    generator_t first{spec};
+    generator_t second{spec};
+
+    EXPECT_EQ(render(first, 42).pixels, render(second, 42).pixels)
+        << platf::synthetic::to_string(pattern);
+  }
+}
+
+TEST(SyntheticDisplay, LeavesRowPaddingAlone) {
+  for (auto pattern : {pattern_e::text, pattern_e::noise, pattern_e::desktop}) {
+    auto spec = small(pattern);
+    generator_t generator{spec};
+
+    frame_t frame{spec, 64};
+    std::fill(frame.pixels.begin(), frame.pixels.end(), 0xAB);
+    generator.render(7, frame.pixels.data(), frame.row_pitch, true);
+
+    for (int y = 0; y < spec.height; ++y) {
+      for (int i = spec.width * 4; i < frame.row_pitch; ++i) {
+        ASSERT_EQ(frame.pixels[(std::size_t)y * frame.row_pitch + i], 0xAB)
+            << platf::synthetic::to_string(pattern);
+      }
+    }
+  }
+}
+
+TEST(SyntheticDisplay, NoiseChangesEverywhere) {
+  auto spec = small(pattern_e::noise);
+  generator_t generator{spec};
+
+  auto changed = diff(spec, render(generator, 0), render(generator, 1)).changed;
+  EXPECT_GT(changed, spec.width * spec.height * 99 / 100);
+}
+
+TEST(SyntheticDisplay, TextScrollsUp) {
+  auto spec = small(pattern_e::text);
+  generator_t generator{spec};
+
+  // Four lines of 16 pixels per second
+  auto before = render(generator, 0);
+  auto after = render(generator, spec.framerate / 4);
+  for (int y = 0; y + 16 < spec.height; ++y) {
+    for (int x = 0; x < spec.width; ++x) {
+      ASSERT_EQ(after.at(x, y), before.at(x, y + 16)) << x << ',' << y;
+    }
+  }
+  EXPECT_GT(diff(spec, before, after).changed, 0);
+}
+
+TEST(SyntheticDisplay, DesktopOnlyChangesUnderTheCursor) {
+  auto spec = small(pattern_e::desktop);
+  generator_t generator{spec};
+
+  auto without = render(generator, 10, false);
+  EXPECT_EQ(diff(spec, without, render(generator, 11, false)).changed, 0);
+
+  auto [x, y] = generator.cursor_position(10);
+  auto changes = diff(spec, without, render(generator, 10, true));
+  ASSERT_GT(changes.changed, 0);
+  EXPECT_GE(changes.min_x, x);
+  EXPECT_GE(changes.min_y, y);
+  EXPECT_LT(changes.max_x, x + 12);
+  EXPECT_LT(changes.max_y, y + 19);
+
+  // The cursor moves from frame to frame
+  EXPECT_NE(generator.cursor_position(10), generator.cursor_position(11));
+}
+
+TEST(SyntheticDisplay, CursorImageMatchesTheDrawnCursor) {
+  auto spec = small(pattern_e::desktop);
+  generator_t generator{spec};
+
+  auto image = generator.cursor_image();
+  ASSERT_TRUE(image);
+  ASSERT_EQ(image->pixels.size(), (std::size_t)image->width * image->height);
+
+  auto without = render(generator, 10, false);
+  auto with = render(generator, 10, true);
+  auto [x0, y0] = generator.cursor_position(10);
+  for (int y = 0; y < image->height && y0 + y < spec.height; ++y) {
+    for (int x = 0; x < image->width && x0 + x < spec.width; ++x) {
+      auto pixel = image->pixels[(std::size_t)y * image->width + x];
+      auto expected = pixel >> 24 ? pixel & 0xffffff : without.at(x0 + x, y0 + y);
+      ASSERT_EQ(with.at(x0 + x, y0 + y), expected) << x << ',' << y;
+    }
+  }
+
+  EXPECT_FALSE(generator_t{small(pattern_e::noise)}.cursor_image());
+}
+
+TEST(SyntheticDisplay, DamageCoversEveryChange) {
+  const std::pair<std::int64_t, std::int64_t> steps[]{{10, 11}, {10, 40}, {5, 5}};
+
+  for (auto pattern : {pattern_e::desktop, pattern_e::text, pattern_e::noise}) {
+    auto spec = small(pattern);
+    generator_t generator{spec};
+
+    for (auto [from, to] : steps) {
+      for (int cursors = 0; cursors < 4; ++cursors) {
+        bool cursor_from = cursors & 1;
+        bool cursor_to = cursors & 2;
+        auto before = render(generator, from, cursor_from);
+        auto after = render(generator, to, cursor_to);
+        auto rects = generator.damage(from, cursor_from, to, cursor_to);
+
+        for (int y = 0; y < spec.height; ++y) {
+          for (int x = 0; x < spec.width; ++x) {
+            if (before.at(x, y) == after.at(x, y)) {
+              continue;
+            }
+            auto covered = std::any_of(rects.begin(), rects.end(), [&](auto &rect) {
+              return x >= rect.x && x < rect.x + rect.width && y >= rect.y &&
+                     y < rect.y + rect.height;
+            });
+            ASSERT_TRUE(covered) << to_string(pattern) << " frame " << from << " to " << to
+                                 << ", pixel " << x << ',' << y;
+          }
+        }
+      }
+    }
+  }
+
+  // On the desktop that's just the cursor
+  auto spec = small(pattern_e::desktop);
+  generator_t generator{spec};
+  EXPECT_TRUE(generator.damage(10, false, 11, false).empty());
+  EXPECT_EQ(generator.damage(10, true, 11, true).size(), 2u);
+}
+
+} // namespace
@@ -0,0 +1,389 @@
+#include <gtest/gtest.h>
+
+#include "video_convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using namespace video::convert;
+
+constexpr format_e kFormats[]{format_e::yuv420p, format_e::yuv420p10, format_e::nv12,
+                              format_e::p010,    format_e::yuv444p,   format_e::yuv444p10};
+
+constexpr isa_e kIsas[]{isa_e::scalar, isa_e::sse41, isa_e::avx2, isa_e::avx512};
+
+/** Same as make_color_matrix() in video_colorspace.cpp, which needs FFmpeg headers. */
+struct color_t {
+  float color_vec_y[4];
+  float color_vec_u[4];
+  float color_vec_v[4];
+  float range_y[2];
+  float range_uv[2];
+};
+
+color_t make_color(float Cr, float Cb, bool full_range) {
+  float Cg = 1.0f - Cr - Cb;
+  float Cr_i = 1.0f - Cr;
+  float Cb_i = 1.0f - Cb;
+
+  float range_y[2] = {16.0f, 235.0f};
+  float range_uv[2] = {16.0f, 240.0f};
+  if (full_range) {
+    range_y[0] = range_uv[0] = 0.0f;
+    range_y[1] = range_uv[1] = 255.0f;
+  }
+
+  return {
+      {Cr, Cg, Cb, 0.0f},
+      {-(Cr * 0.5f / Cb_i), -(Cg * 0.5f / Cb_i), 0.5f, 0.5f},
+      {0.5f, -(Cg * 0.5f / Cr_i), -(Cb * 0.5f / Cr_i), 0.5f},
+      {(range_y[1] - range_y[0]) / 255.0f, range_y[0] / 255.0f},
+      {(range_uv[1] - range_uv[0]) / 255.0f, range_uv[0] / 255.0f},
+  };
+}
+
+const color_t kColors[]{
+    make_color(0.299f, 0.114f, false),   make_color(0.299f, 0.114f, true),
+    make_color(0.2126f, 0.0722f, false), make_color(0.2126f, 0.0722f, true),
+    make_color(0.2627f, 0.0593f, false), make_color(0.2627f, 0.0593f, true),
+};
+
+coefficients_t coefficients(const color_t &color, format_e format) {
+  return make_coefficients(color.color_vec_y, color.color_vec_u, color.color_vec_v,
+                           color.range_y, color.range_uv, bit_depth(format));
+}
+
+bool subsampled(format_e format) {
+  return format != format_e::yuv444p && format != format_e::yuv444p10;
+}
+
+bool interleaved(format_e format) {
+  return format == format_e::nv12 || format == format_e::p010;
+}
+
+struct image_buffer_t {
+  image_buffer_t(int width, int height, std::uint32_t seed)
+      : width{width}, height{height}, pixels((std::size_t)width * height) {
+    std::mt19937 random{seed};
+    for (auto &pixel : pixels) {
+      pixel = random();
+    }
+  }
+
+  image_t image() const {
+    return {(const std::uint8_t *)pixels.data(), width * 4, width, height};
+  }
+
+  std::uint32_t &at(int x, int y) {
+    return pixels[(std::size_t)y * width + x];
+  }
+
+  int width;
+  int height;
+  std::vector<std::uint32_t> pixels;
+};
+
+/** Planes with padding at the end of every row, pre-filled so overruns show up. */
+struct frame_buffer_t {
+  static constexpr int kPadding = 64;
+  static constexpr std::uint8_t kFill = 0xa5;
+
+  frame_buffer_t(format_e format, int width, int height) : format{format} {
+    auto sample = bit_depth(format) > 8 ? 2 : 1;
+    auto chroma_width = subsampled(format) ? (width + 1) / 2 : width;
+    chroma_height = subsampled(format) ? (height + 1) / 2 : height;
+
+    widths[0] = width * sample;
+    widths[1] = widths[2] = chroma_width * sample;
+    if (interleaved(format)) {
+      widths[1] *= 2;
+      widths[2] = 0;
+    }
+
+    for (int plane = 0; plane < 3; ++plane) {
+      linesize[plane] = widths[plane] + kPadding;
+      storage[plane].assign((std::size_t)linesize[plane] * (plane ? chroma_height : height),
+                            kFill);
+    }
+  }
+
+  planes_t planes() {
+    planes_t planes;
+    for (int plane = 0; plane < 3; ++plane) {
+      planes.data[plane] = storage[plane].empty() ? nullptr : storage[plane].data();
+      planes.linesize[plane] = linesize[plane];
+    }
+    return planes;
+  }
+
+  /** Sample `x` of row `y` in `plane`; in interleaved chroma, U and V count separately. */
+  int at(int plane, int x, int y) const {
+    auto row = storage[plane].data() + (std::size_t)y * linesize[plane];
+    if (bit_depth(format) > 8) {
+      std::uint16_t value;
+      std::memcpy(&value, row + x * 2, 2);
+      return format == format_e::p010 ? value >> 6 : value;
+    }
+    return row[x];
+  }
+
+  format_e format;
+  int chroma_height;
+  int widths[3];
+  int linesize[3];
+  std::vector<std::uint8_t> storage[3];
+};
+
+/** What the conversion should give, in doubles straight from the color vectors. */
+double expected(const float vec[4], const float range[2], format_e format, double b, double g,
+                double r) {
+  auto depth = bit_depth(format);
+  auto peak = range[1] == 0.0f ? (1 << depth) - 1 : 255 << (depth - 8);
+  auto value = (vec[0] * r + vec[1] * g + vec[2] * b) / 255 + vec[3];
+  return (value * range[0] + range[1]) * peak;
+}
+
+frame_buffer_t convert_image(format_e format, const image_buffer_t &image, const color_t &color,
+                             isa_e isa) {
+  frame_buffer_t frame{format, image.width, image.height};
+  convert(format, image.image(), frame.planes(), coefficients(color, format), isa);
+  return frame;
+}
+
+TEST(VideoConvert, ScalarIsAlwaysSupported) {
+  EXPECT_TRUE(supported(isa_e::scalar));
+  EXPECT_TRUE(supported(best_isa()));
+  for (auto isa : kIsas) {
+    EXPECT_EQ(isa_from_string(to_string(isa)), isa);
+  }
+}
+
+TEST(VideoConvert, BlackAndWhiteHitTheRangeEnds) {
+  struct {
+    const color_t &color;
+    format_e format;
+    int black, white, neutral;
+  } cases[]{
+      {kColors[2], format_e::yuv420p, 16, 235, 128},
+      {kColors[2], format_e::yuv420p10, 64, 940, 512},
+      {kColors[3], format_e::nv12, 0, 255, 128},
+      {kColors[4], format_e::p010, 64, 940, 512},
+      {kColors[5], format_e::yuv444p10, 0, 1023, 512},
+  };
+
+  for (auto &c : cases) {
+    image_buffer_t image{64, 4, 0};
+    for (int y = 0; y < image.height; ++y) {
+      for (int x = 0; x < image.width; ++x) {
+        image.at(x, y) = x < 32 ? 0xff000000 : 0x00ffffff;
+      }
+    }
+
+    for (auto isa : kIsas) {
+      if (!supported(isa)) {
+        continue;
+      }
+
+      auto frame = convert_image(c.format, image, c.color, isa);
+      SCOPED_TRACE(std::string{to_string(c.format)} + " " + std::string{to_string(isa)});
+      EXPECT_EQ(frame.at(0, 0, 0), c.black);
+      EXPECT_EQ(frame.at(0, 63, 3), c.white);
+      EXPECT_EQ(frame.at(1, 0, 0), c.neutral);
+      EXPECT_EQ(frame.at(1, interleaved(c.format) ? 63 : 31, 1), c.neutral);
+    }
+  }
+}
+
+TEST(VideoConvert, ScalarMatchesFloatingPoint) {
+  image_buffer_t image{66, 34, 1};
+
+  for (auto &color : kColors) {
+    for (auto format : kFormats) {
+      SCOPED_TRACE(std::string{to_string(format)});
+      auto frame = convert_image(format, image, color, isa_e::scalar);
+
+      for (int y = 0; y < image.height; ++y) {
+        for (int x = 0; x < image.width; ++x) {
+          auto px = image.at(x, y);
+          auto want = expected(color.color_vec_y, color.range_y, format, px & 0xff,
+                               px >> 8 & 0xff, px >> 16 & 0xff);
+          ASSERT_LE(std::abs(frame.at(0, x, y) - want), 1.0) << x << ',' << y;
+        }
+      }
+
+      auto factor = subsampled(format) ? 2 : 1;
+      for (int y = 0; y < image.height / factor; ++y) {
+        for (int x = 0; x < image.width / factor; ++x) {
+          double b = 0, g = 0, r = 0;
+          for (int i = 0; i < factor * factor; ++i) {
+            auto px = image.at(x * factor + i % factor, y * factor + i / factor);
+            b += px & 0xff;
+            g += px >> 8 & 0xff;
+            r += px >> 16 & 0xff;
+          }
+          b /= factor * factor;
+          g /= factor * factor;
+          r /= factor * factor;
+
+          auto want_u = expected(color.color_vec_u, color.range_uv, format, b, g, r);
+          auto want_v = expected(color.color_vec_v, color.range_uv, format, b, g, r);
+          auto u = interleaved(format) ? frame.at(1, x * 2, y) : frame.at(1, x, y);
+          auto v = interleaved(format) ? frame.at(1, x * 2 + 1, y) : frame.at(2, x, y);
+          ASSERT_LE(std::abs(u - want_u), 1.0) << x << ',' << y;
+          ASSERT_LE(std::abs(v - want_v), 1.0) << x << ',' << y;
+        }
+      }
+    }
+  }
+}
+
+TEST(VideoConvert, EveryIsaMatchesScalar) {
+  // Widths that leave tails after every vector size, including odd ones
+  const std::pair<int, int> sizes[]{{1920, 4}, {67, 35}, {33, 3}, {7, 1}, {1, 1}};
+
+  for (auto isa : kIsas) {
+    if (!supported(isa)) {
+      std::printf("Skipping %s, which this CPU lacks\n", std::string{to_string(isa)}.c_str());
+      continue;
+    }
+
+    for (auto [width, height] : sizes) {
+      image_buffer_t image{width, height, (std::uint32_t)(width * height)};
+      for (auto format : kFormats) {
+        SCOPED_TRACE(std::string{to_string(format)} + " " + std::string{to_string(isa)} + " " +
+                     std::to_string(width) + "x" + std::to_string(height));
+
+        auto want = convert_image(format, image, kColors[2], isa_e::scalar);
+        auto got = convert_image(format, image, kColors[2], isa);
+        for (int plane = 0; plane < 3; ++plane) {
+          // Includes the row padding, which must be left alone
+          EXPECT_EQ(got.storage[plane], want.storage[plane]) << "plane " << plane;
+          for (std::size_t i = 0; i < want.storage[plane].size(); ++i) {
+            if (i % want.linesize[plane] >= (std::size_t)want.widths[plane]) {
+              ASSERT_EQ(want.storage[plane][i], frame_buffer_t::kFill);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(VideoConvert, StripesCoverEveryRowOnce) {
+  for (auto format : {format_e::nv12, format_e::yuv444p}) {
+    for (int height : {1, 2, 35, 1080}) {
+      for (int stripes : {1, 3, 8, 40}) {
+        int expected_first = 0;
+        for (int stripe = 0; stripe < stripes; ++stripe) {
+          auto [first, last] = stripe_rows(format, height, stripes, stripe);
+          ASSERT_EQ(first, expected_first);
+          ASSERT_LE(first, last);
+          if (format == format_e::nv12) {
+            ASSERT_EQ(first % 2, 0);
+          }
+          expected_first = last;
+        }
+        ASSERT_EQ(expected_first, height);
+      }
+    }
+  }
+}
+
+TEST(VideoConvert, StripedMatchesWhole) {
+  image_buffer_t image{200, 67, 3};
+
+  for (auto format : kFormats) {
+    SCOPED_TRACE(std::string{to_string(format)});
+    auto whole = convert_image(format, image, kColors[4], best_isa());
+
+    frame_buffer_t striped{format, image.width, image.height};
+    auto k = coefficients(kColors[4], format);
+
+    // Out of order, as the workers might
+    constexpr int kStripes = 5;
+    for (int stripe = kStripes - 1; stripe >= 0; --stripe) {
+      auto [first, last] = stripe_rows(format, image.height, kStripes, stripe);
+      convert_rows(format, image.image(), striped.planes(), k, best_isa(), first, last);
+    }
+
+    for (int plane = 0; plane < 3; ++plane) {
+      EXPECT_EQ(striped.storage[plane], whole.storage[plane]) << "plane " << plane;
+    }
+  }
+}
+
+TEST(VideoConvert, RegionsOnlyTouchTheirPixels) {
+  constexpr int kWidth = 67;
+  constexpr int kHeight = 35;
+
+  // {first_column, last_column, first_row, last_row}; the last one ends at the odd edges
+  const int regions[][4]{{0, 64, 0, 32}, {2, 10, 4, 8}, {16, 48, 10, 30}, {64, 67, 32, 35}};
+
+  for (auto format : kFormats) {
+    for (auto &region : regions) {
+      SCOPED_TRACE(std::string{to_string(format)} + " columns " + std::to_string(region[0]) +
+                   "-" + std::to_string(region[1]) + " rows " + std::to_string(region[2]) + "-" +
+                   std::to_string(region[3]));
+
+      image_buffer_t before{kWidth, kHeight, 5};
+      image_buffer_t after{kWidth, kHeight, 5};
+      image_buffer_t changes{kWidth, kHeight, 6};
+      for (int y = region[2]; y < region[3]; ++y) {
+        for (int x = region[0]; x < region[1]; ++x) {
+          after.at(x, y) = changes.at(x, y);
+        }
+      }
+
+      auto k = coefficients(kColors[2], format);
+      auto expected = convert_image(format, after, kColors[2], isa_e::scalar);
+      for (auto isa : kIsas) {
+        if (!supported(isa)) {
+          continue;
+        }
+
+        auto frame = convert_image(format, before, kColors[2], isa);
+        convert_region(format, after.image(), frame.planes(), k, isa, region[0], region[1],
+                       region[2], region[3]);
+        for (int plane = 0; plane < 3; ++plane) {
+          EXPECT_EQ(frame.storage[plane], expected.storage[plane])
+              << to_string(isa) << " plane " << plane;
+        }
+      }
+    }
+  }
+}
+
+TEST(VideoConvert, SemiPlanarLayoutsMatchPlanar) {
+  image_buffer_t image{80, 6, 2};
+
+  for (auto [packed, planar] : {std::pair{format_e::nv12, format_e::yuv420p},
+                                std::pair{format_e::p010, format_e::yuv420p10}}) {
+    auto a = convert_image(packed, image, kColors[0], best_isa());
+    auto b = convert_image(planar, image, kColors[0], best_isa());
+
+    for (int y = 0; y < image.height / 2; ++y) {
+      for (int x = 0; x < image.width / 2; ++x) {
+        ASSERT_EQ(a.at(1, x * 2, y), b.at(1, x, y));
+        ASSERT_EQ(a.at(1, x * 2 + 1, y), b.at(2, x, y));
+      }
+    }
+
+    if (packed == format_e::p010) {
+      // 10 bits in the high bits of each word
+      for (std::size_t i = 0; i < (std::size_t)image.width; ++i) {
+        ASSERT_EQ(a.storage[0][i * 2] & 0x3f, 0);
+      }
+    }
+  }
+}
+
+} // namespace
@@ -0,0 +1,272 @@
+#include <gtest/gtest.h>
+
+#include "video_damage.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using namespace video::damage;
+using video::convert::isa_e;
+
+constexpr isa_e kIsas[]{isa_e::scalar, isa_e::sse41, isa_e::avx2, isa_e::avx512};
+
+/** Random BGRX pixels with `padding` bytes of different junk after each row */
+struct image_t {
+  image_t(int width, int height, int padding, std::uint32_t seed)
+      : width_bytes{width * 4}, row_pitch{width * 4 + padding}, height{height},
+        data((std::size_t)row_pitch * height) {
+    std::mt19937 rng{seed};
+    for (auto &byte : data) {
+      byte = (std::uint8_t)rng();
+    }
+  }
+
+  std::uint8_t &at(int x_byte, int y) {
+    return data[(std::size_t)y * row_pitch + x_byte];
+  }
+
+  std::uint64_t hash(isa_e isa = isa_e::scalar) const {
+    return fingerprint(data.data(), row_pitch, width_bytes, height, isa);
+  }
+
+  int width_bytes;
+  int row_pitch;
+  int height;
+  std::vector<std::uint8_t> data;
+};
+
+TEST(VideoDamage, EveryIsaMatchesScalar) {
+  // Widths that leave partial blocks, and one narrower than a block
+  const std::pair<int, int> sizes[]{{1920, 4}, {67, 35}, {33, 3}, {7, 1}, {1, 1}};
+
+  for (auto isa : kIsas) {
+    if (!video::convert::supported(isa)) {
+      std::printf("Skipping %s, which this CPU lacks\n",
+                  std::string{video::convert::to_string(isa)}.c_str());
+      continue;
+    }
+
+    for (auto [width, height] : sizes) {
+      SCOPED_TRACE(std::string{video::convert::to_string(isa)} + " " + std::to_string(width) +
+                   "x" + std::to_string(height));
+
+      image_t image{width, height, 12, (std::uint32_t)(width * height)};
+      EXPECT_EQ(image.hash(isa), image.hash());
+    }
+  }
+
+  image_t image{640, 8, 0, 1};
+  EXPECT_EQ(fingerprint(image.data.data(), image.row_pitch, image.width_bytes, image.height),
+            image.hash());
+}
+
+TEST(VideoDamage, EveryByteCounts) {
+  image_t image{37, 5, 8, 2};
+  auto original = image.hash();
+
+  for (int y = 0; y < image.height; ++y) {
+    for (int x = 0; x < image.width_bytes; ++x) {
+      image.at(x, y) ^= 1;
+      EXPECT_NE(image.hash(), original) << "byte " << x << " of row " << y;
+      image.at(x, y) ^= 1;
+    }
+  }
+
+  EXPECT_EQ(image.hash(), original);
+}
+
+TEST(VideoDamage, PaddingIsIgnored) {
+  image_t image{100, 6, 16, 3};
+  auto original = image.hash();
+
+  for (int y = 0; y < image.height; ++y) {
+    for (int x = image.width_bytes; x < image.row_pitch; ++x) {
+      image.at(x, y) ^= 0xff;
+    }
+  }
+
+  EXPECT_EQ(image.hash(), original);
+}
+
+TEST(VideoDamage, MovedContentChangesTheHash) {
+  // A flat background with one small sprite, like a caret or a cursor, in different places
+  constexpr int kWidth = 256;
+  constexpr int kHeight = 16;
+
+  std::set<std::uint64_t> hashes;
+  int placements = 0;
+  for (int y : {0, 1, 7, 15}) {
+    for (int x : {0, 4, 64, 128, 252}) {
+      std::vector<std::uint8_t> data(kWidth * 4 * kHeight, 0x40);
+      for (int i = 0; i < 4; ++i) {
+        data[(std::size_t)y * kWidth * 4 + x * 4 + i] = 0xff;
+      }
+
+      hashes.insert(fingerprint(data.data(), kWidth * 4, kWidth * 4, kHeight, isa_e::scalar));
+      ++placements;
+    }
+  }
+  EXPECT_EQ(hashes.size(), (std::size_t)placements);
+
+  // Swapping two rows
+  image_t image{64, 4, 0, 4};
+  auto original = image.hash();
+  for (int x = 0; x < image.width_bytes; ++x) {
+    std::swap(image.at(x, 1), image.at(x, 2));
+  }
+  EXPECT_NE(image.hash(), original);
+}
+
+/** Which pixels the rectangles cover, with each pixel covered at most once */
+std::vector<int> coverage(const std::vector<rect_t> &rects, int width, int height) {
+  std::vector<int> covered((std::size_t)width * height);
+  for (auto &rect : rects) {
+    EXPECT_GT(rect.width, 0);
+    EXPECT_GT(rect.height, 0);
+    EXPECT_GE(rect.x, 0);
+    EXPECT_GE(rect.y, 0);
+    EXPECT_LE(rect.x + rect.width, width);
+    EXPECT_LE(rect.y + rect.height, height);
+    for (int y = rect.y; y < rect.y + rect.height; ++y) {
+      for (int x = rect.x; x < rect.x + rect.width; ++x) {
+        ++covered[(std::size_t)y * width + x];
+      }
+    }
+  }
+  return covered;
+}
+
+TEST(VideoDamage, TilesMergeIntoRects) {
+  // Three tiles wide and high, with a partial last column and row
+  tiles_t tiles{kTileWidth * 2 + 10, kTileHeight * 2 + 6};
+  EXPECT_EQ(tiles.size(), 9);
+  EXPECT_TRUE(tiles.rects().empty());
+
+  // A 2x2 block of tiles from one rect that straddles their corners
+  tiles.mark({kTileWidth - 1, kTileHeight - 1, 2, 2});
+  EXPECT_EQ(tiles.count(), 4);
+  auto rects = tiles.rects();
+  ASSERT_EQ(rects.size(), 1u);
+  EXPECT_EQ(rects[0].x, 0);
+  EXPECT_EQ(rects[0].y, 0);
+  EXPECT_EQ(rects[0].width, kTileWidth * 2);
+  EXPECT_EQ(rects[0].height, kTileHeight * 2);
+
+  // The bottom right tile is clipped to the image, and off-image rects do nothing
+  tiles.clear();
+  tiles.mark({kTileWidth * 2 + 9, kTileHeight * 2 + 5, 100, 100});
+  tiles.mark({-50, 0, 50, 10});
+  tiles.mark({0, 0, 0, 10});
+  rects = tiles.rects();
+  ASSERT_EQ(rects.size(), 1u);
+  EXPECT_EQ(rects[0].x, kTileWidth * 2);
+  EXPECT_EQ(rects[0].y, kTileHeight * 2);
+  EXPECT_EQ(rects[0].width, 10);
+  EXPECT_EQ(rects[0].height, 6);
+
+  tiles.mark_all();
+  EXPECT_EQ(tiles.count(), 9);
+  rects = tiles.rects();
+  ASSERT_EQ(rects.size(), 1u);
+  EXPECT_EQ(rects[0].width, kTileWidth * 2 + 10);
+  EXPECT_EQ(rects[0].height, kTileHeight * 2 + 6);
+}
+
+TEST(VideoDamage, RectsCoverEachMarkedTileOnce) {
+  constexpr int kWidth = kTileWidth * 7 + 3;
+  constexpr int kHeight = kTileHeight * 5 + 1;
+  constexpr int kColumns = 8;
+  constexpr int kRows = 6;
+
+  std::mt19937 rng{7};
+  for (int round = 0; round < 20; ++round) {
+    tiles_t tiles{kWidth, kHeight};
+    std::vector<bool> marked(kColumns * kRows);
+    for (int i = 0; i < 12; ++i) {
+      auto column = (int)(rng() % kColumns);
+      auto row = (int)(rng() % kRows);
+      tiles.mark({column * kTileWidth, row * kTileHeight, 1, 1});
+      marked[row * kColumns + column] = true;
+    }
+
+    auto covered = coverage(tiles.rects(), kWidth, kHeight);
+    for (int y = 0; y < kHeight; ++y) {
+      for (int x = 0; x < kWidth; ++x) {
+        auto tile = y / kTileHeight * kColumns + x / kTileWidth;
+        ASSERT_EQ(covered[(std::size_t)y * kWidth + x], marked[tile] ? 1 : 0)
+            << "pixel " << x << "," << y;
+      }
+    }
+  }
+}
+
+TEST(VideoDamage, DiffFindsChangedTiles) {
+  constexpr int kWidth = kTileWidth * 4 + 20;
+  constexpr int kHeight = kTileHeight * 3 + 8;
+  image_t previous{kWidth, kHeight, 16, 8};
+
+  auto as_image = [](const image_t &image) {
+    return video::convert::image_t{image.data.data(), image.row_pitch, image.width_bytes / 4,
+                                   image.height};
+  };
+
+  // Corners and edges of tiles, and the partial ones at the right and bottom
+  const std::pair<int, int> pixels[]{
+      {0, 0},
+      {kTileWidth - 1, kTileHeight - 1},
+      {kTileWidth, kTileHeight},
+      {kWidth - 1, 0},
+      {kTileWidth * 2 + 5, kHeight - 1},
+  };
+
+  for (auto isa : kIsas) {
+    if (!video::convert::supported(isa)) {
+      continue;
+    }
+    SCOPED_TRACE(std::string{video::convert::to_string(isa)});
+
+    auto current = previous;
+    EXPECT_TRUE(diff(as_image(previous), as_image(current), isa).empty());
+
+    // Padding isn't part of the image
+    current.at(kWidth * 4 + 3, 2) ^= 0xff;
+    EXPECT_TRUE(diff(as_image(previous), as_image(current), isa).empty());
+
+    for (auto [x, y] : pixels) {
+      current = previous;
+      current.at(x * 4 + 1, y) ^= 0x10;
+
+      auto rects = diff(as_image(previous), as_image(current), isa);
+      ASSERT_EQ(rects.size(), 1u) << "pixel " << x << "," << y;
+      EXPECT_EQ(rects[0].x, x / kTileWidth * kTileWidth);
+      EXPECT_EQ(rects[0].y, y / kTileHeight * kTileHeight);
+      EXPECT_EQ(rects[0].x + rects[0].width, std::min(rects[0].x + kTileWidth, kWidth));
+      EXPECT_EQ(rects[0].y + rects[0].height, std::min(rects[0].y + kTileHeight, kHeight));
+    }
+
+    // Everything changed
+    image_t other{kWidth, kHeight, 16, 9};
+    auto rects = diff(as_image(previous), as_image(other), isa);
+    ASSERT_EQ(rects.size(), 1u);
+    EXPECT_EQ(rects[0].width, kWidth);
+    EXPECT_EQ(rects[0].height, kHeight);
+  }
+}
+
+TEST(VideoDamage, SizeIsPartOfTheHash) {
+  std::vector<std::uint8_t> zeros(64 * 64);
+  EXPECT_NE(fingerprint(zeros.data(), 64, 64, 4, isa_e::scalar),
+            fingerprint(zeros.data(), 64, 64, 8, isa_e::scalar));
+  EXPECT_NE(fingerprint(zeros.data(), 64, 64, 4, isa_e::scalar),
+            fingerprint(zeros.data(), 64, 32, 4, isa_e::scalar));
+}
+
+} // namespace
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include "video_rfi.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+using video::rfi::dpb_t;
+using action_e = dpb_t::action_e;
+
+/** Encodes frames first to last, the first of them an IDR frame if idr */
+void encode(dpb_t &dpb, std::int64_t first, std::int64_t last, bool idr = false) {
+  for (auto frame = first; frame <= last; ++frame) {
+    dpb.encoded(frame, idr && frame == first);
+  }
+}
+
+std::vector<std::int64_t> usable(const dpb_t &dpb) {
+  std::vector<std::int64_t> frames;
+  for (auto &reference : dpb.references()) {
+    if (reference.usable) {
+      frames.push_back(reference.frame);
+    }
+  }
+  return frames;
+}
+
+TEST(VideoRfi, KeepsASlidingWindow) {
+  dpb_t dpb{4};
+  encode(dpb, 1, 10, true);
+
+  ASSERT_EQ(dpb.references().size(), 4u);
+  EXPECT_EQ(dpb.references().front().frame, 7);
+  EXPECT_EQ(usable(dpb), (std::vector<std::int64_t>{7, 8, 9, 10}));
+  EXPECT_EQ(dpb.newest_usable(), 10);
+
+  // An IDR frame replaces every reference
+  dpb.encoded(11, true);
+  EXPECT_EQ(usable(dpb), (std::vector<std::int64_t>{11}));
+}
+
+TEST(VideoRfi, FallsBackOnAnOlderFrame) {
+  dpb_t dpb{4};
+  encode(dpb, 1, 10, true);
+
+  EXPECT_EQ(dpb.invalidate(9, 9), action_e::invalidate);
+  EXPECT_EQ(usable(dpb), (std::vector<std::int64_t>{7, 8}));
+  EXPECT_EQ(dpb.newest_usable(), 8);
+
+  // Only the next frame tells the host it was repaired
+  EXPECT_TRUE(dpb.encoded(11, false));
+  EXPECT_FALSE(dpb.encoded(12, false));
+
+  // Invalidated frames still take up room until they slide out
+  EXPECT_EQ(usable(dpb), (std::vector<std::int64_t>{11, 12}));
+  encode(dpb, 13, 14);
+  EXPECT_EQ(usable(dpb), (std::vector<std::int64_t>{11, 12, 13, 14}));
+}
+
+TEST(VideoRfi, NeedsAnIdrWithoutAnOlderFrame) {
+  dpb_t dpb{4};
+  EXPECT_EQ(dpb.invalidate(1, 1), action_e::idr);
+
+  encode(dpb, 1, 10, true);
+
+  // Everything the encoder keeps was lost
+  EXPECT_EQ(dpb.invalidate(7, 10), action_e::idr);
+
+  // Not encoded yet, or backwards
+  dpb_t other{4};
+  encode(other, 1, 10, true);
+  EXPECT_EQ(other.invalidate(11, 12), action_e::idr);
+  EXPECT_EQ(other.invalidate(9, 8), action_e::idr);
+}
+
+TEST(VideoRfi, LosingTheIdrFrameNeedsAnother) {
+  dpb_t dpb{4};
+  encode(dpb, 1, 3, true);
+  encode(dpb, 4, 6, true);
+
+  EXPECT_EQ(dpb.invalidate(3, 4), action_e::idr);
+}
+
+TEST(VideoRfi, IgnoresLossesBeforeTheIdrFrame) {
+  dpb_t dpb{4};
+  encode(dpb, 1, 5, true);
+  encode(dpb, 6, 8, true);
+
+  EXPECT_EQ(dpb.invalidate(2, 4), action_e::none);
+  EXPECT_EQ(usable(dpb), (std::vector<std::int64_t>{6, 7, 8}));
+  EXPECT_FALSE(dpb.encoded(9, false));
+}
+
+TEST(VideoRfi, RepeatedReportsKeepNewerFrames) {
+  dpb_t dpb{5};
+  encode(dpb, 1, 10, true);
+
+  ASSERT_EQ(dpb.invalidate(9, 9), action_e::invalidate);
+  EXPECT_TRUE(dpb.encoded(11, false));
+
+  // The host reports the same loss, and more of it, before it sees frame 11
+  EXPECT_EQ(dpb.invalidate(9, 9), action_e::none);
+  EXPECT_EQ(dpb.invalidate(9, 10), action_e::none);
+  EXPECT_EQ(usable(dpb), (std::vector<std::int64_t>{7, 8, 11}));
+
+  // A new loss is invalidated again
+  EXPECT_EQ(dpb.invalidate(11, 11), action_e::invalidate);
+  EXPECT_EQ(dpb.newest_usable(), 8);
+}
+
+TEST(VideoRfi, ASingleReferenceCantFallBack) {
+  dpb_t dpb{1};
+  encode(dpb, 1, 10, true);
+
+  EXPECT_EQ(dpb.invalidate(10, 10), action_e::idr);
+}
+
+} // namespace